@@ -0,0 +1,184 @@
+/*
+ * append_bench.c
+ *
+ * Flash traffic of a stream of small records appended to a log, on
+ * RAM-backed flash.  Records arrive at a fixed rate in simulated time and
+ * must reach flash within a maximum age.  The log is a queue of files, the
+ * oldest removed when a new one is started.  Each record size is run three
+ * ways on a freshly formatted file system:
+ *
+ *   direct   every record written straight through, as when no write cache
+ *            page is free
+ *   cache    the write cache, flushed with SPIFFS_fflush at the max age
+ *   buffer   an append buffer, flushed with SPIFFS_fflush_aged every tick
+ *
+ *   append_bench [-f fs_kb] [-n records] [-i interval_ms] [-a max_age_ms]
+ *                [-t tick_ms] [-b buffer]
+ *
+ * Per run it prints the flash writes, bytes written and erases per record,
+ * and the modelled flash time per record.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+#define FILES       4
+#define FILE_KB     16
+
+enum { MODE_DIRECT, MODE_CACHE, MODE_BUFFER };
+
+static u32_t records = 4000, interval = 100, max_age = 5000, tick = 1000, buffer = 1024;
+static u8_t *abuf;
+
+static spiffs_file open_log(int mode, u32_t n) {
+  char name[16];
+  sprintf(name, "log%u", n);
+  spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND |
+      (mode == MODE_DIRECT ? SPIFFS_DIRECT : 0), 0);
+  if (fh < 0) {
+    fprintf(stderr, "%s: open failed: %i\n", name, SPIFFS_errno(&fs));
+  } else if (mode == MODE_BUFFER && SPIFFS_fbuffer(&fs, fh, abuf, buffer) != SPIFFS_OK) {
+    fprintf(stderr, "%s: fbuffer failed: %i\n", name, SPIFFS_errno(&fs));
+    return -1;
+  }
+  return fh;
+}
+
+// the byte at offset o of log file n
+static u8_t pattern(u32_t n, u32_t o) {
+  return (u8_t)(n * 7 + o / 3);
+}
+
+// reads back the log files that are left
+static int verify(u32_t head, u32_t file_size, u32_t last_size) {
+  static u8_t data[FILE_KB * 1024];
+  char name[16];
+  u32_t n, i;
+  for (n = head >= FILES - 1 ? head - (FILES - 1) : 0; n <= head; n++) {
+    u32_t size = n == head ? last_size : file_size;
+    sprintf(name, "log%u", n);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0 || (size && SPIFFS_read(&fs, fh, data, size) != (s32_t)size)) {
+      fprintf(stderr, "%s: read back failed: %i\n", name, SPIFFS_errno(&fs));
+      return -1;
+    }
+    SPIFFS_close(&fs, fh);
+    for (i = 0; i < size; i++) {
+      if (data[i] != pattern(n, i)) {
+        fprintf(stderr, "%s: byte %u differs\n", name, i);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static int run(const char *what, int mode, u32_t record) {
+  flash_emu_stats st;
+  u8_t buf[256];
+  u32_t file_size = (FILE_KB * 1024 / record) * record;
+  u32_t head = 0, written = 0, r, i, t, dirty = 0, dirty_since = 0;
+  spiffs_file fh;
+
+  if (bench_fs_fresh() != 0) return -1;
+  flash_emu_reset_stats();
+
+  fh = open_log(mode, head);
+  for (r = 0; r < records; r++) {
+    if (fh < 0) return -1;
+    t = r * interval;
+    for (i = 0; i < record; i++) buf[i] = pattern(head, written + i);
+    if (SPIFFS_write(&fs, fh, buf, record) != (s32_t)record) {
+      fprintf(stderr, "write failed: %i\n", SPIFFS_errno(&fs));
+      return -1;
+    }
+    written += record;
+    if (!dirty) {
+      dirty = 1;
+      dirty_since = t;
+    }
+    if (written >= file_size) {
+      SPIFFS_close(&fs, fh);
+      dirty = 0;
+      if (++head >= FILES) {
+        char name[16];
+        sprintf(name, "log%u", head - FILES);
+        SPIFFS_remove(&fs, name);
+      }
+      fh = open_log(mode, head);
+      written = 0;
+    }
+
+    // ticks until the next record, keeping to the max age
+    for (t = (t / tick + 1) * tick; t <= (r + 1) * interval; t += tick) {
+      if (mode == MODE_CACHE && dirty && t - dirty_since >= max_age) {
+        SPIFFS_fflush(&fs, fh);
+        dirty = 0;
+      } else if (mode == MODE_BUFFER && SPIFFS_fflush_aged(&fs, t, max_age) < 0) {
+        fprintf(stderr, "fflush_aged failed: %i\n", SPIFFS_errno(&fs));
+        return -1;
+      }
+    }
+  }
+  SPIFFS_close(&fs, fh);
+
+  flash_emu_get_stats(&st);
+  printf("%-8s %6.2f %8.1f %6.3f %8.3f\n", what,
+      (double)st.writes / records, (double)st.write_bytes / records,
+      (double)st.erases / records, st.busy_us / records / 1e3);
+
+  return verify(head, file_size, written);
+}
+
+int main(int argc, char **argv) {
+  static const u32_t sizes[] = { 16, 32, 64 };
+  u32_t fs_kb = 256;
+  unsigned i;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:n:i:a:t:b:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'n': records = atoi(optarg); break;
+    case 'i': interval = atoi(optarg); break;
+    case 'a': max_age = atoi(optarg); break;
+    case 't': tick = atoi(optarg); break;
+    case 'b': buffer = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-n records] [-i interval_ms] [-a max_age_ms] "
+          "[-t tick_ms] [-b buffer]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (records == 0 || interval == 0 || tick == 0 || buffer == 0) {
+    fprintf(stderr, "records, interval, tick and buffer must be above 0\n");
+    return 2;
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+  abuf = malloc(buffer);
+  if (abuf == NULL) return 1;
+
+  printf("%u KB fs, %u records every %u ms, max age %u ms, tick %u ms, %u byte buffer\n",
+      fs_kb, records, interval, max_age, tick, buffer);
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    printf("\n%u byte records\n", sizes[i]);
+    printf("mode     writes    bytes erases       ms\n");
+    if (run("direct", MODE_DIRECT, sizes[i]) != 0 ||
+        run("cache", MODE_CACHE, sizes[i]) != 0 ||
+        run("buffer", MODE_BUFFER, sizes[i]) != 0) {
+      return 1;
+    }
+  }
+
+  free(abuf);
+  bench_fs_free();
+  return 0;
+}
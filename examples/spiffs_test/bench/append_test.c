@@ -0,0 +1,170 @@
+/*
+ * append_test.c
+ *
+ * Append buffers at the edges, on RAM-backed flash: what is buffered must
+ * show in read, seek and fstat, also through another descriptor of the
+ * same file, a write elsewhere in the file must not reorder it, buffers run
+ * out and are freed again by remove, and close and unmount must not lose
+ * what is buffered.
+ *
+ *   append_test
+ *
+ * Prints the checks that fail and a count, and exits with 1 if any did.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+
+static int failures, checks;
+
+#define CHECK(cond) do { \
+    ++checks; \
+    if (!(cond)) { \
+      ++failures; \
+      printf("%s:%d: check failed: %s (%i)\n", __FILE__, __LINE__, #cond, SPIFFS_errno(&fs)); \
+    } \
+  } while (0)
+
+static s32_t size_of(const char *name) {
+  spiffs_stat s;
+  return SPIFFS_stat(&fs, (char *)name, &s) == SPIFFS_OK ? (s32_t)s.size : -1;
+}
+
+// buffered data shows in fstat, seek and read of the descriptor
+static void test_own(void) {
+  static u8_t ab[100];
+  u8_t rd[400];
+  spiffs_stat s;
+  int i;
+
+  spiffs_file fh = SPIFFS_open(&fs, "own", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  CHECK(fh > 0);
+  // cached before the buffer is given, and flushed by it
+  CHECK(SPIFFS_write(&fs, fh, "hello", 5) == 5);
+  CHECK(SPIFFS_fbuffer(&fs, fh, ab, sizeof(ab)) == SPIFFS_OK);
+  CHECK(SPIFFS_fstat(&fs, fh, &s) == SPIFFS_OK && s.size == 5);
+  for (i = 0; i < 30; i++) CHECK(SPIFFS_write(&fs, fh, "0123456789", 10) == 10);
+  CHECK(SPIFFS_fstat(&fs, fh, &s) == SPIFFS_OK && s.size == 305);
+  CHECK(SPIFFS_lseek(&fs, fh, 0, SPIFFS_SEEK_SET) == 0);
+  CHECK(SPIFFS_read(&fs, fh, rd, 305) == 305);
+  CHECK(memcmp(rd, "hello0123", 9) == 0 && memcmp(rd + 295, "0123456789", 10) == 0);
+
+  // a write in the middle, then to the end without SPIFFS_APPEND
+  CHECK(SPIFFS_lseek(&fs, fh, 5, SPIFFS_SEEK_SET) == 5);
+  CHECK(SPIFFS_write(&fs, fh, "XY", 2) == 2);
+  CHECK(SPIFFS_lseek(&fs, fh, 0, SPIFFS_SEEK_END) == 305);
+  CHECK(SPIFFS_write(&fs, fh, "tail", 4) == 4);
+  SPIFFS_close(&fs, fh);
+
+  fh = SPIFFS_open(&fs, "own", SPIFFS_RDONLY, 0);
+  CHECK(SPIFFS_read(&fs, fh, rd, 309) == 309);
+  CHECK(memcmp(rd, "helloXY", 7) == 0 && memcmp(rd + 305, "tail", 4) == 0);
+  SPIFFS_close(&fs, fh);
+  SPIFFS_remove(&fs, "own");
+}
+
+// a second descriptor of the file sees what the first one buffered, and
+// its writes land after it
+static void test_shared(void) {
+  static u8_t ab[100], ab2[100];
+  u8_t rd[64];
+  spiffs_stat s;
+
+  spiffs_file w = SPIFFS_open(&fs, "shared", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  spiffs_file r = SPIFFS_open(&fs, "shared", SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  CHECK(w > 0 && r > 0);
+  CHECK(SPIFFS_fbuffer(&fs, w, ab, sizeof(ab)) == SPIFFS_OK);
+  CHECK(SPIFFS_write(&fs, w, "aaaa", 4) == 4);
+
+  CHECK(SPIFFS_fstat(&fs, r, &s) == SPIFFS_OK && s.size == 4);
+  CHECK(SPIFFS_read(&fs, r, rd, 4) == 4 && memcmp(rd, "aaaa", 4) == 0);
+
+  CHECK(SPIFFS_write(&fs, w, "bbbb", 4) == 4);
+  CHECK(SPIFFS_write(&fs, r, "cccc", 4) == 4);
+  CHECK(SPIFFS_write(&fs, w, "dddd", 4) == 4);
+  CHECK(SPIFFS_lseek(&fs, r, 0, SPIFFS_SEEK_END) == 16);
+  CHECK(SPIFFS_lseek(&fs, r, 0, SPIFFS_SEEK_SET) == 0);
+  CHECK(SPIFFS_read(&fs, r, rd, 16) == 16 && memcmp(rd, "aaaabbbbccccdddd", 16) == 0);
+
+  // the file's buffer moves to the descriptor asking for one
+  CHECK(SPIFFS_write(&fs, w, "eeee", 4) == 4);
+  CHECK(SPIFFS_fbuffer(&fs, r, ab2, sizeof(ab2)) == SPIFFS_OK);
+  CHECK(spiffs_append_buf_get(&fs, w) == 0 && spiffs_append_buf_get(&fs, r) != 0);
+  CHECK(SPIFFS_write(&fs, r, "ffff", 4) == 4);
+  CHECK(SPIFFS_write(&fs, w, "gggg", 4) == 4);
+  SPIFFS_close(&fs, w);
+  SPIFFS_close(&fs, r);
+  CHECK(size_of("shared") == 28);
+
+  r = SPIFFS_open(&fs, "shared", SPIFFS_RDONLY, 0);
+  CHECK(SPIFFS_read(&fs, r, rd, 28) == 28 && memcmp(rd + 16, "eeeeffffgggg", 12) == 0);
+  SPIFFS_close(&fs, r);
+  SPIFFS_remove(&fs, "shared");
+}
+
+// buffers run out, flush by age, and are freed by remove and fremove
+static void test_slots(void) {
+  static u8_t ab[100], ab2[100], ab3[100];
+  spiffs_file a = SPIFFS_open(&fs, "a", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  spiffs_file b = SPIFFS_open(&fs, "b", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  spiffs_file c = SPIFFS_open(&fs, "c", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+
+  CHECK(a > 0 && b > 0 && c > 0);
+  CHECK(SPIFFS_fbuffer(&fs, a, ab, sizeof(ab)) == SPIFFS_OK);
+  CHECK(SPIFFS_fbuffer(&fs, b, ab2, sizeof(ab2)) == SPIFFS_OK);
+  CHECK(SPIFFS_fbuffer(&fs, c, ab3, sizeof(ab3)) < 0 && SPIFFS_errno(&fs) == SPIFFS_ERR_OUT_OF_APPEND_BUFS);
+
+  // timed from the first call that sees the data
+  CHECK(SPIFFS_write(&fs, a, "aaa", 3) == 3);
+  CHECK(SPIFFS_write(&fs, b, "bbb", 3) == 3);
+  CHECK(SPIFFS_fflush_aged(&fs, 1000, 500) == 0);
+  CHECK(SPIFFS_fflush_aged(&fs, 1400, 500) == 0);
+  CHECK(size_of("a") == 0);
+  CHECK(SPIFFS_fflush_aged(&fs, 1500, 500) == 2);
+  CHECK(size_of("a") == 3 && size_of("b") == 3);
+
+  CHECK(SPIFFS_write(&fs, b, "BBB", 3) == 3);
+  CHECK(SPIFFS_remove(&fs, "b") == SPIFFS_OK);
+  CHECK(spiffs_append_buf_get(&fs, b) == 0);
+  CHECK(SPIFFS_fbuffer(&fs, c, ab3, sizeof(ab3)) == SPIFFS_OK);
+  CHECK(SPIFFS_write(&fs, c, "ccc", 3) == 3);
+  CHECK(SPIFFS_fremove(&fs, c) == SPIFFS_OK);
+  CHECK(size_of("c") < 0);
+  CHECK(spiffs_append_buf_get(&fs, 0) != 0);
+  SPIFFS_close(&fs, a);
+  CHECK(size_of("a") == 3);
+  SPIFFS_remove(&fs, "a");
+}
+
+// unmount flushes what is still buffered
+static void test_unmount(void) {
+  static u8_t ab[100];
+  spiffs_file fh = SPIFFS_open(&fs, "d", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+
+  CHECK(SPIFFS_fbuffer(&fs, fh, ab, sizeof(ab)) == SPIFFS_OK);
+  CHECK(SPIFFS_write(&fs, fh, "dd", 2) == 2);
+  SPIFFS_unmount(&fs);
+  CHECK(bench_fs_mount() == SPIFFS_OK);
+  CHECK(size_of("d") == 2);
+}
+
+int main(void) {
+  if (bench_fs_init(256 * 1024, PAGE_SIZE) != 0) return 1;
+  if (bench_fs_fresh() != 0) return 1;
+
+  test_own();
+  test_shared();
+  test_slots();
+  test_unmount();
+  CHECK(SPIFFS_check(&fs) == SPIFFS_OK);
+
+  bench_fs_free();
+  printf("%d checks, %d failed\n", checks, failures);
+  return failures ? 1 : 0;
+}
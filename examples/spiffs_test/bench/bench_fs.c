@@ -0,0 +1,69 @@
+/*
+ * bench_fs.c
+ *
+ * The spiffs instance the benchmarks run on, see bench_fs.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+spiffs fs;
+
+static spiffs_config cfg;
+static u8_t *work;
+static u8_t fds[BENCH_FS_FDS * sizeof(spiffs_fd)];
+static u8_t *default_cache;
+static u8_t *cache;
+static u32_t cache_size;
+
+int bench_fs_init(u32_t size, u32_t log_page_size) {
+  if (flash_emu_init(size, BENCH_FS_BLOCK_SIZE) != 0) return -1;
+  flash_emu_config(&cfg, log_page_size);
+  work = malloc(2 * log_page_size);
+  default_cache = malloc((log_page_size + 64) * BENCH_FS_CACHE_PAGES);
+  if (work == NULL || default_cache == NULL) {
+    bench_fs_free();
+    return -1;
+  }
+  cache = default_cache;
+  cache_size = (log_page_size + 64) * BENCH_FS_CACHE_PAGES;
+  return 0;
+}
+
+void bench_fs_free(void) {
+  SPIFFS_unmount(&fs);
+  free(work);
+  free(default_cache);
+  work = default_cache = cache = NULL;
+  flash_emu_free();
+}
+
+void bench_fs_set_cache(u8_t *buf, u32_t size) {
+  cache = buf;
+  cache_size = buf ? size : 0;
+}
+
+int bench_fs_mount(void) {
+  if (SPIFFS_mount(&fs, &cfg, work, fds, sizeof(fds), cache, cache_size, 0) != SPIFFS_OK) {
+    fprintf(stderr, "mount failed: %i\n", SPIFFS_errno(&fs));
+    return -1;
+  }
+  return 0;
+}
+
+int bench_fs_fresh(void) {
+  SPIFFS_unmount(&fs);
+  // mounting unformatted flash fails, format and mount again
+  SPIFFS_mount(&fs, &cfg, work, fds, sizeof(fds), cache, cache_size, 0);
+  SPIFFS_unmount(&fs);
+  if (SPIFFS_format(&fs) != SPIFFS_OK) {
+    fprintf(stderr, "format failed: %i\n", SPIFFS_errno(&fs));
+    return -1;
+  }
+  return bench_fs_mount();
+}
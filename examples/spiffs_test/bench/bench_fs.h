@@ -0,0 +1,36 @@
+/*
+ * bench_fs.h
+ *
+ * The spiffs instance the benchmarks run on: emulated flash in 4 KB
+ * blocks, the work, descriptor and cache memory SPIFFS_mount wants, and
+ * mounting and formatting it.
+ */
+
+#ifndef BENCH_FS_H_
+#define BENCH_FS_H_
+
+#include "spiffs.h"
+
+#define BENCH_FS_BLOCK_SIZE   (4*1024)
+#define BENCH_FS_FDS          6
+// the cache mounted unless bench_fs_set_cache gives another
+#define BENCH_FS_CACHE_PAGES  8
+
+extern spiffs fs;
+
+// allocates size bytes of erased flash and configures spiffs on it with
+// log_page_size pages, nothing is mounted yet
+int bench_fs_init(u32_t size, u32_t log_page_size);
+// unmounts and frees the flash and memory
+void bench_fs_free(void);
+
+// cache memory for the mounts that follow in place of the default of
+// BENCH_FS_CACHE_PAGES pages, null for none
+void bench_fs_set_cache(u8_t *buf, u32_t size);
+
+// mounts, 0 when that worked, else prints the error
+int bench_fs_mount(void);
+// unmounts, formats and mounts an empty file system
+int bench_fs_fresh(void);
+
+#endif /* BENCH_FS_H_ */
@@ -0,0 +1,150 @@
+/*
+ * cache_bench.c
+ *
+ * Read throughput of spiffs against the size of its page cache, on
+ * RAM-backed flash.  A set of files is written once, then for each cache
+ * size the file system is mounted again and the files are read, first
+ * front to back in small chunks and then at random offsets.
+ *
+ *   cache_bench [-f fs_kb] [-p page] [-n files] [-s file_kb] [-r rounds]
+ *
+ * Per cache size it prints the host read rate, the flash reads and bytes
+ * spiffs asked for per KB delivered, and the cache hit rate.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define CHUNK       64
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_files(int files, u32_t file_size) {
+  u8_t buf[CHUNK];
+  char name[16];
+  int i;
+  u32_t off;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "f%d", i);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (fh < 0) return -1;
+    for (off = 0; off < file_size; off += CHUNK) {
+      memset(buf, i + off / CHUNK, sizeof(buf));
+      if (SPIFFS_write(&fs, fh, buf, CHUNK) != CHUNK) return -1;
+    }
+    SPIFFS_close(&fs, fh);
+  }
+  return 0;
+}
+
+// reads every file through, then rounds*files random chunks, returns bytes read
+static u32_t read_files(int files, u32_t file_size, int rounds, unsigned *seed) {
+  u8_t buf[CHUNK];
+  char name[16];
+  u32_t total = 0;
+  int i, r;
+  u32_t off;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "f%d", i);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0) return 0;
+    for (off = 0; off < file_size; off += CHUNK) {
+      if (SPIFFS_read(&fs, fh, buf, CHUNK) != CHUNK) return 0;
+      if (buf[0] != (u8_t)(i + off / CHUNK)) return 0;
+      total += CHUNK;
+    }
+    SPIFFS_close(&fs, fh);
+  }
+  for (r = 0; r < rounds * files; r++) {
+    i = rand_r(seed) % files;
+    off = (rand_r(seed) % (file_size / CHUNK)) * CHUNK;
+    sprintf(name, "f%d", i);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0) return 0;
+    SPIFFS_lseek(&fs, fh, off, SPIFFS_SEEK_SET);
+    if (SPIFFS_read(&fs, fh, buf, CHUNK) != CHUNK) return 0;
+    if (buf[0] != (u8_t)(i + off / CHUNK)) return 0;
+    total += CHUNK;
+    SPIFFS_close(&fs, fh);
+  }
+  return total;
+}
+
+int main(int argc, char **argv) {
+  static const int cache_pages[] = { 0, 2, 4, 8, 16, 32, 64, 128, 256 };
+  u32_t fs_kb = 128, page = 128, file_kb = 4;
+  int files = 16, rounds = 64;
+  int c;
+  unsigned i;
+
+  while ((c = getopt(argc, argv, "f:p:n:s:r:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'p': page = atoi(optarg); break;
+    case 'n': files = atoi(optarg); break;
+    case 's': file_kb = atoi(optarg); break;
+    case 'r': rounds = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-p page] [-n files] [-s file_kb] [-r rounds]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (bench_fs_init(fs_kb * 1024, page) != 0) return 1;
+  bench_fs_set_cache(0, 0);
+  if (bench_fs_fresh() != 0) return 1;
+  SPIFFS_unmount(&fs);
+  u32_t wcache_size = SPIFFS_buffer_bytes_for_cache(&fs, 8);
+  u8_t *wcache = malloc(wcache_size);
+  bench_fs_set_cache(wcache, wcache_size);
+  if (bench_fs_mount() != 0 || write_files(files, file_kb * 1024) != 0) {
+    fprintf(stderr, "could not write %d files of %u KB: %i\n", files, file_kb, SPIFFS_errno(&fs));
+    return 1;
+  }
+  SPIFFS_unmount(&fs);
+  free(wcache);
+
+  printf("%u KB fs, %u byte pages, %d files of %u KB, %d random reads per file\n",
+      fs_kb, page, files, file_kb, rounds);
+  printf(" pages   bytes     KB/s  rd/KB  flashB/KB   hit%%\n");
+  for (i = 0; i < sizeof(cache_pages) / sizeof(cache_pages[0]); i++) {
+    u32_t cache_size = cache_pages[i] ? SPIFFS_buffer_bytes_for_cache(&fs, cache_pages[i]) : 0;
+    u8_t *cache = cache_size ? malloc(cache_size) : 0;
+    unsigned seed = 1;
+    flash_emu_stats st;
+
+    bench_fs_set_cache(cache, cache_size);
+    if (bench_fs_mount() != 0) return 1;
+    fs.cache_hits = fs.cache_misses = 0;
+    flash_emu_reset_stats();
+    double t = now();
+    u32_t bytes = read_files(files, file_kb * 1024, rounds, &seed);
+    t = now() - t;
+    flash_emu_get_stats(&st);
+    if (bytes == 0) {
+      fprintf(stderr, "read back failed with %d cache pages: %i\n", cache_pages[i], SPIFFS_errno(&fs));
+      return 1;
+    }
+    double kb = bytes / 1024.0;
+    u32_t lookups = fs.cache_hits + fs.cache_misses;
+    printf("%6d %7u %8.0f %6.1f %10.0f %5.1f%%\n", cache_pages[i], cache_size,
+        kb / t, st.reads / kb, st.read_bytes / kb,
+        lookups ? 100.0 * fs.cache_hits / lookups : 0.0);
+    SPIFFS_unmount(&fs);
+    free(cache);
+  }
+
+  bench_fs_free();
+  return 0;
+}
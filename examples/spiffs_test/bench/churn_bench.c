@@ -0,0 +1,171 @@
+/*
+ * churn_bench.c
+ *
+ * Cost of creating, appending to and removing files, on RAM-backed flash.
+ * Files are created and filled with a few appends, and once there are
+ * enough of them the oldest is removed each time a new one is created, so
+ * the file system keeps churning through garbage collection.  At the end
+ * the file system is checked and mounted again, and the files left are
+ * read back.
+ *
+ *   churn_bench [-f fs_kb] [-k files] [-a appends] [-s append] [-n rounds]
+ *
+ * For each kind of operation it prints the flash reads and modelled time
+ * per operation.  Build with SPIFFS_ALLOC_MAP_PAGES and SPIFFS_ALLOC_MAP_IDS
+ * defined to use the allocation bitmaps, without them to compare with
+ * searching flash.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+
+typedef struct {
+  const char *what;
+  u32_t ops;
+  u32_t reads;
+  double us;
+} op_stats;
+
+enum { OP_CREATE, OP_APPEND, OP_REMOVE, OP_COUNT };
+
+static op_stats ops[OP_COUNT] = {
+  { "create" }, { "append" }, { "remove" },
+};
+
+static flash_emu_stats before;
+
+static void op_begin(void) {
+  flash_emu_get_stats(&before);
+}
+
+static void op_end(int op) {
+  flash_emu_stats now;
+  flash_emu_get_stats(&now);
+  ops[op].ops++;
+  ops[op].reads += now.reads - before.reads;
+  ops[op].us += now.busy_us - before.busy_us;
+}
+
+// the byte at offset o of file number f
+static u8_t pattern(u32_t f, u32_t o) {
+  return (u8_t)(f * 31 + o);
+}
+
+int main(int argc, char **argv) {
+  u32_t fs_kb = 256, files = 24, appends = 8, append = 48, rounds = 2000;
+  u8_t buf[PAGE_SIZE];
+  char name[16];
+  u32_t r, a, i;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:k:a:s:n:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'k': files = atoi(optarg); break;
+    case 'a': appends = atoi(optarg); break;
+    case 's': append = atoi(optarg); break;
+    case 'n': rounds = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-k files] [-a appends] [-s append] [-n rounds]\n",
+          argv[0]);
+      return 2;
+    }
+  }
+  if (append == 0 || append > sizeof(buf) || files == 0 || rounds < files) {
+    fprintf(stderr, "append must be 1..%u bytes, rounds at least files\n", (unsigned)sizeof(buf));
+    return 2;
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+  if (bench_fs_fresh() != 0) return 1;
+
+  for (r = 0; r < rounds; r++) {
+    if (r >= files) {
+      sprintf(name, "c%u", r - files);
+      op_begin();
+      if (SPIFFS_remove(&fs, name) != SPIFFS_OK) {
+        fprintf(stderr, "%s: remove failed: %i\n", name, SPIFFS_errno(&fs));
+        return 1;
+      }
+      op_end(OP_REMOVE);
+    }
+
+    sprintf(name, "c%u", r);
+    op_begin();
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (fh < 0) {
+      fprintf(stderr, "%s: create failed: %i\n", name, SPIFFS_errno(&fs));
+      return 1;
+    }
+    op_end(OP_CREATE);
+
+    for (a = 0; a < appends; a++) {
+      for (i = 0; i < append; i++) buf[i] = pattern(r, a * append + i);
+      op_begin();
+      if (SPIFFS_write(&fs, fh, buf, append) != (s32_t)append) {
+        fprintf(stderr, "%s: append failed: %i\n", name, SPIFFS_errno(&fs));
+        return 1;
+      }
+      SPIFFS_fflush(&fs, fh);
+      op_end(OP_APPEND);
+    }
+    SPIFFS_close(&fs, fh);
+  }
+
+  printf("%u KB fs, %u files of %u appends of %u bytes, %u rounds\n",
+      fs_kb, files, appends, append, rounds);
+  printf("page map %s, id map %s\n",
+      SPIFFS_ALLOC_MAP_PAGES ? "on" : "off", SPIFFS_ALLOC_MAP_IDS ? "on" : "off");
+  printf("op         count   reads/op      ms/op\n");
+  for (i = 0; i < OP_COUNT; i++) {
+    printf("%-8s %7u %10.1f %10.3f\n", ops[i].what, ops[i].ops,
+        (double)ops[i].reads / ops[i].ops, ops[i].us / ops[i].ops / 1e3);
+  }
+
+  // what is left must survive a check and a mount
+  if (SPIFFS_check(&fs) != SPIFFS_OK) {
+    fprintf(stderr, "check failed: %i\n", SPIFFS_errno(&fs));
+    return 1;
+  }
+  SPIFFS_unmount(&fs);
+  if (bench_fs_mount() != 0) return 1;
+  u32_t size = appends * append;
+  u8_t *data = malloc(size);
+  if (data == NULL) return 1;
+  for (r = rounds - files; r < rounds; r++) {
+    sprintf(name, "c%u", r);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0 || SPIFFS_read(&fs, fh, data, size) != (s32_t)size) {
+      fprintf(stderr, "%s: read failed: %i\n", name, SPIFFS_errno(&fs));
+      return 1;
+    }
+    for (i = 0; i < size; i++) {
+      if (data[i] != pattern(r, i)) {
+        fprintf(stderr, "%s: byte %u differs\n", name, i);
+        return 1;
+      }
+    }
+    SPIFFS_close(&fs, fh);
+  }
+  free(data);
+  for (r = 0; r < rounds - files; r++) {
+    sprintf(name, "c%u", r);
+    spiffs_stat s;
+    if (SPIFFS_stat(&fs, name, &s) == SPIFFS_OK) {
+      fprintf(stderr, "%s: still there after remove\n", name);
+      return 1;
+    }
+  }
+  printf("check and remount ok\n");
+
+  bench_fs_free();
+  return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * flash_emu.c
+ *
+ * RAM-backed SPI flash. Programming can only clear bits, as on NOR flash,
+ * and erases set a whole sector back to 0xff. The SDK's spi_flash calls
+ * are provided on top of it for esp_spiffs.c.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "flash_emu.h"
+#include "c_types.h"
+#include "spi_flash.h"
+
+static u8_t *flash;
+static u32_t flash_size;
+static u32_t flash_erase_block;
+// erases of each sector since flash_emu_init
+static u32_t *erase_counts;
+static flash_emu_stats stats;
+// ESP8266 spi_flash_read/write: the cache flush and SPI setup per call,
+// about 10 MB/s on a 40 MHz DIO bus, and a 4 KB sector erase
+static double access_us = 15, byte_ns = 100, erase_us = 30000;
+static int delay_on;
+
+// waits out the modelled time of an access if delays are on, spinning as
+// sleeps are too coarse for accesses of a few microseconds
+static void delay(double us) {
+  struct timespec t0, t;
+  if (!delay_on) return;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  do {
+    clock_gettime(CLOCK_MONOTONIC, &t);
+  } while ((t.tv_sec - t0.tv_sec) * 1e6 + (t.tv_nsec - t0.tv_nsec) / 1e3 < us);
+}
+
+int flash_emu_init(u32_t size, u32_t erase_block) {
+  flash_emu_free();
+  flash = malloc(size);
+  erase_counts = calloc(size / erase_block, sizeof(*erase_counts));
+  if (flash == NULL || erase_counts == NULL) {
+    flash_emu_free();
+    return -1;
+  }
+  memset(flash, 0xff, size);
+  flash_size = size;
+  flash_erase_block = erase_block;
+  flash_emu_reset_stats();
+  return 0;
+}
+
+void flash_emu_free(void) {
+  free(flash);
+  flash = NULL;
+  free(erase_counts);
+  erase_counts = NULL;
+}
+
+s32_t flash_emu_read(u32_t addr, u32_t size, u8_t *dst) {
+  if (addr + size > flash_size) return SPIFFS_ERR_NOT_CONFIGURED;
+  memcpy(dst, &flash[addr], size);
+  stats.reads++;
+  stats.read_bytes += size;
+  stats.busy_us += access_us + size * byte_ns / 1000;
+  delay(access_us + size * byte_ns / 1000);
+  return SPIFFS_OK;
+}
+
+s32_t flash_emu_write(u32_t addr, u32_t size, u8_t *src) {
+  u32_t i;
+  if (addr + size > flash_size) return SPIFFS_ERR_NOT_CONFIGURED;
+  for (i = 0; i < size; i++) {
+    flash[addr + i] &= src[i];
+  }
+  stats.writes++;
+  stats.write_bytes += size;
+  stats.busy_us += access_us + size * byte_ns / 1000;
+  delay(access_us + size * byte_ns / 1000);
+  return SPIFFS_OK;
+}
+
+s32_t flash_emu_erase(u32_t addr, u32_t size) {
+  if (size != flash_erase_block || addr % flash_erase_block != 0 ||
+      addr + size > flash_size) {
+    return SPIFFS_ERR_NOT_CONFIGURED;
+  }
+  memset(&flash[addr], 0xff, size);
+  erase_counts[addr / flash_erase_block]++;
+  stats.erases++;
+  stats.busy_us += erase_us;
+  delay(erase_us);
+  return SPIFFS_OK;
+}
+
+u32_t flash_emu_erase_count(u32_t addr) {
+  return addr < flash_size ? erase_counts[addr / flash_erase_block] : 0;
+}
+
+void flash_emu_config(spiffs_config *cfg, u32_t log_page_size) {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->phys_size = flash_size;
+  cfg->phys_addr = 0;
+  cfg->phys_erase_block = flash_erase_block;
+  cfg->log_block_size = flash_erase_block;
+  cfg->log_page_size = log_page_size;
+  cfg->hal_read_f = flash_emu_read;
+  cfg->hal_write_f = flash_emu_write;
+  cfg->hal_erase_f = flash_emu_erase;
+}
+
+void flash_emu_set_timing(double us_per_access, double ns_per_byte, double us_per_erase) {
+  access_us = us_per_access;
+  byte_ns = ns_per_byte;
+  erase_us = us_per_erase;
+}
+
+void flash_emu_set_delay(int on) {
+  delay_on = on;
+}
+
+void flash_emu_get_stats(flash_emu_stats *s) {
+  *s = stats;
+}
+
+void flash_emu_reset_stats(void) {
+  memset(&stats, 0, sizeof(stats));
+}
+
+// the ROM routines behind these move whole words to and from word
+// aligned buffers, anything else is refused here
+#define WORD_ALIGNED(x) (((uintptr_t)(x) & 3) == 0)
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size) {
+  if (!WORD_ALIGNED(src_addr) || !WORD_ALIGNED(des_addr) || !WORD_ALIGNED(size)) {
+    return SPI_FLASH_RESULT_ERR;
+  }
+  return flash_emu_read(src_addr, size, (u8_t *)des_addr) == SPIFFS_OK ?
+      SPI_FLASH_RESULT_OK : SPI_FLASH_RESULT_ERR;
+}
+
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size) {
+  if (!WORD_ALIGNED(des_addr) || !WORD_ALIGNED(src_addr) || !WORD_ALIGNED(size)) {
+    return SPI_FLASH_RESULT_ERR;
+  }
+  return flash_emu_write(des_addr, size, (u8_t *)src_addr) == SPIFFS_OK ?
+      SPI_FLASH_RESULT_OK : SPI_FLASH_RESULT_ERR;
+}
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec) {
+  return flash_emu_erase(sec * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == SPIFFS_OK ?
+      SPI_FLASH_RESULT_OK : SPI_FLASH_RESULT_ERR;
+}
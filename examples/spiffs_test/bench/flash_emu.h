@@ -0,0 +1,48 @@
+/*
+ * flash_emu.h
+ *
+ * RAM-backed SPI flash for host runs of spiffs, with the hal callbacks
+ * spiffs_config wants and counters for what spiffs asked of the flash.
+ */
+
+#ifndef FLASH_EMU_H_
+#define FLASH_EMU_H_
+
+#include "spiffs.h"
+
+typedef struct {
+  u32_t reads;
+  u32_t read_bytes;
+  u32_t writes;
+  u32_t write_bytes;
+  u32_t erases;
+  // modelled time the flash was busy, see flash_emu_set_timing
+  double busy_us;
+} flash_emu_stats;
+
+// allocates size bytes of erased flash in erase_block sized sectors
+int flash_emu_init(u32_t size, u32_t erase_block);
+void flash_emu_free(void);
+
+s32_t flash_emu_read(u32_t addr, u32_t size, u8_t *dst);
+s32_t flash_emu_write(u32_t addr, u32_t size, u8_t *src);
+s32_t flash_emu_erase(u32_t addr, u32_t size);
+
+// erases of the sector holding addr since flash_emu_init
+u32_t flash_emu_erase_count(u32_t addr);
+
+// fills cfg with the geometry and hal callbacks of the emulated flash
+void flash_emu_config(spiffs_config *cfg, u32_t log_page_size);
+
+// sets the modelled cost of a read or write, a fixed part per access and a
+// part per byte, and the cost of a sector erase
+void flash_emu_set_timing(double us_per_access, double ns_per_byte, double us_per_erase);
+
+// with delays on, every access also takes its modelled time in real time,
+// for code that times itself or runs against a deadline
+void flash_emu_set_delay(int on);
+
+void flash_emu_get_stats(flash_emu_stats *stats);
+void flash_emu_reset_stats(void);
+
+#endif /* FLASH_EMU_H_ */
@@ -0,0 +1,148 @@
+/*
+ * gc_bench.c
+ *
+ * Write stalls from garbage collection, with and without collecting in the
+ * idle time between writes.  Records are appended to a queue of files on
+ * RAM-backed flash, the oldest file is removed when a new one is started,
+ * and after every burst of records the system is idle.  The run is done
+ * twice on a freshly formatted file system: once leaving all collection to
+ * the write path, once calling SPIFFS_gc_step in the idle time the way the
+ * esp_spiffs.c gc task does.
+ *
+ *   gc_bench [-f fs_kb] [-q files] [-k file_kb] [-s record] [-b burst]
+ *            [-n records] [-r reserve]
+ *
+ * Per run it prints the modelled time of a record write at the median, the
+ * 99th percentile and the worst, how many writes had to erase, and the
+ * erases done in the write path and in the idle time.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+
+static u32_t files = 8, file_kb = 16, record = 48, burst = 8, records = 20000;
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// runs the queue workload, stepping gc in idle time if reserve >= 0
+static int run(const char *what, int reserve, double *lat) {
+  flash_emu_stats st;
+  u8_t buf[256];
+  char name[16];
+  u32_t head = 0, written = 0, r, stalls = 0, fg_erases = 0, bg_erases = 0;
+  double bg_us = 0;
+  spiffs_file fh;
+
+  if (bench_fs_fresh() != 0) return -1;
+  flash_emu_reset_stats();
+
+  sprintf(name, "q%u", head);
+  fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  for (r = 0; r < records; r++) {
+    if (fh < 0) {
+      fprintf(stderr, "open failed: %i\n", SPIFFS_errno(&fs));
+      return -1;
+    }
+
+    flash_emu_get_stats(&st);
+    double us = st.busy_us;
+    u32_t erases = st.erases;
+    memset(buf, r, record);
+    if (SPIFFS_write(&fs, fh, buf, record) != (s32_t)record) {
+      fprintf(stderr, "write failed: %i\n", SPIFFS_errno(&fs));
+      return -1;
+    }
+    written += record;
+    if (written >= file_kb * 1024) {
+      SPIFFS_close(&fs, fh);
+      if (++head >= files) {
+        sprintf(name, "q%u", head - files);
+        SPIFFS_remove(&fs, name);
+      }
+      sprintf(name, "q%u", head);
+      fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+      written = 0;
+    }
+    flash_emu_get_stats(&st);
+    lat[r] = st.busy_us - us;
+    if (st.erases != erases) {
+      stalls++;
+      fg_erases += st.erases - erases;
+    }
+
+    if (reserve >= 0 && (r + 1) % burst == 0) {
+      s32_t res;
+      us = st.busy_us;
+      erases = st.erases;
+      while ((res = SPIFFS_gc_step(&fs, reserve)) > 0);
+      if (res < 0) {
+        fprintf(stderr, "gc step failed: %i\n", SPIFFS_errno(&fs));
+        return -1;
+      }
+      flash_emu_get_stats(&st);
+      bg_us += st.busy_us - us;
+      bg_erases += st.erases - erases;
+    }
+  }
+  SPIFFS_close(&fs, fh);
+
+  qsort(lat, records, sizeof(lat[0]), cmp_double);
+  printf("%-10s %8.2f %8.2f %8.2f %7u %7u %7u %8.0f\n", what,
+      lat[records / 2] / 1e3, lat[records * 99 / 100] / 1e3, lat[records - 1] / 1e3,
+      stalls, fg_erases, bg_erases, bg_us / 1e3);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  u32_t fs_kb = 256;
+  int reserve = 5;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:q:k:s:b:n:r:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'q': files = atoi(optarg); break;
+    case 'k': file_kb = atoi(optarg); break;
+    case 's': record = atoi(optarg); break;
+    case 'b': burst = atoi(optarg); break;
+    case 'n': records = atoi(optarg); break;
+    case 'r': reserve = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-q files] [-k file_kb] [-s record] "
+          "[-b burst] [-n records] [-r reserve]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (record == 0 || record > 256 || burst == 0 || records == 0) {
+    fprintf(stderr, "record must be 1..256 bytes, burst and records above 0\n");
+    return 2;
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+  double *lat = malloc(records * sizeof(*lat));
+  if (lat == NULL) return 1;
+
+  printf("%u KB fs, queue of %u files of %u KB, %u byte records in bursts of %u\n",
+      fs_kb, files, file_kb, record, burst);
+  printf("                 write ms                  erases    idle gc\n");
+  printf("               p50      p99      max  stalls   write    idle       ms\n");
+  if (run("write gc", -1, lat) != 0) return 1;
+  char what[16];
+  sprintf(what, "idle gc %d", reserve);
+  if (run(what, reserve, lat) != 0) return 1;
+
+  free(lat);
+  bench_fs_free();
+  return 0;
+}
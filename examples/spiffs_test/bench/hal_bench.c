@@ -0,0 +1,136 @@
+/*
+ * hal_bench.c
+ *
+ * spiffs through the SDK's esp_spiffs.c hal and the newlib file calls it
+ * provides, on emulated flash that only takes word aligned spi_flash calls.  Records of a few sizes are appended
+ * to a set of files and read back, and the spi_flash traffic is reported
+ * per KB of file data.
+ *
+ *   hal_bench [-f fs_kb] [-n records]
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_common.h"
+#include "flash_emu.h"
+
+#define FILES 4
+
+// what newlib's open, read, write and close call on the device
+int _open_r(struct _reent *r, const char *filename, int flags, int mode);
+_ssize_t _read_r(struct _reent *r, int fd, void *buf, size_t len);
+_ssize_t _write_r(struct _reent *r, int fd, void *buf, size_t len);
+int _close_r(struct _reent *r, int fd);
+int _unlink_r(struct _reent *r, const char *filename);
+
+static void report(const char *what, u32_t bytes) {
+  flash_emu_stats st;
+  double kb = bytes / 1024.0;
+  flash_emu_get_stats(&st);
+  printf("%-6s %8u %7.1f %8.0f %7.1f %8.0f %7.0f\n", what, bytes,
+      st.reads / kb, st.read_bytes / kb, st.writes / kb, st.write_bytes / kb,
+      kb / (st.busy_us / 1e6));
+}
+
+int main(int argc, char **argv) {
+  static const u32_t sizes[] = { 7, 16, 33, 64, 130 };
+  struct esp_spiffs_config config;
+  u32_t fs_kb = 128, records = 200;
+  u8_t buf[256];
+  char name[16];
+  int c, f;
+  unsigned i, r;
+
+  while ((c = getopt(argc, argv, "f:n:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'n': records = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-n records]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (flash_emu_init(fs_kb * 1024, SPI_FLASH_SEC_SIZE) != 0) return 1;
+  config.phys_size = fs_kb * 1024;
+  config.phys_addr = 0;
+  config.phys_erase_block = SPI_FLASH_SEC_SIZE;
+  config.log_block_size = SPI_FLASH_SEC_SIZE;
+  config.log_page_size = 128;
+  // room for FILES + 1 descriptors with 64-bit host pointers
+  config.fd_buf_size = 64 * (FILES + 1);
+  config.cache_buf_size = (128 + 32) * 4;
+
+  // mounting unformatted flash fails, format and mount again
+  esp_spiffs_init(&config);
+  esp_spiffs_deinit(1);
+  if (esp_spiffs_init(&config) != 0) {
+    fprintf(stderr, "mount failed\n");
+    return 1;
+  }
+
+  printf("%u KB fs, %u records of each size over %d files\n", fs_kb, records, FILES);
+  printf("          bytes   rd/KB  rdB/KB   wr/KB  wrB/KB    KB/s\n");
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    u32_t bytes = 0;
+    int fh[FILES];
+
+    flash_emu_reset_stats();
+    for (f = 0; f < FILES; f++) {
+      sprintf(name, "r%u_%d", sizes[i], f);
+      fh[f] = _open_r(NULL, name, O_CREAT | O_TRUNC | O_RDWR, 0);
+      if (fh[f] < 0) {
+        fprintf(stderr, "open failed: %i\n", fh[f]);
+        return 1;
+      }
+    }
+    for (r = 0; r < records; r++) {
+      memset(buf, r, sizes[i]);
+      _ssize_t res = _write_r(NULL, fh[r % FILES], buf, sizes[i]);
+      if (res != (_ssize_t)sizes[i]) {
+        fprintf(stderr, "write failed: %i\n", (int)res);
+        return 1;
+      }
+      bytes += sizes[i];
+    }
+    for (f = 0; f < FILES; f++) _close_r(NULL, fh[f]);
+    sprintf(name, "wr %u", sizes[i]);
+    report(name, bytes);
+
+    flash_emu_reset_stats();
+    bytes = 0;
+    for (f = 0; f < FILES; f++) {
+      sprintf(name, "r%u_%d", sizes[i], f);
+      int rh = _open_r(NULL, name, O_RDONLY, 0);
+      u32_t k, j;
+      if (rh < 0) return 1;
+      // record k of file f was record k * FILES + f, read it to an odd
+      // offset in buf so the data reads are not word aligned
+      for (k = 0; k * FILES + f < records; k++) {
+        _ssize_t res = _read_r(NULL, rh, buf + 1, sizes[i]);
+        if (res != (_ssize_t)sizes[i]) {
+          fprintf(stderr, "read failed: %i\n", (int)res);
+          return 1;
+        }
+        for (j = 0; j < sizes[i]; j++) {
+          if (buf[1 + j] != (u8_t)(k * FILES + f)) {
+            fprintf(stderr, "%s: record %u differs\n", name, k);
+            return 1;
+          }
+        }
+        bytes += sizes[i];
+      }
+      _close_r(NULL, rh);
+      _unlink_r(NULL, name);
+    }
+    sprintf(name, "rd %u", sizes[i]);
+    report(name, bytes);
+  }
+
+  esp_spiffs_deinit(0);
+  flash_emu_free();
+  return 0;
+}
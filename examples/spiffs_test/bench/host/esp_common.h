@@ -0,0 +1,28 @@
+/*
+ * esp_common.h
+ *
+ * Host stand-in for the SDK header, what esp_spiffs.c needs to build
+ * natively against the emulated flash.
+ */
+
+#ifndef __ESP_COMMON_H__
+#define __ESP_COMMON_H__
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "c_types.h"
+#include "spi_flash.h"
+#include "esp_spiffs.h"
+
+/* newlib names for the syscall types */
+struct _reent;
+typedef ssize_t _ssize_t;
+typedef off_t _off_t;
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * FreeRTOS.h
+ *
+ * Host stand-in for the kernel headers spiffs_config.h pulls in, only the
+ * SDK's integer types are needed.
+ */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include "c_types.h"
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * task.h
+ *
+ * Host stand-in, spiffs does not use the scheduler.
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#endif
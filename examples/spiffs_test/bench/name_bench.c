@@ -0,0 +1,159 @@
+/*
+ * name_bench.c
+ *
+ * Cost of finding files by name against the number of files, on RAM-backed
+ * flash.  For each file count the file system is formatted, the files are
+ * created and it is mounted again, then every file is opened and stat'ed
+ * by name and as many names that do not exist are opened.  Half the files
+ * are then renamed and a quarter removed, and every old and new name is
+ * checked to open or not.
+ *
+ *   name_bench [-f fs_kb] [-c cache_pages]
+ *
+ * Per file count it prints the flash reads and modelled time of an open,
+ * a stat and an open of a missing name.  Build with -DSPIFFS_NAME_INDEX=0
+ * to compare with the lookup scan.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+
+static u8_t *cache;
+static u32_t cache_size;
+
+// opens name, expecting it to exist or not, returns -1 if it is otherwise
+static int probe(const char *name, int exists) {
+  spiffs_file fh = SPIFFS_open(&fs, (char *)name, SPIFFS_RDONLY, 0);
+  if (fh >= 0) SPIFFS_close(&fs, fh);
+  if ((fh >= 0) != exists ||
+      (fh < 0 && SPIFFS_errno(&fs) != SPIFFS_ERR_NOT_FOUND)) {
+    fprintf(stderr, "%s: open gave %i, expected %s\n", name,
+        fh >= 0 ? (int)fh : (int)SPIFFS_errno(&fs), exists ? "a file" : "not found");
+    return -1;
+  }
+  return 0;
+}
+
+static void measure_begin(flash_emu_stats *st) {
+  flash_emu_get_stats(st);
+}
+
+static void measure_end(flash_emu_stats *st, u32_t n, double *reads, double *ms) {
+  flash_emu_stats now;
+  flash_emu_get_stats(&now);
+  *reads = (double)(now.reads - st->reads) / n;
+  *ms = (now.busy_us - st->busy_us) / n / 1e3;
+}
+
+static int run(u32_t files) {
+  flash_emu_stats st;
+  spiffs_stat s;
+  double rd_open, ms_open, rd_stat, ms_stat, rd_miss, ms_miss;
+  char name[32];
+  u32_t i;
+
+  if (bench_fs_fresh() != 0) return -1;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "log/%u.txt", i);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (fh < 0 || SPIFFS_write(&fs, fh, name, strlen(name)) < 0) {
+      fprintf(stderr, "create failed: %i\n", SPIFFS_errno(&fs));
+      return -1;
+    }
+    SPIFFS_close(&fs, fh);
+  }
+  SPIFFS_unmount(&fs);
+  if (bench_fs_mount() != 0) return -1;
+
+  // visit the files in an order unrelated to where they are on flash
+  measure_begin(&st);
+  for (i = 0; i < files; i++) {
+    sprintf(name, "log/%u.txt", (i * 7919) % files);
+    if (probe(name, 1) != 0) return -1;
+  }
+  measure_end(&st, files, &rd_open, &ms_open);
+
+  measure_begin(&st);
+  for (i = 0; i < files; i++) {
+    sprintf(name, "log/%u.txt", (i * 7919) % files);
+    if (SPIFFS_stat(&fs, name, &s) != SPIFFS_OK || s.size != strlen(name)) {
+      fprintf(stderr, "%s: stat failed: %i\n", name, SPIFFS_errno(&fs));
+      return -1;
+    }
+  }
+  measure_end(&st, files, &rd_stat, &ms_stat);
+
+  measure_begin(&st);
+  for (i = 0; i < files; i++) {
+    sprintf(name, "tmp/%u.txt", i);
+    if (probe(name, 0) != 0) return -1;
+  }
+  measure_end(&st, files, &rd_miss, &ms_miss);
+
+  printf("%6u %8.1f %8.2f %8.1f %8.2f %8.1f %8.2f\n", files,
+      rd_open, ms_open, rd_stat, ms_stat, rd_miss, ms_miss);
+
+  // odd files renamed, every fourth removed
+  for (i = 0; i < files; i++) {
+    char new_name[32];
+    sprintf(name, "log/%u.txt", i);
+    sprintf(new_name, "old/%u.txt", i);
+    if (i % 2 && SPIFFS_rename(&fs, name, new_name) != SPIFFS_OK) {
+      fprintf(stderr, "%s: rename failed: %i\n", name, SPIFFS_errno(&fs));
+      return -1;
+    }
+    if (i % 4 == 0 && SPIFFS_remove(&fs, name) != SPIFFS_OK) {
+      fprintf(stderr, "%s: remove failed: %i\n", name, SPIFFS_errno(&fs));
+      return -1;
+    }
+  }
+  for (i = 0; i < files; i++) {
+    sprintf(name, "log/%u.txt", i);
+    if (probe(name, i % 2 == 0 && i % 4 != 0) != 0) return -1;
+    sprintf(name, "old/%u.txt", i);
+    if (probe(name, i % 2) != 0) return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const u32_t counts[] = { 8, 16, 32, 64, 128, 256 };
+  u32_t fs_kb = 1024, cache_pages = 8;
+  unsigned i;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:c:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'c': cache_pages = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-c cache_pages]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+  cache_size = SPIFFS_buffer_bytes_for_cache(&fs, cache_pages);
+  cache = malloc(cache_size);
+  if (cache == NULL) return 1;
+  bench_fs_set_cache(cache, cache_size);
+
+  printf("%u KB fs, %u cache pages, name index of %u\n", fs_kb, cache_pages, SPIFFS_NAME_INDEX);
+  printf("             open            stat          missing\n");
+  printf(" files    reads       ms    reads       ms    reads       ms\n");
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (run(counts[i]) != 0) return 1;
+  }
+
+  free(cache);
+  bench_fs_free();
+  return 0;
+}
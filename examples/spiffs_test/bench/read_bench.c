@@ -0,0 +1,126 @@
+/*
+ * read_bench.c
+ *
+ * Streaming read throughput of spiffs on RAM-backed flash.  One file is
+ * written, then read front to back with a range of chunk sizes, and
+ * finally with seeks between the chunks so that nothing is sequential.
+ *
+ *   read_bench [-f fs_kb] [-p page] [-s file_kb] [-c cache_pages]
+ *
+ * Time is the flash busy time of the modelled ESP8266 SPI flash in
+ * flash_emu.c, the host CPU time is left out.  The last line gives the
+ * rate of reading the whole file with a single flash access.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+static u8_t pattern(u32_t off) {
+  return (u8_t)(off * 7 + (off >> 8));
+}
+
+static int write_file(u32_t size) {
+  u8_t buf[256];
+  u32_t off, i;
+  spiffs_file fh = SPIFFS_open(&fs, "stream", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fh < 0) return -1;
+  for (off = 0; off < size; off += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++) buf[i] = pattern(off + i);
+    if (SPIFFS_write(&fs, fh, buf, sizeof(buf)) != sizeof(buf)) return -1;
+  }
+  SPIFFS_close(&fs, fh);
+  return 0;
+}
+
+// reads the file in chunks, seeking before each chunk if scatter is set
+static int read_file(u32_t size, u32_t chunk, int scatter) {
+  static u8_t buf[4096];
+  u32_t off, i;
+  spiffs_file fh = SPIFFS_open(&fs, "stream", SPIFFS_RDONLY, 0);
+  if (fh < 0) return -1;
+  for (off = 0; off < size; off += chunk) {
+    u32_t at = off;
+    if (scatter) {
+      // visit the chunks in a stride that never continues the last read
+      at = (off / chunk * 7919 % (size / chunk)) * chunk;
+      SPIFFS_lseek(&fs, fh, at, SPIFFS_SEEK_SET);
+    }
+    if (SPIFFS_read(&fs, fh, buf, chunk) != (s32_t)chunk) return -1;
+    for (i = 0; i < chunk; i++) {
+      if (buf[i] != pattern(at + i)) return -1;
+    }
+  }
+  SPIFFS_close(&fs, fh);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static const u32_t chunks[] = { 16, 64, 256, 1024, 4096 };
+  u32_t fs_kb = 128, page = 128, file_kb = 64, cache_pages = 4;
+  int c, scatter;
+  unsigned i;
+
+  while ((c = getopt(argc, argv, "f:p:s:c:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'p': page = atoi(optarg); break;
+    case 's': file_kb = atoi(optarg); break;
+    case 'c': cache_pages = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-p page] [-s file_kb] [-c cache_pages]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  if (bench_fs_init(fs_kb * 1024, page) != 0) return 1;
+  bench_fs_set_cache(0, 0);
+  if (bench_fs_fresh() != 0) return 1;
+  SPIFFS_unmount(&fs);
+  u32_t cache_size = SPIFFS_buffer_bytes_for_cache(&fs, cache_pages);
+  u8_t *cache = malloc(cache_size);
+  bench_fs_set_cache(cache, cache_size);
+  if (bench_fs_mount() != 0 || write_file(file_kb * 1024) != 0) {
+    fprintf(stderr, "could not write a %u KB file: %i\n", file_kb, SPIFFS_errno(&fs));
+    return 1;
+  }
+
+  printf("%u KB file, %u byte pages, %u cache pages (%u bytes), read ahead %u pages\n",
+      file_kb, page, cache_pages, cache_size, SPIFFS_READ_AHEAD_PAGES);
+  printf("         chunk  reads  rd/KB  flashB/KB   KB/s\n");
+  for (scatter = 0; scatter < 2; scatter++) {
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+      flash_emu_stats st;
+      // start cold, as after a remount
+      SPIFFS_unmount(&fs);
+      if (bench_fs_mount() != 0) return 1;
+      flash_emu_reset_stats();
+      if (read_file(file_kb * 1024, chunks[i], scatter) != 0) {
+        fprintf(stderr, "read back failed with %u byte chunks: %i\n", chunks[i], SPIFFS_errno(&fs));
+        return 1;
+      }
+      flash_emu_get_stats(&st);
+      printf("%s %5u %6u %6.1f %10.0f %6.0f\n", scatter ? "seek" : "seq ", chunks[i],
+          st.reads, st.reads / (double)file_kb, st.read_bytes / (double)file_kb,
+          file_kb / (st.busy_us / 1e6));
+    }
+  }
+
+  // the whole file in one access, what streaming could at best approach
+  u8_t *raw = malloc(file_kb * 1024);
+  flash_emu_stats st;
+  flash_emu_reset_stats();
+  flash_emu_read(0, file_kb * 1024, raw);
+  flash_emu_get_stats(&st);
+  printf("raw flash read %24.0f\n", file_kb / (st.busy_us / 1e6));
+
+  bench_fs_free();
+  free(raw);
+  free(cache);
+  return 0;
+}
@@ -0,0 +1,527 @@
+/*
+ * suite_bench.c
+ *
+ * A benchmark suite of spiffs on RAM-backed flash, printing one JSON object
+ * per line so that runs can be kept and compared to catch regressions.
+ * Times are the modelled flash time of flash_emu, and so the same from run
+ * to run; with -t the flash also takes that time for real and the wall time
+ * is printed as well.  The benches are:
+ *
+ *   seq_write   a file written in chunks of each size
+ *   seq_read    the file read back in chunks after mounting again
+ *   rand_read   chunks read at random offsets of the file
+ *   rand_write  chunks written at random offsets, each flushed
+ *   open_stat   open, stat and open of a missing name against file count
+ *   gc_pause    record write latency of a queue of log files cycling
+ *               through the file system, and its percentiles
+ *   write_amp   flash bytes written per byte written by the application,
+ *               rewriting files at random with the file system kept filled
+ *               to a few levels
+ *
+ * gc_pause and write_amp are run with the default and the greedy garbage
+ * collection policy of SPIFFS_gc_policy.
+ *
+ *   suite_bench [-f fs_kb] [-s file_kb] [-n ops] [-t]
+ *
+ * Every object has "bench" naming what it measured, times are in
+ * microseconds and rates in KB/s.  Data read back is checked, a bench that
+ * finds it wrong or fails makes the run exit with an error.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+#define CHUNK_MAX   4096
+
+static u32_t fs_kb = 512, file_kb = 64, ops = 500;
+static int delays;
+static u32_t rnd = 2463534242u;
+
+static flash_emu_stats before;
+static struct timespec wall_before;
+
+static const struct {
+  const char *what;
+  spiffs_gc_score_f score_f;
+} policies[] = {
+  { "default", spiffs_gc_score_default },
+  { "greedy", spiffs_gc_score_greedy },
+};
+
+static u32_t random32(void) {
+  rnd ^= rnd << 13;
+  rnd ^= rnd >> 17;
+  rnd ^= rnd << 5;
+  return rnd;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// the byte at offset o of file f
+static u8_t pattern(u32_t f, u32_t o) {
+  return (u8_t)(f * 13 + o / 7 + o);
+}
+
+static int fail(const char *what) {
+  fprintf(stderr, "%s failed: %i\n", what, SPIFFS_errno(&fs));
+  return -1;
+}
+
+static void begin(void) {
+  flash_emu_get_stats(&before);
+  clock_gettime(CLOCK_MONOTONIC, &wall_before);
+}
+
+// flash traffic and wall time since begin
+static void end(flash_emu_stats *d, double *wall_us) {
+  struct timespec t;
+  flash_emu_get_stats(d);
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  d->reads -= before.reads;
+  d->read_bytes -= before.read_bytes;
+  d->writes -= before.writes;
+  d->write_bytes -= before.write_bytes;
+  d->erases -= before.erases;
+  d->busy_us -= before.busy_us;
+  *wall_us = (t.tv_sec - wall_before.tv_sec) * 1e6 + (t.tv_nsec - wall_before.tv_nsec) / 1e3;
+}
+
+static void emit_begin(const char *bench) {
+  printf("{\"bench\":\"%s\"", bench);
+}
+
+static void emit_s(const char *key, const char *v) {
+  printf(",\"%s\":\"%s\"", key, v);
+}
+
+static void emit_u(const char *key, u32_t v) {
+  printf(",\"%s\":%u", key, v);
+}
+
+static void emit_f(const char *key, double v) {
+  printf(",\"%s\":%.3f", key, v);
+}
+
+// the flash traffic of a bench, and its rate for bytes of data if any
+static void emit_flash(const flash_emu_stats *d, double wall_us, u32_t bytes) {
+  emit_u("reads", d->reads);
+  emit_u("read_bytes", d->read_bytes);
+  emit_u("writes", d->writes);
+  emit_u("write_bytes", d->write_bytes);
+  emit_u("erases", d->erases);
+  emit_f("flash_us", d->busy_us);
+  if (bytes) emit_f("kb_s", bytes / 1024.0 / (d->busy_us / 1e6));
+  if (delays) {
+    emit_f("wall_us", wall_us);
+    if (bytes) emit_f("wall_kb_s", bytes / 1024.0 / (wall_us / 1e6));
+  }
+}
+
+static void emit_end(void) {
+  printf("}\n");
+  fflush(stdout);
+}
+
+static int check(const u8_t *data, const u8_t *expect, u32_t len, const char *what) {
+  if (memcmp(data, expect, len) != 0) {
+    fprintf(stderr, "%s: data read back differs\n", what);
+    return -1;
+  }
+  return 0;
+}
+
+// sequential and random reads and writes of a file in chunks
+static int bench_io(u32_t chunk) {
+  static u8_t buf[CHUNK_MAX];
+  u32_t size = file_kb * 1024, o, i, n;
+  flash_emu_stats d;
+  double wall;
+  spiffs_file fh;
+
+  u8_t *shadow = malloc(size);
+  if (shadow == NULL) return -1;
+  for (o = 0; o < size; o++) shadow[o] = pattern(chunk, o);
+
+  if (bench_fs_fresh() != 0) goto err;
+  begin();
+  fh = SPIFFS_open(&fs, "io", SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fh < 0) goto err_fs;
+  for (o = 0; o < size; o += chunk) {
+    if (SPIFFS_write(&fs, fh, &shadow[o], chunk) != (s32_t)chunk) goto err_fs;
+  }
+  SPIFFS_close(&fs, fh);
+  end(&d, &wall);
+  emit_begin("seq_write");
+  emit_u("chunk", chunk);
+  emit_u("bytes", size);
+  emit_f("wa", (double)d.write_bytes / size);
+  emit_flash(&d, wall, size);
+  emit_end();
+
+  // mount again to read with a cold cache
+  SPIFFS_unmount(&fs);
+  if (bench_fs_mount() != 0) goto err;
+  begin();
+  fh = SPIFFS_open(&fs, "io", SPIFFS_RDONLY, 0);
+  if (fh < 0) goto err_fs;
+  for (o = 0; o < size; o += chunk) {
+    if (SPIFFS_read(&fs, fh, buf, chunk) != (s32_t)chunk) goto err_fs;
+    if (check(buf, &shadow[o], chunk, "seq_read") != 0) goto err;
+  }
+  end(&d, &wall);
+  emit_begin("seq_read");
+  emit_u("chunk", chunk);
+  emit_u("bytes", size);
+  emit_flash(&d, wall, size);
+  emit_end();
+
+  begin();
+  for (n = 0; n < ops; n++) {
+    o = random32() % (size - chunk + 1);
+    if (SPIFFS_lseek(&fs, fh, o, SPIFFS_SEEK_SET) != (s32_t)o ||
+        SPIFFS_read(&fs, fh, buf, chunk) != (s32_t)chunk) {
+      goto err_fs;
+    }
+    if (check(buf, &shadow[o], chunk, "rand_read") != 0) goto err;
+  }
+  end(&d, &wall);
+  SPIFFS_close(&fs, fh);
+  emit_begin("rand_read");
+  emit_u("chunk", chunk);
+  emit_u("ops", ops);
+  emit_f("us_op", d.busy_us / ops);
+  emit_f("reads_op", (double)d.reads / ops);
+  emit_flash(&d, wall, ops * chunk);
+  emit_end();
+
+  fh = SPIFFS_open(&fs, "io", SPIFFS_RDWR, 0);
+  if (fh < 0) goto err_fs;
+  begin();
+  for (n = 0; n < ops; n++) {
+    o = random32() % (size - chunk + 1);
+    for (i = 0; i < chunk; i++) shadow[o + i] = random32();
+    if (SPIFFS_lseek(&fs, fh, o, SPIFFS_SEEK_SET) != (s32_t)o ||
+        SPIFFS_write(&fs, fh, &shadow[o], chunk) != (s32_t)chunk ||
+        SPIFFS_fflush(&fs, fh) < SPIFFS_OK) {
+      goto err_fs;
+    }
+  }
+  end(&d, &wall);
+  SPIFFS_close(&fs, fh);
+  emit_begin("rand_write");
+  emit_u("chunk", chunk);
+  emit_u("ops", ops);
+  emit_f("us_op", d.busy_us / ops);
+  emit_f("wa", (double)d.write_bytes / (ops * chunk));
+  emit_flash(&d, wall, ops * chunk);
+  emit_end();
+
+  // what the random writes left must read back
+  fh = SPIFFS_open(&fs, "io", SPIFFS_RDONLY, 0);
+  if (fh < 0) goto err_fs;
+  for (o = 0; o < size; o += chunk) {
+    if (SPIFFS_read(&fs, fh, buf, chunk) != (s32_t)chunk) goto err_fs;
+    if (check(buf, &shadow[o], chunk, "rand_write") != 0) goto err;
+  }
+  SPIFFS_close(&fs, fh);
+
+  free(shadow);
+  return 0;
+err_fs:
+  fail("io");
+err:
+  free(shadow);
+  return -1;
+}
+
+// opens name, which must exist or not, and adds its time to *us
+static int probe(const char *name, int exists, double *us, double *max_us) {
+  flash_emu_stats d;
+  double wall;
+  begin();
+  spiffs_file fh = SPIFFS_open(&fs, (char *)name, SPIFFS_RDONLY, 0);
+  if (fh >= 0) SPIFFS_close(&fs, fh);
+  end(&d, &wall);
+  if ((fh >= 0) != exists || (fh < 0 && SPIFFS_errno(&fs) != SPIFFS_ERR_NOT_FOUND)) {
+    fprintf(stderr, "%s: open gave %i\n", name, fh >= 0 ? (int)fh : (int)SPIFFS_errno(&fs));
+    return -1;
+  }
+  *us += d.busy_us;
+  if (max_us && d.busy_us > *max_us) *max_us = d.busy_us;
+  return 0;
+}
+
+// open and stat by name against the number of files
+static int bench_open_stat(u32_t files) {
+  flash_emu_stats d, d_open;
+  double wall, open_us = 0, open_max_us = 0, miss_us = 0;
+  spiffs_stat s;
+  char name[32];
+  u32_t i;
+
+  if (bench_fs_fresh() != 0) return -1;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "dev/%u.cfg", i);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+    if (fh < 0 || SPIFFS_write(&fs, fh, name, strlen(name)) < 0) return fail("create");
+    SPIFFS_close(&fs, fh);
+  }
+  SPIFFS_unmount(&fs);
+  if (bench_fs_mount() != 0) return -1;
+
+  // visit the files in an order unrelated to where they are on flash
+  begin();
+  flash_emu_stats d0 = before;
+  for (i = 0; i < files; i++) {
+    sprintf(name, "dev/%u.cfg", (i * 7919) % files);
+    if (probe(name, 1, &open_us, &open_max_us) != 0) return -1;
+  }
+  before = d0;
+  end(&d_open, &wall);
+
+  begin();
+  for (i = 0; i < files; i++) {
+    sprintf(name, "dev/%u.cfg", (i * 7919) % files);
+    if (SPIFFS_stat(&fs, name, &s) != SPIFFS_OK || s.size != strlen(name)) return fail("stat");
+  }
+  end(&d, &wall);
+
+  for (i = 0; i < files; i++) {
+    sprintf(name, "tmp/%u.cfg", i);
+    if (probe(name, 0, &miss_us, NULL) != 0) return -1;
+  }
+
+  emit_begin("open_stat");
+  emit_u("files", files);
+  emit_f("open_us", open_us / files);
+  emit_f("open_max_us", open_max_us);
+  emit_f("open_reads", (double)d_open.reads / files);
+  emit_f("stat_us", d.busy_us / files);
+  emit_f("stat_reads", (double)d.reads / files);
+  emit_f("miss_us", miss_us / files);
+  emit_end();
+  return 0;
+}
+
+// latency of record writes to a queue of log files that cycles through
+// half the file system, with garbage collection in the write path
+static int bench_gc_pause(u32_t record, int policy) {
+  flash_emu_stats d;
+  spiffs_fs_stats fst;
+  double wall;
+  u8_t buf[256];
+  char name[16];
+  u32_t total, file_size = 16 * 1024, files, records, head = 0, written = 0, r;
+  u32_t stalls = 0, erases = 0;
+  spiffs_file fh;
+
+  if (bench_fs_fresh() != 0) return -1;
+  SPIFFS_gc_policy(&fs, policies[policy].score_f);
+  SPIFFS_info(&fs, &total, NULL);
+  files = total / 2 / file_size;
+  if (files < 2) files = 2;
+  records = total / record * 4;
+  double *lat = malloc(records * sizeof(*lat));
+  if (lat == NULL) return -1;
+
+  sprintf(name, "log%u", head);
+  fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+  for (r = 0; r < records; r++) {
+    if (fh < 0) goto err_fs;
+    memset(buf, r, record);
+    begin();
+    if (SPIFFS_write(&fs, fh, buf, record) != (s32_t)record ||
+        SPIFFS_fflush(&fs, fh) < SPIFFS_OK) {
+      goto err_fs;
+    }
+    end(&d, &wall);
+    lat[r] = d.busy_us;
+    erases += d.erases;
+    if (d.erases) stalls++;
+    written += record;
+    if (written >= file_size) {
+      SPIFFS_close(&fs, fh);
+      if (++head >= files) {
+        sprintf(name, "log%u", head - files);
+        if (SPIFFS_remove(&fs, name) != SPIFFS_OK) goto err_fs;
+      }
+      sprintf(name, "log%u", head);
+      fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+      written = 0;
+    }
+  }
+  SPIFFS_close(&fs, fh);
+  SPIFFS_fs_stats(&fs, &fst);
+
+  qsort(lat, records, sizeof(lat[0]), cmp_double);
+  emit_begin("gc_pause");
+  emit_s("policy", policies[policy].what);
+  emit_u("record", record);
+  emit_u("records", records);
+  emit_f("p50_us", lat[(records - 1) * 500 / 1000]);
+  emit_f("p90_us", lat[(records - 1) * 900 / 1000]);
+  emit_f("p99_us", lat[(records - 1) * 990 / 1000]);
+  emit_f("p999_us", lat[(records - 1) * 999 / 1000]);
+  emit_f("max_us", lat[records - 1]);
+  emit_u("stalls", stalls);
+  emit_u("erases", erases);
+  emit_u("gc_runs", fst.gc_runs);
+  emit_end();
+  free(lat);
+  return 0;
+err_fs:
+  free(lat);
+  return fail("gc_pause");
+}
+
+static int write_version(u32_t f, u32_t version, u32_t size) {
+  u8_t buf[PAGE_SIZE];
+  char name[16];
+  u32_t o, i;
+  sprintf(name, "f%u", f);
+  spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fh < 0) return -1;
+  for (o = 0; o < size; o += sizeof(buf)) {
+    u32_t len = MIN(sizeof(buf), size - o);
+    for (i = 0; i < len; i++) buf[i] = pattern(f + version, o + i);
+    if (SPIFFS_write(&fs, fh, buf, len) != (s32_t)len) {
+      SPIFFS_close(&fs, fh);
+      return -1;
+    }
+  }
+  SPIFFS_close(&fs, fh);
+  return 0;
+}
+
+// write amplification of rewriting files at random, with the file system
+// holding fill percent of live data
+static int bench_write_amp(u32_t fill, int policy) {
+  flash_emu_stats d;
+  spiffs_fs_stats before_fs, fst;
+  double wall;
+  u8_t buf[PAGE_SIZE];
+  u32_t total, size = 4 * 1024, files, rewrites, f, n, o;
+  char name[16];
+
+  if (bench_fs_fresh() != 0) return -1;
+  SPIFFS_gc_policy(&fs, policies[policy].score_f);
+  SPIFFS_info(&fs, &total, NULL);
+  // a file takes its data pages and an index header page
+  u32_t file_pages = (size + SPIFFS_DATA_PAGE_SIZE(&fs) - 1) / SPIFFS_DATA_PAGE_SIZE(&fs) + 1;
+  files = total / SPIFFS_DATA_PAGE_SIZE(&fs) * fill / 100 / file_pages;
+  rewrites = total / size * 4;
+  u32_t *version = calloc(files, sizeof(*version));
+  if (version == NULL) return -1;
+
+  for (f = 0; f < files; f++) {
+    if (write_version(f, 0, size) != 0) goto err_fs;
+  }
+  SPIFFS_fs_stats(&fs, &before_fs);
+  begin();
+  for (n = 0; n < rewrites; n++) {
+    f = random32() % files;
+    if (write_version(f, ++version[f], size) != 0) goto err_fs;
+  }
+  end(&d, &wall);
+  SPIFFS_fs_stats(&fs, &fst);
+
+  for (f = 0; f < files; f++) {
+    sprintf(name, "f%u", f);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0) goto err_fs;
+    for (o = 0; o < size; o++) {
+      if (o % sizeof(buf) == 0 && SPIFFS_read(&fs, fh, buf, MIN(sizeof(buf), size - o)) < 0) {
+        goto err_fs;
+      }
+      if (buf[o % sizeof(buf)] != pattern(f + version[f], o)) {
+        fprintf(stderr, "%s: byte %u differs\n", name, o);
+        free(version);
+        return -1;
+      }
+    }
+    SPIFFS_close(&fs, fh);
+  }
+
+  double user = (double)rewrites * size;
+  emit_begin("write_amp");
+  emit_s("policy", policies[policy].what);
+  emit_u("fill", fill);
+  emit_u("files", files);
+  emit_u("file_bytes", size);
+  emit_u("rewrites", rewrites);
+  emit_f("wa", d.write_bytes / user);
+  emit_f("gc_moved_pages", (double)(fst.gc_moved_pages - before_fs.gc_moved_pages) * SPIFFS_DATA_PAGE_SIZE(&fs) / user);
+  emit_f("erases_mb", d.erases / (user / (1024 * 1024)));
+  emit_u("gc_runs", fst.gc_runs - before_fs.gc_runs);
+  emit_flash(&d, wall, 0);
+  emit_end();
+  free(version);
+  return 0;
+err_fs:
+  free(version);
+  return fail("write_amp");
+}
+
+int main(int argc, char **argv) {
+  static const u32_t chunks[] = { 16, 64, 256, 1024, 4096 };
+  static const u32_t counts[] = { 8, 32, 128, 256 };
+  static const u32_t fills[] = { 25, 40, 55 };
+  unsigned i, p;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:s:n:t")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 's': file_kb = atoi(optarg); break;
+    case 'n': ops = atoi(optarg); break;
+    case 't': delays = 1; break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-s file_kb] [-n ops] [-t]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (file_kb * 1024 < CHUNK_MAX || ops == 0) {
+    fprintf(stderr, "file_kb must be at least %u, ops above 0\n", CHUNK_MAX / 1024);
+    return 2;
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+  flash_emu_set_delay(delays);
+
+  emit_begin("config");
+  emit_u("fs_kb", fs_kb);
+  emit_u("block", BENCH_FS_BLOCK_SIZE);
+  emit_u("page", PAGE_SIZE);
+  emit_u("cache_pages", 8);
+  emit_u("file_kb", file_kb);
+  emit_u("ops", ops);
+  emit_u("delays", delays);
+  emit_end();
+
+  for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+    if (bench_io(chunks[i]) != 0) return 1;
+  }
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (bench_open_stat(counts[i]) != 0) return 1;
+  }
+  for (p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+    if (bench_gc_pause(48, p) != 0 || bench_gc_pause(200, p) != 0) return 1;
+    for (i = 0; i < sizeof(fills) / sizeof(fills[0]); i++) {
+      if (bench_write_amp(fills[i], p) != 0) return 1;
+    }
+  }
+
+  bench_fs_free();
+  return 0;
+}
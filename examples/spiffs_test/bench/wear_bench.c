@@ -0,0 +1,245 @@
+/*
+ * wear_bench.c
+ *
+ * Write amplification and block wear of garbage collection policies over
+ * months of an MQTT client queueing messages on RAM-backed flash while it is
+ * offline.  A few configuration files are written once.  While the client is
+ * offline, messages of random size are appended to a queue of files and
+ * flushed one by one; the oldest file is dropped when the queue is full.
+ * On reconnecting the queue is read back and removed, and the session file
+ * is rewritten.  The same simulated days are run on a freshly formatted file
+ * system with each policy given to SPIFFS_gc_policy:
+ *
+ *   default  spiffs_gc_score_default
+ *   greedy   spiffs_gc_score_greedy
+ *   wear     spiffs_gc_score_wear
+ *   benefit  a cost benefit score defined here, erase age times the pages
+ *            to gain over the pages to move
+ *
+ *   wear_bench [-f fs_kb] [-d days] [-i interval_s] [-o offline_min]
+ *              [-u online_min] [-q files] [-k file_kb]
+ *
+ * Per policy it prints the flash bytes written per byte queued, the pages
+ * moved by the garbage collector per page queued, the erases, and the most,
+ * fewest and mean erases of a block, counted by the emulated flash.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+#include "bench_fs.h"
+#include "flash_emu.h"
+
+#define PAGE_SIZE   256
+#define MSG_MIN     16
+#define MSG_MAX     256
+
+static u32_t fs_kb = 128, days = 90, interval = 30, offline_min = 60, online_min = 90;
+static u32_t files = 8, file_kb = 8;
+static u32_t rnd;
+
+// erase age times the pages gained over the pages moved, after the cost
+// benefit policy of log-structured file systems
+static s32_t score_benefit(const spiffs_block_stats *b, u8_t fs_crammed) {
+  s32_t age = fs_crammed ? 1 : b->erase_age + 1;
+  return age * (b->pages - b->used_pages) * 16 / (b->used_pages + 1);
+}
+
+static const struct {
+  const char *what;
+  spiffs_gc_score_f score_f;
+} policies[] = {
+  { "default", spiffs_gc_score_default },
+  { "greedy", spiffs_gc_score_greedy },
+  { "wear", spiffs_gc_score_wear },
+  { "benefit", score_benefit },
+};
+
+// xorshift, the same sequence for every policy
+static u32_t random32(void) {
+  rnd ^= rnd << 13;
+  rnd ^= rnd >> 17;
+  rnd ^= rnd << 5;
+  return rnd;
+}
+
+// uniformly distributed from 1 to 2 * mean - 1
+static u32_t random_around(u32_t mean) {
+  return mean <= 1 ? 1 : 1 + random32() % (2 * mean - 1);
+}
+
+static int write_file(const char *name, u32_t size) {
+  u8_t buf[MSG_MAX];
+  spiffs_file fh = SPIFFS_open(&fs, (char *)name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR, 0);
+  if (fh < 0) goto fail;
+  while (size > 0) {
+    u32_t len = size < sizeof(buf) ? size : sizeof(buf);
+    memset(buf, size, len);
+    if (SPIFFS_write(&fs, fh, buf, len) != (s32_t)len) goto fail;
+    size -= len;
+  }
+  SPIFFS_close(&fs, fh);
+  return 0;
+fail:
+  fprintf(stderr, "%s: write failed: %i\n", name, SPIFFS_errno(&fs));
+  return -1;
+}
+
+// reads back and removes queue files tail to head
+static int drain(u32_t tail, u32_t head) {
+  u8_t buf[MSG_MAX];
+  char name[16];
+  for (; tail <= head; tail++) {
+    sprintf(name, "q%u", tail);
+    spiffs_file fh = SPIFFS_open(&fs, name, SPIFFS_RDONLY, 0);
+    if (fh < 0) continue;
+    while (SPIFFS_read(&fs, fh, buf, sizeof(buf)) > 0);
+    SPIFFS_close(&fs, fh);
+    if (SPIFFS_remove(&fs, name) != SPIFFS_OK) {
+      fprintf(stderr, "%s: remove failed: %i\n", name, SPIFFS_errno(&fs));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int run(const char *what, spiffs_gc_score_f score_f) {
+  flash_emu_stats st;
+  spiffs_fs_stats fst;
+  u8_t buf[MSG_MAX];
+  char name[16];
+  u32_t t = 0, end = days * 24 * 3600;
+  u32_t tail = 0, head = 0, written = 0, msgs = 0, bix;
+  u32_t max = 0, min = (u32_t)-1, *base;
+  double queued = 0;
+  spiffs_file fh = -1;
+
+  rnd = 2463534242u;
+  if (bench_fs_fresh() != 0) return -1;
+  // erases of each block before the run, the file system counts from mount
+  base = malloc(fs.block_count * sizeof(*base));
+  if (base == NULL) return -1;
+  for (bix = 0; bix < fs.block_count; bix++) {
+    base[bix] = flash_emu_erase_count(bix * BENCH_FS_BLOCK_SIZE);
+  }
+  SPIFFS_gc_policy(&fs, score_f);
+  if (write_file("config.json", 1536) != 0 || write_file("ca.pem", 1400) != 0 ||
+      write_file("client.pem", 1200) != 0 || write_file("session", 64) != 0) {
+    return -1;
+  }
+  flash_emu_reset_stats();
+
+  while (t < end) {
+    // offline, queueing messages
+    u32_t offline_end = t + random_around(offline_min) * 60;
+    for (t += random_around(interval); t < offline_end; t += random_around(interval)) {
+      u32_t len = MSG_MIN + random32() % (MSG_MAX - MSG_MIN + 1);
+      if (fh < 0) {
+        sprintf(name, "q%u", head);
+        fh = SPIFFS_open(&fs, name, SPIFFS_CREAT | SPIFFS_TRUNC | SPIFFS_RDWR | SPIFFS_APPEND, 0);
+        if (fh < 0) {
+          fprintf(stderr, "%s: open failed: %i\n", name, SPIFFS_errno(&fs));
+          return -1;
+        }
+      }
+      memset(buf, msgs, len);
+      if (SPIFFS_write(&fs, fh, buf, len) != (s32_t)len || SPIFFS_fflush(&fs, fh) < 0) {
+        fprintf(stderr, "%s: write failed: %i\n", name, SPIFFS_errno(&fs));
+        return -1;
+      }
+      queued += len;
+      written += len;
+      msgs++;
+      if (written >= file_kb * 1024) {
+        SPIFFS_close(&fs, fh);
+        fh = -1;
+        written = 0;
+        if (++head - tail >= files) {
+          // queue full, the oldest messages are dropped
+          if (drain(tail, tail) != 0) return -1;
+          tail++;
+        }
+      }
+    }
+
+    // reconnected, the queue is sent and a new session stored
+    if (fh >= 0) {
+      SPIFFS_close(&fs, fh);
+      fh = -1;
+      written = 0;
+      head++;
+    }
+    if (drain(tail, head) != 0 || write_file("session", 64) != 0) return -1;
+    tail = head;
+    t = offline_end + random_around(online_min) * 60;
+  }
+
+  flash_emu_get_stats(&st);
+  SPIFFS_fs_stats(&fs, &fst);
+  for (bix = 0; bix < fs.block_count; bix++) {
+    u32_t n = flash_emu_erase_count(bix * BENCH_FS_BLOCK_SIZE) - base[bix];
+    max = n > max ? n : max;
+    min = n < min ? n : min;
+  }
+  printf("%-8s %7u %7.2f %7.3f %7u %6u %6u %7.1f\n", what, msgs,
+      st.write_bytes / queued, fst.gc_moved_pages * SPIFFS_DATA_PAGE_SIZE(&fs) / queued,
+      st.erases, max, min, (double)st.erases / fs.block_count);
+  free(base);
+  if ((SPIFFS_GC_STATS && fst.erases != st.erases) ||
+      (fs.block_count <= SPIFFS_WEAR_STATS_BLOCKS && fst.block_erases_max != max)) {
+    fprintf(stderr, "fs stats disagree with the flash: %u erases, %u most\n",
+        fst.erases, fst.block_erases_max);
+    return -1;
+  }
+
+  // the configuration must have survived
+  spiffs_stat s;
+  if (SPIFFS_stat(&fs, "config.json", &s) != SPIFFS_OK || s.size != 1536 ||
+      SPIFFS_check(&fs) != SPIFFS_OK) {
+    fprintf(stderr, "file system damaged: %i\n", SPIFFS_errno(&fs));
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  unsigned i;
+  int c;
+
+  while ((c = getopt(argc, argv, "f:d:i:o:u:q:k:")) != -1) {
+    switch (c) {
+    case 'f': fs_kb = atoi(optarg); break;
+    case 'd': days = atoi(optarg); break;
+    case 'i': interval = atoi(optarg); break;
+    case 'o': offline_min = atoi(optarg); break;
+    case 'u': online_min = atoi(optarg); break;
+    case 'q': files = atoi(optarg); break;
+    case 'k': file_kb = atoi(optarg); break;
+    default:
+      fprintf(stderr, "usage: %s [-f fs_kb] [-d days] [-i interval_s] [-o offline_min] "
+          "[-u online_min] [-q files] [-k file_kb]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (days == 0 || files == 0 || file_kb == 0) {
+    fprintf(stderr, "days, files and file_kb must be above 0\n");
+    return 2;
+  }
+
+  if (bench_fs_init(fs_kb * 1024, PAGE_SIZE) != 0) return 1;
+
+  printf("%u KB fs, %u days, a message every %u s while offline, offline %u min, "
+      "online %u min, queue of %u files of %u KB\n",
+      fs_kb, days, interval, offline_min, online_min, files, file_kb);
+  printf("                  flash/  moved/           block erases\n");
+  printf("policy      msgs  queued  queued  erases   most fewest    mean\n");
+  for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    if (run(policies[i].what, policies[i].score_f) != 0) return 1;
+  }
+
+  bench_fs_free();
+  return 0;
+}
@@ -82,8 +82,7 @@ TEST(lu_check1) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
   SPIFFS_check(FS);
 
@@ -118,8 +117,7 @@ TEST(page_cons1) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   SPIFFS_check(FS);
@@ -163,8 +161,7 @@ TEST(page_cons2) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   SPIFFS_check(FS);
@@ -204,8 +201,7 @@ TEST(page_cons3) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   SPIFFS_check(FS);
@@ -245,8 +241,7 @@ TEST(page_cons_final) {
 
   // delete all cache
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   SPIFFS_check(FS);
@@ -287,8 +282,7 @@ TEST(index_cons1) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
   SPIFFS_check(FS);
 
@@ -327,8 +321,7 @@ TEST(index_cons2) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
   SPIFFS_check(FS);
 
@@ -368,8 +361,7 @@ TEST(index_cons3) {
   area_write(addr, (u8_t*)&obj_id, sizeof(spiffs_obj_id));
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
   SPIFFS_check(FS);
 
@@ -406,8 +398,7 @@ TEST(index_cons4) {
   area_write(addr, (u8_t*)&flags, 1);
 
 #if SPIFFS_CACHE
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
   SPIFFS_check(FS);
 
@@ -820,8 +820,7 @@ TEST(bad_index_1) {
 
 #if SPIFFS_CACHE
   // delete all cache
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   res = read_and_verify("file");
@@ -857,8 +856,7 @@ TEST(bad_index_2) {
 
 #if SPIFFS_CACHE
   // delete all cache
-  spiffs_cache *cache = spiffs_get_cache(FS);
-  cache->cpage_use_map = 0;
+  spiffs_cache_init(FS);
 #endif
 
   res = read_and_verify("file");
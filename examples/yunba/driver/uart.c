@@ -56,7 +56,7 @@ uart1_write_char(char c)
     }
 }
 
-LOCAL void
+void
 uart0_write_char(char c)
 {
     if (c == '\n') {
@@ -0,0 +1,38 @@
+/*
+ * heap_trace.h
+ *
+ * Records every heap operation of the running device, one line each, in the
+ * format test/heap_bench replays:
+ *   m <block> <size> <caller> <us>
+ *   f <block> <caller> <us>
+ *   r <block> <newblock> <size> <caller> <us>
+ * Blocks and callers are hex addresses, a failed allocation has block 0.  The
+ * time is system_get_time().  Needs a heap_4 built with configUSE_HEAP_TRACE.
+ */
+
+#ifndef HEAP_TRACE_H_
+#define HEAP_TRACE_H_
+
+#include "c_types.h"
+
+#ifndef HEAP_TRACE_BUF_SIZE
+/* records wait here for the writer task, must be a power of two */
+#define HEAP_TRACE_BUF_SIZE 2048
+#endif
+
+#ifndef HEAP_TRACE_FLUSH_MS
+/* how often the writer task empties the buffer */
+#define HEAP_TRACE_FLUSH_MS 100
+#endif
+
+/* start recording to a spiffs file, or out of UART0 if path is NULL.
+   spiffs must be mounted for a file.  0 on success. */
+int8_t heap_trace_start(const char *path);
+
+/* stop recording, the writer task flushes what is left and exits */
+void heap_trace_stop(void);
+
+/* records lost because the buffer was full */
+uint32_t heap_trace_dropped(void);
+
+#endif /* HEAP_TRACE_H_ */
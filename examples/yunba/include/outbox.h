@@ -0,0 +1,46 @@
+/*
+ * outbox.h
+ *
+ * Store-and-forward queue for publishes made while the broker is unreachable.
+ * Messages are appended to segment files on SPIFFS so they survive a reboot,
+ * and are replayed as QoS1 publishes once the client is connected again.
+ */
+
+#ifndef OUTBOX_H_
+#define OUTBOX_H_
+
+#include "MQTTClient.h"
+
+#ifndef OUTBOX_SEGMENT_SIZE
+/* at most two segments are kept, the older one is dropped when the newer fills */
+#define OUTBOX_SEGMENT_SIZE (8 * 1024)
+#endif
+
+#ifndef OUTBOX_BATCH
+/* publishes sent per drain, must not exceed MAX_INFLIGHT_MESSAGES */
+#define OUTBOX_BATCH 4
+#endif
+
+#ifndef OUTBOX_DRAIN_INTERVAL_MS
+/* minimum time between two batches */
+#define OUTBOX_DRAIN_INTERVAL_MS 500
+#endif
+
+#if OUTBOX_BATCH > MAX_INFLIGHT_MESSAGES
+#error "OUTBOX_BATCH must not exceed MAX_INFLIGHT_MESSAGES"
+#endif
+
+/* load the drain position, spiffs must be mounted.  0 on success. */
+int8_t outbox_init(void);
+
+/* append a message, evicting the oldest segment if the outbox is full.  0 on success. */
+int8_t outbox_put(const char *topic, const void *payload, uint16_t payload_len);
+
+/* true if every stored message has been acknowledged */
+bool outbox_empty(void);
+
+/* call periodically: once the previous batch is acknowledged, and the rate
+ * limit allows, publish the next batch.  Returns the number of messages sent. */
+int outbox_drain(MQTTClient *c);
+
+#endif /* OUTBOX_H_ */
@@ -4,5 +4,25 @@
 
 #define RESTORE_KEEP_TIMER 0
 
+/* spiffs partition for the offline outbox, behind the two OTA slots of the
+ * flash size map (see setup_spiffs): at 1MB with 512KB slots, at 2MB with
+ * 1024KB slots.  Maps without room behind the slots do not mount it. */
+#define SPIFFS_FLASH_ADDR_512   (1024*1024)
+#define SPIFFS_FLASH_ADDR_1024  (2048*1024)
+#define SPIFFS_FLASH_SIZE   (128*1024)
+#define SPIFFS_SECTOR_SIZE  (4*1024)
+#define SPIFFS_LOG_PAGE     (128)
+#define SPIFFS_FD_BUF_SIZE  (32*4)
+/* four cache pages and the window of SPIFFS_READ_AHEAD_PAGES (4) pages the
+ * outbox is read through when it drains */
+#define SPIFFS_READ_AHEAD_SIZE (4*SPIFFS_LOG_PAGE)
+#define SPIFFS_CACHE_BUF_SIZE ((SPIFFS_LOG_PAGE + 32)*4 + SPIFFS_READ_AHEAD_SIZE)
+
+/* record every heap operation for test/heap_bench, see heap_trace.h: either
+ * out of UART0 from boot (move printf to UART1 with UART_SetPrintPort so the
+ * two do not mix), or to a spiffs file once it is mounted */
+//#define HEAP_TRACE_UART
+//#define HEAP_TRACE_FILE "heap.trc"
+
 #endif
 
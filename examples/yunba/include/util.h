@@ -25,4 +25,6 @@ void user_parm_free(USER_PARM_t *user_parm);
 void setup_wifi_monitor(os_timer_func_t * fn, void *arg, uint32_t msec);
 void wifi_monitor_close(void);
 
+int8_t setup_spiffs(void);
+
 #endif /* UTIL_H_ */
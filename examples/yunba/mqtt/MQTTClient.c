@@ -47,15 +47,32 @@ static void NewMessageData(MessageData* md, MQTTString* aTopicName,
 	md->message = aMessage;
 }
 
+static int isInflightId(MQTTClient *c, uint64_t id) {
+	int i;
+
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i)
+		if (c->inflight[i].state != 0 && c->inflight[i].id == id)
+			return 1;
+	return 0;
+}
+
+/* Yunba ids count up from a random seed taken once at init; standard MQTT ids
+ * cycle through 1..MAX_PACKET_ID, skipping any still waiting for an ack */
 static uint64_t getNextPacketId(MQTTClient *c) {
-	c->next_packetid = generate_uuid();
+	if (c->wide_packetid)
+		return ++c->next_packetid;
+	do
+		c->next_packetid =
+				(c->next_packetid >= MAX_PACKET_ID) ? 1 : c->next_packetid + 1;
+	while (isInflightId(c, c->next_packetid));
 	return c->next_packetid;
 }
 
-static int sendPacket(MQTTClient* c, int length, Timer* timer) {
+static int sendBuffer(MQTTClient* c, unsigned char* buf, int length,
+		Timer* timer) {
 	int rc = FAILURE, sent = 0;
 	while (sent < length && TimerIsExpired(timer) == pdFALSE) {
-		rc = c->ipstack->mqttwrite(c->ipstack, &c->buf[sent], length,
+		rc = c->ipstack->mqttwrite(c->ipstack, &buf[sent], length - sent,
 				TimerLeftMS(timer));
 		if (rc < 0)  // there was an error writing the data
 			break;
@@ -71,14 +88,106 @@ static int sendPacket(MQTTClient* c, int length, Timer* timer) {
 	return rc;
 }
 
+static int sendPacket(MQTTClient* c, int length, Timer* timer) {
+	return sendBuffer(c, c->buf, length, timer);
+}
+
+static struct InflightMessage* getFreeInflight(MQTTClient* c) {
+	int i;
+
+	if (c->inflight_count >= MAX_INFLIGHT_MESSAGES)
+		return NULL;
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i)
+		if (c->inflight[i].state == 0)
+			return &c->inflight[i];
+	return NULL;
+}
+
+static struct InflightMessage* findInflight(MQTTClient* c, uint64_t id,
+		unsigned char state) {
+	int i;
+
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i)
+		if (c->inflight[i].state == state && c->inflight[i].id == id)
+			return &c->inflight[i];
+	return NULL;
+}
+
+static void completeInflight(MQTTClient* c, struct InflightMessage* m, int rc) {
+	publishCompleteHandler cb = m->cb;
+	void *context = m->context;
+	uint64_t id = m->id;
+
+	if (m->packet != NULL)
+		free(m->packet);
+	m->packet = NULL;
+	m->state = 0;
+	c->inflight_count--;
+	if (cb != NULL)
+		cb(id, rc, context);
+}
+
+/* resend whatever has waited longer than MQTT_RETRY_INTERVAL_MS for its ack */
+static void retryInflight(MQTTClient* c) {
+	int i;
+
+	if (c->inflight_count == 0 || !c->isconnected)
+		return;
+
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i) {
+		struct InflightMessage* m = &c->inflight[i];
+		Timer timer;
+		int len = 0, rc = SUCCESS;
+
+		if (m->state == 0 || TimerIsExpired(&m->retry_timer) == pdFALSE)
+			continue;
+		if (m->retries++ >= MQTT_MAX_RETRIES) {
+			printf("publish %d dropped after %d retries\n", (int) m->id,
+					MQTT_MAX_RETRIES);
+			completeInflight(c, m, FAILURE);
+			continue;
+		}
+
+		TimerInit(&timer);
+		TimerCountdownMS(&timer, c->command_timeout_ms);
+		if (m->state == PUBLISH && m->packet != NULL) {
+			MQTTHeader header = { 0 };
+			header.byte = m->packet[0];
+			header.bits.dup = 1;
+			m->packet[0] = header.byte;
+			rc = sendBuffer(c, m->packet, m->len, &timer);
+			if (rc == SUCCESS && m->payload != NULL)
+				rc = sendBuffer(c, (unsigned char*) m->payload, m->payloadlen,
+						&timer);
+		} else if (m->state == PUBREL
+				&& (len = MQTTSerialize_ack(c->buf, c->buf_size, PUBREL, 1, m->id))
+						> 0)
+			rc = sendPacket(c, len, &timer);
+		if (rc != SUCCESS) {
+			/* part of the packet may be on the stream, as in publish(); the
+			 * rest is resent once connected again */
+			c->isconnected = 0;
+			mqttclient_disconnect_internal(c);
+			return;
+		}
+		TimerCountdownMS(&m->retry_timer, MQTT_RETRY_INTERVAL_MS);
+	}
+}
+
 void ICACHE_FLASH_ATTR MQTTClientInit(MQTTClient* c, Network* network,
 		unsigned int command_timeout_ms, unsigned char* sendbuf,
 		size_t sendbuf_size, unsigned char* readbuf, size_t readbuf_size) {
 	int i;
 	c->ipstack = network;
 
-	for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-		c->messageHandlers[i].topicFilter = 0;
+	MQTTTopicTrie_init(&c->messageHandlers);
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i) {
+		c->inflight[i].state = 0;
+		c->inflight[i].packet = NULL;
+	}
+	c->inflight_count = 0;
+	for (i = 0; i < MAX_PENDING_SUBSCRIPTIONS; ++i)
+		c->pending_subs[i].topicFilter = NULL;
 	c->command_timeout_ms = command_timeout_ms;
 	c->buf = sendbuf;
 	c->buf_size = sendbuf_size;
@@ -87,7 +196,8 @@ void ICACHE_FLASH_ATTR MQTTClientInit(MQTTClient* c, Network* network,
 	c->isconnected = 0;
 	c->ping_outstanding = 0;
 	c->defaultMessageHandler = NULL;
-	c->next_packetid = 1;
+	c->next_packetid = generate_uuid();
+	c->wide_packetid = 1;
 	c->fail_conn_count = 0;
 	c->cl = NULL;
 	TimerInit(&c->ping_timer);
@@ -146,64 +256,42 @@ static int readPacket(MQTTClient* c, Timer* timer) {
 	exit: return rc;
 }
 
-// assume topic filter and name is in correct format
-// # can only be at end
-// + and # can only be next to separator
-static char isTopicMatched(char* topicFilter, MQTTString* topicName) {
-	char* curf = topicFilter;
-	char* curn = topicName->lenstring.data;
-	char* curn_end = curn + topicName->lenstring.len;
+/* the SUBACK of a subscribe came in, a filter the broker refused must not
+ * keep its handler.  readChar sign extends the 0x80 failure code. */
+static void ackSubscription(MQTTClient* c, uint64_t id, int grantedQoS) {
+	int i;
 
-	os_printf("topic matching \n");
-	while (*curf && curn < curn_end) {
-		if (*curn == '/' && *curf != '/')
-			break;
-		if (*curf != '+' && *curf != '#' && *curf != *curn)
-			break;
-		if (*curf == '+') { // skip until we meet the next separator, or end of string
-			char* nextpos = curn + 1;
-			while (nextpos < curn_end && *nextpos != '/')
-				nextpos = ++curn + 1;
-		} else if (*curf == '#')
-			curn = curn_end - 1;    // skip until end of string
-		curf++;
-		curn++;
-	};
-	return (curn == curn_end) && (*curf == '\0');
+	for (i = 0; i < MAX_PENDING_SUBSCRIPTIONS; ++i) {
+		struct PendingSubscription* s = &c->pending_subs[i];
+
+		if (s->topicFilter == NULL || s->id != id)
+			continue;
+		if ((grantedQoS & 0xff) == 0x80
+				&& MQTTTopicTrie_remove(&c->messageHandlers, s->topicFilter) == 0)
+			os_printf("subscribe to %s refused\n", s->topicFilter);
+		s->topicFilter = NULL;
+	}
+}
+
+static void deliverToHandler(MQTTTopicHandler fp, void* md) {
+	fp((MessageData*) md);
 }
 
 int deliverMessage(MQTTClient* c, MQTTString* topicName, MQTTMessage* message) {
-	int i;
 	int rc = FAILURE;
+	MessageData md;
+
+	NewMessageData(&md, topicName, message);
 
 	// we have to find the right message handler - indexed by topic
-//    for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-//    {
-//        if (c->messageHandlers[i].topicFilter != 0 && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
-//                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)))
-//        {
-//            if (c->messageHandlers[i].fp != NULL)
-//            {
-//                MessageData md;
-//                NewMessageData(&md, topicName, message);
-//                c->messageHandlers[i].fp(&md);
-//                rc = SUCCESS;
-//            }
-//        }
-//    }
-
-//    if (rc == FAILURE && c->defaultMessageHandler != NULL)
-//    {
-//        MessageData md;
-//        NewMessageData(&md, topicName, message);
-//        c->defaultMessageHandler(&md);
-//        rc = SUCCESS;
-//    }
+	if (MQTTTopicTrie_match(&c->messageHandlers, topicName->lenstring.data,
+			topicName->lenstring.len, deliverToHandler, &md) > 0)
+		rc = SUCCESS;
 
-	MessageData md;
-	NewMessageData(&md, topicName, message);
-	c->messageHandlers[0].fp(&md);
-	rc = SUCCESS;
+	if (rc == FAILURE && c->defaultMessageHandler != NULL) {
+		c->defaultMessageHandler(&md);
+		rc = SUCCESS;
+	}
 
 	return rc;
 }
@@ -274,8 +362,12 @@ cycle(MQTTClient* c, Timer* timer) {
 		if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf,
 				c->readbuf_size) != 1)
 			rc = FAILURE;
-		else
+		else {
+			struct InflightMessage* m = findInflight(c, mypacketid, PUBLISH);
+			if (m != NULL && m->qos == QOS1)
+				completeInflight(c, m, SUCCESS);
 			rc = SUCCESS;
+		}
 	}
 		break;
 	case SUBACK: {
@@ -283,28 +375,11 @@ cycle(MQTTClient* c, Timer* timer) {
 		uint64_t mypacketid;
 
 		if (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS,
-				c->readbuf, c->readbuf_size) == 1)
+				c->readbuf, c->readbuf_size) == 1) {
 			rc = grantedQoS; // 0, 1, 2 or 0x80
-		os_printf("setup subscribe %d\n", rc);
-#if 0
-		os_printf("setup subscribe1 rc:%d\n", rc);
-		if (rc != 0x80)
-		{
-			int i;
-			for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-			{
-				if (c->messageHandlers[i].topicFilter == 0)
-				{
-					c->messageHandlers[i].topicFilter = gTopic;
-					c->messageHandlers[i].fp = fMessageArive;
-					rc = 0;
-					break;
-				}
-			}
-			os_printf("setup subscribe1 ok\n");
+			ackSubscription(c, mypacketid, grantedQoS);
 		}
-#endif
-
+		os_printf("setup subscribe %d\n", rc);
 	}
 		break;
 	case PUBLISH: {
@@ -331,8 +406,8 @@ cycle(MQTTClient* c, Timer* timer) {
 				rc = sendPacket(c, len, timer);
 			}
 			//      printf("send pack rc: %d\n", rc);
-			deliverMessage(c, &topicName, &msg);
 		}
+		deliverMessage(c, &topicName, &msg);
 		break;
 	}
 	case PUBREC: {
@@ -349,6 +424,18 @@ cycle(MQTTClient* c, Timer* timer) {
 		if (rc == FAILURE)
 			goto exit;
 		// there was a problem
+		{
+			/* the stored PUBLISH is no longer needed, from now on PUBREL is what gets resent */
+			struct InflightMessage* m = findInflight(c, mypacketid, PUBLISH);
+			if (m != NULL) {
+				if (m->packet != NULL)
+					free(m->packet);
+				m->packet = NULL;
+				m->state = PUBREL;
+				m->retries = 0;
+				TimerCountdownMS(&m->retry_timer, MQTT_RETRY_INTERVAL_MS);
+			}
+		}
 		break;
 	}
 
@@ -369,7 +456,18 @@ cycle(MQTTClient* c, Timer* timer) {
 		break;
 	}
 
-	case PUBCOMP:
+	case PUBCOMP: {
+		uint64_t mypacketid;
+		unsigned char dup, type;
+		if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf,
+				c->readbuf_size) != 1)
+			rc = FAILURE;
+		else {
+			struct InflightMessage* m = findInflight(c, mypacketid, PUBREL);
+			if (m != NULL)
+				completeInflight(c, m, SUCCESS);
+		}
+	}
 		break;
 	case PINGRESP:
 		printf("ping response\n");
@@ -390,6 +488,7 @@ cycle(MQTTClient* c, Timer* timer) {
 	}
 		break;
 	}
+	retryInflight(c);
 	keepalive(c);
 	exit: if (rc == SUCCESS)
 		rc = packet_type;
@@ -414,6 +513,28 @@ int MQTTYield(MQTTClient* c, int timeout_ms) {
 	return rc;
 }
 
+#if defined(MQTT_TASK_SELECT)
+static uint32_t timerLeft(Timer* timer) {
+	return (TimerIsExpired(timer) == pdTRUE) ? 0 : TimerLeftMS(timer);
+}
+
+/* how long the MQTT task may sleep before a ping or a resend is due.
+ * Capped at MQTT_RETRY_INTERVAL_MS so that publishes added by other tasks
+ * while we sleep are still resent on time. */
+static uint32_t nextDeadlineMS(MQTTClient* c) {
+	uint32_t left = MQTT_RETRY_INTERVAL_MS, t;
+	int i;
+
+	if (c->keepAliveInterval > 0 && (t = timerLeft(&c->ping_timer)) < left)
+		left = t;
+	for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i)
+		if (c->inflight[i].state != 0
+				&& (t = timerLeft(&c->inflight[i].retry_timer)) < left)
+			left = t;
+	return left;
+}
+#endif
+
 void ICACHE_FLASH_ATTR MQTTRun(void* parm) {
 	Timer timer;
 	MQTTClient* c = (MQTTClient*) parm;
@@ -421,6 +542,32 @@ void ICACHE_FLASH_ATTR MQTTRun(void* parm) {
 	TimerInit(&timer);
 
 	while (1) {
+#if defined(MQTT_TASK_SELECT)
+		/* sleep in select without holding the mutex, so other tasks can
+		 * publish directly; wake for incoming data or the next deadline */
+		uint32_t wait_ms;
+		int rc;
+
+		MutexLock(&c->mutex);
+		wait_ms = nextDeadlineMS(c);
+		MutexUnlock(&c->mutex);
+
+		rc = c->ipstack->mqttwait(c->ipstack, wait_ms);
+
+		MutexLock(&c->mutex);
+		/* another task may have consumed the data while we were unlocked */
+		if (rc > 0 && c->ipstack->mqttwait(c->ipstack, 0) > 0) {
+			TimerCountdownMS(&timer, 1000);
+			cycle(c, &timer);
+		} else {
+			retryInflight(c);
+			keepalive(c);
+		}
+		MutexUnlock(&c->mutex);
+
+		if (rc < 0) /* socket closed or being reconnected, don't spin */
+			vTaskDelay(200 / portTICK_RATE_MS);
+#else
 #if defined(MQTT_TASK)
 		MutexLock(&c->mutex);
 #endif
@@ -430,6 +577,7 @@ void ICACHE_FLASH_ATTR MQTTRun(void* parm) {
 		MutexUnlock(&c->mutex);
 #endif
 		vTaskDelay(200 / portTICK_RATE_MS);
+#endif
 //		 printf("MQTTRun %d word left\n",uxTaskGetStackHighWaterMark(NULL));
 	}
 }
@@ -470,6 +618,7 @@ int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options, bool block) {
 		options = &default_options; /* set default options if none were supplied */
 
 	c->keepAliveInterval = options->keepAliveInterval;
+	c->wide_packetid = (options->MQTTVersion == MQTT_YUNBA_VERSION);
 	TimerCountdown(&c->ping_timer, c->keepAliveInterval);
 	if ((len = MQTTSerialize_connect(c->buf, c->buf_size, options)) <= 0)
 		goto exit;
@@ -491,8 +640,17 @@ int MQTTConnect(MQTTClient* c, MQTTPacket_connectData* options, bool block) {
 			rc = FAILURE;
 	}
 	exit: if (block) {
-		if (rc == SUCCESS)
+		if (rc == SUCCESS) {
+			int i;
 			c->isconnected = 1;
+			/* resend anything still unacknowledged from the previous connection */
+			for (i = 0; i < MAX_INFLIGHT_MESSAGES; ++i)
+				if (c->inflight[i].state != 0)
+					TimerCountdownMS(&c->inflight[i].retry_timer, 0);
+			/* SUBACKs owed by the old connection will not come */
+			for (i = 0; i < MAX_PENDING_SUBSCRIPTIONS; ++i)
+				c->pending_subs[i].topicFilter = NULL;
+		}
 	}
 #endif
 
@@ -509,7 +667,8 @@ int MQTTSubscribe(MQTTClient* c, const char* topicFilter, enum QoS qos,
 		messageHandler messageHandler) {
 	int rc = FAILURE;
 	Timer timer;
-	int len = 0;
+	int len = 0, i;
+	uint64_t id;
 	MQTTString topic = MQTTString_initializer;
 	topic.cstring = (char *) topicFilter;
 
@@ -523,8 +682,9 @@ int MQTTSubscribe(MQTTClient* c, const char* topicFilter, enum QoS qos,
 	TimerInit(&timer);
 	TimerCountdownMS(&timer, c->command_timeout_ms);
 
-	len = MQTTSerialize_subscribe(c->buf, c->buf_size, 0, getNextPacketId(c), 1,
-			&topic, (int*) &qos);
+	id = getNextPacketId(c);
+	len = MQTTSerialize_subscribe(c->buf, c->buf_size, 0, id, 1, &topic,
+			(int*) &qos);
 	if (len <= 0)
 		goto exit;
 
@@ -532,33 +692,24 @@ int MQTTSubscribe(MQTTClient* c, const char* topicFilter, enum QoS qos,
 		goto exit;
 	// there was a problem
 
-#if 0
-	if (waitfor(c, SUBACK, &timer) == SUBACK)      // wait for suback
-	{
-		int count = 0, grantedQoS = -1;
-		uint64_t mypacketid;
-
-		if (MQTTDeserialize_suback(&mypacketid, 1, &count, &grantedQoS, c->readbuf, c->readbuf_size) == 1)
-		rc = grantedQoS; // 0, 1, 2 or 0x80
-
-		if (rc != 0x80)
-		{
-			int i;
-			for (i = 0; i < MAX_MESSAGE_HANDLERS; ++i)
-			{
-				if (c->messageHandlers[i].topicFilter == 0)
-				{
-					c->messageHandlers[i].topicFilter = topicFilter;
-					c->messageHandlers[i].fp = messageHandler;
-					rc = 0;
-					break;
-				}
-			}
-		}
+	/* the SUBACK is handled by cycle(); register the handler now so messages
+	 * arriving right behind it are not missed */
+	if (messageHandler == NULL)
+		goto exit;
+	if (MQTTTopicTrie_insert(&c->messageHandlers, topicFilter, messageHandler)
+			!= 0) {
+		os_printf("no room for handler of %s\n", topicFilter);
+		goto exit;
 	}
-	else
-	rc = FAILURE;
-#endif
+	for (i = 0; i < MAX_PENDING_SUBSCRIPTIONS; ++i)
+		if (c->pending_subs[i].topicFilter == NULL) {
+			c->pending_subs[i].id = id;
+			c->pending_subs[i].topicFilter = topicFilter;
+			break;
+		}
+	if (i == MAX_PENDING_SUBSCRIPTIONS)
+		os_printf("SUBACK of %s not tracked, a refusal keeps its handler\n",
+				topicFilter);
 
 	exit:
 #if defined(MQTT_TASK)
@@ -590,6 +741,8 @@ int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter) {
 		goto exit;
 	// there was a problem
 
+	MQTTTopicTrie_remove(&c->messageHandlers, topicFilter);
+
 	if (waitfor(c, UNSUBACK, &timer) == UNSUBACK) {
 		uint64_t mypacketid;  // should be the same as the packetid above
 		if (MQTTDeserialize_unsuback(&mypacketid, c->readbuf, c->readbuf_size)
@@ -605,12 +758,16 @@ int MQTTUnsubscribe(MQTTClient* c, const char* topicFilter) {
 	return rc;
 }
 
-int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message) {
+/* copy says whether a QoS1/2 payload is copied for the resends or resent
+ * from message->payload */
+static int publish(MQTTClient* c, const char* topicName, MQTTMessage* message,
+		publishCompleteHandler cb, void *context, int copy) {
 	int rc = FAILURE;
 	Timer timer;
 	MQTTString topic = MQTTString_initializer;
 	topic.cstring = (char *) topicName;
-	int len = 0;
+	int len = 0, hdrlen = 0;
+	struct InflightMessage* m = NULL;
 
 #if defined(MQTT_TASK)
 	MutexLock(&c->mutex);
@@ -621,50 +778,95 @@ int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message) {
 	TimerInit(&timer);
 	TimerCountdownMS(&timer, c->command_timeout_ms);
 
-	if (message->qos == QOS1 || message->qos == QOS2)
+	if (message->qos == QOS1 || message->qos == QOS2) {
+		/* window full: process incoming acks until a slot frees up */
+		while ((m = getFreeInflight(c)) == NULL) {
+			if (TimerIsExpired(&timer) || !c->isconnected)
+				goto exit;
+			cycle(c, &timer);
+		}
 		message->id = getNextPacketId(c);
+	}
 
-	len = MQTTSerialize_publish(c->buf, c->buf_size, 0, message->qos,
-			message->retained, message->id, topic,
-			(unsigned char*) message->payload, message->payloadlen);
-	if (len <= 0)
-		goto exit;
-	if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the subscribe packet
-		goto exit;
-	// there was a problem
-#if 0
-	if (message->qos == QOS1)
-	{
-		if (waitfor(c, PUBACK, &timer) == PUBACK)
-		{
-			int64_t mypacketid;
-			unsigned char dup, type;
-			if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
-			rc = FAILURE;
-		}
-		else
-		rc = FAILURE;
+	if (MQTTPacket_len(MQTTSerialize_publishLength(message->qos, topic,
+			message->payloadlen)) <= c->buf_size) {
+		len = MQTTSerialize_publish(c->buf, c->buf_size, 0, message->qos,
+				message->retained, message->id, topic,
+				(unsigned char*) message->payload, message->payloadlen);
+		if (len <= 0)
+			goto exit;
+		hdrlen = len - message->payloadlen;
+	} else {
+		/* too big for c->buf: only the header goes through it, the payload
+		 * is written straight from the caller's memory */
+		hdrlen = MQTTSerialize_publishHeader(c->buf, c->buf_size, 0,
+				message->qos, message->retained, message->id, topic,
+				message->payloadlen);
+		if (hdrlen <= 0)
+			goto exit;
 	}
-	else if (message->qos == QOS2)
-	{
-		if (waitfor(c, PUBCOMP, &timer) == PUBCOMP)
-		{
-			uint64_t mypacketid;
-			unsigned char dup, type;
-			if (MQTTDeserialize_ack(&type, &dup, &mypacketid, c->readbuf, c->readbuf_size) != 1)
-			rc = FAILURE;
+
+	/* what the resends need is taken before sending, a publish that could
+	 * not be resent fails here rather than go out at most once */
+	if (m != NULL) {
+		if ((m->packet = (unsigned char *) malloc(
+				copy ? hdrlen + message->payloadlen : hdrlen)) == NULL)
+			goto exit;
+		memcpy(m->packet, c->buf, hdrlen);
+		if (copy) {
+			memcpy(m->packet + hdrlen, message->payload, message->payloadlen);
+			m->len = hdrlen + message->payloadlen;
+			m->payload = NULL;
+		} else {
+			m->len = hdrlen;
+			m->payload = (const unsigned char*) message->payload;
 		}
-		else
-		rc = FAILURE;
+		m->payloadlen = message->payloadlen;
+	}
+
+	if (len > 0) {
+		if ((rc = sendPacket(c, len, &timer)) != SUCCESS) // send the publish packet
+			goto exit;
+	} else if ((rc = sendPacket(c, hdrlen, &timer)) != SUCCESS
+			|| (rc = sendBuffer(c, (unsigned char*) message->payload,
+					message->payloadlen, &timer)) != SUCCESS) {
+		/* part of a PUBLISH may be on the stream and anything sent after it
+		 * would be read as its payload, the connection has to go */
+		c->isconnected = 0;
+		mqttclient_disconnect_internal(c);
+		goto exit;
+	}
+
+	if (m != NULL) {
+		m->id = message->id;
+		m->qos = message->qos;
+		m->state = PUBLISH;
+		m->retries = 0;
+		m->cb = cb;
+		m->context = context;
+		TimerInit(&m->retry_timer);
+		TimerCountdownMS(&m->retry_timer, MQTT_RETRY_INTERVAL_MS);
+		c->inflight_count++;
+	}
+	exit: if (m != NULL && m->state == 0) { /* not sent, the slot stays free */
+		free(m->packet);
+		m->packet = NULL;
 	}
-#endif
-	exit:
 #if defined(MQTT_TASK)
 	MutexUnlock(&c->mutex);
 #endif
 	return rc;
 }
 
+int MQTTPublishAsync(MQTTClient* c, const char* topicName,
+		MQTTMessage* message, publishCompleteHandler cb, void *context) {
+	return publish(c, topicName, message, cb, context, 0);
+}
+
+int MQTTPublish(MQTTClient* c, const char* topicName, MQTTMessage* message) {
+	return publish(c, topicName, message, NULL, NULL, 1);
+}
+
 int MQTTDisconnect(MQTTClient* c) {
 	int rc = FAILURE;
 	Timer timer;  // we might wait for incomplete incoming publishes to complete
@@ -807,7 +1009,6 @@ int MQTTSetAlias(MQTTClient* c, const char* alias) {
 		M.qos = 1;
 		strcpy(temp, alias);
 		M.payload = temp;
-		M.id = getNextPacketId(c);
 		M.payloadlen = strlen(temp);
 		rc = MQTTPublish(c, ",yali", &M);
 		free(temp);
@@ -825,7 +1026,6 @@ int MQTTPublishToAlias(MQTTClient* c, const char* alias, void *payload,
 		M.qos = 1;
 		sprintf(topic, ",yta/%s", alias);
 		M.payload = payload;
-		M.id = getNextPacketId(c);
 		M.payloadlen = payloadlen;
 		rc = MQTTPublish(c, topic, &M);
 
@@ -892,8 +1092,7 @@ int MQTTSetCallBack(MQTTClient *c, messageHandler cb,
 	c->extmessageHandlers[0].cmd = 1;
 	c->extmessageHandlers[0].cb = ext_cb;
 
-	c->messageHandlers[0].topicFilter = 0;
-	c->messageHandlers[0].fp = cb;
+	c->defaultMessageHandler = cb;
 
 	c->cl = cl;
 #if defined(MQTT_TASK)
@@ -35,7 +35,7 @@ extern "C" {
 
 #include "esp_common.h"
 #include "MQTTPacket.h"
-#include "MQTTFreeRTOS.h"
+#include "MQTTTopicTrie.h"
 #include "json/cJSON.h"
 //#include "stdio.h"
 
@@ -46,12 +46,38 @@ extern "C" {
 #define xstr(s) str(s)
 #define str(s) #s
 #include xstr(MQTTCLIENT_PLATFORM_HEADER)
+#else
+#include "MQTTFreeRTOS.h"
+#endif
+
+#if defined(MQTT_TASK_SELECT) && !defined(MQTT_TASK)
+#error "MQTT_TASK_SELECT needs MQTT_TASK"
 #endif
 
 #define MAX_PACKET_ID 65535 /* according to the MQTT specification - do not change! */
 
+#if !defined(MQTT_YUNBA_VERSION)
+#define MQTT_YUNBA_VERSION 19 /* protocol level of the Yunba extensions, which use 64 bit packet ids */
+#endif
+
 #if !defined(MAX_MESSAGE_HANDLERS)
-#define MAX_MESSAGE_HANDLERS 1 /* redefinable - how many subscriptions do you want? */
+#define MAX_MESSAGE_HANDLERS 1 /* redefinable - how many extended command handlers do you want? */
+#endif
+
+#if !defined(MAX_INFLIGHT_MESSAGES)
+#define MAX_INFLIGHT_MESSAGES 4 /* redefinable - how many QoS1/2 publishes may be unacknowledged at once */
+#endif
+
+#if !defined(MAX_PENDING_SUBSCRIPTIONS)
+#define MAX_PENDING_SUBSCRIPTIONS 2 /* redefinable - how many subscribes may wait for their SUBACK at once */
+#endif
+
+#if !defined(MQTT_RETRY_INTERVAL_MS)
+#define MQTT_RETRY_INTERVAL_MS 10000 /* redefinable - resend an unacknowledged publish after this long */
+#endif
+
+#if !defined(MQTT_MAX_RETRIES)
+#define MQTT_MAX_RETRIES 3 /* redefinable - give up on a publish after this many resends */
 #endif
 
 enum QoS {
@@ -98,19 +124,19 @@ typedef void (*messageHandler)(MessageData*);
 typedef void (*extendedmessageHandler)(EXTED_CMD cmd, int status,
 		int ret_string_len, char *ret_string);
 typedef void (*mqttConnectLostHandler)(char *reaseon);
+/* called once a QoS1/2 publish is acknowledged (rc SUCCESS) or abandoned (rc FAILURE) */
+typedef void (*publishCompleteHandler)(uint64_t id, int rc, void *context);
 
 typedef struct MQTTClient {
 	uint64_t next_packetid, command_timeout_ms;
+	unsigned char wide_packetid; /* 64 bit Yunba packet ids, set from the protocol level at connect */
 	size_t buf_size, readbuf_size;
 	unsigned char *buf, *readbuf;
 	unsigned int keepAliveInterval;
 	char ping_outstanding;
 	int isconnected;
 	uint8_t fail_conn_count;
-	struct MessageHandlers {
-		const char* topicFilter;
-		void (*fp)(MessageData*);
-	} messageHandlers[MAX_MESSAGE_HANDLERS]; /* Message handlers are indexed by subscription topic */
+	MQTTTopicTrie messageHandlers; /* Message handlers are indexed by subscription topic */
 
 	struct ExtMessageHandlers {
 		EXTED_CMD cmd;
@@ -118,6 +144,29 @@ typedef struct MQTTClient {
 				char *ret_string);
 	} extmessageHandlers[MAX_MESSAGE_HANDLERS];
 
+	/* QoS1/2 publishes waiting for PUBACK, PUBREC or PUBCOMP, indexed by packet id */
+	struct InflightMessage {
+		uint64_t id;
+		unsigned char state; /* 0 if the slot is free, otherwise PUBLISH or PUBREL - the packet awaiting its ack */
+		unsigned char qos;
+		unsigned char retries;
+		unsigned char *packet; /* PUBLISH header kept for retransmission, and the payload if copied */
+		int len;
+		const unsigned char *payload; /* payload left in the caller's memory, NULL if in packet */
+		int payloadlen;
+		Timer retry_timer;
+		publishCompleteHandler cb;
+		void *context;
+	} inflight[MAX_INFLIGHT_MESSAGES];
+	int inflight_count;
+
+	/* filters whose handler went into the trie before their SUBACK, so that
+	 * a refusal can take it out again */
+	struct PendingSubscription {
+		uint64_t id;
+		const char* topicFilter; /* NULL if the slot is free */
+	} pending_subs[MAX_PENDING_SUBSCRIPTIONS];
+
 	void (*defaultMessageHandler)(MessageData*);
 	mqttConnectLostHandler cl;
 
@@ -166,7 +215,10 @@ DLLExport void MQTTClientInit(MQTTClient* client, Network* network,
 DLLExport int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options,
 		bool block);
 
-/** MQTT Publish - send an MQTT publish packet and wait for all acks to complete for all QoSs
+/** MQTT Publish - send an MQTT publish packet.  QoS1/2 publishes are kept in the in-flight
+ *  window until acknowledged and are resent with DUP set if no ack arrives in time.  Only
+ *  blocks while the window is full.  A QoS1/2 payload is copied for the resends, the
+ *  publish fails before anything is sent if there is no memory for the copy.
  *  @param client - the client object to use
  *  @param topic - the topic to publish to
  *  @param message - the message to send
@@ -174,10 +226,25 @@ DLLExport int MQTTConnect(MQTTClient* client, MQTTPacket_connectData* options,
  */
 DLLExport int MQTTPublish(MQTTClient* client, const char*, MQTTMessage*);
 
-/** MQTT Subscribe - send an MQTT subscribe packet and wait for suback before returning.
+/** MQTT Publish Async - as MQTTPublish, with a callback invoked from the MQTT task once a
+ *  QoS1/2 publish completes.  The callback is never called for QoS0.  A QoS1/2 payload is
+ *  not copied but resent from message->payload, which must stay valid until cb runs for a
+ *  publish that returned SUCCESS.
  *  @param client - the client object to use
- *  @param topicFilter - the topic filter to subscribe to
- *  @param message - the message to send
+ *  @param topic - the topic to publish to
+ *  @param message - the message to send, message->id is set to the packet id used
+ *  @param cb - completion callback, may be NULL
+ *  @param context - passed back to cb
+ *  @return success code
+ */
+DLLExport int MQTTPublishAsync(MQTTClient* client, const char*, MQTTMessage*,
+		publishCompleteHandler cb, void *context);
+
+/** MQTT Subscribe - send an MQTT subscribe packet.  Messages matching the filter go to
+ *  messageHandler, messages matching no filter go to the callback set by MQTTSetCallBack.
+ *  @param client - the client object to use
+ *  @param topicFilter - the topic filter to subscribe to, must stay valid until unsubscribed
+ *  @param messageHandler - the handler for this filter, may be NULL
  *  @return success code
  */
 DLLExport int MQTTSubscribe(MQTTClient* client, const char* topicFilter,
@@ -205,6 +272,8 @@ DLLExport int MQTTYield(MQTTClient* client, int time);
 
 #if defined(MQTT_TASK)
 /** MQTT start background thread for a client.  After this, MQTTYield should not be called.
+ *  With MQTT_TASK_SELECT the thread sleeps in select() until data arrives or a ping or
+ *  resend is due, instead of polling every 200ms.
  *  @param client - the client object to use
  *  @return success code
  */
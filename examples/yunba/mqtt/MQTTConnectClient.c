@@ -147,7 +147,7 @@ int MQTTDeserialize_connack(unsigned char* sessionPresent, unsigned char* connac
 	if (header.bits.type != CONNACK)
 		goto exit;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
 	enddata = curdata + mylen;
 	if (enddata - curdata < 2)
 		goto exit;
@@ -26,11 +26,14 @@ int MQTTDeserialize_extendedcmd(unsigned char* dup, int* qos,
 	*qos = header.bits.qos;
 	*retained = header.bits.retain;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
 	enddata = curdata + mylen;
 
 //	printf("%s, retain len:%d, qos:%d\n", __func__, mylen, *qos);
 
+	/* packet id, command, status and payload length */
+	if (enddata - curdata < 12)
+		goto exit;
 //	if (*qos > 0)
 	*packetid = readInt64(&curdata);
 
@@ -41,7 +44,8 @@ int MQTTDeserialize_extendedcmd(unsigned char* dup, int* qos,
 //	printf("%s, status: %d\n", __func__, *status);
 	curdata++;
 	*payloadlen = readInt(&curdata);
-	;
+	if (*payloadlen > enddata - curdata)
+		goto exit;
 //	printf("%s, payload len: %d\n", __func__, *payloadlen);
 	*payload = curdata;
 //	printf("%s, payload: %s\n", __func__, *payload);
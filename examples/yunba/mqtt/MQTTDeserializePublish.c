@@ -50,15 +50,18 @@ int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retaine
 	*qos = header.bits.qos;
 	*retained = header.bits.retain;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
 	enddata = curdata + mylen;
 
 	if (!readMQTTLenString(topicName, &curdata, enddata) ||
 		enddata - curdata < 0) /* do we have enough data to read the protocol version byte? */
 		goto exit;
 
-	if (*qos > 0)
+	if (*qos > 0) {
+		if (enddata - curdata < 8)
+			goto exit;
 		*packetid = readInt64(&curdata);
+	}
 
 	*payloadlen = enddata - curdata;
 	*payload = curdata;
@@ -92,10 +95,10 @@ int MQTTDeserialize_ack(unsigned char* packettype, unsigned char* dup, uint64_t*
 	*dup = header.bits.dup;
 	*packettype = header.bits.type;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
 	enddata = curdata + mylen;
 
-	if (enddata - curdata < 2)
+	if (enddata - curdata < 8)
 		goto exit;
 	*packetid = readInt64(&curdata);
 
@@ -86,27 +86,62 @@ void TimerInit(Timer* timer) {
 	memset(&timer->xTimeOut, '\0', sizeof(timer->xTimeOut));
 }
 
+/* copy out up to len bytes already held in the receive buffer */
+static int NetworkBufferTake(Network* n, unsigned char* buffer, int len) {
+	if (len > n->rxbuf_len)
+		len = n->rxbuf_len;
+	memcpy(buffer, n->rxbuf + n->rxbuf_head, len);
+	n->rxbuf_head += len;
+	n->rxbuf_len -= len;
+	if (n->rxbuf_len == 0)
+		n->rxbuf_head = 0;
+	return len;
+}
+
 int FreeRTOS_read(Network* n, unsigned char* buffer, int len,
 		uint32_t timeout_ms) {
 	portTickType xTicksToWait = timeout_ms / portTICK_RATE_MS; /* convert milliseconds to ticks */
 	xTimeOutType xTimeOut;
 	int recvLen = 0;
+	char timeout_set = 0;
 
 	vTaskSetTimeOutState(&xTimeOut); /* Record the time at which this function was entered. */
-	FreeRTOS_setsockopt(n->my_socket, SOL_SOCKET, FREERTOS_SO_RCVTIMEO,
-			&timeout_ms, sizeof(timeout_ms));
-	do {
+
+	/* bytes already buffered are taken whatever time is left, a packet split
+	 * across a refill must not be cut short by an expired timer */
+	if (n->rxbuf_len > 0)
+		recvLen = NetworkBufferTake(n, buffer, len);
+
+	while (recvLen < len) {
 		int rc = 0;
 
-		rc = FreeRTOS_recv(n->my_socket, buffer + recvLen, len - recvLen, 0);
-		if (rc > 0)
-			recvLen += rc;
-		else if (rc < 0) {
+		/* only touch the socket when the buffer cannot serve the read */
+		if (!timeout_set) {
+			FreeRTOS_setsockopt(n->my_socket, SOL_SOCKET, FREERTOS_SO_RCVTIMEO,
+					&timeout_ms, sizeof(timeout_ms));
+			timeout_set = 1;
+		}
+
+		if (n->rxbuf != NULL && len - recvLen < n->rxbuf_size) {
+			/* small read: pull in whatever lwIP holds, headers of the
+			 * following packets included */
+			rc = FreeRTOS_recv(n->my_socket, n->rxbuf, n->rxbuf_size, 0);
+			if (rc > 0) {
+				n->rxbuf_len = rc;
+				recvLen += NetworkBufferTake(n, buffer + recvLen, len - recvLen);
+			}
+		} else {
+			rc = FreeRTOS_recv(n->my_socket, buffer + recvLen, len - recvLen, 0);
+			if (rc > 0)
+				recvLen += rc;
+		}
+		if (rc < 0) {
 			recvLen = rc;
 			break;
 		}
-	} while (recvLen < len
-			&& xTaskCheckForTimeOut(&xTimeOut, &xTicksToWait) == pdFALSE);
+		if (xTaskCheckForTimeOut(&xTimeOut, &xTicksToWait) != pdFALSE)
+			break;
+	}
 
 	return recvLen;
 }
@@ -137,17 +172,46 @@ int FreeRTOS_write(Network* n, unsigned char* buffer, int len,
 	return sentLen;
 }
 
+/* block until the socket is readable: >0 readable, 0 on timeout, <0 on error */
+int FreeRTOS_wait(Network* n, uint32_t timeout_ms) {
+	fd_set readset;
+	struct timeval tv;
+
+	if (n->rxbuf_len > 0)
+		return 1;
+	if (n->my_socket < 0)
+		return -1;
+
+	FD_ZERO(&readset);
+	FD_SET(n->my_socket, &readset);
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	return select(n->my_socket + 1, &readset, NULL, NULL, &tv);
+}
+
 void FreeRTOS_disconnect(Network* n) {
 	FreeRTOS_closesocket(n->my_socket);
+	n->rxbuf_head = n->rxbuf_len = 0;
 }
 
 void ICACHE_FLASH_ATTR NetworkInit(Network* n) {
 	n->my_socket = 0;
+	n->rxbuf = NULL;
+	n->rxbuf_size = n->rxbuf_head = n->rxbuf_len = 0;
 	n->mqttread = FreeRTOS_read;
 	n->mqttwrite = FreeRTOS_write;
+	n->mqttwait = FreeRTOS_wait;
 	n->disconnect = FreeRTOS_disconnect;
 }
 
+void ICACHE_FLASH_ATTR NetworkSetReadBuffer(Network* n, unsigned char* buf,
+		int size) {
+	n->rxbuf = buf;
+	n->rxbuf_size = (buf != NULL) ? size : 0;
+	n->rxbuf_head = n->rxbuf_len = 0;
+}
+
 int ICACHE_FLASH_ATTR getIpForHost(const char *host, struct sockaddr_in *ip) {
 	struct hostent *he;
 	struct in_addr **addr_list;
@@ -165,6 +229,7 @@ int ICACHE_FLASH_ATTR getIpForHost(const char *host, struct sockaddr_in *ip) {
 int ICACHE_FLASH_ATTR NetworkConnect(Network* n, char* addr, int port) {
 	struct sockaddr_in sAddr;
 	int retVal = -1;
+	int nodelay = 1;
 
 	bzero(&sAddr, sizeof(struct sockaddr_in));
 	if (!getIpForHost(addr, &sAddr)) {
@@ -173,6 +238,7 @@ int ICACHE_FLASH_ATTR NetworkConnect(Network* n, char* addr, int port) {
 	}
 
 	sAddr.sin_port = FreeRTOS_htons(port);
+	n->rxbuf_head = n->rxbuf_len = 0;
 
 	if ((n->my_socket = FreeRTOS_socket(PF_INET, FREERTOS_SOCK_STREAM, 0)) < 0)
 		goto exit;
@@ -185,6 +251,11 @@ int ICACHE_FLASH_ATTR NetworkConnect(Network* n, char* addr, int port) {
 		goto exit;
 	}
 
+	/* a publish too big for the send buffer goes out as two writes, don't
+	 * let Nagle hold the payload back until the header is acked */
+	FreeRTOS_setsockopt(n->my_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+			sizeof(nodelay));
+
 	exit:
 //	printf("------------>connect init: %d, sock:%d \n", retVal, n->my_socket);
 	return retVal;
@@ -289,8 +360,9 @@ int ICACHE_FLASH_ATTR NetworkConnect(Network* n, char* addr, int port) {
 //        return y;
 //}
 
+/* seed for the packet id counter: random high word, so ids do not repeat after a reboot */
 uint64_t generate_uuid() {
-	uint64_t system_time = (uint64_t) system_get_time();
+	uint64_t system_time = ((uint64_t) os_random() << 32) | system_get_time();
 //        uint64_t id = utc << (64 - 41);
 //        id |= (uint64_t)(randm(16) % (unsigned long long int)(pow(2, (64 - 41))));
 	return system_time;
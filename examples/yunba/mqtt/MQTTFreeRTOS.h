@@ -59,8 +59,12 @@ typedef struct Network Network;
 struct Network {
 //	xSocket_t my_socket;
 	int my_socket;
+	/* optional receive buffer, lets one recv() serve several small reads */
+	unsigned char *rxbuf;
+	int rxbuf_size, rxbuf_head, rxbuf_len;
 	int (*mqttread)(Network*, unsigned char*, int, uint32_t);
 	int (*mqttwrite)(Network*, unsigned char*, int, uint32_t);
+	int (*mqttwait)(Network*, uint32_t);
 	void (*disconnect)(Network*);
 };
 
@@ -87,9 +91,11 @@ int ThreadStart(Thread*, void (*fn)(void*), void* arg);
 
 int FreeRTOS_read(Network*, unsigned char*, int, uint32_t);
 int FreeRTOS_write(Network*, unsigned char*, int, uint32_t);
+int FreeRTOS_wait(Network*, uint32_t);
 void FreeRTOS_disconnect(Network*);
 
 void NetworkInit(Network*);
+void NetworkSetReadBuffer(Network*, unsigned char*, int);
 int NetworkConnect(Network*, char*, int);
 /*int NetworkConnectTLS(Network*, char*, int, SlSockSecureFiles_t*, unsigned char, unsigned int, char);*/
 uint64_t generate_uuid();
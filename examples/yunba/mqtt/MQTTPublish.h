@@ -28,6 +28,10 @@
 DLLExport int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, uint64_t packetid,
 		MQTTString topicName, unsigned char* payload, int payloadlen);
 
+DLLExport int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, uint64_t packetid,
+		MQTTString topicName, int payloadlen);
+DLLExport int MQTTSerialize_publishLength(int qos, MQTTString topicName, int payloadlen);
+
 DLLExport int MQTTDeserialize_publish(unsigned char* dup, int* qos, unsigned char* retained, uint64_t* packetid, MQTTString* topicName,
 		unsigned char** payload, int* payloadlen, unsigned char* buf, int len);
 
@@ -40,20 +40,21 @@ int MQTTSerialize_publishLength(int qos, MQTTString topicName, int payloadlen)
 
 
 /**
-  * Serializes the supplied publish data into the supplied buffer, ready for sending
-  * @param buf the buffer into which the packet will be serialized
+  * Serializes the fixed header, topic name and packet identifier of a publish packet, leaving out
+  * the payload.  The payloadlen bytes of payload are expected to be sent straight after it, which
+  * lets large payloads go to the network without being copied into the send buffer.
+  * @param buf the buffer into which the header will be serialized
   * @param buflen the length in bytes of the supplied buffer
   * @param dup integer - the MQTT dup flag
   * @param qos integer - the MQTT QoS value
   * @param retained integer - the MQTT retained flag
   * @param packetid integer - the MQTT packet identifier
   * @param topicName MQTTString - the MQTT topic in the publish
-  * @param payload byte buffer - the MQTT publish payload
-  * @param payloadlen integer - the length of the MQTT payload
-  * @return the length of the serialized data.  <= 0 indicates error
+  * @param payloadlen integer - the length of the MQTT payload that will follow
+  * @return the length of the serialized header.  <= 0 indicates error
   */
-int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, uint64_t packetid,
-		MQTTString topicName, unsigned char* payload, int payloadlen)
+int MQTTSerialize_publishHeader(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, uint64_t packetid,
+		MQTTString topicName, int payloadlen)
 {
 	unsigned char *ptr = buf;
 	MQTTHeader header = {0};
@@ -61,7 +62,7 @@ int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int
 	int rc = 0;
 
 	FUNC_ENTRY;
-	if (MQTTPacket_len(rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen)) > buflen)
+	if (MQTTPacket_len(rem_len = MQTTSerialize_publishLength(qos, topicName, payloadlen)) - payloadlen > buflen)
 	{
 		rc = MQTTPACKET_BUFFER_TOO_SHORT;
 		goto exit;
@@ -80,6 +81,42 @@ int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int
 	if (qos > 0)
 		writeInt64(&ptr, packetid);
 
+	rc = ptr - buf;
+
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+
+/**
+  * Serializes the supplied publish data into the supplied buffer, ready for sending
+  * @param buf the buffer into which the packet will be serialized
+  * @param buflen the length in bytes of the supplied buffer
+  * @param dup integer - the MQTT dup flag
+  * @param qos integer - the MQTT QoS value
+  * @param retained integer - the MQTT retained flag
+  * @param packetid integer - the MQTT packet identifier
+  * @param topicName MQTTString - the MQTT topic in the publish
+  * @param payload byte buffer - the MQTT publish payload
+  * @param payloadlen integer - the length of the MQTT payload
+  * @return the length of the serialized data.  <= 0 indicates error
+  */
+int MQTTSerialize_publish(unsigned char* buf, int buflen, unsigned char dup, int qos, unsigned char retained, uint64_t packetid,
+		MQTTString topicName, unsigned char* payload, int payloadlen)
+{
+	unsigned char *ptr = buf;
+	int rc = 0;
+
+	FUNC_ENTRY;
+	if (MQTTPacket_len(MQTTSerialize_publishLength(qos, topicName, payloadlen)) > buflen)
+	{
+		rc = MQTTPACKET_BUFFER_TOO_SHORT;
+		goto exit;
+	}
+
+	ptr += MQTTSerialize_publishHeader(buf, buflen, dup, qos, retained, packetid, topicName, payloadlen);
+
 	memcpy(ptr, payload, payloadlen);
 	ptr += payloadlen;
 
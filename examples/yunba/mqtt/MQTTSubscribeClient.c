@@ -110,9 +110,9 @@ int MQTTDeserialize_suback(uint64_t* packetid, int maxcount, int* count, int gra
 	if (header.bits.type != SUBACK)
 		goto exit;
 
-	curdata += (rc = MQTTPacket_decodeBuf(curdata, &mylen)); /* read remaining length */
+	curdata += MQTTPacket_decodeBuf(curdata, &mylen); /* read remaining length */
 	enddata = curdata + mylen;
-	if (enddata - curdata < 2)
+	if (enddata - curdata < 8)
 		goto exit;
 
 	*packetid = readInt64(&curdata);
@@ -120,7 +120,7 @@ int MQTTDeserialize_suback(uint64_t* packetid, int maxcount, int* count, int gra
 	*count = 0;
 	while (curdata < enddata)
 	{
-		if (*count > maxcount)
+		if (*count >= maxcount)
 		{
 			rc = -1;
 			goto exit;
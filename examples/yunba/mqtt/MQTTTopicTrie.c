@@ -0,0 +1,179 @@
+/*
+ * MQTTTopicTrie.c
+ *
+ * Statically allocated topic filter trie with '+' and '#' wildcards.
+ */
+#include "MQTTTopicTrie.h"
+#include "StackTrace.h"
+
+#include <string.h>
+
+#define NONE (-1)
+
+static int isWildcard(MQTTTopicTrieNode* n, char w) {
+	return n->len == 1 && n->level[0] == w;
+}
+
+static short findChild(MQTTTopicTrie* trie, short node, const char* level,
+		int len) {
+	short i;
+
+	for (i = trie->nodes[node].child; i != NONE; i = trie->nodes[i].sibling)
+		if (trie->nodes[i].len == len
+				&& memcmp(trie->nodes[i].level, level, len) == 0)
+			return i;
+	return NONE;
+}
+
+/* release nodes on the way up that no longer lead to any handler */
+static void prune(MQTTTopicTrie* trie, short node) {
+	while (node > 0 && trie->nodes[node].fp == NULL
+			&& trie->nodes[node].child == NONE) {
+		MQTTTopicTrieNode* n = &trie->nodes[node];
+		short* link = &trie->nodes[n->parent].child;
+		short parent = n->parent;
+
+		while (*link != node)
+			link = &trie->nodes[*link].sibling;
+		*link = n->sibling;
+
+		n->sibling = trie->free_list;
+		trie->free_list = node;
+		node = parent;
+	}
+}
+
+void MQTTTopicTrie_init(MQTTTopicTrie* trie) {
+	short i;
+
+	for (i = 0; i < MQTT_TOPIC_TRIE_NODES; ++i) {
+		trie->nodes[i].level = NULL;
+		trie->nodes[i].len = 0;
+		trie->nodes[i].parent = trie->nodes[i].child = NONE;
+		trie->nodes[i].sibling = (i + 1 < MQTT_TOPIC_TRIE_NODES) ? i + 1 : NONE;
+		trie->nodes[i].fp = NULL;
+	}
+	trie->nodes[0].sibling = NONE;
+	trie->free_list = (MQTT_TOPIC_TRIE_NODES > 1) ? 1 : NONE;
+}
+
+int MQTTTopicTrie_insert(MQTTTopicTrie* trie, const char* topicFilter,
+		MQTTTopicHandler fp) {
+	const char* level = topicFilter;
+	short node = 0;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	for (;;) {
+		const char* sep = strchr(level, '/');
+		int len = (sep != NULL) ? sep - level : strlen(level);
+		short next = findChild(trie, node, level, len);
+
+		if (next == NONE) {
+			MQTTTopicTrieNode* n;
+
+			if (trie->free_list == NONE || len > 255) {
+				prune(trie, node);
+				goto exit;
+			}
+			next = trie->free_list;
+			n = &trie->nodes[next];
+			trie->free_list = n->sibling;
+			n->level = level;
+			n->len = len;
+			n->parent = node;
+			n->child = NONE;
+			n->fp = NULL;
+			n->sibling = trie->nodes[node].child;
+			trie->nodes[node].child = next;
+		}
+		node = next;
+		if (sep == NULL)
+			break;
+		level = sep + 1;
+	}
+	trie->nodes[node].fp = fp;
+	rc = 0;
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+int MQTTTopicTrie_remove(MQTTTopicTrie* trie, const char* topicFilter) {
+	const char* level = topicFilter;
+	short node = 0;
+	int rc = -1;
+
+	FUNC_ENTRY;
+	for (;;) {
+		const char* sep = strchr(level, '/');
+		int len = (sep != NULL) ? sep - level : strlen(level);
+
+		if ((node = findChild(trie, node, level, len)) == NONE)
+			goto exit;
+		if (sep == NULL)
+			break;
+		level = sep + 1;
+	}
+	if (trie->nodes[node].fp != NULL) {
+		trie->nodes[node].fp = NULL;
+		prune(trie, node);
+		rc = 0;
+	}
+exit:
+	FUNC_EXIT_RC(rc);
+	return rc;
+}
+
+static int matchLevel(MQTTTopicTrie* trie, short node, const char* level,
+		const char* end, void (*visit)(MQTTTopicHandler, void*),
+		void* context) {
+	const char* sep = level;
+	/* wildcards at the first level must not match $SYS style topics */
+	int dollar = (node == 0 && level < end && *level == '$');
+	int count = 0;
+	short i;
+
+	while (sep < end && *sep != '/')
+		++sep;
+
+	for (i = trie->nodes[node].child; i != NONE; i = trie->nodes[i].sibling) {
+		MQTTTopicTrieNode* n = &trie->nodes[i];
+
+		if (isWildcard(n, '#')) {
+			if (!dollar && n->fp != NULL) {
+				visit(n->fp, context);
+				++count;
+			}
+			continue;
+		}
+		if (isWildcard(n, '+')) {
+			if (dollar)
+				continue;
+		} else if (n->len != sep - level || memcmp(n->level, level, n->len) != 0)
+			continue;
+
+		if (sep < end)
+			count += matchLevel(trie, i, sep + 1, end, visit, context);
+		else {
+			short j;
+
+			if (n->fp != NULL) {
+				visit(n->fp, context);
+				++count;
+			}
+			/* "a/#" also matches "a" */
+			for (j = n->child; j != NONE; j = trie->nodes[j].sibling)
+				if (isWildcard(&trie->nodes[j], '#') && trie->nodes[j].fp != NULL) {
+					visit(trie->nodes[j].fp, context);
+					++count;
+				}
+		}
+	}
+	return count;
+}
+
+int MQTTTopicTrie_match(MQTTTopicTrie* trie, const char* topicName, int len,
+		void (*visit)(MQTTTopicHandler fp, void* context), void* context) {
+	return matchLevel(trie, 0, topicName, topicName + len, visit, context);
+}
@@ -0,0 +1,49 @@
+/*
+ * MQTTTopicTrie.h
+ *
+ * Subscription lookup: topic filters are stored one level per node, so
+ * matching a topic name costs one walk down its levels rather than a
+ * wildcard comparison against every subscription.
+ */
+
+#ifndef MQTTTOPICTRIE_H_
+#define MQTTTOPICTRIE_H_
+
+#if !defined(MQTT_TOPIC_TRIE_NODES)
+#define MQTT_TOPIC_TRIE_NODES 16 /* redefinable - total topic levels over all subscriptions, plus one */
+#endif
+
+struct MessageData;
+typedef void (*MQTTTopicHandler)(struct MessageData*);
+
+typedef struct {
+	const char* level; /* points into the topic filter given to insert */
+	unsigned char len;
+	short parent, child, sibling; /* node indexes, -1 for none */
+	MQTTTopicHandler fp;
+} MQTTTopicTrieNode;
+
+typedef struct {
+	MQTTTopicTrieNode nodes[MQTT_TOPIC_TRIE_NODES]; /* nodes[0] is the root */
+	short free_list;
+} MQTTTopicTrie;
+
+void MQTTTopicTrie_init(MQTTTopicTrie* trie);
+
+/** Add or replace the handler of a topic filter.  The filter is not copied and
+ *  must stay valid until it is removed.
+ *  @return 0 on success, -1 if the trie is full
+ */
+int MQTTTopicTrie_insert(MQTTTopicTrie* trie, const char* topicFilter,
+		MQTTTopicHandler fp);
+
+/** @return 0 on success, -1 if the filter was not subscribed */
+int MQTTTopicTrie_remove(MQTTTopicTrie* trie, const char* topicFilter);
+
+/** Call visit once for each filter that matches the topic name.
+ *  @return the number of matching filters
+ */
+int MQTTTopicTrie_match(MQTTTopicTrie* trie, const char* topicName, int len,
+		void (*visit)(MQTTTopicHandler fp, void* context), void* context);
+
+#endif /* MQTTTOPICTRIE_H_ */
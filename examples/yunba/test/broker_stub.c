@@ -0,0 +1,323 @@
+/*
+ * broker_stub.c
+ *
+ * Replies are queued with a due time instead of sleeping, so a configured
+ * latency delays each packet without serialising the whole exchange.
+ */
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "MQTTPacket.h"
+#include "broker_stub.h"
+
+#define MAX_PENDING 256
+#define MAX_SUBSCRIPTIONS 8
+#define MAX_PACKET 8192
+
+struct reply {
+	long long due_us;
+	int len;
+	unsigned char *data;
+};
+
+static struct broker_options options;
+static int listen_fd = -1;
+static volatile int client_fd = -1;
+
+static struct reply pending[MAX_PENDING];
+static int pending_head, pending_count;
+static char *subscriptions[MAX_SUBSCRIPTIONS];
+
+static long long now_us(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void queue_reply(const unsigned char *data, int len) {
+	struct reply *r;
+
+	if (pending_count == MAX_PENDING)
+		return; /* a full queue behaves like one more lost packet */
+	r = &pending[(pending_head + pending_count++) % MAX_PENDING];
+	r->due_us = now_us() + options.latency_ms * 1000LL;
+	r->len = len;
+	r->data = malloc(len);
+	memcpy(r->data, data, len);
+}
+
+static void flush_replies(int fd) {
+	long long now = now_us();
+
+	while (pending_count > 0 && pending[pending_head].due_us <= now) {
+		struct reply *r = &pending[pending_head];
+
+		send(fd, r->data, r->len, MSG_NOSIGNAL);
+		free(r->data);
+		pending_head = (pending_head + 1) % MAX_PENDING;
+		--pending_count;
+	}
+}
+
+static void clear_session(void) {
+	int i;
+
+	while (pending_count > 0) {
+		free(pending[pending_head].data);
+		pending_head = (pending_head + 1) % MAX_PENDING;
+		--pending_count;
+	}
+	for (i = 0; i < MAX_SUBSCRIPTIONS; ++i) {
+		free(subscriptions[i]);
+		subscriptions[i] = NULL;
+	}
+}
+
+static int topic_matches(const char *filter, const char *topic, int len) {
+	int flen = strlen(filter);
+
+	if (strcmp(filter, "#") == 0)
+		return 1;
+	if (flen >= 2 && strcmp(filter + flen - 2, "/#") == 0)
+		return len >= flen - 2 && memcmp(filter, topic, flen - 2) == 0
+				&& (len == flen - 2 || topic[flen - 2] == '/');
+	return len == flen && memcmp(filter, topic, len) == 0;
+}
+
+static void handle_publish(unsigned char *buf, int len) {
+	unsigned char dup, retained, *payload, out[MAX_PACKET];
+	MQTTString topic;
+	uint64_t id = 0;
+	int qos, payloadlen, i;
+
+	if (MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic, &payload,
+			&payloadlen, buf, len) != 1)
+		return;
+	if (qos > 0) {
+		int n = MQTTSerialize_ack(out, sizeof(out), qos == 1 ? PUBACK : PUBREC, 0,
+				id);
+		queue_reply(out, n);
+	}
+	for (i = 0; i < MAX_SUBSCRIPTIONS; ++i)
+		if (subscriptions[i] != NULL
+				&& topic_matches(subscriptions[i], topic.lenstring.data,
+						topic.lenstring.len)) {
+			int n = MQTTSerialize_publish(out, sizeof(out), 0, 0, 0, 0, topic,
+					payload, payloadlen);
+			if (n > 0)
+				queue_reply(out, n);
+			break;
+		}
+}
+
+static void handle_subscribe(unsigned char *p, unsigned char *end, int unsub) {
+	unsigned char out[64], *q = out, refused[32];
+	uint64_t id = readInt64(&p);
+	int count = 0, i;
+
+	while (p + 2 <= end && count < (int) sizeof(refused)) {
+		int len = readInt(&p);
+
+		if (p + len > end)
+			break;
+		/* filters under deny/ are refused, for the client's SUBACK handling */
+		refused[count] = !unsub && len >= 5 && memcmp(p, "deny/", 5) == 0;
+		for (i = 0; !unsub && !refused[count] && i < MAX_SUBSCRIPTIONS; ++i)
+			if (subscriptions[i] == NULL) {
+				subscriptions[i] = strndup((char *) p, len);
+				break;
+			}
+		for (i = 0; unsub && i < MAX_SUBSCRIPTIONS; ++i)
+			if (subscriptions[i] != NULL
+					&& (int) strlen(subscriptions[i]) == len
+					&& memcmp(subscriptions[i], p, len) == 0) {
+				free(subscriptions[i]);
+				subscriptions[i] = NULL;
+			}
+		p += len + (unsub ? 0 : 1);
+		++count;
+	}
+
+	writeChar(&q, unsub ? 0xb0 : 0x90);
+	q += MQTTPacket_encode(q, 8 + (unsub ? 0 : count));
+	writeInt64(&q, id);
+	for (i = 0; !unsub && i < count; ++i)
+		writeChar(&q, refused[i] ? 0x80 : 1);
+	queue_reply(out, q - out);
+}
+
+/* reply with the command's ACK, status 0, echoing the payload */
+static void handle_extcmd(unsigned char header, unsigned char *p,
+		unsigned char *end) {
+	unsigned char out[MAX_PACKET], *q = out;
+	uint64_t id;
+	int cmd, len;
+
+	if (end - p < 11)
+		return;
+	id = readInt64(&p);
+	cmd = readChar(&p);
+	len = readInt(&p);
+	if (len > end - p || len > MAX_PACKET - 32)
+		return;
+
+	writeChar(&q, header);
+	q += MQTTPacket_encode(q, 8 + 1 + 1 + 2 + len);
+	writeInt64(&q, id);
+	writeChar(&q, cmd + 1);
+	writeChar(&q, 0);
+	writeInt(&q, len);
+	memcpy(q, p, len);
+	queue_reply(out, q + len - out);
+}
+
+static void handle_packet(unsigned char *buf, int len, int hdrlen) {
+	static const unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+	static const unsigned char pingresp[] = { 0xd0, 0x00 };
+	unsigned char out[16], *body = buf + hdrlen, *end = buf + len;
+	int type = buf[0] >> 4;
+
+	if (type != CONNECT && rand() % 100 < options.loss_percent)
+		return;
+
+	switch (type) {
+	case CONNECT:
+		queue_reply(connack, sizeof(connack));
+		break;
+	case PUBLISH:
+		handle_publish(buf, len);
+		break;
+	case PUBREL: {
+		unsigned char *p = body;
+
+		if (end - p >= 8)
+			queue_reply(out, MQTTSerialize_ack(out, sizeof(out), PUBCOMP, 0,
+					readInt64(&p)));
+		break;
+	}
+	case SUBSCRIBE:
+	case UNSUBSCRIBE:
+		if (end - body >= 8)
+			handle_subscribe(body, end, type == UNSUBSCRIBE);
+		break;
+	case PINGREQ:
+		queue_reply(pingresp, sizeof(pingresp));
+		break;
+	case EXTCMD:
+		handle_extcmd(buf[0], body, end);
+		break;
+	default:
+		break;
+	}
+}
+
+static int read_full(int fd, unsigned char *buf, int len) {
+	int got = 0;
+
+	while (got < len) {
+		int rc = recv(fd, buf + got, len - got, 0);
+
+		if (rc <= 0 && !(rc < 0 && errno == EINTR))
+			return -1;
+		if (rc > 0)
+			got += rc;
+	}
+	return got;
+}
+
+/* one packet from the socket, -1 once the connection is closed */
+static int read_packet(int fd, unsigned char *buf, int *hdrlen) {
+	int rem = 0, multiplier = 1, n = 1;
+
+	if (read_full(fd, buf, 1) != 1)
+		return -1;
+	do {
+		if (n > 4 || read_full(fd, buf + n, 1) != 1)
+			return -1;
+		rem += (buf[n] & 127) * multiplier;
+		multiplier *= 128;
+	} while (buf[n++] & 128);
+	if (n + rem > MAX_PACKET || read_full(fd, buf + n, rem) != rem)
+		return -1;
+	*hdrlen = n;
+	return n + rem;
+}
+
+static void serve(int fd) {
+	static unsigned char buf[MAX_PACKET];
+
+	for (;;) {
+		struct timeval tv = { 1, 0 };
+		fd_set readset;
+		int len, hdrlen;
+
+		if (pending_count > 0) {
+			long long wait = pending[pending_head].due_us - now_us();
+
+			if (wait < 0)
+				wait = 0;
+			tv.tv_sec = wait / 1000000;
+			tv.tv_usec = wait % 1000000;
+		}
+		FD_ZERO(&readset);
+		FD_SET(fd, &readset);
+		if (select(fd + 1, &readset, NULL, NULL, &tv) > 0) {
+			if ((len = read_packet(fd, buf, &hdrlen)) < 0
+					|| (buf[0] >> 4) == DISCONNECT)
+				break;
+			handle_packet(buf, len, hdrlen);
+		}
+		flush_replies(fd);
+	}
+}
+
+static void *broker_thread(void *arg) {
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0)
+			continue;
+		client_fd = fd;
+		serve(fd);
+		client_fd = -1;
+		close(fd);
+		clear_session();
+	}
+	return NULL;
+}
+
+int broker_start(const struct broker_options *opt) {
+	struct sockaddr_in addr;
+	socklen_t addrlen = sizeof(addr);
+	pthread_t thread;
+
+	options = *opt;
+	if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+			|| listen(listen_fd, 1) < 0
+			|| getsockname(listen_fd, (struct sockaddr *) &addr, &addrlen) < 0)
+		return -1;
+	if (pthread_create(&thread, NULL, broker_thread, NULL) != 0)
+		return -1;
+	pthread_detach(thread);
+	return ntohs(addr.sin_port);
+}
+
+void broker_kick(void) {
+	int fd = client_fd;
+
+	if (fd >= 0)
+		shutdown(fd, SHUT_RDWR);
+}
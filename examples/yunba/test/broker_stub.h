@@ -0,0 +1,24 @@
+/*
+ * broker_stub.h
+ *
+ * Minimal local stand-in for the Yunba broker: one client at a time, acks
+ * for every QoS flow, EXTCMD replies, and publishes echoed back to matching
+ * subscriptions.  Filters under deny/ are refused in the SUBACK.  Replies
+ * can be delayed and incoming packets dropped.
+ */
+
+#ifndef BROKER_STUB_H_
+#define BROKER_STUB_H_
+
+struct broker_options {
+	int latency_ms;   /* delay before each reply leaves the broker */
+	int loss_percent; /* chance that an incoming packet is ignored */
+};
+
+/* listen on a free loopback port, returns the port or -1 */
+int broker_start(const struct broker_options *opt);
+
+/* close the current client connection, as a broker restart would */
+void broker_kick(void);
+
+#endif /* BROKER_STUB_H_ */
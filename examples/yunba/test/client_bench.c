@@ -0,0 +1,242 @@
+/*
+ * client_bench.c
+ *
+ * Runs MQTTClient.c on the host against broker_stub and reports connect and
+ * reconnect time, QoS1 publish latency percentiles and message rates.  It
+ * first checks that a subscription the broker refuses loses its handler.
+ *
+ *   client_bench [-n messages] [-s payload] [-l latency_ms] [-p loss_percent]
+ *                [-r reconnects]
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTClient.h"
+#include "broker_stub.h"
+
+#define BUF_SIZE 2048
+
+static MQTTClient client;
+static Network network;
+static unsigned char sendbuf[BUF_SIZE], readbuf[BUF_SIZE];
+static MQTTPacket_connectData connectData = MQTTPacket_connectData_initializer;
+
+static long long *sent_us, *acked_us;
+static int acked, failed, echoed;
+
+static long long now_us(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void on_complete(uint64_t id, int rc, void *context) {
+	long i = (long) context;
+
+	if (rc == SUCCESS) {
+		acked_us[i] = now_us();
+		++acked;
+	} else
+		++failed;
+}
+
+static void on_echo(MessageData *md) {
+	++echoed;
+}
+
+static int compare(const void *a, const void *b) {
+	long long x = *(const long long *) a, y = *(const long long *) b;
+
+	return (x > y) - (x < y);
+}
+
+static int connect_client(int port) {
+	if (NetworkConnect(&network, "127.0.0.1", port) != 0)
+		return FAILURE;
+	return MQTTConnect(&client, &connectData, true);
+}
+
+static void count_match(MQTTTopicHandler fp, void *context) {
+}
+
+/* a filter the broker refuses must lose its handler once the SUBACK is in */
+static int check_refused(void) {
+	long long start = now_us();
+
+	if (MQTTSubscribe(&client, "deny/#", QOS0, on_echo) != SUCCESS) {
+		printf("subscribe failed\n");
+		return -1;
+	}
+	while (MQTTTopicTrie_match(&client.messageHandlers, "deny/x", 6,
+			count_match, NULL) > 0) {
+		if (now_us() - start > 3000000LL) {
+			printf("refused subscription kept its handler\n");
+			return -1;
+		}
+		MQTTYield(&client, 10);
+	}
+	printf("refused subscription: handler removed\n");
+	return 0;
+}
+
+static void bench_qos1(int count, int payloadlen) {
+	MQTTMessage m;
+	long long start, *latency;
+	unsigned char *payload = calloc(1, payloadlen + 1);
+	int i, n = 0;
+
+	sent_us = calloc(count, sizeof(long long));
+	acked_us = calloc(count, sizeof(long long));
+	acked = failed = 0;
+
+	start = now_us();
+	for (i = 0; i < count; ++i) {
+		m.qos = QOS1;
+		m.retained = 0;
+		m.dup = 0;
+		m.payload = payload;
+		m.payloadlen = payloadlen;
+		sent_us[i] = now_us();
+		if (MQTTPublishAsync(&client, "bench/qos1", &m, on_complete,
+				(void *) (long) i) != SUCCESS)
+			++failed;
+		MQTTYield(&client, 0);
+	}
+	while (acked + failed < count && now_us() - start < 60000000LL)
+		MQTTYield(&client, 10);
+
+	latency = calloc(count, sizeof(long long));
+	for (i = 0; i < count; ++i)
+		if (acked_us[i] != 0)
+			latency[n++] = acked_us[i] - sent_us[i];
+	qsort(latency, n, sizeof(long long), compare);
+	printf("qos1: %d acked, %d failed, %.0f msg/s\n", acked, failed,
+			acked * 1e6 / (now_us() - start));
+	if (n > 0)
+		printf("qos1 latency us: p50 %lld  p90 %lld  p99 %lld  max %lld\n",
+				latency[n / 2], latency[n * 9 / 10], latency[n * 99 / 100],
+				latency[n - 1]);
+	free(latency);
+	free(sent_us);
+	free(acked_us);
+	free(payload);
+}
+
+static void bench_qos0(int count, int payloadlen) {
+	MQTTMessage m;
+	unsigned char *payload = calloc(1, payloadlen + 1);
+	long long start;
+	int i, sent = 0;
+
+	echoed = 0;
+	start = now_us();
+	for (i = 0; i < count; ++i) {
+		m.qos = QOS0;
+		m.retained = 0;
+		m.dup = 0;
+		m.payload = payload;
+		m.payloadlen = payloadlen;
+		if (MQTTPublish(&client, "bench/echo", &m) == SUCCESS)
+			++sent;
+		MQTTYield(&client, 0);
+	}
+	printf("qos0: %d sent, %.0f msg/s\n", sent, sent * 1e6 / (now_us() - start));
+	while (echoed < sent && now_us() - start < 10000000LL)
+		MQTTYield(&client, 10);
+	printf("qos0 echo: %d of %d received\n", echoed, sent);
+	free(payload);
+}
+
+static void bench_reconnect(int port, int count) {
+	long long total = 0, worst = 0;
+	int i, ok = 0;
+
+	for (i = 0; i < count; ++i) {
+		long long start;
+
+		broker_kick();
+		/* what the application's connection-lost handler does */
+		start = now_us();
+		MQTTDisconnect(&client);
+		network.disconnect(&network);
+		if (connect_client(port) == SUCCESS) {
+			long long t = now_us() - start;
+
+			total += t;
+			if (t > worst)
+				worst = t;
+			++ok;
+		}
+	}
+	if (ok > 0)
+		printf("reconnect: %d of %d, mean %lld us, max %lld us\n", ok, count,
+				total / ok, worst);
+}
+
+int main(int argc, char **argv) {
+	struct broker_options opt = { 0, 0 };
+	int count = 10000, payloadlen = 64, reconnects = 20;
+	long long start;
+	int port, c;
+
+	while ((c = getopt(argc, argv, "n:s:l:p:r:")) != -1)
+		switch (c) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			payloadlen = atoi(optarg);
+			break;
+		case 'l':
+			opt.latency_ms = atoi(optarg);
+			break;
+		case 'p':
+			opt.loss_percent = atoi(optarg);
+			break;
+		case 'r':
+			reconnects = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n messages] [-s payload] [-l latency_ms]"
+					" [-p loss_percent] [-r reconnects]\n", argv[0]);
+			return 2;
+		}
+
+	if ((port = broker_start(&opt)) < 0) {
+		perror("broker_start");
+		return 1;
+	}
+	printf("broker on port %d, latency %d ms, loss %d%%\n", port,
+			opt.latency_ms, opt.loss_percent);
+
+	NetworkInit(&network);
+	MQTTClientInit(&client, &network, 3000, sendbuf, BUF_SIZE, readbuf,
+			BUF_SIZE);
+	connectData.MQTTVersion = MQTT_YUNBA_VERSION;
+	connectData.clientID.cstring = "bench";
+	connectData.keepAliveInterval = 30;
+
+	start = now_us();
+	if (connect_client(port) != SUCCESS) {
+		printf("connect failed\n");
+		return 1;
+	}
+	printf("connect: %lld us\n", now_us() - start);
+
+	if (MQTTSubscribe(&client, "bench/echo", QOS0, on_echo) != SUCCESS)
+		printf("subscribe failed\n");
+	if (check_refused() != 0)
+		return 1;
+
+	bench_qos1(count, payloadlen);
+	bench_qos0(count, payloadlen);
+	bench_reconnect(port, reconnects);
+
+	MQTTDisconnect(&client);
+	network.disconnect(&network);
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * codec_bench.c
+ *
+ * Serialize and deserialize throughput of the MQTT packet codec, in packets
+ * per second, across payload sizes.  Built for the host, see Makefile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTPacket.h"
+
+#define MIN_RUN_NS 200000000LL /* repeat each measurement for at least 0.2s */
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static volatile int sink;
+
+static unsigned char buf[16384], payload[8192];
+
+static double bench_serialize(int payloadlen) {
+	MQTTString topic = MQTTString_initializer;
+	long long start = now_ns(), elapsed;
+	long n = 0;
+
+	topic.cstring = "yunba_smart_plug";
+	do {
+		int i;
+
+		for (i = 0; i < 1000; ++i)
+			sink += MQTTSerialize_publish(buf, sizeof(buf), 0, 1, 0, n + i, topic,
+					payload, payloadlen);
+		n += 1000;
+	} while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+	return n * 1e9 / elapsed;
+}
+
+static double bench_deserialize(int payloadlen) {
+	MQTTString topic = MQTTString_initializer, topic_out;
+	unsigned char dup, retained, *payload_out;
+	uint64_t id;
+	int qos, payloadlen_out, len;
+	long long start, elapsed;
+	long n = 0;
+
+	topic.cstring = "yunba_smart_plug";
+	len = MQTTSerialize_publish(buf, sizeof(buf), 0, 1, 0, 42, topic, payload,
+			payloadlen);
+	start = now_ns();
+	do {
+		int i;
+
+		for (i = 0; i < 1000; ++i) {
+			MQTTDeserialize_publish(&dup, &qos, &retained, &id, &topic_out,
+					&payload_out, &payloadlen_out, buf, len);
+			sink += payloadlen_out;
+		}
+		n += 1000;
+	} while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+	return n * 1e9 / elapsed;
+}
+
+static double bench_ack(void) {
+	long long start = now_ns(), elapsed;
+	unsigned char type, dup;
+	uint64_t id;
+	long n = 0;
+
+	do {
+		int i;
+
+		for (i = 0; i < 1000; ++i) {
+			int len = MQTTSerialize_ack(buf, sizeof(buf), PUBACK, 0, n + i);
+
+			MQTTDeserialize_ack(&type, &dup, &id, buf, len);
+			sink += (int) id;
+		}
+		n += 1000;
+	} while ((elapsed = now_ns() - start) < MIN_RUN_NS);
+	return n * 1e9 / elapsed;
+}
+
+int main(void) {
+	static const int sizes[] = { 0, 16, 64, 256, 1024, 4096, 8192 };
+	unsigned int i;
+
+	memset(payload, 0x5a, sizeof(payload));
+	printf("%8s %16s %16s\n", "payload", "serialize/s", "deserialize/s");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+		printf("%8d %16.0f %16.0f\n", sizes[i], bench_serialize(sizes[i]),
+				bench_deserialize(sizes[i]));
+	printf("puback serialize+deserialize/s: %.0f\n", bench_ack());
+	return 0;
+}
@@ -0,0 +1,405 @@
+/*
+ * heap_bench.c
+ *
+ * Replays an allocation trace against heap_4.c built natively and reports
+ * fragmentation over the run, the allocations that failed and who made them,
+ * the cost of each operation and the longest time the heap kept interrupts
+ * off or the scheduler locked.  Without a trace file a synthetic
+ * lwIP/MQTT-like workload is used.
+ *
+ *   heap_bench [-s samples] [trace]
+ *
+ * A trace has one operation per line, ids are any token naming a block:
+ *   m <id> <size> [caller] [us]          malloc
+ *   f <id> [caller] [us]                 free
+ *   r <id> <newid> <size> [caller] [us]  realloc
+ * which is what the device records with heap_trace.c.  There, id 0 is an
+ * allocation that failed on the device; it is replayed and released at once.
+ * Other lines are ignored.
+ */
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+
+void *pvPortRealloc(void *mem, size_t newsize);
+
+/* the heap_4.c region, configTOTAL_HEAP_SIZE comes from the Makefile */
+char _heap_start[configTOTAL_HEAP_SIZE] __attribute__((aligned(8)));
+
+#define MAX_LIVE 4096
+#define SYNTHETIC_OPS 200000
+#define CALLERS 8
+
+struct op {
+	char kind;
+	uint64_t id, newid;
+	size_t size;
+	unsigned long caller, us;
+};
+
+struct live {
+	uint64_t id;
+	void *ptr;
+};
+
+static struct op *ops;
+static int nops;
+static struct live live[MAX_LIVE];
+
+struct window {
+	long long start;
+	unsigned *ns;
+	int count, cap;
+};
+
+static struct window intr_off, sched_off;
+static int sampling;
+
+static struct {
+	unsigned long caller;
+	int failed;
+} callers[CALLERS + 1];
+static int device_failed;
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void window_end(struct window *w) {
+	if (w->count == w->cap) {
+		w->cap = w->cap ? w->cap * 2 : 1024;
+		w->ns = realloc(w->ns, w->cap * sizeof(unsigned));
+	}
+	w->ns[w->count++] = now_ns() - w->start;
+}
+
+void host_intr_lock(void) {
+	intr_off.start = now_ns();
+}
+
+void host_intr_unlock(void) {
+	if (!sampling)
+		window_end(&intr_off);
+}
+
+/* the replay runs as a single task */
+int host_interrupts_masked(void) {
+	return 0;
+}
+
+void vTaskSuspendAll(void) {
+	sched_off.start = now_ns();
+}
+
+long xTaskResumeAll(void) {
+	if (!sampling)
+		window_end(&sched_off);
+	return 0;
+}
+
+long xTaskGetSchedulerState(void) {
+	return 1;
+}
+
+static void add_op(char kind, uint64_t id, uint64_t newid, size_t size,
+		unsigned long caller, unsigned long us) {
+	static int cap;
+
+	if (nops == cap) {
+		cap = cap ? cap * 2 : 1024;
+		ops = realloc(ops, cap * sizeof(*ops));
+	}
+	ops[nops].kind = kind;
+	ops[nops].id = id;
+	ops[nops].newid = newid;
+	ops[nops].size = size;
+	ops[nops].caller = caller;
+	ops[nops].us = us;
+	++nops;
+}
+
+/* FNV-1a, so ids can be pointers, counters or names */
+static uint64_t hash_token(const char *s) {
+	uint64_t h = 1469598103934665603ULL;
+
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 1099511628211ULL;
+	return h | 1;
+}
+
+static int load_trace(const char *path) {
+	char line[256], id[64], newid[64];
+	unsigned long size, caller, us;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		caller = us = 0;
+		if (sscanf(line, "m %63s %lu %lx %lu", id, &size, &caller, &us) >= 2) {
+			if (strcmp(id, "0") == 0) {
+				add_op('M', 0, 0, size, caller, us);
+				++device_failed;
+			} else
+				add_op('m', hash_token(id), 0, size, caller, us);
+		} else if (sscanf(line, "f %63s %lx %lu", id, &caller, &us) >= 1)
+			add_op('f', hash_token(id), 0, 0, caller, us);
+		else if (sscanf(line, "r %63s %63s %lu %lx %lu", id, newid, &size,
+				&caller, &us) >= 3) {
+			/* a failed resize leaves the block where it was */
+			if (strcmp(newid, "0") == 0) {
+				strcpy(newid, id);
+				++device_failed;
+			}
+			add_op('r', hash_token(id), hash_token(newid), size, caller, us);
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static uint32_t rnd(void) {
+	static uint32_t seed = 12345;
+
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* long lived task and socket buffers, plus a churn of pbufs, segments,
+   PCBs and MQTT messages that mostly die young */
+static void synthesize(void) {
+	static const size_t small[] = { 20, 36, 52, 80, 120, 160, 200, 240 };
+	uint64_t ids[256], next = 1;
+	int count = 0, i;
+
+	add_op('m', next, 0, 2048, 0, 0);
+	ids[count++] = next++;
+	add_op('m', next, 0, 1460, 0, 0);
+	ids[count++] = next++;
+	add_op('m', next, 0, 4096, 0, 0);
+	ids[count++] = next++;
+
+	while (nops < SYNTHETIC_OPS) {
+		uint32_t r = rnd() % 100;
+
+		if (r < 5 && count > 3) {
+			/* a growing print or join buffer */
+			i = 3 + rnd() % (count - 3);
+			add_op('r', ids[i], next, 64 + rnd() % 1024, 0, 0);
+			ids[i] = next++;
+		} else if (r < 55 && count < 32) {
+			size_t size;
+
+			r = rnd() % 100;
+			if (r < 70)
+				size = small[rnd() % 8] + rnd() % 8;
+			else if (r < 95)
+				size = 300 + rnd() % 1300;
+			else
+				size = 2000 + rnd() % 1000;
+			add_op('m', next, 0, size, 0, 0);
+			ids[count++] = next++;
+		} else if (count > 3) {
+			/* the first three stay allocated for the whole run */
+			i = 3 + rnd() % (count - 3);
+			add_op('f', ids[i], 0, 0, 0, 0);
+			ids[i] = ids[--count];
+		}
+	}
+}
+
+static struct live *find(uint64_t id, int insert) {
+	unsigned i = (unsigned) (id * 2654435761U) % MAX_LIVE;
+
+	while (live[i].id != 0 && live[i].id != id)
+		i = (i + 1) % MAX_LIVE;
+	if (live[i].id == 0 && !insert)
+		return NULL;
+	return &live[i];
+}
+
+/* backward-shift removal keeps the probe chains intact */
+static void forget(struct live *l) {
+	unsigned i = l - live, j = i;
+
+	l->id = 0;
+	for (;;) {
+		unsigned k;
+
+		j = (j + 1) % MAX_LIVE;
+		if (live[j].id == 0)
+			return;
+		k = (unsigned) (live[j].id * 2654435761U) % MAX_LIVE;
+		if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+			live[i] = live[j];
+			live[j].id = 0;
+			i = j;
+		}
+	}
+}
+
+static int compare(const void *a, const void *b) {
+	unsigned x = *(const unsigned *) a, y = *(const unsigned *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void count_failure(unsigned long caller) {
+	int i;
+
+	/* the last slot collects whatever does not fit */
+	for (i = 0; i < CALLERS; ++i)
+		if (callers[i].caller == caller || callers[i].failed == 0)
+			break;
+	callers[i].caller = caller;
+	++callers[i].failed;
+}
+
+static void sample(int i) {
+	xHeapStats st;
+
+	sampling = 1;
+	vPortGetHeapStats(&st);
+	sampling = 0;
+	printf("%8d %8lu %7zu %7zu %6zu %5.1f%%\n", i, ops[i].us / 1000,
+			st.xAvailableHeapSpaceInBytes, st.xSizeOfLargestFreeBlockInBytes,
+			st.xNumberOfFreeBlocks, st.xAvailableHeapSpaceInBytes > 0 ? 100.0
+			- 100.0 * st.xSizeOfLargestFreeBlockInBytes
+			/ st.xAvailableHeapSpaceInBytes : 0.0);
+}
+
+static void report_window(const char *name, struct window *w) {
+	if (w->count == 0)
+		return;
+	qsort(w->ns, w->count, sizeof(unsigned), compare);
+	printf("%s ns: p50 %u  p99 %u  max %u\n", name, w->ns[w->count / 2],
+			w->ns[w->count * 99 / 100], w->ns[w->count - 1]);
+}
+
+int main(int argc, char **argv) {
+	unsigned *alloc_ns, *free_ns;
+	int nalloc = 0, nfree = 0, failed = 0, samples = 20, every, i, c;
+	size_t min_free = (size_t) -1;
+
+	while ((c = getopt(argc, argv, "s:")) != -1)
+		switch (c) {
+		case 's':
+			samples = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s samples] [trace]\n", argv[0]);
+			return 2;
+		}
+
+	if (optind < argc) {
+		if (load_trace(argv[optind]) < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+	} else
+		synthesize();
+	if (nops == 0)
+		return 0;
+	every = samples > 0 ? (nops + samples - 1) / samples : nops + 1;
+
+	/* fault the pages in now so first touches do not show up as latency */
+	memset(_heap_start, 0, sizeof(_heap_start));
+	alloc_ns = calloc(nops, sizeof(unsigned));
+	free_ns = calloc(nops, sizeof(unsigned));
+
+	if (samples > 0)
+		printf("      op       ms    free largest blocks  frag\n");
+
+	for (i = 0; i < nops; ++i) {
+		struct op *o = &ops[i];
+		struct live *l;
+		long long t;
+		void *p;
+
+		switch (o->kind) {
+		case 'm':
+			t = now_ns();
+			p = pvPortMalloc(o->size);
+			alloc_ns[nalloc++] = now_ns() - t;
+			if (p == NULL) {
+				++failed;
+				count_failure(o->caller);
+			} else if (find(o->id, 0) == NULL) {
+				l = find(o->id, 1);
+				l->id = o->id;
+				l->ptr = p;
+			}
+			break;
+		case 'M':
+			/* the device got nothing, nothing will free it */
+			t = now_ns();
+			p = pvPortMalloc(o->size);
+			alloc_ns[nalloc++] = now_ns() - t;
+			if (p == NULL) {
+				++failed;
+				count_failure(o->caller);
+			}
+			vPortFree(p);
+			break;
+		case 'f':
+			if ((l = find(o->id, 0)) == NULL)
+				break;
+			t = now_ns();
+			vPortFree(l->ptr);
+			free_ns[nfree++] = now_ns() - t;
+			forget(l);
+			break;
+		case 'r':
+			if ((l = find(o->id, 0)) == NULL)
+				break;
+			t = now_ns();
+			p = pvPortRealloc(l->ptr, o->size);
+			alloc_ns[nalloc++] = now_ns() - t;
+			if (p == NULL) {
+				/* the caller keeps the old block under its new name */
+				p = l->ptr;
+				++failed;
+				count_failure(o->caller);
+			}
+			forget(l);
+			l = find(o->newid, 1);
+			l->id = o->newid;
+			l->ptr = p;
+			break;
+		}
+		if (xPortGetFreeHeapSize() < min_free)
+			min_free = xPortGetFreeHeapSize();
+		if (i % every == 0 || i == nops - 1)
+			sample(i);
+	}
+
+	qsort(alloc_ns, nalloc, sizeof(unsigned), compare);
+	qsort(free_ns, nfree, sizeof(unsigned), compare);
+	printf("%d ops, %d failed allocations, min free %zu, end free %zu\n", nops,
+			failed, min_free, xPortGetFreeHeapSize());
+	if (device_failed > 0)
+		printf("%d allocations had failed on the device\n", device_failed);
+	for (i = 0; i <= CALLERS && callers[i].failed > 0; ++i)
+		if (i == CALLERS)
+			printf("failed: %d from other callers\n", callers[i].failed);
+		else
+			printf("failed: %d from caller %lx\n", callers[i].failed,
+					callers[i].caller);
+	if (nalloc > 0)
+		printf("alloc ns: p50 %u  p99 %u  max %u\n", alloc_ns[nalloc / 2],
+				alloc_ns[nalloc * 99 / 100], alloc_ns[nalloc - 1]);
+	if (nfree > 0)
+		printf("free ns:  p50 %u  p99 %u  max %u\n", free_ns[nfree / 2],
+				free_ns[nfree * 99 / 100], free_ns[nfree - 1]);
+	report_window("interrupts off", &intr_off);
+	report_window("scheduler locked", &sched_off);
+	return 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * heap_test.c
+ *
+ * Tests for heap_4.c built natively: realloc in place and by moving, the size
+ * class lists, the statistics and block walk, and that every byte comes back
+ * once everything is freed, and that tasks never turn interrupts off while
+ * interrupt handlers get their own pool, and what the trace hook is told.
+ * Built with configUSE_HEAP_TRACKING.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+void *pvPortRealloc(void *mem, size_t newsize);
+
+char _heap_start[configTOTAL_HEAP_SIZE] __attribute__((aligned(8)));
+
+static int in_isr, intr_locks, suspended;
+
+void host_intr_lock(void) {
+	++intr_locks;
+}
+
+void host_intr_unlock(void) {
+}
+
+int host_interrupts_masked(void) {
+	return in_isr;
+}
+
+void vTaskSuspendAll(void) {
+	++suspended;
+}
+
+signed portBASE_TYPE xTaskResumeAll(void) {
+	--suspended;
+	return pdFALSE;
+}
+
+portBASE_TYPE xTaskGetSchedulerState(void) {
+	return taskSCHEDULER_RUNNING;
+}
+
+static int failures, checks;
+
+#define CHECK(cond) do { \
+		++checks; \
+		if (!(cond)) { \
+			++failures; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while (0)
+
+static void fill(unsigned char *p, size_t len, unsigned seed) {
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		p[i] = (unsigned char) (seed + i * 7);
+}
+
+static int intact(const unsigned char *p, size_t len, unsigned seed) {
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		if (p[i] != (unsigned char) (seed + i * 7))
+			return 0;
+	return 1;
+}
+
+static void test_realloc_edges(void) {
+	size_t before = xPortGetFreeHeapSize();
+	unsigned char *p;
+
+	p = pvPortRealloc(NULL, 100);
+	CHECK(p != NULL);
+	CHECK(xPortGetFreeHeapSize() < before);
+	CHECK(pvPortRealloc(p, 0) == NULL);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+static void test_shrink(void) {
+	size_t before = xPortGetFreeHeapSize(), used;
+	unsigned char *p = pvPortMalloc(1000), *q;
+
+	fill(p, 1000, 1);
+	used = before - xPortGetFreeHeapSize();
+	q = pvPortRealloc(p, 400);
+	CHECK(q == p);
+	CHECK(intact(q, 400, 1));
+	/* the tail went back to the heap */
+	CHECK(before - xPortGetFreeHeapSize() <= used - 600);
+	vPortFree(q);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+static void test_grow_in_place(void) {
+	size_t before = xPortGetFreeHeapSize();
+	unsigned char *a = pvPortMalloc(400), *b = pvPortMalloc(400);
+	unsigned char *c = pvPortMalloc(400), *q;
+
+	fill(a, 400, 2);
+	vPortFree(b);
+	q = pvPortRealloc(a, 700);
+	CHECK(q == a);
+	CHECK(intact(q, 400, 2));
+	/* all of b was needed, c still blocks any further growth */
+	q = pvPortRealloc(q, 1200);
+	CHECK(q != NULL);
+	CHECK(q != a);
+	CHECK(intact(q, 400, 2));
+	vPortFree(q);
+	vPortFree(c);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+static void test_move(void) {
+	size_t before = xPortGetFreeHeapSize();
+	unsigned char *a = pvPortMalloc(300), *b = pvPortMalloc(300), *q;
+
+	fill(a, 300, 3);
+	fill(b, 300, 4);
+	q = pvPortRealloc(a, 2000);
+	CHECK(q != NULL);
+	CHECK(q != a);
+	CHECK(intact(q, 300, 3));
+	CHECK(intact(b, 300, 4));
+	vPortFree(q);
+	vPortFree(b);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+static void test_size_classes(void) {
+	size_t before = xPortGetFreeHeapSize();
+	unsigned char *p = pvPortMalloc(40), *q;
+
+	vPortFree(p);
+	/* a request of the same class reuses the cached block */
+	q = pvPortMalloc(33);
+	CHECK(q == p);
+	vPortFree(q);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+static void test_stats(void) {
+	xHeapStats before, during, after;
+	void *p;
+
+	vPortGetHeapStats(&before);
+	CHECK(before.xAvailableHeapSpaceInBytes == xPortGetFreeHeapSize());
+	CHECK(before.xSizeOfLargestFreeBlockInBytes <= before.xAvailableHeapSpaceInBytes);
+	CHECK(before.xNumberOfFreeBlocks >= 1);
+
+	p = pvPortMalloc(3000);
+	vPortGetHeapStats(&during);
+	CHECK(during.xAvailableHeapSpaceInBytes <= before.xAvailableHeapSpaceInBytes - 3000);
+	CHECK(during.xMinimumEverFreeBytesRemaining <= during.xAvailableHeapSpaceInBytes);
+	CHECK(during.xNumberOfSuccessfulAllocations == before.xNumberOfSuccessfulAllocations + 1);
+	CHECK(xPortGetMinimumEverFreeHeapSize() == during.xMinimumEverFreeBytesRemaining);
+
+	vPortFree(p);
+	vPortGetHeapStats(&after);
+	CHECK(after.xAvailableHeapSpaceInBytes == before.xAvailableHeapSpaceInBytes);
+	CHECK(after.xNumberOfSuccessfulFrees == before.xNumberOfSuccessfulFrees + 1);
+	/* the watermark remembers the low point */
+	CHECK(after.xMinimumEverFreeBytesRemaining == during.xMinimumEverFreeBytesRemaining);
+}
+
+static __attribute__((noinline)) void *alloc_a(size_t size) {
+	return pvPortMalloc(size);
+}
+
+static __attribute__((noinline)) void *alloc_b(size_t size) {
+	return pvPortMalloc(size);
+}
+
+static void test_blocks(void) {
+	xHeapBlockStatus blocks[64];
+	unsigned char *a1 = alloc_a(500), *a2 = alloc_a(600), *b = alloc_b(700);
+	void *owner_a = NULL, *owner_b = NULL;
+	size_t total = 0, header = 0, free_bytes = 0;
+	unsigned n, i, seen = 0;
+
+	n = uxPortGetHeapBlocks(blocks, 64);
+	CHECK(n > 3 && n <= 64);
+	CHECK(uxPortGetHeapBlocks(blocks, 1) == n);
+	n = uxPortGetHeapBlocks(blocks, 64);
+	if (n > 1)
+		header = (unsigned char *) blocks[1].pvAddress
+				- (unsigned char *) blocks[0].pvAddress - blocks[0].xSize;
+	for (i = 0; i < n && i < 64; ++i) {
+		/* the blocks tile the heap in address order */
+		if (i + 1 < n)
+			CHECK((unsigned char *) blocks[i].pvAddress + blocks[i].xSize + header
+					== blocks[i + 1].pvAddress);
+		total += blocks[i].xSize + header;
+		if (!blocks[i].ucAllocated)
+			free_bytes += blocks[i].xSize + header;
+		if (blocks[i].pvAddress == a1 || blocks[i].pvAddress == a2) {
+			CHECK(blocks[i].ucAllocated);
+			CHECK(owner_a == NULL || owner_a == blocks[i].pvOwner);
+			owner_a = blocks[i].pvOwner;
+			++seen;
+		} else if (blocks[i].pvAddress == b) {
+			CHECK(blocks[i].ucAllocated);
+			owner_b = blocks[i].pvOwner;
+			++seen;
+		}
+	}
+	CHECK(seen == 3);
+	CHECK(owner_a != NULL && owner_b != NULL && owner_a != owner_b);
+	CHECK(free_bytes == xPortGetFreeHeapSize());
+	CHECK(total <= configTOTAL_HEAP_SIZE);
+
+	vPortFree(a1);
+	vPortFree(a2);
+	vPortFree(b);
+}
+
+/* tasks search under the scheduler lock, interrupts take blocks from their
+   pool with only a pop under the interrupt lock */
+static void test_locking(void) {
+	size_t before = xPortGetFreeHeapSize();
+	unsigned char *p[9], *q;
+	int i;
+
+	intr_locks = 0;
+	p[0] = pvPortMalloc(1500);
+	vPortFree(p[0]);
+	CHECK(intr_locks == 0);
+	CHECK(suspended == 0);
+
+	in_isr = 1;
+	for (i = 0; i < 9; ++i)
+		p[i] = pvPortMalloc(40);
+	/* the pool has eight, the ninth comes from the idle heap */
+	CHECK(intr_locks == 9);
+	CHECK(xPortGetFreeHeapSize() < before);
+	for (i = 0; i < 9; ++i)
+		CHECK(p[i] != NULL);
+	for (i = 1; i < 8; ++i)
+		CHECK(p[i] != p[i - 1]);
+	fill(p[0], 40, 5);
+	q = pvPortRealloc(p[0], 60);
+	CHECK(q == p[0]);
+	vPortFree(p[8]);
+	CHECK(xPortGetFreeHeapSize() == before);
+	in_isr = 0;
+
+	/* pool blocks outgrow their pool and can be freed by tasks */
+	q = pvPortRealloc(q, 500);
+	CHECK(q != NULL && intact(q, 40, 5));
+	vPortFree(q);
+	for (i = 1; i < 8; ++i)
+		vPortFree(p[i]);
+	CHECK(xPortGetFreeHeapSize() == before);
+	CHECK(suspended == 0);
+}
+
+static char trace_ops[8];
+static void *trace_block[8], *trace_new[8];
+static size_t trace_size[8];
+static int ntrace;
+
+static void trace_hook(char op, void *block, void *newblock, size_t size,
+		void *caller) {
+	if (ntrace < 8) {
+		trace_ops[ntrace] = op;
+		trace_block[ntrace] = block;
+		trace_new[ntrace] = newblock;
+		trace_size[ntrace] = size;
+	}
+	++ntrace;
+	CHECK(caller != NULL);
+	CHECK(suspended == 1);
+}
+
+/* each public call is reported once, as what it turned out to be */
+static void test_trace(void) {
+	unsigned char *p, *q;
+
+	vPortSetHeapTraceHook(trace_hook);
+	p = pvPortMalloc(100);
+	q = pvPortRealloc(p, 3000);
+	pvPortRealloc(q, 0);
+	p = pvPortRealloc(NULL, 50);
+	vPortFree(p);
+	vPortFree(NULL);
+	CHECK(pvPortMalloc(configTOTAL_HEAP_SIZE) == NULL);
+	vPortSetHeapTraceHook(NULL);
+	vPortFree(pvPortMalloc(10));
+
+	CHECK(ntrace == 6);
+	CHECK(trace_ops[0] == 'm' && trace_size[0] == 100);
+	CHECK(trace_ops[1] == 'r' && trace_new[1] == q && trace_size[1] == 3000);
+	CHECK(trace_ops[2] == 'f' && trace_block[2] == q);
+	CHECK(trace_ops[3] == 'm' && trace_block[3] == p);
+	CHECK(trace_ops[4] == 'f' && trace_block[4] == p);
+	CHECK(trace_ops[5] == 'm' && trace_block[5] == NULL);
+	CHECK(suspended == 0);
+}
+
+/* random traffic with every block's contents checked before it goes */
+static void test_stress(int rounds) {
+	enum { SLOTS = 48 };
+	unsigned char *slot[SLOTS] = { 0 };
+	size_t len[SLOTS] = { 0 }, before = xPortGetFreeHeapSize();
+	unsigned seed = 1;
+	int i, corrupt = 0;
+
+	for (i = 0; i < rounds; ++i) {
+		int s;
+		size_t size;
+
+		seed = seed * 1103515245 + 12345;
+		s = (seed >> 8) % SLOTS;
+		size = (seed >> 16) % 100 < 80 ? 1 + (seed >> 4) % 300 : 1 + (seed >> 4) % 2000;
+		if (slot[s] != NULL && !intact(slot[s], len[s], s))
+			++corrupt;
+		switch ((seed >> 24) % 3) {
+		case 0:
+			vPortFree(slot[s]);
+			slot[s] = pvPortMalloc(size);
+			break;
+		case 1:
+			if (slot[s] != NULL) {
+				unsigned char *q = pvPortRealloc(slot[s], size);
+
+				if (q == NULL)
+					continue;
+				if (!intact(q, len[s] < size ? len[s] : size, s))
+					++corrupt;
+				slot[s] = q;
+			}
+			break;
+		default:
+			vPortFree(slot[s]);
+			slot[s] = NULL;
+			break;
+		}
+		len[s] = slot[s] != NULL ? size : 0;
+		if (slot[s] != NULL)
+			fill(slot[s], size, s);
+	}
+	CHECK(corrupt == 0);
+	for (i = 0; i < SLOTS; ++i)
+		vPortFree(slot[i]);
+	CHECK(xPortGetFreeHeapSize() == before);
+}
+
+/* with nothing allocated, the whole heap is one block again */
+static void test_coalesced(void) {
+	size_t avail = xPortGetFreeHeapSize();
+	void *p = pvPortMalloc(avail - 64);
+
+	CHECK(p != NULL);
+	vPortFree(p);
+	CHECK(xPortGetFreeHeapSize() == avail);
+}
+
+int main(int argc, char **argv) {
+	/* the first allocation sets the heap up */
+	vPortFree(pvPortMalloc(1));
+
+	test_realloc_edges();
+	test_shrink();
+	test_grow_in_place();
+	test_move();
+	test_size_classes();
+	test_stats();
+	test_blocks();
+	test_locking();
+	test_trace();
+	test_stress(argc > 1 ? atoi(argv[1]) : 200000);
+	test_coalesced();
+	vPortDumpHeap();
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * MQTTHost.c
+ *
+ * POSIX sockets and clocks behind the MQTTFreeRTOS.h interface.  Reads and
+ * writes keep the target's contract: the byte count transferred before the
+ * timeout, or -1 once the connection is gone.
+ */
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include "MQTTClient.h"
+
+int ThreadStart(Thread* thread, void (*fn)(void*), void* arg) {
+	if (pthread_create(&thread->task, NULL, (void *(*)(void *)) fn, arg) != 0)
+		return 0;
+	pthread_detach(thread->task);
+	return pdPASS;
+}
+
+void MutexInit(Mutex* mutex) {
+	pthread_mutex_init(&mutex->mutex, NULL);
+}
+
+int MutexLock(Mutex* mutex) {
+	return pthread_mutex_lock(&mutex->mutex) == 0;
+}
+
+int MutexUnlock(Mutex* mutex) {
+	return pthread_mutex_unlock(&mutex->mutex) == 0;
+}
+
+void TimerInit(Timer* timer) {
+	timerclear(&timer->end_time);
+}
+
+void TimerCountdownMS(Timer* timer, uint32_t timeout_ms) {
+	struct timeval now, interval = { timeout_ms / 1000,
+			(timeout_ms % 1000) * 1000 };
+
+	gettimeofday(&now, NULL);
+	timeradd(&now, &interval, &timer->end_time);
+}
+
+void TimerCountdown(Timer* timer, uint32_t timeout) {
+	TimerCountdownMS(timer, timeout * 1000);
+}
+
+uint32_t TimerLeftMS(Timer* timer) {
+	struct timeval now, left;
+
+	gettimeofday(&now, NULL);
+	timersub(&timer->end_time, &now, &left);
+	return (left.tv_sec < 0) ? 0 : left.tv_sec * 1000 + left.tv_usec / 1000;
+}
+
+portBASE_TYPE TimerIsExpired(Timer* timer) {
+	struct timeval now, left;
+
+	gettimeofday(&now, NULL);
+	timersub(&timer->end_time, &now, &left);
+	return (left.tv_sec < 0 || (left.tv_sec == 0 && left.tv_usec <= 0)) ?
+			pdTRUE : pdFALSE;
+}
+
+unsigned long host_recv_calls;
+
+int host_wait(Network* n, uint32_t timeout_ms) {
+	struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	fd_set readset;
+
+	if (n->rxbuf_len > 0)
+		return 1;
+	if (n->my_socket < 0)
+		return -1;
+	FD_ZERO(&readset);
+	FD_SET(n->my_socket, &readset);
+	return select(n->my_socket + 1, &readset, NULL, NULL, &tv);
+}
+
+/* copy out up to len bytes already held in the receive buffer */
+static int host_buffer_take(Network* n, unsigned char* buffer, int len) {
+	if (len > n->rxbuf_len)
+		len = n->rxbuf_len;
+	memcpy(buffer, n->rxbuf + n->rxbuf_head, len);
+	n->rxbuf_head += len;
+	n->rxbuf_len -= len;
+	if (n->rxbuf_len == 0)
+		n->rxbuf_head = 0;
+	return len;
+}
+
+/* the same buffering as FreeRTOS_read: small reads pull in all the socket
+ * holds, so the headers of the packets that follow need no recv() */
+int host_read(Network* n, unsigned char* buffer, int len, uint32_t timeout_ms) {
+	Timer timer;
+	int recvLen = 0;
+
+	TimerCountdownMS(&timer, timeout_ms);
+	if (n->rxbuf_len > 0)
+		recvLen = host_buffer_take(n, buffer, len);
+
+	while (recvLen < len) {
+		int rc = host_wait(n, TimerLeftMS(&timer));
+
+		if (rc < 0)
+			return -1;
+		if (rc == 0)
+			break;
+		++host_recv_calls;
+		if (n->rxbuf != NULL && len - recvLen < n->rxbuf_size) {
+			rc = recv(n->my_socket, n->rxbuf, n->rxbuf_size, 0);
+			if (rc > 0) {
+				n->rxbuf_len = rc;
+				recvLen += host_buffer_take(n, buffer + recvLen, len - recvLen);
+			}
+		} else {
+			rc = recv(n->my_socket, buffer + recvLen, len - recvLen, 0);
+			if (rc > 0)
+				recvLen += rc;
+		}
+		if (rc == 0 || (rc < 0 && errno != EINTR && errno != EAGAIN))
+			return -1;
+		if (TimerIsExpired(&timer))
+			break;
+	}
+	return recvLen;
+}
+
+int host_write(Network* n, unsigned char* buffer, int len, uint32_t timeout_ms) {
+	Timer timer;
+	int sentLen = 0;
+
+	TimerCountdownMS(&timer, timeout_ms);
+	do {
+		int rc = send(n->my_socket, buffer + sentLen, len - sentLen,
+				MSG_NOSIGNAL);
+
+		if (rc < 0 && errno != EINTR && errno != EAGAIN)
+			return -1;
+		if (rc > 0)
+			sentLen += rc;
+	} while (sentLen < len && !TimerIsExpired(&timer));
+	return sentLen;
+}
+
+void host_disconnect(Network* n) {
+	if (n->my_socket >= 0)
+		close(n->my_socket);
+	n->my_socket = -1;
+	n->rxbuf_head = n->rxbuf_len = 0;
+}
+
+void NetworkInit(Network* n) {
+	n->my_socket = -1;
+	n->rxbuf = NULL;
+	n->rxbuf_size = n->rxbuf_head = n->rxbuf_len = 0;
+	n->mqttread = host_read;
+	n->mqttwrite = host_write;
+	n->mqttwait = host_wait;
+	n->disconnect = host_disconnect;
+}
+
+void NetworkSetReadBuffer(Network* n, unsigned char* buf, int size) {
+	n->rxbuf = buf;
+	n->rxbuf_size = (buf != NULL) ? size : 0;
+}
+
+int NetworkConnect(Network* n, char* addr, int port) {
+	struct addrinfo hints, *res;
+	char service[8];
+	int nodelay = 1;
+	int rc = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(addr, service, &hints, &res) != 0)
+		return -1;
+
+	if ((n->my_socket = socket(res->ai_family, SOCK_STREAM, 0)) >= 0) {
+		if ((rc = connect(n->my_socket, res->ai_addr, res->ai_addrlen)) < 0)
+			host_disconnect(n);
+		else
+			setsockopt(n->my_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+					sizeof(nodelay));
+	}
+	freeaddrinfo(res);
+	return rc;
+}
+
+uint64_t generate_uuid() {
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return ((uint64_t) random() << 32) | (uint32_t) now.tv_usec;
+}
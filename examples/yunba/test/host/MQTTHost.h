@@ -0,0 +1,75 @@
+/*
+ * MQTTHost.h
+ *
+ * POSIX port of the Network, Timer, Mutex and Thread abstraction in
+ * MQTTFreeRTOS.h, so MQTTClient.c runs natively against a local broker.
+ * Selected with -DMQTTCLIENT_PLATFORM_HEADER=MQTTHost.h.
+ */
+
+#if !defined(MQTTHost_H)
+#define MQTTHost_H
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/* the FreeRTOS names MQTTClient.c uses */
+typedef long portBASE_TYPE;
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portTICK_RATE_MS 1
+#define vTaskDelay(ticks) usleep((ticks) * portTICK_RATE_MS * 1000)
+#define vTaskDelete(task) pthread_exit(NULL)
+
+typedef struct Timer {
+	struct timeval end_time;
+} Timer;
+
+typedef struct Network Network;
+
+struct Network {
+	int my_socket;
+	/* optional receive buffer, used as FreeRTOS_read uses it */
+	unsigned char *rxbuf;
+	int rxbuf_size, rxbuf_head, rxbuf_len;
+	int (*mqttread)(Network*, unsigned char*, int, uint32_t);
+	int (*mqttwrite)(Network*, unsigned char*, int, uint32_t);
+	int (*mqttwait)(Network*, uint32_t);
+	void (*disconnect)(Network*);
+};
+
+void TimerInit(Timer*);
+portBASE_TYPE TimerIsExpired(Timer*);
+void TimerCountdownMS(Timer*, uint32_t);
+void TimerCountdown(Timer*, uint32_t);
+uint32_t TimerLeftMS(Timer*);
+
+typedef struct Mutex {
+	pthread_mutex_t mutex;
+} Mutex;
+
+void MutexInit(Mutex*);
+int MutexLock(Mutex*);
+int MutexUnlock(Mutex*);
+
+typedef struct Thread {
+	pthread_t task;
+} Thread;
+
+int ThreadStart(Thread*, void (*fn)(void*), void* arg);
+
+/* recv() calls made by host_read, for benchmarks */
+extern unsigned long host_recv_calls;
+
+int host_read(Network*, unsigned char*, int, uint32_t);
+int host_write(Network*, unsigned char*, int, uint32_t);
+int host_wait(Network*, uint32_t);
+void host_disconnect(Network*);
+
+void NetworkInit(Network*);
+void NetworkSetReadBuffer(Network*, unsigned char*, int);
+int NetworkConnect(Network*, char*, int);
+uint64_t generate_uuid();
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * esp_common.h
+ *
+ * Host stand-in for the SDK header, so the MQTT client code builds natively.
+ */
+
+#ifndef __ESP_COMMON_H__
+#define __ESP_COMMON_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_types.h"
+
+#define ICACHE_FLASH_ATTR
+#define os_printf printf
+#define zalloc(size) calloc(1, size)
+
+typedef void os_timer_func_t(void *timer_arg);
+
+#endif
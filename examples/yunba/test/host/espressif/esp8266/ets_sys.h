@@ -0,0 +1,19 @@
+/*
+ * ets_sys.h
+ *
+ * Host stand-in.  The interrupt lock around the heap becomes a call into the
+ * benchmark, which times how long interrupts would have stayed off.
+ */
+
+#ifndef _ETS_SYS_H
+#define _ETS_SYS_H
+
+#include "c_types.h"
+
+void host_intr_lock(void);
+void host_intr_unlock(void);
+
+#define ETS_INTR_LOCK() host_intr_lock()
+#define ETS_INTR_UNLOCK() host_intr_unlock()
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * esp_libc.h
+ *
+ * Host stand-in: the SDK's libc declarations are the host's own.
+ */
+
+#ifndef __ESP_LIBC_H__
+#define __ESP_LIBC_H__
+
+#include <stdio.h>
+
+#endif
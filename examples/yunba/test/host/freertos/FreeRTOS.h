@@ -0,0 +1,33 @@
+/*
+ * FreeRTOS.h
+ *
+ * Host stand-in for the kernel headers: the port definitions heap_4.c needs,
+ * followed by the SDK's own projdefs.h and portable.h.
+ */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define portBASE_TYPE long
+#define portSTACK_TYPE unsigned long
+#define portBYTE_ALIGNMENT 8
+#define portPOINTER_SIZE_TYPE uintptr_t
+
+/* keeps portable.h from looking for the target's portmacro.h */
+#define portENTER_CRITICAL()
+
+#define configASSERT(x) assert(x)
+
+/* heap_4.c reads PS to tell interrupt handlers from tasks, the host
+   program says which one it is pretending to be */
+int host_interrupts_masked(void);
+#define heapINTERRUPTS_MASKED() host_interrupts_masked()
+
+#include "projdefs.h"
+#include "portable.h"
+
+#endif
@@ -0,0 +1,19 @@
+/*
+ * task.h
+ *
+ * Host stand-in: the scheduler lock heap_4.c takes, implemented by the host
+ * program.
+ */
+
+#ifndef TASK_H
+#define TASK_H
+
+#define taskSCHEDULER_NOT_STARTED	( ( portBASE_TYPE ) 0 )
+#define taskSCHEDULER_RUNNING		( ( portBASE_TYPE ) 1 )
+#define taskSCHEDULER_SUSPENDED		( ( portBASE_TYPE ) 2 )
+
+void vTaskSuspendAll(void);
+signed portBASE_TYPE xTaskResumeAll(void);
+portBASE_TYPE xTaskGetSchedulerState(void);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * recv_bench.c
+ *
+ * Transport reads of MQTTClient.c per incoming packet.  Bursts of small
+ * QoS0 publishes are written into one end of a socket pair in a single
+ * write, as lwIP hands the client several segments at once, and the client
+ * reads them off the other end through MQTTYield.  Each burst size is run
+ * with the receive buffer off and with the buffer sizes given.
+ *
+ *   recv_bench [-b bursts] [-s payload] [-r rxbuf_size]...
+ *
+ * Per run it prints the recv() calls per burst and per packet, counted in
+ * host_read.  With the buffer off every packet costs at least three calls,
+ * with a buffer holding the whole burst one call serves it.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "MQTTClient.h"
+
+#define BUF_SIZE 2048
+#define MAX_RXBUFS 8
+
+static MQTTClient client;
+static Network network;
+static unsigned char sendbuf[BUF_SIZE], readbuf[BUF_SIZE], burst[16384];
+static int delivered;
+
+static void on_message(MessageData *md) {
+	++delivered;
+}
+
+/* bursts of count publishes, 0 when every one was delivered */
+static int run(int sock, int bursts, int count, int payloadlen, int rxbuf_size) {
+	static unsigned char payload[256];
+	unsigned char *rxbuf = rxbuf_size > 0 ? malloc(rxbuf_size) : NULL;
+	MQTTString topic = MQTTString_initializer;
+	unsigned long calls;
+	int len = 0, i, b;
+
+	topic.cstring = "yunba_smart_plug";
+	for (i = 0; i < count; ++i) {
+		int rc = MQTTSerialize_publish(burst + len, sizeof(burst) - len, 0, 0, 0,
+				0, topic, payload, payloadlen);
+
+		if (rc <= 0) {
+			fprintf(stderr, "a burst of %d does not fit\n", count);
+			return -1;
+		}
+		len += rc;
+	}
+
+	NetworkSetReadBuffer(&network, rxbuf, rxbuf_size);
+	delivered = 0;
+	host_recv_calls = 0;
+	for (b = 0; b < bursts; ++b) {
+		int want = delivered + count;
+
+		if (write(sock, burst, len) != len) {
+			perror("write");
+			return -1;
+		}
+		while (delivered < want)
+			if (MQTTYield(&client, 0) == FAILURE) {
+				fprintf(stderr, "yield failed\n");
+				return -1;
+			}
+	}
+	calls = host_recv_calls;
+	if (rxbuf_size > 0)
+		printf("%6d %8d %10.2f %10.2f\n", count, rxbuf_size,
+				(double) calls / bursts, (double) calls / delivered);
+	else
+		printf("%6d %8s %10.2f %10.2f\n", count, "off",
+				(double) calls / bursts, (double) calls / delivered);
+	NetworkSetReadBuffer(&network, NULL, 0);
+	free(rxbuf);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	static const int counts[] = { 1, 4, 16, 64 };
+	int rxbufs[MAX_RXBUFS] = { 0 }, nrxbufs = 1;
+	int bursts = 1000, payloadlen = 16;
+	int sv[2], i, j, c;
+
+	while ((c = getopt(argc, argv, "b:s:r:")) != -1)
+		switch (c) {
+		case 'b':
+			bursts = atoi(optarg);
+			break;
+		case 's':
+			payloadlen = atoi(optarg);
+			break;
+		case 'r':
+			if (nrxbufs < MAX_RXBUFS)
+				rxbufs[nrxbufs++] = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-b bursts] [-s payload] [-r rxbuf_size]...\n",
+					argv[0]);
+			return 2;
+		}
+	if (bursts <= 0 || payloadlen < 0 || payloadlen > 256) {
+		fprintf(stderr, "bursts must be above 0, payload 0..256 bytes\n");
+		return 2;
+	}
+	/* the device buffer, and one that holds the largest burst */
+	if (nrxbufs == 1) {
+		rxbufs[nrxbufs++] = 128;
+		rxbufs[nrxbufs++] = 4096;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		perror("socketpair");
+		return 1;
+	}
+	NetworkInit(&network);
+	network.my_socket = sv[0];
+	MQTTClientInit(&client, &network, 3000, sendbuf, BUF_SIZE, readbuf,
+			BUF_SIZE);
+	MQTTSetCallBack(&client, on_message, NULL, NULL);
+
+	printf("%d bursts of publishes with %d byte payloads\n", bursts, payloadlen);
+	printf("burst    rxbuf recv/burst  recv/packet\n");
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i)
+		for (j = 0; j < nrxbufs; ++j)
+			if (run(sv[1], bursts, counts[i], payloadlen, rxbufs[j]) != 0)
+				return 1;
+
+	network.disconnect(&network);
+	close(sv[1]);
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * topic_bench.c
+ *
+ * Matching incoming topic names against subscriptions: the topic filter
+ * trie the client dispatches through, against a wildcard comparison with
+ * every filter in turn as the client did before.  Filters and topics are
+ * drawn from the same small vocabulary, so that a good share of the topics
+ * match one filter or more, and both ways must find the same matches.
+ *
+ *   topic_bench [-f filters] [-t topics]
+ *
+ * Prints the matches found and the time per topic name for each way.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTTopicTrie.h"
+
+#define MIN_RUN_NS 200000000LL /* repeat each measurement for at least 0.2s */
+#define NAME_LEN 48
+
+static const char *roots[] = { "home", "plant", "fleet", "lab" };
+static const char *subs[] = { "temp", "hum", "power", "door", "light", "fan",
+		"pump", "valve" };
+static const char *leaves[] = { "state", "set", "cfg", "alarm" };
+
+#define COUNT(a) (sizeof(a) / sizeof(a[0]))
+#define IDS 32
+
+static MQTTTopicTrie trie;
+static unsigned int rnd = 2463534242u;
+static long visited;
+
+static long long now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* xorshift, the same filters and topics on every run */
+static unsigned int random32(void) {
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 17;
+	rnd ^= rnd << 5;
+	return rnd;
+}
+
+static void handler(struct MessageData *md) {
+}
+
+static void visit(MQTTTopicHandler fp, void *context) {
+	++visited;
+}
+
+/* the wildcard comparison MQTTClient.c made against each subscription,
+ * without its trace output */
+static int isTopicMatched(const char *topicFilter, const char *topicName,
+		int len) {
+	const char *curf = topicFilter;
+	const char *curn = topicName;
+	const char *curn_end = curn + len;
+
+	while (*curf && curn < curn_end) {
+		if (*curn == '/' && *curf != '/')
+			break;
+		if (*curf != '+' && *curf != '#' && *curf != *curn)
+			break;
+		if (*curf == '+') { // skip until we meet the next separator, or end of string
+			const char *nextpos = curn + 1;
+			while (nextpos < curn_end && *nextpos != '/')
+				nextpos = ++curn + 1;
+		} else if (*curf == '#')
+			curn = curn_end - 1;    // skip until end of string
+		curf++;
+		curn++;
+	};
+	return (curn == curn_end) && (*curf == '\0');
+}
+
+/* four levels, the shape of every topic name */
+static void random_topic(char *name) {
+	sprintf(name, "%s/%u/%s/%s", roots[random32() % COUNT(roots)],
+			random32() % IDS, subs[random32() % COUNT(subs)],
+			leaves[random32() % COUNT(leaves)]);
+}
+
+/* wildcards in the places devices subscribe with them, '#' only below the
+ * second level so the old comparison and the trie agree */
+static void random_filter(char *name) {
+	const char *root = roots[random32() % COUNT(roots)];
+	const char *sub = subs[random32() % COUNT(subs)];
+	const char *leaf = leaves[random32() % COUNT(leaves)];
+	unsigned int id = random32() % IDS;
+
+	switch (random32() % 5) {
+	case 0:
+		sprintf(name, "%s/%u/%s/%s", root, id, sub, leaf);
+		break;
+	case 1:
+		sprintf(name, "%s/%u/+/%s", root, id, leaf);
+		break;
+	case 2:
+		sprintf(name, "%s/+/%s/#", root, sub);
+		break;
+	case 3:
+		sprintf(name, "%s/%u/#", root, id);
+		break;
+	default:
+		sprintf(name, "+/%u/%s/%s", id, sub, leaf);
+		break;
+	}
+}
+
+int main(int argc, char **argv) {
+	int nfilters = 256, ntopics = 10000;
+	char (*filters)[NAME_LEN], (*topics)[NAME_LEN];
+	int *lens;
+	long matches = 0, passes;
+	long long start, trie_ns, scan_ns;
+	int i, j, c;
+
+	while ((c = getopt(argc, argv, "f:t:")) != -1)
+		switch (c) {
+		case 'f':
+			nfilters = atoi(optarg);
+			break;
+		case 't':
+			ntopics = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-f filters] [-t topics]\n", argv[0]);
+			return 2;
+		}
+	/* fewer than all the distinct filters random_filter can draw */
+	if (nfilters <= 0 || nfilters > 4096 || ntopics <= 0) {
+		fprintf(stderr, "filters must be 1..4096, topics above 0\n");
+		return 2;
+	}
+
+	filters = calloc(nfilters, NAME_LEN);
+	topics = calloc(ntopics, NAME_LEN);
+	lens = calloc(ntopics, sizeof(int));
+	if (filters == NULL || topics == NULL || lens == NULL)
+		return 1;
+
+	MQTTTopicTrie_init(&trie);
+	for (i = 0; i < nfilters; ++i) {
+		/* a filter drawn twice is subscribed once */
+		random_filter(filters[i]);
+		for (j = 0; j < i && strcmp(filters[j], filters[i]) != 0; ++j)
+			;
+		if (j < i) {
+			--i;
+			continue;
+		}
+		if (MQTTTopicTrie_insert(&trie, filters[i], handler) != 0) {
+			fprintf(stderr, "trie full at %d filters, raise MQTT_TOPIC_TRIE_NODES\n",
+					i);
+			return 1;
+		}
+	}
+	for (i = 0; i < ntopics; ++i) {
+		random_topic(topics[i]);
+		lens[i] = strlen(topics[i]);
+	}
+
+	/* the same matches both ways */
+	for (i = 0; i < ntopics; ++i) {
+		int scan = 0, found = MQTTTopicTrie_match(&trie, topics[i], lens[i],
+				visit, NULL);
+
+		for (j = 0; j < nfilters; ++j)
+			scan += isTopicMatched(filters[j], topics[i], lens[i]);
+		if (found != scan) {
+			fprintf(stderr, "%s: trie matched %d filters, the scan %d\n",
+					topics[i], found, scan);
+			return 1;
+		}
+		matches += found;
+	}
+
+	passes = 0;
+	start = now_ns();
+	do {
+		for (i = 0; i < ntopics; ++i)
+			MQTTTopicTrie_match(&trie, topics[i], lens[i], visit, NULL);
+		++passes;
+	} while ((trie_ns = now_ns() - start) < MIN_RUN_NS);
+	trie_ns /= passes;
+
+	passes = 0;
+	start = now_ns();
+	do {
+		for (i = 0; i < ntopics; ++i)
+			for (j = 0; j < nfilters; ++j)
+				visited += isTopicMatched(filters[j], topics[i], lens[i]);
+		++passes;
+	} while ((scan_ns = now_ns() - start) < MIN_RUN_NS);
+	scan_ns /= passes;
+
+	printf("%d topics against %d filters, %ld matches\n", ntopics, nfilters,
+			matches);
+	printf("way     ns/topic\n");
+	printf("trie    %8.1f\n", (double) trie_ns / ntopics);
+	printf("scan    %8.1f\n", (double) scan_ns / ntopics);
+
+	free(filters);
+	free(topics);
+	free(lens);
+	return 0;
+}
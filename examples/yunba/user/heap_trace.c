@@ -0,0 +1,175 @@
+/*
+ * heap_trace.c
+ *
+ * The heap hook formats each record and appends it to a ring buffer, holding
+ * interrupts off only for the copy, as the hook also runs in interrupts.  A
+ * task writes the buffer out, so nothing waits on the UART or the flash with
+ * the heap locked.  Records that do not fit are dropped and counted, and a
+ * "# dropped" line marks the spot, as the replay is not exact past it.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "esp_common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "heap_trace.h"
+
+#if (HEAP_TRACE_BUF_SIZE & (HEAP_TRACE_BUF_SIZE - 1)) != 0
+#error "HEAP_TRACE_BUF_SIZE must be a power of two"
+#endif
+
+/* the longest record, a failed realloc with every field at full width, is 51 */
+#define HEAP_TRACE_LINE 64
+
+LOCAL char ring[HEAP_TRACE_BUF_SIZE];
+
+/* free running, the hook advances head and the writer task tail */
+LOCAL volatile uint32_t ring_head, ring_tail;
+LOCAL volatile uint32_t dropped;
+LOCAL uint32_t dropped_reported;
+
+LOCAL volatile bool stopping;
+LOCAL bool running;
+LOCAL int trace_fd = -1;
+
+/* printf may allocate, so the hook formats by hand */
+LOCAL char *put_hex(char *p, uint32_t v) {
+	char tmp[8];
+	int n = 0;
+
+	do {
+		tmp[n++] = "0123456789abcdef"[v & 0xf];
+		v >>= 4;
+	} while (v != 0);
+	while (n > 0)
+		*p++ = tmp[--n];
+	return p;
+}
+
+LOCAL char *put_dec(char *p, uint32_t v) {
+	char tmp[10];
+	int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	while (n > 0)
+		*p++ = tmp[--n];
+	return p;
+}
+
+LOCAL void trace_hook(char op, void *block, void *newblock, size_t size,
+		void *caller) {
+	char line[HEAP_TRACE_LINE], *p = line;
+	uint32_t len, i;
+
+	*p++ = op;
+	*p++ = ' ';
+	p = put_hex(p, (uint32_t) block);
+	if (op == 'r') {
+		*p++ = ' ';
+		p = put_hex(p, (uint32_t) newblock);
+	}
+	if (op != 'f') {
+		*p++ = ' ';
+		p = put_dec(p, size);
+	}
+	*p++ = ' ';
+	p = put_hex(p, (uint32_t) caller);
+	*p++ = ' ';
+	p = put_dec(p, system_get_time());
+	*p++ = '\n';
+	len = p - line;
+
+	ETS_INTR_LOCK();
+	if (HEAP_TRACE_BUF_SIZE - (ring_head - ring_tail) >= len) {
+		for (i = 0; i < len; ++i)
+			ring[(ring_head + i) & (HEAP_TRACE_BUF_SIZE - 1)] = line[i];
+		ring_head += len;
+	} else
+		++dropped;
+	ETS_INTR_UNLOCK();
+}
+
+LOCAL void write_out(const char *buf, uint32_t len) {
+	if (trace_fd >= 0)
+		write(trace_fd, buf, len);
+	else
+		while (len-- > 0)
+			uart0_write_char(*buf++);
+}
+
+LOCAL void flush_ring(void) {
+	uint32_t head = ring_head, tail = ring_tail;
+	uint32_t off = tail & (HEAP_TRACE_BUF_SIZE - 1), n = head - tail;
+	uint32_t lost = dropped;
+
+	if (n > HEAP_TRACE_BUF_SIZE - off) {
+		write_out(ring + off, HEAP_TRACE_BUF_SIZE - off);
+		n -= HEAP_TRACE_BUF_SIZE - off;
+		off = 0;
+	}
+	write_out(ring + off, n);
+	ring_tail = head;
+
+	if (lost != dropped_reported) {
+		char line[24], *p = line;
+
+		*p++ = '#';
+		*p++ = ' ';
+		p = put_dec(p, lost - dropped_reported);
+		memcpy(p, " dropped\n", 9);
+		write_out(line, p + 9 - line);
+		dropped_reported = lost;
+	}
+}
+
+LOCAL void heap_trace_task(void *pvParameters) {
+	while (!stopping) {
+		vTaskDelay(HEAP_TRACE_FLUSH_MS / portTICK_RATE_MS);
+		flush_ring();
+	}
+	flush_ring();
+	if (trace_fd >= 0) {
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	running = false;
+	vTaskDelete(NULL);
+}
+
+int8_t heap_trace_start(const char *path) {
+	if (running)
+		return -1;
+	if (path != NULL) {
+		trace_fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0);
+		if (trace_fd < 0)
+			return -1;
+	}
+
+	ring_head = ring_tail = 0;
+	dropped = dropped_reported = 0;
+	stopping = false;
+	if (xTaskCreate(heap_trace_task, "heap_trace", 256, NULL, 2, NULL) != pdPASS) {
+		if (trace_fd >= 0) {
+			close(trace_fd);
+			trace_fd = -1;
+		}
+		return -1;
+	}
+	running = true;
+	vPortSetHeapTraceHook(trace_hook);
+	return 0;
+}
+
+void heap_trace_stop(void) {
+	vPortSetHeapTraceHook(NULL);
+	stopping = true;
+}
+
+uint32_t heap_trace_dropped(void) {
+	return dropped;
+}
@@ -4,15 +4,45 @@
  *  Created on: Oct 22, 2015
  *      Author: yunba
  */
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "esp_common.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "MQTTClient.h"
 #include "util.h"
 #include "client.h"
+#include "outbox.h"
+#include "heap_trace.h"
 
 #define YUNBA_MQTT_VER   19
 
+/* the flash has no wall clock to age entries by, so the TTL counts boots */
+#define REG_CACHE_TTL_BOOTS  32
+#define REG_CACHE_FILE       "reg.cache"
+#define REG_CACHE_MAGIC      0x59524331
+/* connect attempts in a row that may fail before the broker is fetched anew */
+#define REG_CACHE_MAX_FAILURES  5
+
+/* CONNACK return codes meaning the cached registration is no longer valid */
+#define CONNACK_IDENTIFIER_REJECTED    2
+#define CONNACK_BAD_USERNAME_PASSWORD  4
+#define CONNACK_NOT_AUTHORIZED         5
+
+struct reg_cache {
+	uint32_t magic;
+	uint16_t uses_left;
+	uint16_t port;
+	char appkey[54];
+	char deviceid[54];
+	char addr[28];
+	char client_id[56];
+	char username[56];
+	char password[56];
+	char device_id[56];
+};
+
 USER_PARM_t parm = {
     NULL, NULL, NULL, NULL, 60
 };
@@ -41,6 +71,13 @@ typedef enum {
 
 MQTT_STATE_t MQTT_State = ST_INIT;
 
+static REG_info reg;
+static int connect_failures;
+
+static bool is_auth_failure(int rc);
+static bool broker_failed(bool refused);
+static void refresh_mqtt_broker(void);
+
 void messageArrived(MessageData* data) {
 	if (data->message->payloadlen > 256 || data->topicName->lenstring.len > 100)
 		return;
@@ -119,12 +156,25 @@ static void mqttConnectLost(char *reaseon) {
 	int rc;
 	MQTTDisconnect(&client);
 	network.disconnect(&network);
-	if ((rc = NetworkConnect(&network, addr, port)) != 0)
+	if ((rc = NetworkConnect(&network, addr, port)) != 0) {
 		os_printf("Return code from network connect is %d\n", rc);
-	else {
+		if (broker_failed(false)) {
+			refresh_mqtt_broker();
+			if ((rc = NetworkConnect(&network, addr, port)) == 0)
+				rc = MQTTConnect(&client, &connectData, true);
+		}
+	} else {
 		printf("net connect: %d\n", rc);
 		rc = MQTTConnect(&client, &connectData, true);
+		if (rc != 0 && broker_failed(is_auth_failure(rc))) {
+			network.disconnect(&network);
+			refresh_mqtt_broker();
+			if ((rc = NetworkConnect(&network, addr, port)) == 0)
+				rc = MQTTConnect(&client, &connectData, true);
+		}
 	}
+	if (rc == 0)
+		connect_failures = 0;
 	printf("mqtt connect lost, reconnect:%d\n", rc);
 }
 
@@ -157,9 +207,96 @@ static int get_ip_pair(const char *url, char *addr, uint16_t *port) {
 	return FAILURE;
 }
 
+static int8_t load_reg_cache(char *appkey, char *deviceid, char *broker_addr,
+		uint16_t *port, REG_info *reg) {
+	struct reg_cache *rc;
+	int fd;
+	int8_t ret = -1;
+
+	if ((fd = open(REG_CACHE_FILE, O_RDWR, 0)) < 0)
+		return -1;
+	rc = (struct reg_cache *) malloc(sizeof(*rc));
+	if (rc != NULL) {
+		if (read(fd, rc, sizeof(*rc)) == sizeof(*rc)
+				&& rc->magic == REG_CACHE_MAGIC && rc->uses_left > 0
+				&& strcmp(rc->appkey, appkey) == 0
+				&& strcmp(rc->deviceid, deviceid) == 0) {
+			strcpy(broker_addr, rc->addr);
+			*port = rc->port;
+			strcpy(reg->client_id, rc->client_id);
+			strcpy(reg->username, rc->username);
+			strcpy(reg->password, rc->password);
+			strcpy(reg->device_id, rc->device_id);
+
+			--rc->uses_left;
+			lseek(fd, 0, SEEK_SET);
+			write(fd, rc, sizeof(*rc));
+			ret = 0;
+		}
+		free(rc);
+	}
+	close(fd);
+	return ret;
+}
+
+static void save_reg_cache(char *appkey, char *deviceid, char *broker_addr,
+		uint16_t port, REG_info *reg) {
+	struct reg_cache *rc;
+	int fd;
+
+	rc = (struct reg_cache *) zalloc(sizeof(*rc));
+	if (rc == NULL)
+		return;
+	rc->magic = REG_CACHE_MAGIC;
+	rc->uses_left = REG_CACHE_TTL_BOOTS;
+	rc->port = port;
+	strncpy(rc->appkey, appkey, sizeof(rc->appkey) - 1);
+	strncpy(rc->deviceid, deviceid, sizeof(rc->deviceid) - 1);
+	strncpy(rc->addr, broker_addr, sizeof(rc->addr) - 1);
+	strncpy(rc->client_id, reg->client_id, sizeof(rc->client_id) - 1);
+	strncpy(rc->username, reg->username, sizeof(rc->username) - 1);
+	strncpy(rc->password, reg->password, sizeof(rc->password) - 1);
+	strncpy(rc->device_id, reg->device_id, sizeof(rc->device_id) - 1);
+
+	fd = open(REG_CACHE_FILE, O_CREAT | O_TRUNC | O_RDWR, 0);
+	if (fd >= 0) {
+		write(fd, rc, sizeof(*rc));
+		close(fd);
+	}
+	free(rc);
+}
+
+static void drop_reg_cache(void) {
+	unlink(REG_CACHE_FILE);
+}
+
+static bool is_auth_failure(int rc) {
+	return rc == CONNACK_IDENTIFIER_REJECTED
+			|| rc == CONNACK_BAD_USERNAME_PASSWORD
+			|| rc == CONNACK_NOT_AUTHORIZED;
+}
+
+/* count a failed connect, true when the broker is to be fetched anew: at
+ * once if it refused the registration, else after REG_CACHE_MAX_FAILURES
+ * failures in a row, as the cached address may be gone */
+static bool broker_failed(bool refused) {
+	if (!refused && ++connect_failures < REG_CACHE_MAX_FAILURES)
+		return false;
+	connect_failures = 0;
+	return true;
+}
+
+/* the broker address and registration are fetched once and then reused from
+ * flash, until the broker rejects them, connects to it keep failing or
+ * REG_CACHE_TTL_BOOTS boots pass */
 void yunba_get_mqtt_broker(char *appkey, char *deviceid, char *broker_addr,
 		uint16_t *port, REG_info *reg) {
-	char *url = (char *) malloc(128);
+	char *url;
+
+	if (load_reg_cache(appkey, deviceid, broker_addr, port, reg) == 0)
+		return;
+
+	url = (char *) malloc(128);
 
 	if (url) {
 		memset(url, 0, 128);
@@ -178,6 +315,16 @@ void yunba_get_mqtt_broker(char *appkey, char *deviceid, char *broker_addr,
 			break;
 		vTaskDelay(30 / portTICK_RATE_MS);
 	} while (1);
+
+	save_reg_cache(appkey, deviceid, broker_addr, *port, reg);
+}
+
+/* the broker refused the cached registration or cannot be reached: fetch a
+ * fresh one */
+static void refresh_mqtt_broker(void) {
+	drop_reg_cache();
+	memset(addr, 0, 28);
+	yunba_get_mqtt_broker(parm.appkey, parm.deviceid, addr, &port, &reg);
 }
 
 void ICACHE_FLASH_ATTR
@@ -185,21 +332,29 @@ yunba_mqtt_client_task(void *pvParameters) {
 	int rc = 0, count = 0;
 	uint8_t *sendbuf = (uint8_t *) malloc(200);
 	uint8_t *readbuf = (uint8_t *) malloc(200);
+	uint8_t *netbuf = (uint8_t *) malloc(128);
 
 	if (init_user_parm(&parm) == 0)
 		load_user_parm(&parm);
 
 	setup_wifi_monitor(check_wifi_status, NULL, 6000);
 
+	if (setup_spiffs() != 0 || outbox_init() != 0)
+		printf("outbox unavailable, offline messages will be lost\n");
+#ifdef HEAP_TRACE_FILE
+	if (heap_trace_start(HEAP_TRACE_FILE) != 0)
+		printf("heap trace to %s failed\n", HEAP_TRACE_FILE);
+#endif
+
 	if (QueueMQTTClient == NULL)
 		QueueMQTTClient = xQueueCreate(5, sizeof(struct MSG_t));
 
 	pvParameters = 0;
 	NetworkInit(&network);
+	NetworkSetReadBuffer(&network, netbuf, 128 * sizeof(uint8_t));
 	MQTTClientInit(&client, &network, 30000, sendbuf, 200 * sizeof(uint8_t),
 			readbuf, 200 * sizeof(uint8_t));
 
-	REG_info reg;
 	reg.client_id = (char *) malloc(56);
 	reg.device_id = (char *) malloc(56);
 	reg.password = (char *) malloc(56);
@@ -217,11 +372,14 @@ yunba_mqtt_client_task(void *pvParameters) {
 	while (MQTT_State != ST_RUNNING) {
 		switch (MQTT_State) {
 		case ST_INIT:
-			if ((rc = NetworkConnect(&network, addr, port)) != 0)
+			if ((rc = NetworkConnect(&network, addr, port)) != 0) {
 				os_printf("Return code from network connect is %d\n", rc);
-			else
+				if (broker_failed(false))
+					refresh_mqtt_broker();
+			} else {
 				printf("net connect: %d\n", rc);
-			MQTT_State = ST_CONNECT;
+				MQTT_State = ST_CONNECT;
+			}
 			break;
 
 		case ST_CONNECT:
@@ -233,8 +391,13 @@ yunba_mqtt_client_task(void *pvParameters) {
 
 			if ((rc = MQTTConnect(&client, &connectData, true)) != 0) {
 				os_printf("Return code from MQTT connect is %d\n", rc);
+				network.disconnect(&network);
+				if (broker_failed(is_auth_failure(rc)))
+					refresh_mqtt_broker();
+				MQTT_State = ST_INIT;
 			} else {
 				os_printf("MQTT Connected\n");
+				connect_failures = 0;
 #if defined(MQTT_TASK)
 				if ((rc = MQTTStartTask(&client)) != pdPASS)
 				os_printf("Return code from start tasks is %d\n", rc);
@@ -268,10 +431,15 @@ yunba_mqtt_client_task(void *pvParameters) {
 	cJSON_AddStringToObject(Opt, "time_to_live", "30");
 	for (;;) {
 		if (xQueueReceive(QueueMQTTClient, &M, 100/portTICK_RATE_MS ) == pdPASS) {
-			if ((rc = MQTTPublish2(&client, parm.topic, M.payload, M.len, Opt))
-					!= 0)
-				printf("Return code from MQTT publish is %d\n", rc);
+			/* keep the order: while the outbox holds messages, queue behind them */
+			if (!outbox_empty() || !client.isconnected
+					|| (rc = MQTTPublish2(&client, parm.topic, M.payload, M.len,
+							Opt)) != 0) {
+				if (outbox_put(parm.topic, M.payload, M.len) != 0)
+					printf("outbox put failed, message lost\n");
+			}
 		}
+		outbox_drain(&client);
 	}
 	cJSON_Delete(Opt);
 	free(reg.client_id);
@@ -280,6 +448,7 @@ yunba_mqtt_client_task(void *pvParameters) {
 	free(reg.username);
 	free(sendbuf);
 	free(readbuf);
+	free(netbuf);
 
 	free(addr);
 	user_parm_free(&parm);
@@ -0,0 +1,284 @@
+/*
+ * outbox.c
+ *
+ * Each record is a header followed by the topic and the payload, appended to
+ * segment file "outbox.<seq % OUTBOX_NAMES>".  A cursor file records the
+ * oldest segment, how far into it the broker has acknowledged, and the
+ * segment being appended to.  Delivery is at-least-once: a batch whose acks
+ * are lost is sent again.  Files are used through the libc calls esp_spiffs
+ * provides, so the outbox needs nothing of libspiffs beyond esp_spiffs_init.
+ */
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "esp_common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "MQTTClient.h"
+#include "outbox.h"
+
+#define OUTBOX_CURSOR "outbox.pos"
+#define OUTBOX_PREFIX "outbox."
+/* at most two segments exist and their numbers follow each other, so four
+ * names are enough to find them again without the cursor */
+#define OUTBOX_NAMES 4
+#define OUTBOX_NAME_LEN 16
+
+struct outbox_rec_hdr {
+	uint16_t topic_len;
+	uint16_t payload_len;
+};
+
+LOCAL struct outbox_cursor {
+	uint32_t head_seq; /* oldest segment, the one being drained */
+	uint32_t head_off; /* everything before this offset has been acknowledged */
+	uint32_t tail_seq; /* segment new messages are appended to */
+} cur;
+
+LOCAL bool ready;
+LOCAL uint32_t tail_size;
+
+/* the batch in flight: acks belong to it only if they carry its generation */
+LOCAL uint8_t batch_gen;
+LOCAL uint8_t batch_sent;
+LOCAL volatile uint8_t batch_acked, batch_failed;
+LOCAL uint32_t batch_end;
+LOCAL portTickType last_drain;
+
+LOCAL void segment_name(char *name, uint32_t seq) {
+	sprintf(name, OUTBOX_PREFIX "%u", seq % OUTBOX_NAMES);
+}
+
+LOCAL int8_t save_cursor(void) {
+	int fd = open(OUTBOX_CURSOR, O_CREAT | O_TRUNC | O_RDWR, 0);
+	int res;
+
+	if (fd < 0)
+		return -1;
+	res = write(fd, &cur, sizeof(cur));
+	close(fd);
+	return (res == sizeof(cur)) ? 0 : -1;
+}
+
+LOCAL int8_t load_cursor(void) {
+	int fd = open(OUTBOX_CURSOR, O_RDONLY, 0);
+	int res;
+
+	if (fd < 0)
+		return -1;
+	res = read(fd, &cur, sizeof(cur));
+	close(fd);
+	return (res == sizeof(cur) && cur.head_seq <= cur.tail_seq
+			&& cur.tail_seq - cur.head_seq <= 1) ? 0 : -1;
+}
+
+/* 0 if the segment is missing */
+LOCAL int32_t segment_size(uint32_t seq) {
+	char name[OUTBOX_NAME_LEN];
+	int fd, size;
+
+	segment_name(name, seq);
+	if ((fd = open(name, O_RDONLY, 0)) < 0)
+		return 0;
+	size = lseek(fd, 0, SEEK_END);
+	close(fd);
+	return (size > 0) ? size : 0;
+}
+
+/* the cursor is lost or torn: resend every segment that is still on flash.
+ * The head is the segment whose predecessor is gone. */
+LOCAL void recover_cursor(void) {
+	bool present[OUTBOX_NAMES];
+	uint32_t i;
+
+	memset(&cur, 0, sizeof(cur));
+	for (i = 0; i < OUTBOX_NAMES; ++i)
+		present[i] = segment_size(i) > 0;
+	for (i = 0; i < OUTBOX_NAMES; ++i)
+		if (present[i] && !present[(i + OUTBOX_NAMES - 1) % OUTBOX_NAMES]) {
+			cur.head_seq = i;
+			cur.tail_seq = present[(i + 1) % OUTBOX_NAMES] ? i + 1 : i;
+			break;
+		}
+}
+
+/* delete the head segment once everything in it is acknowledged */
+LOCAL void release_head(void) {
+	char name[OUTBOX_NAME_LEN];
+
+	if (cur.head_off < segment_size(cur.head_seq))
+		return;
+	segment_name(name, cur.head_seq);
+	unlink(name);
+	if (cur.head_seq == cur.tail_seq)
+		tail_size = 0;
+	else
+		++cur.head_seq;
+	cur.head_off = 0;
+	save_cursor();
+}
+
+/* context is the record sent, kept until now for the resends, its first
+ * byte the generation of its batch */
+LOCAL void outbox_ack(uint64_t id, int rc, void *context) {
+	uint8_t gen = *(uint8_t *) context;
+
+	free(context);
+	if (gen != batch_gen)
+		return;
+	if (rc == SUCCESS)
+		++batch_acked;
+	else
+		batch_failed = 1;
+}
+
+int8_t outbox_init(void) {
+	if (load_cursor() != 0) {
+		recover_cursor();
+		save_cursor();
+	}
+	tail_size = segment_size(cur.tail_seq);
+	batch_sent = 0;
+	ready = true;
+	return 0;
+}
+
+bool outbox_empty(void) {
+	return !ready
+			|| (cur.head_seq == cur.tail_seq && cur.head_off >= tail_size);
+}
+
+int8_t outbox_put(const char *topic, const void *payload,
+		uint16_t payload_len) {
+	struct outbox_rec_hdr hdr;
+	char name[OUTBOX_NAME_LEN];
+	int fd, size;
+	uint32_t len;
+	int8_t ret = -1;
+
+	if (!ready)
+		return -1;
+	hdr.topic_len = strlen(topic);
+	hdr.payload_len = payload_len;
+	len = sizeof(hdr) + hdr.topic_len + hdr.payload_len;
+	if (len > OUTBOX_SEGMENT_SIZE)
+		return -1;
+
+	if (tail_size + len > OUTBOX_SEGMENT_SIZE) {
+		if (cur.head_seq != cur.tail_seq) {
+			/* both segments are full, drop the older one */
+			segment_name(name, cur.head_seq);
+			unlink(name);
+			printf("outbox full, dropped %s\n", name);
+			cur.head_seq = cur.tail_seq;
+			cur.head_off = 0;
+			batch_sent = 0;
+			++batch_gen;
+		}
+		++cur.tail_seq;
+		tail_size = 0;
+		save_cursor();
+	}
+
+	segment_name(name, cur.tail_seq);
+	fd = open(name, O_CREAT | O_APPEND | O_RDWR, 0);
+	if (fd < 0)
+		return -1;
+	if (write(fd, &hdr, sizeof(hdr)) == sizeof(hdr)
+			&& write(fd, topic, hdr.topic_len) == hdr.topic_len
+			&& write(fd, payload, payload_len) == payload_len)
+		ret = 0;
+	/* a torn record is skipped when draining, see send_batch */
+	if ((size = lseek(fd, 0, SEEK_END)) >= 0)
+		tail_size = size;
+	close(fd);
+	return ret;
+}
+
+LOCAL int send_batch(MQTTClient *c) {
+	struct outbox_rec_hdr hdr;
+	char name[OUTBOX_NAME_LEN];
+	int fd;
+	uint32_t off = cur.head_off;
+	int32_t size = segment_size(cur.head_seq);
+
+	segment_name(name, cur.head_seq);
+	if ((fd = open(name, O_RDONLY, 0)) < 0 || lseek(fd, off, SEEK_SET) < 0)
+		size = 0;
+
+	batch_acked = batch_failed = 0;
+	while (batch_sent < OUTBOX_BATCH && off + sizeof(hdr) <= size) {
+		MQTTMessage m;
+		uint8_t *rec;
+		int rc;
+
+		if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+			break;
+		if (off + sizeof(hdr) + hdr.topic_len + hdr.payload_len > size) {
+			off = size; /* torn by a reset while appending */
+			break;
+		}
+		/* the batch generation, the topic and the payload */
+		if ((rec = (uint8_t *) malloc(1 + hdr.topic_len + 1 + hdr.payload_len))
+				== NULL)
+			break;
+		if (read(fd, rec + 1, hdr.topic_len) != hdr.topic_len
+				|| read(fd, rec + 1 + hdr.topic_len + 1, hdr.payload_len)
+						!= hdr.payload_len) {
+			free(rec);
+			break;
+		}
+		rec[0] = batch_gen;
+		rec[1 + hdr.topic_len] = '\0';
+
+		m.qos = QOS1;
+		m.retained = 0;
+		m.dup = 0;
+		m.payload = rec + 1 + hdr.topic_len + 1;
+		m.payloadlen = hdr.payload_len;
+		/* on success the payload is resent from rec, outbox_ack frees it */
+		rc = MQTTPublishAsync(c, (const char *) rec + 1, &m, outbox_ack, rec);
+		if (rc != SUCCESS) {
+			free(rec);
+			break;
+		}
+		off += sizeof(hdr) + hdr.topic_len + hdr.payload_len;
+		++batch_sent;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	if (batch_sent > 0)
+		batch_end = off;
+	else if (off >= size) {
+		cur.head_off = off;
+		release_head();
+	}
+	return batch_sent;
+}
+
+int outbox_drain(MQTTClient *c) {
+	portTickType now = xTaskGetTickCount();
+
+	if (!ready)
+		return 0;
+	if (batch_sent > 0) {
+		if (batch_failed) {
+			/* give up on this batch, it is resent from head_off */
+			batch_sent = 0;
+			++batch_gen;
+		} else if (batch_acked >= batch_sent) {
+			batch_sent = 0;
+			++batch_gen;
+			cur.head_off = batch_end;
+			save_cursor();
+			release_head();
+		} else
+			return 0;
+	}
+	if (outbox_empty() || !c->isconnected
+			|| now - last_drain < OUTBOX_DRAIN_INTERVAL_MS / portTICK_RATE_MS)
+		return 0;
+	last_drain = now;
+	return send_batch(c);
+}
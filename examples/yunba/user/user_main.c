@@ -9,6 +9,7 @@
 #include "freertos/task.h"
 #include "mqtt_client.h"
 #include "util.h"
+#include "heap_trace.h"
 
 /******************************************************************************
  * FunctionName : user_init
@@ -18,6 +19,9 @@
  *******************************************************************************/
 void ICACHE_FLASH_ATTR
 user_init(void) {
+#ifdef HEAP_TRACE_UART
+	heap_trace_start(NULL);
+#endif
 #if defined(LIGHT_DEVICE)
 	user_light_init();
 #elif defined(PLUG_DEVICE)
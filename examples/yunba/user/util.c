@@ -6,6 +6,7 @@
  */
 #include "esp_common.h"
 #include "util.h"
+#include "user_config.h"
 
 LOCAL os_timer_t wifi_monitor_timer;
 
@@ -54,3 +55,37 @@ void setup_wifi_monitor(os_timer_func_t * fn, void *arg, uint32_t msec) {
 void wifi_monitor_close(void) {
 	os_timer_disarm(&wifi_monitor_timer);
 }
+
+/* the partition address for the flash size map the image was built for,
+ * 0 if it would overlap the OTA slots or the system parameters */
+LOCAL uint32_t spiffs_flash_addr(void) {
+	switch (system_get_flash_size_map()) {
+	case FLASH_SIZE_16M_MAP_512_512:
+	case FLASH_SIZE_32M_MAP_512_512:
+		return SPIFFS_FLASH_ADDR_512;
+	case FLASH_SIZE_32M_MAP_1024_1024:
+		return SPIFFS_FLASH_ADDR_1024;
+	default:
+		return 0;
+	}
+}
+
+int8_t setup_spiffs(void) {
+	struct esp_spiffs_config config;
+	uint32_t addr = spiffs_flash_addr();
+
+	if (addr == 0) {
+		printf("no room for spiffs in flash size map %d\n",
+				system_get_flash_size_map());
+		return -1;
+	}
+	config.phys_size = SPIFFS_FLASH_SIZE;
+	config.phys_addr = addr;
+	config.phys_erase_block = SPIFFS_SECTOR_SIZE;
+	config.log_block_size = SPIFFS_SECTOR_SIZE;
+	config.log_page_size = SPIFFS_LOG_PAGE;
+	config.fd_buf_size = SPIFFS_FD_BUF_SIZE;
+	config.cache_buf_size = SPIFFS_CACHE_BUF_SIZE;
+
+	return (esp_spiffs_init(&config) == 0) ? 0 : -1;
+}
@@ -73,6 +73,35 @@ sint32 esp_spiffs_init(struct esp_spiffs_config *config);
   */
 void esp_spiffs_deinit(uint8 format);
 
+#if SPIFFS_GC_TASK
+/**
+  * @brief  Start a low priority task that collects garbage while the system
+  *         is idle, so that writes seldom have to stop and erase blocks.
+  *
+  *         Every period_ms the task reclaims blocks, one at a time, until
+  *         there are more than reserve_blocks free blocks. spiffs collects
+  *         garbage in the write path when it is down to 3 free blocks, a
+  *         reserve of 4 or more keeps that rare; a larger reserve means more
+  *         erases ahead of need.
+  *
+  * @param  uint32 reserve_blocks : free blocks to keep
+  * @param  uint32 period_ms : time between checks
+  *
+  * @return 0         : succeed
+  * @return otherwise : fail, or the task is already running
+  */
+sint32 esp_spiffs_gc_start(uint32 reserve_blocks, uint32 period_ms);
+
+/**
+  * @brief  Stop the task started by esp_spiffs_gc_start.
+  *
+  * @param  null
+  *
+  * @return null
+  */
+void esp_spiffs_gc_stop(void);
+#endif
+
 /**
   * @}
   */
@@ -367,6 +367,64 @@ void *pvPortMalloc( size_t xSize ) PRIVILEGED_FUNCTION;
 void vPortFree( void *pv ) PRIVILEGED_FUNCTION;
 void vPortInitialiseBlocks( void ) PRIVILEGED_FUNCTION;
 size_t xPortGetFreeHeapSize( void ) PRIVILEGED_FUNCTION;
+size_t xPortGetMinimumEverFreeHeapSize( void ) PRIVILEGED_FUNCTION;
+
+/*
+ * Heap state as returned by vPortGetHeapStats().  Free bytes spread over many
+ * small blocks, seen as a large free block count next to a small largest
+ * block, is what makes big requests such as a TLS handshake fail.
+ */
+typedef struct xHEAP_STATS
+{
+	size_t xAvailableHeapSpaceInBytes;		/* The same as xPortGetFreeHeapSize(). */
+	size_t xSizeOfLargestFreeBlockInBytes;	/* The largest request that could succeed right now. */
+	size_t xSizeOfSmallestFreeBlockInBytes;	/* Usable bytes in the smallest free block. */
+	size_t xNumberOfFreeBlocks;				/* Free blocks, including those held for reuse by size. */
+	size_t xMinimumEverFreeBytesRemaining;	/* The lowest xAvailableHeapSpaceInBytes has been since boot. */
+	size_t xNumberOfSuccessfulAllocations;	/* Calls that returned memory, resizes included. */
+	size_t xNumberOfSuccessfulFrees;		/* Blocks given back. */
+} xHeapStats;
+
+/*
+ * One block of the heap as reported by uxPortGetHeapBlocks().
+ */
+typedef struct xHEAP_BLOCK_STATUS
+{
+	void *pvAddress;			/* The usable memory of the block. */
+	size_t xSize;				/* Usable bytes in the block. */
+	void *pvOwner;				/* Return address of the call that allocated the block.  Only set when configUSE_HEAP_TRACKING is 1, NULL otherwise and for free blocks. */
+	unsigned char ucAllocated;	/* pdTRUE if the block is in use. */
+} xHeapBlockStatus;
+
+void vPortGetHeapStats( xHeapStats *pxHeapStats ) PRIVILEGED_FUNCTION;
+
+/*
+ * Fills pxBlockArray with up to uxArraySize blocks in address order and returns
+ * the number of blocks in the heap, which may be more than were written.
+ * The heap is locked for the whole walk.
+ */
+unsigned portBASE_TYPE uxPortGetHeapBlocks( xHeapBlockStatus *pxBlockArray, unsigned portBASE_TYPE uxArraySize ) PRIVILEGED_FUNCTION;
+
+/*
+ * Prints the heap statistics and the bytes held by each owner, for field
+ * diagnostics.  Owners are only told apart when configUSE_HEAP_TRACKING is 1.
+ */
+void vPortDumpHeap( void ) PRIVILEGED_FUNCTION;
+
+/*
+ * Called after every pvPortMalloc(), pvPortCalloc(), pvPortZalloc(),
+ * vPortFree() and pvPortRealloc() once installed with vPortSetHeapTraceHook(),
+ * to record the allocation sequence of a running device.  cOp is 'm' for an
+ * allocation, with pvBlock NULL if it failed, 'f' for a free, and 'r' for a
+ * resize of pvBlock to pvNewBlock, with pvNewBlock NULL if it failed.  pvCaller
+ * is the return address of the call.  Tasks hold the scheduler lock across the
+ * operation and the call, so records arrive in the order the heap saw them.
+ * The hook may run in an interrupt and must neither block nor use the heap.
+ * Only present when configUSE_HEAP_TRACE is 1.
+ */
+typedef void ( *pdHEAP_TRACE_HOOK )( char cOp, void *pvBlock, void *pvNewBlock, size_t xSize, void *pvCaller );
+
+void vPortSetHeapTraceHook( pdHEAP_TRACE_HOOK pxHook ) PRIVILEGED_FUNCTION;
 
 /*
  * Setup the hardware ready for the scheduler to take control.  This generally
@@ -83,9 +83,25 @@ extern const u32_t memp_sizes[MEMP_MAX];
 
 #include "mem.h"
 
+#if MEMP_HYBRID_POOLS
+/** Allocation counts of one pool type, see memp_hybrid_get_stats() */
+struct memp_hybrid_stats {
+  u32_t hits;    /* allocations served from the static pool */
+  u32_t misses;  /* allocations that went to the heap */
+  u16_t avail;   /* elements in the static pool, 0 if the type has none */
+  u16_t used;    /* pool elements in use now */
+  u16_t max;     /* most pool elements in use at once */
+};
+
+void  memp_init(void);
+void *memp_malloc(memp_t type);
+void  memp_free(memp_t type, void *mem);
+void  memp_hybrid_get_stats(memp_t type, struct memp_hybrid_stats *stats);
+#else /* MEMP_HYBRID_POOLS */
 #define memp_init()
 #define memp_malloc(type)     mem_malloc(memp_sizes[type])
 #define memp_free(type, mem)  mem_free(mem)
+#endif /* MEMP_HYBRID_POOLS */
 
 #else /* MEMP_MEM_MALLOC */
 
@@ -115,6 +115,47 @@
 #define MEMP_MEM_MALLOC                 0
 #endif
 
+/**
+ * MEMP_HYBRID_POOLS==1: With MEMP_MEM_MALLOC, still give the busiest pool
+ * types a small static pool and only fall back to mem_malloc once it is
+ * empty. Keeps the short lived TCP fast path allocations out of the heap.
+ * The pool sizes are set with the MEMP_HYBRID_NUM_xxx options below, 0
+ * leaves a type entirely on the heap.
+ */
+#ifndef MEMP_HYBRID_POOLS
+#define MEMP_HYBRID_POOLS               0
+#endif
+
+/**
+ * MEMP_HYBRID_NUM_TCP_SEG: static TCP_SEG elements in hybrid mode.
+ */
+#ifndef MEMP_HYBRID_NUM_TCP_SEG
+#define MEMP_HYBRID_NUM_TCP_SEG         8
+#endif
+
+/**
+ * MEMP_HYBRID_NUM_PBUF: static PBUF (PBUF_REF/ROM headers) elements in
+ * hybrid mode.
+ */
+#ifndef MEMP_HYBRID_NUM_PBUF
+#define MEMP_HYBRID_NUM_PBUF            8
+#endif
+
+/**
+ * MEMP_HYBRID_NUM_TCPIP_MSG: static TCPIP_MSG_API and TCPIP_MSG_INPKT
+ * elements, each, in hybrid mode.
+ */
+#ifndef MEMP_HYBRID_NUM_TCPIP_MSG
+#define MEMP_HYBRID_NUM_TCPIP_MSG       4
+#endif
+
+/**
+ * MEMP_HYBRID_NUM_NETBUF: static NETBUF elements in hybrid mode.
+ */
+#ifndef MEMP_HYBRID_NUM_NETBUF
+#define MEMP_HYBRID_NUM_NETBUF          4
+#endif
+
 /**
  * MEM_ALIGNMENT: should be set to the alignment of the CPU
  *    4 byte alignment -> #define MEM_ALIGNMENT 4
@@ -77,6 +77,12 @@
 */
 #define MEMP_MEM_MALLOC                 1
 
+/**
+ * MEMP_HYBRID_POOLS==1: Serve TCP_SEG, PBUF, TCPIP_MSG and NETBUF from small
+ * static pools first, and from the heap only when those run out.
+ */
+#define MEMP_HYBRID_POOLS               1
+
 /**
  * MEM_ALIGNMENT: should be set to the alignment of the CPU
  *    4 byte alignment -> #define MEM_ALIGNMENT 4
@@ -48,6 +48,7 @@ extern "C" {
 #define SPIFFS_ERR_MAGIC_NOT_POSSIBLE   -10028
 
 #define SPIFFS_ERR_NO_DELETED_BLOCKS    -10029
+#define SPIFFS_ERR_OUT_OF_APPEND_BUFS   -10030
 
 #define SPIFFS_ERR_INTERNAL             -10050
 
@@ -167,6 +168,58 @@ typedef struct {
 #endif
 } spiffs_config;
 
+#if SPIFFS_NAME_INDEX
+// name index entry, see SPIFFS_NAME_INDEX
+typedef struct {
+  // hash of the object name
+  u16_t hash;
+  // object id, without the index flag
+  spiffs_obj_id obj_id;
+  // object index header page
+  spiffs_page_ix pix;
+} spiffs_name_ix_entry;
+#endif
+
+#if SPIFFS_APPEND_BUFFERS
+// append buffer of a file descriptor, see SPIFFS_fbuffer
+typedef struct {
+  // file descriptor owning the buffer, 0 if unused
+  spiffs_file file_nbr;
+  // object id of the file, other descriptors of it find the buffer by this
+  spiffs_obj_id obj_id;
+  // set once SPIFFS_fflush_aged has seen the buffered data, at time since
+  u8_t aged;
+  u32_t since;
+  // buffer memory, given by user
+  u8_t *buf;
+  // size of buffer memory
+  u32_t size;
+  // bytes buffered, to be appended at the end of the file
+  u32_t len;
+} spiffs_append_buf;
+#endif
+
+// pages and wear of a block, see SPIFFS_block_stats
+typedef struct {
+  // block index
+  spiffs_block_ix bix;
+  // data pages in a block, and how many of them are in use or deleted
+  u16_t pages;
+  u16_t used_pages;
+  u16_t deleted_pages;
+  // blocks erased in the file system since this one was last erased
+  u16_t erase_age;
+  // erases of this block since mount, and the fewest erases of any block
+  // since mount, 0 if not counted, see SPIFFS_WEAR_STATS_BLOCKS
+  u16_t erases;
+  u16_t erases_min;
+} spiffs_block_stats;
+
+// scores a block holding deleted pages as garbage collection candidate, the
+// block with the highest score is collected. fs_crammed is set when there
+// are no free pages left. See SPIFFS_gc_policy
+typedef s32_t (*spiffs_gc_score_f)(const spiffs_block_stats *b, u8_t fs_crammed);
+
 typedef struct {
   // file system configuration
   spiffs_config cfg;
@@ -207,7 +260,19 @@ typedef struct {
 
 #if SPIFFS_GC_STATS
   u32_t stats_gc_runs;
+  // blocks erased since mount, blocks erased by the garbage collector and
+  // pages it wrote moving live data out of them
+  u32_t stats_erases;
+  u32_t stats_gc_erases;
+  u32_t stats_gc_moved_pages;
 #endif
+#if SPIFFS_WEAR_STATS_BLOCKS
+  // erases of each block since mount, if the file system has at most
+  // SPIFFS_WEAR_STATS_BLOCKS blocks
+  u16_t block_erases[SPIFFS_WEAR_STATS_BLOCKS];
+#endif
+  // garbage collection candidate score, 0 for spiffs_gc_score_default
+  spiffs_gc_score_f gc_score_f;
 
 #if SPIFFS_CACHE
   // cache memory
@@ -220,6 +285,32 @@ typedef struct {
 #endif
 #endif
 
+#if SPIFFS_ALLOC_MAP_PAGES
+  // free page bitmap, one bit per object lookup entry, set while the page
+  // is free
+  u8_t free_map[(SPIFFS_ALLOC_MAP_PAGES + 7) / 8];
+  // entries in free page bitmap, 0 if the file system does not fit
+  u32_t free_map_pages;
+#endif
+#if SPIFFS_ALLOC_MAP_IDS
+  // object id bitmap, bit n set while object id n + 1 is in use
+  u8_t id_map[(SPIFFS_ALLOC_MAP_IDS + 7) / 8];
+#endif
+
+#if SPIFFS_NAME_INDEX
+  // name index, built at mount
+  spiffs_name_ix_entry name_ix[SPIFFS_NAME_INDEX];
+  // used entries in name index
+  u16_t name_ix_count;
+  // set when an object did not fit in the name index, names that are not
+  // in the index must then be scanned for
+  u8_t name_ix_overflow;
+#endif
+
+#if SPIFFS_APPEND_BUFFERS
+  spiffs_append_buf append_bufs[SPIFFS_APPEND_BUFFERS];
+#endif
+
   // check callback function
   spiffs_check_callback check_cb_f;
 
@@ -237,6 +328,23 @@ typedef struct {
   u8_t name[SPIFFS_OBJ_NAME_LEN];
 } spiffs_stat;
 
+/* spiffs file system statistics struct, see SPIFFS_fs_stats */
+typedef struct {
+  // garbage collection runs, the blocks they erased and the pages they
+  // wrote moving live data, see SPIFFS_GC_STATS
+  u32_t gc_runs;
+  u32_t gc_erases;
+  u32_t gc_moved_pages;
+  // all blocks erased
+  u32_t erases;
+  // read cache hits and misses, see SPIFFS_CACHE_STATS
+  u32_t cache_hits;
+  u32_t cache_misses;
+  // most and fewest erases of a block, see SPIFFS_WEAR_STATS_BLOCKS
+  u32_t block_erases_max;
+  u32_t block_erases_min;
+} spiffs_fs_stats;
+
 struct spiffs_dirent {
   spiffs_obj_id obj_id;
   u8_t name[SPIFFS_OBJ_NAME_LEN];
@@ -377,12 +485,50 @@ s32_t SPIFFS_stat(spiffs *fs, char *path, spiffs_stat *s);
 s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s);
 
 /**
- * Flushes all pending write operations from cache for given file
+ * Flushes all pending write operations from cache and append buffer for
+ * given file
  * @param fs            the file system struct
  * @param fh            the filehandle of the file to flush
  */
 s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh);
 
+#if SPIFFS_APPEND_BUFFERS
+/**
+ * Gives a file an append buffer. Writes to the end of the file that are
+ * smaller than the buffer are collected in it, and appended to the file in
+ * one go when the next write does not fit, on SPIFFS_fflush and on any
+ * other operation on the file. The object index header is then rewritten
+ * once per buffer instead of once per write, which for small records saves
+ * most of the flash writes and wear. Data in the buffer is lost on power
+ * loss, SPIFFS_fflush_aged bounds for how long.
+ *
+ * At most SPIFFS_APPEND_BUFFERS files can have a buffer at a time, and a
+ * file has one buffer however many times it is open: what is buffered is
+ * appended before any other descriptor of the file reads, writes, seeks or
+ * stats it, and giving another descriptor a buffer moves the file's buffer
+ * there. The buffer is released when the descriptor owning it is closed.
+ * @param fs            the file system struct
+ * @param fh            the filehandle of the file
+ * @param buf           memory for the buffer, kept until the file is closed
+ *                      or the buffer is released, or null to flush and
+ *                      release the buffer
+ * @param size          size of buf
+ */
+s32_t SPIFFS_fbuffer(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size);
+
+/**
+ * Flushes the append buffers that have held data for at least max_age, for
+ * calling periodically with a clock in any unit. Data is timed from the
+ * first call that sees it in a buffer, so it is flushed between max_age and
+ * max_age plus one calling period after it was written.
+ * Returns the number of buffers flushed, or -1 on error, with err_no set.
+ * @param fs            the file system struct
+ * @param now           current time
+ * @param max_age       age at which buffered data is flushed
+ */
+s32_t SPIFFS_fflush_aged(spiffs *fs, u32_t now, u32_t max_age);
+#endif
+
 /**
  * Closes a filehandle. If there are pending write operations, these are finalized before closing.
  * @param fs            the file system struct
@@ -527,6 +673,88 @@ s32_t SPIFFS_gc_quick(spiffs *fs, u16_t max_free_pages);
  */
 s32_t SPIFFS_gc(spiffs *fs, u32_t size);
 
+/**
+ * Does one bounded step of garbage collection, for calling while the system
+ * is idle. When there are reserve_blocks free blocks or less, reclaims one
+ * block: a block with only deleted pages is simply erased, otherwise the best
+ * candidate block has its live pages moved before it is erased. Nothing is
+ * done until there are at least a block worth of deleted pages.
+ *
+ * spiffs collects garbage in the write path when it is down to 3 free
+ * blocks, so calling this with a reserve above that until it returns 0
+ * keeps most erases out of SPIFFS_write.
+ *
+ * Returns 1 if a block was reclaimed, 0 if there was nothing to do, -1 on
+ * error, with err_no set.
+ *
+ * @param fs             the file system struct
+ * @param reserve_blocks number of free blocks to keep
+ */
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t reserve_blocks);
+
+/**
+ * Returns statistics of the file system since it was mounted: garbage
+ * collection runs and the blocks they erased and pages they moved, all
+ * erases, read cache hits and misses, and the most and fewest erases of a
+ * block. Counts that are not compiled in are returned as 0.
+ *
+ * Pages moved over pages written by the application gives the write
+ * amplification of garbage collection, the spread of block erases how well
+ * it levels wear.
+ *
+ * @param fs            the file system struct
+ * @param s             the statistics struct to populate
+ */
+s32_t SPIFFS_fs_stats(spiffs *fs, spiffs_fs_stats *s);
+
+/**
+ * Returns the pages in use and deleted in a block, the blocks erased since
+ * it was last erased and its erases since mount.
+ *
+ * spiffs stores no erase count per block on flash, only the order in which
+ * blocks were erased, so the erase counts start from 0 at mount and are only
+ * kept if the file system has at most SPIFFS_WEAR_STATS_BLOCKS blocks.
+ *
+ * @param fs            the file system struct
+ * @param bix           the block index, from 0
+ * @param s             the block statistics struct to populate
+ */
+s32_t SPIFFS_block_stats(spiffs *fs, u32_t bix, spiffs_block_stats *s);
+
+/**
+ * Sets the policy choosing which block the garbage collector reclaims.
+ * Each block with deleted pages is scored, and the one with the highest
+ * score is cleaned and erased. Given 0, spiffs_gc_score_default is used.
+ * Mounting sets the default, call this after SPIFFS_mount.
+ *
+ * @param fs            the file system struct
+ * @param score_f       the scoring function
+ */
+s32_t SPIFFS_gc_policy(spiffs *fs, spiffs_gc_score_f score_f);
+
+/**
+ * Scoring functions for SPIFFS_gc_policy.
+ *
+ * spiffs_gc_score_default weighs deleted pages, used pages and erase age with
+ * SPIFFS_GC_HEUR_W_DELET, SPIFFS_GC_HEUR_W_USED and
+ * SPIFFS_GC_HEUR_W_ERASE_AGE, leaving out the age when the file system is
+ * crammed.
+ *
+ * spiffs_gc_score_greedy leaves out the erase age, reclaiming the block with
+ * the least live data to move. It writes the least but leaves blocks of
+ * long lived files unerased while the others wear.
+ *
+ * spiffs_gc_score_wear is the greedy score plus SPIFFS_GC_HEUR_W_WEAR for
+ * each erase of a block since mount more than the least erased block, so
+ * that worn blocks are passed over and blocks of long lived files are
+ * collected once the others have caught up. It moves fewer pages than the
+ * default, but needs the erase counts of SPIFFS_WEAR_STATS_BLOCKS, without
+ * them it is the greedy score.
+ */
+s32_t spiffs_gc_score_default(const spiffs_block_stats *b, u8_t fs_crammed);
+s32_t spiffs_gc_score_greedy(const spiffs_block_stats *b, u8_t fs_crammed);
+s32_t spiffs_gc_score_wear(const spiffs_block_stats *b, u8_t fs_crammed);
+
 #if SPIFFS_TEST_VISUALISATION
 /**
  * Prints out a visualization of the filesystem.
@@ -62,6 +62,15 @@
 #ifndef  SPIFFS_CACHE_STATS
 #define SPIFFS_CACHE_STATS              1
 #endif
+
+// Number of pages read ahead in one flash access when a file descriptor
+// is read sequentially. The window is taken from the cache memory given
+// in SPIFFS_mount, only if that still leaves room for a cache page, so a
+// cache buffer without room for the window reads as before. 0 disables
+// read ahead.
+#ifndef  SPIFFS_READ_AHEAD_PAGES
+#define SPIFFS_READ_AHEAD_PAGES         4
+#endif
 #endif
 
 // Always check header of each accessed page to ensure consistent state.
@@ -80,6 +89,15 @@
 #define SPIFFS_GC_STATS                 1
 #endif
 
+// Number of blocks whose erases are counted in RAM, for SPIFFS_block_stats
+// and wear aware garbage collection policies. spiffs keeps no erase count
+// per block on flash, so these count from mount. Two bytes per block in the
+// spiffs struct, file systems with more blocks are not counted. 0 disables
+// the counts.
+#ifndef SPIFFS_WEAR_STATS_BLOCKS
+#define SPIFFS_WEAR_STATS_BLOCKS        (32)
+#endif
+
 // Garbage collecting examines all pages in a block which and sums up
 // to a block score. Deleted pages normally gives positive score and
 // used pages normally gives a negative score (as these must be moved).
@@ -101,12 +119,53 @@
 #ifndef SPIFFS_GC_HEUR_W_ERASE_AGE
 #define SPIFFS_GC_HEUR_W_ERASE_AGE      (50)
 #endif
+// Garbage collecting heuristics - weight used by spiffs_gc_score_wear for
+// each erase of a block since mount more than the least erased block.
+#ifndef SPIFFS_GC_HEUR_W_WEAR
+#define SPIFFS_GC_HEUR_W_WEAR           (-2)
+#endif
 
 // Object name maximum length.
 #ifndef SPIFFS_OBJ_NAME_LEN
 #define SPIFFS_OBJ_NAME_LEN             (32)
 #endif
 
+// Number of objects kept in the in-RAM name index, mapping a hash of the
+// name to the object index header page so that open, stat and remove by
+// name need one flash read instead of a scan of all lookup pages. Each
+// entry takes 6 bytes of the spiffs struct. With more objects than this
+// the names left out are found by scanning. 0 disables the index.
+#ifndef SPIFFS_NAME_INDEX
+#define SPIFFS_NAME_INDEX               (32)
+#endif
+
+// Number of pages tracked in a RAM bitmap of free pages, built at mount,
+// so that allocating a page does not read object lookup pages from flash.
+// One bit per page in the spiffs struct, the file system must fit entirely
+// or flash is searched as before. 0 disables the bitmap; a project that
+// creates and removes many files defines it to its page count, e.g. 2048
+// for 256 KB of 128 byte pages (256 bytes of RAM).
+#ifndef SPIFFS_ALLOC_MAP_PAGES
+#define SPIFFS_ALLOC_MAP_PAGES          (0)
+#endif
+
+// Number of object ids tracked in a RAM bitmap of ids in use, built at
+// mount, so that creating a file does not scan flash for a free id. One
+// bit per id in the spiffs struct, counted from 1; once they are all taken
+// flash is searched as before. 0 disables the bitmap, define it along with
+// SPIFFS_ALLOC_MAP_PAGES, e.g. to 128.
+#ifndef SPIFFS_ALLOC_MAP_IDS
+#define SPIFFS_ALLOC_MAP_IDS            (0)
+#endif
+
+// Number of file descriptors that may have an append buffer at a time, see
+// SPIFFS_fbuffer. Small appends to such a file are collected in the buffer
+// and written as one append, rewriting the object index header once per
+// buffer instead of once per write. 0 disables append buffers.
+#ifndef SPIFFS_APPEND_BUFFERS
+#define SPIFFS_APPEND_BUFFERS           (2)
+#endif
+
 // Size of buffer allocated on stack used when copying data.
 // Lower value generates more read/writes. No meaning having it bigger
 // than logical page size.
@@ -122,8 +181,26 @@
 #define SPIFFS_USE_MAGIC                (0)
 #endif
 
+// Enable the background garbage collection task of esp_spiffs.c, see
+// esp_spiffs_gc_start. The task and the application tasks share the file
+// system, so this also defines SPIFFS_LOCK and SPIFFS_UNLOCK below to take
+// a mutex in esp_spiffs.c.
+#ifndef SPIFFS_GC_TASK
+#define SPIFFS_GC_TASK                  1
+#endif
+
 // SPIFFS_LOCK and SPIFFS_UNLOCK protects spiffs from reentrancy on api level
 // These should be defined on a multithreaded system
+#if SPIFFS_GC_TASK
+void esp_spiffs_lock(void);
+void esp_spiffs_unlock(void);
+#ifndef SPIFFS_LOCK
+#define SPIFFS_LOCK(fs)                 esp_spiffs_lock()
+#endif
+#ifndef SPIFFS_UNLOCK
+#define SPIFFS_UNLOCK(fs)               esp_spiffs_unlock()
+#endif
+#endif
 
 // define this to enter a mutex if you're running on a multithreaded system
 #ifndef SPIFFS_LOCK
@@ -332,14 +332,21 @@
 #define spiffs_get_cache_page(fs, c, ix) \
   ((u8_t *)(&((c)->cpages[(ix) * SPIFFS_CACHE_PAGE_SIZE(fs)])) + sizeof(spiffs_cache_page))
 
+// marks the end of a cache page list or hash chain
+#define SPIFFS_CACHE_NIL              ((u16_t)-1)
+
 // cache page struct
 typedef struct {
-  // cache flags
+  // cache flags, zero when the cache page is free
   u8_t flags;
   // cache page index
-  u8_t ix;
-  // last access of this cache page
-  u32_t last_access;
+  u16_t ix;
+  // neighbours in the lru or write list, lru_next links the free list
+  // when unused
+  u16_t lru_prev;
+  u16_t lru_next;
+  // next read cache page in the same hash bucket
+  u16_t hash_next;
   union {
     // type read cache
     struct {
@@ -362,13 +369,38 @@ typedef struct {
 
 // cache struct
 typedef struct {
-  u8_t cpage_count;
-  u32_t last_access;
-  u32_t cpage_use_map;
-  u32_t cpage_use_mask;
+  u16_t cpage_count;
+  // most and least recently used read cache pages
+  u16_t lru_head;
+  u16_t lru_tail;
+  // write cache pages, these are never evicted and kept apart from the lru
+  u16_t wr_head;
+  u16_t wr_tail;
+  // first unused cache page
+  u16_t free_head;
+  // 16 - log2 of the number of hash buckets
+  u8_t hash_shift;
+  // read cache pages by page index, SPIFFS_CACHE_NIL for empty buckets
+  u16_t *hash;
   u8_t *cpages;
+#if SPIFFS_READ_AHEAD_PAGES
+  // flash address and length of the read ahead window, ra_len is zero when
+  // the window is empty or there was no room for it
+  u32_t ra_addr;
+  u32_t ra_len;
+  u8_t *ra_buf;
+#endif
 } spiffs_cache;
 
+// bytes of cache memory used per cache page, the page itself plus at most
+// two hash buckets
+#define SPIFFS_CACHE_ENTRY_SIZE(fs) \
+  (SPIFFS_CACHE_PAGE_SIZE(fs) + 2 * sizeof(u16_t))
+
+// bytes of cache memory set aside for the read ahead window
+#define SPIFFS_CACHE_READ_AHEAD_SIZE(fs) \
+  (SPIFFS_READ_AHEAD_PAGES * SPIFFS_CFG_LOG_PAGE_SZ(fs))
+
 #endif
 
 
@@ -644,6 +676,11 @@ s32_t spiffs_object_find_object_index_header_by_name(
     u8_t name[SPIFFS_OBJ_NAME_LEN],
     spiffs_page_ix *pix);
 
+#if SPIFFS_NAME_INDEX
+s32_t spiffs_name_ix_build(
+    spiffs *fs);
+#endif
+
 // ---------------
 
 s32_t spiffs_gc_check(
@@ -667,6 +704,15 @@ s32_t spiffs_gc_clean(
 s32_t spiffs_gc_quick(
     spiffs *fs, u16_t max_free_pages);
 
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t reserve_blocks);
+
+s32_t spiffs_gc_block_stats(
+    spiffs *fs,
+    spiffs_block_ix bix,
+    spiffs_block_stats *b);
+
 // ---------------
 
 s32_t spiffs_fd_find_new(
@@ -682,6 +728,20 @@ s32_t spiffs_fd_get(
     spiffs_file f,
     spiffs_fd **fd);
 
+#if SPIFFS_APPEND_BUFFERS
+spiffs_append_buf *spiffs_append_buf_get(
+    spiffs *fs,
+    spiffs_file f);
+
+spiffs_append_buf *spiffs_append_buf_get_by_obj_id(
+    spiffs *fs,
+    spiffs_obj_id obj_id);
+
+void spiffs_append_buf_release(
+    spiffs *fs,
+    spiffs_file f);
+#endif
+
 #if SPIFFS_CACHE
 void spiffs_cache_init(
     spiffs *fs);
@@ -690,6 +750,14 @@ void spiffs_cache_drop_page(
     spiffs *fs,
     spiffs_page_ix pix);
 
+#if SPIFFS_READ_AHEAD_PAGES
+void spiffs_cache_read_ahead(
+    spiffs *fs,
+    spiffs_file fh,
+    spiffs_page_ix pix,
+    u32_t pages);
+#endif
+
 #if SPIFFS_CACHE_WR
 spiffs_cache_page *spiffs_cache_page_allocate_by_fd(
     spiffs *fs,
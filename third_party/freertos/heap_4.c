@@ -67,6 +67,11 @@
  * (coalescences) adjacent memory blocks as they are freed, and in so doing 
  * limits memory fragmentation.
  *
+ * Freed blocks of a few small sizes are kept on per-size lists instead, up to
+ * configHEAP_CLASS_CACHE_SIZE bytes, so that the short lived pbufs, segments
+ * and messages that make up most requests are allocated and freed without a
+ * walk of the free list.
+ *
  * See heap_1.c, heap_2.c and heap_3.c for alternative implementations, and the 
  * memory management pages of http://www.FreeRTOS.org for more information.
  */
@@ -82,11 +87,104 @@ task.h is included from an application file. */
 #include "freertos/task.h"
 
 #include "espressif/esp8266/ets_sys.h"
+#include "espressif/esp_libc.h"
 
 #undef MPU_WRAPPERS_INCLUDED_FROM_API_FILE
 
 extern char _heap_start;
-#define configTOTAL_HEAP_SIZE			( ( size_t ) ( 0x40000000 - (uint32)&_heap_start ) )
+#ifndef configTOTAL_HEAP_SIZE
+	#define configTOTAL_HEAP_SIZE			( ( size_t ) ( 0x40000000 - (uint32)&_heap_start ) )
+#endif
+
+/* Small blocks are served from per-size free lists, see prvAllocateFromClass(). */
+#ifndef configUSE_HEAP_SIZE_CLASSES
+	#define configUSE_HEAP_SIZE_CLASSES		1
+#endif
+
+/* Upper bound on the free memory held back in the size class lists, so the
+cache cannot starve larger allocations. */
+#ifndef configHEAP_CLASS_CACHE_SIZE
+	#define configHEAP_CLASS_CACHE_SIZE		2048
+#endif
+
+/* When set, every allocated block records the address of the code that asked
+for it, for vPortDumpHeap() and uxPortGetHeapBlocks().  The address is kept in
+the otherwise unused free list link of the block, so blocks do not grow. */
+#ifndef configUSE_HEAP_TRACKING
+	#define configUSE_HEAP_TRACKING			0
+#endif
+
+/* When set, tasks hold the scheduler lock rather than turning interrupts off
+while they walk the free list, so interrupt latency no longer depends on how
+fragmented the heap is.  Interrupt handlers then cannot wait for the heap and
+are served from a small pool of fixed size blocks instead, see
+prvIsrPoolAllocate(), and get NULL for requests larger than a pool block.  Off
+until the pool is sized from the allocations interrupt handlers make on the
+device; then the heap is searched with interrupts off, as before. */
+#ifndef configUSE_HEAP_SCHEDULER_LOCK
+	#define configUSE_HEAP_SCHEDULER_LOCK	0
+#endif
+
+/* Number and usable size of the blocks kept for interrupt handlers.  The pool
+is carved out of the heap when it is set up. */
+#ifndef configHEAP_ISR_POOL_BLOCKS
+	#define configHEAP_ISR_POOL_BLOCKS		8
+#endif
+
+#ifndef configHEAP_ISR_POOL_BLOCK_SIZE
+	#define configHEAP_ISR_POOL_BLOCK_SIZE	64
+#endif
+
+/* When set, vPortSetHeapTraceHook() can install a function that is told about
+every allocation, free and resize, to capture the allocation sequence of a
+running device.  Costs one test of the hook per call while none is set. */
+#ifndef configUSE_HEAP_TRACE
+	#define configUSE_HEAP_TRACE			1
+#endif
+
+#if( configUSE_HEAP_TRACKING == 1 )
+	#define heapCALLER()					__builtin_return_address( 0 )
+#else
+	#define heapCALLER()					NULL
+#endif
+
+/* How prvHeapLock() got hold of the heap, so prvHeapUnlock() can let go of
+it the same way. */
+#define heapLOCK_FAILED					0
+#define heapLOCK_SCHEDULER				1
+#define heapLOCK_INTERRUPTS				2
+#define heapLOCK_HELD					3
+
+/* True for interrupt handlers, the NMI, and tasks inside a critical section:
+code that no other user of the heap can preempt, but that may itself have
+preempted a task in the middle of a search.  On the LX106 an interrupt handler
+runs with PS.INTLEVEL or PS.EXCM set. */
+#ifndef heapINTERRUPTS_MASKED
+	static inline unsigned long prvReadPS( void )
+	{
+	unsigned long ulPS;
+
+		__asm__ volatile ( "rsr %0, ps" : "=a" ( ulPS ) );
+		return ulPS;
+	}
+
+	#define heapINTERRUPTS_MASKED()		( ( NMIIrqIsOn != 0 ) || ( ( prvReadPS() & 0x1fUL ) != 0 ) )
+#endif
+
+#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+
+	/* Keeps the compiler from moving heap accesses across the busy flag. */
+	#define heapBARRIER()					__asm__ volatile ( "" ::: "memory" )
+
+	/* Usable size of an interrupt pool block, rounded to the alignment. */
+	#define heapISR_POOL_BLOCK_SIZE			( ( ( size_t ) configHEAP_ISR_POOL_BLOCK_SIZE + portBYTE_ALIGNMENT_MASK ) & ~( ( size_t ) portBYTE_ALIGNMENT_MASK ) )
+
+	#define heapIS_ISR_POOL_BLOCK( pv )		( ( ( unsigned char * ) ( pv ) >= pucIsrPoolStart ) && ( ( unsigned char * ) ( pv ) < pucIsrPoolEnd ) )
+
+#endif
+
+/* Number of distinct owners vPortDumpHeap() totals separately. */
+#define heapDUMP_OWNERS					16
 
 /* Block sizes must not get too small. */
 #define heapMINIMUM_BLOCK_SIZE	( ( size_t ) ( heapSTRUCT_SIZE * 2 ) )
@@ -125,6 +223,110 @@ static void prvInsertBlockIntoFreeList( xBlockLink *pxBlockToInsert );
  */
 static void prvHeapInit( void );
 
+/*
+ * The body of pvPortMalloc(), with the owner to record against the block
+ * passed in so the public wrappers can each report their own caller.
+ */
+static void *prvMalloc( size_t xWantedSize, void *pvOwner );
+
+/*
+ * The bodies of vPortFree() and pvPortRealloc(), which the traced versions of
+ * the public functions wrap.
+ */
+static void prvFree( void *pv );
+static void *prvRealloc( void *mem, size_t newsize, void *pvOwner );
+
+/*
+ * First fit search of the address ordered free list.  Returns NULL if no block
+ * is large enough.  Must be called with the heap locked.
+ */
+static void *prvAllocateFromFreeList( size_t xWantedSize );
+
+/*
+ * Returns a block that is no longer in use to the heap, either to its size
+ * class list or to the main free list.  Must be called with the heap locked.
+ */
+static void prvReleaseBlock( xBlockLink *pxBlock );
+
+/*
+ * Takes the heap for the caller and returns how, for prvHeapUnlock().  With
+ * configUSE_HEAP_SCHEDULER_LOCK a task holds the scheduler lock and interrupts
+ * stay on; an interrupt handler gets heapLOCK_FAILED if it preempted a task
+ * that was using the heap, and must not touch it.
+ */
+static portBASE_TYPE prvHeapLock( void );
+
+/*
+ * Gives the heap back after prvHeapLock().
+ */
+static void prvHeapUnlock( portBASE_TYPE xLock );
+
+#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+
+	/*
+	 * Pops a block from the interrupt pool if xWantedSize fits in one.  Only
+	 * interrupts are held off, and only for the pop.
+	 */
+	static void *prvIsrPoolAllocate( size_t xWantedSize );
+
+	/*
+	 * Returns pv to the interrupt pool if it came from there.  Returns pdFALSE
+	 * for any other block.
+	 */
+	static portBASE_TYPE prvIsrPoolFree( void *pv );
+
+	/*
+	 * Releases the blocks interrupt handlers freed while the heap was in use.
+	 * Must be called with the heap locked.
+	 */
+	static void prvReleaseDeferredBlocks( void );
+
+#endif
+
+#if( configUSE_HEAP_TRACE == 1 )
+
+	/*
+	 * Suspends the scheduler around a traced operation and its hook when
+	 * called from a task, so no other task's records can come in between.
+	 * Returns pdTRUE if it did.
+	 */
+	static portBASE_TYPE prvTraceBegin( void );
+	static void prvTraceEnd( portBASE_TYPE xSuspended );
+
+	/*
+	 * Traced pvPortMalloc(), pvPortCalloc() and pvPortZalloc().
+	 */
+	static void *prvTracedAllocate( pdHEAP_TRACE_HOOK pxHook, size_t xCount, size_t xSize, portBASE_TYPE xZero, void *pvOwner, void *pvCaller );
+
+#endif
+
+#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+
+	/*
+	 * Rounds *pxWantedSize up to its size class, if it has one, and pops a
+	 * block from that class's free list.  Returns NULL when the list is empty
+	 * so the caller can carve a block of the rounded size from the main list.
+	 */
+	static void *prvAllocateFromClass( size_t *pxWantedSize );
+
+	/*
+	 * Gives every block held in the size class lists back to the main free list
+	 * so they can be coalesced.  Used when the main list cannot satisfy a
+	 * request on its own.
+	 */
+	static void prvFlushClassLists( void );
+
+#endif
+
+/* An allocated block has no place in the free list.  Without tracking its link
+is NULL, which also catches a block being freed twice; with tracking the link
+holds the owner and only the allocated bit can be checked. */
+#if( configUSE_HEAP_TRACKING == 1 )
+	#define heapBLOCK_IS_UNLINKED( pxBlock )	( pdTRUE )
+#else
+	#define heapBLOCK_IS_UNLINKED( pxBlock )	( ( pxBlock )->pxNextFreeBlock == NULL )
+#endif
+
 /*-----------------------------------------------------------*/
 
 /* The size of the structure placed at the beginning of each allocated memory
@@ -149,6 +351,66 @@ application.  When the bit is free the block is still part of the free heap
 space. */
 static size_t xBlockAllocatedBit = 0;
 
+/* First block of the heap, where a walk through every block starts. */
+static unsigned char *pucHeapStart = NULL;
+
+/* Statistics reported by vPortGetHeapStats(). */
+static size_t xMinimumEverFreeBytesRemaining = 0;
+static size_t xNumberOfSuccessfulAllocations = 0;
+static size_t xNumberOfSuccessfulFrees = 0;
+
+#if( configUSE_HEAP_TRACE == 1 )
+
+	/* Set by vPortSetHeapTraceHook(), NULL while nothing is traced. */
+	static pdHEAP_TRACE_HOOK pxHeapTraceHook = NULL;
+
+#endif
+
+#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+
+	/* Set while someone is inside the heap.  Tasks cannot see it set by
+	anyone else, as the owner either holds the scheduler lock or has
+	interrupts off; interrupt handlers check it before going near the heap. */
+	static volatile unsigned char ucHeapBusy = 0;
+
+	/* Blocks freed by interrupt handlers while the heap was busy, linked
+	through pxNextFreeBlock, for the next holder of the heap to release. */
+	static xBlockLink * volatile pxDeferredFree = NULL;
+
+	/* The interrupt pool: one allocated heap block cut into equal pieces,
+	with the free ones on a LIFO list. */
+	static unsigned char *pucIsrPoolStart = NULL, *pucIsrPoolEnd = NULL;
+	static xBlockLink *pxIsrPoolFreeList = NULL;
+
+#endif
+
+#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+
+	/* Usable bytes of each size class.  These cover the pbuf, PCB, timer and
+	MQTT message sizes that dominate the allocation pattern at run time. */
+	static const unsigned short usClassPayloadSize[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+	#define heapNUM_SIZE_CLASSES	( sizeof( usClassPayloadSize ) / sizeof( usClassPayloadSize[ 0 ] ) )
+
+	/* Largest request, in usable bytes, that belongs to a size class. */
+	#define heapMAX_CLASS_PAYLOAD	( ( size_t ) 256 )
+
+	/* Maps a usable size in units of portBYTE_ALIGNMENT to the smallest class
+	that can hold it, so the lookup is a single table read. */
+	static unsigned char ucClassIndex[ heapMAX_CLASS_PAYLOAD / portBYTE_ALIGNMENT + 1 ];
+
+	/* Block size, header included, of each class. */
+	static size_t xClassBlockSize[ heapNUM_SIZE_CLASSES ];
+
+	/* Singly linked LIFO lists of free blocks, one per class.  The blocks keep
+	their exact class size and are not merged with their neighbours while they
+	are held here. */
+	static xBlockLink *pxClassFreeList[ heapNUM_SIZE_CLASSES ];
+
+	/* Bytes currently held in the class lists, counted as free heap. */
+	static size_t xClassCachedBytes = 0;
+
+#endif
+
 /*-----------------------------------------------------------*/
 
 size_t xPortWantedSizeAlign(size_t xWantedSize)
@@ -168,13 +430,43 @@ size_t xPortWantedSizeAlign(size_t xWantedSize)
 
 void *pvPortMalloc( size_t xWantedSize )
 {
-xBlockLink *pxBlock, *pxPreviousBlock, *pxNewBlockLink;
+	#if( configUSE_HEAP_TRACE == 1 )
+	{
+	pdHEAP_TRACE_HOOK pxHook = pxHeapTraceHook;
+
+		if( pxHook != NULL )
+		{
+			return prvTracedAllocate( pxHook, 1, xWantedSize, pdFALSE, heapCALLER(), __builtin_return_address( 0 ) );
+		}
+	}
+	#endif
+
+	return prvMalloc( xWantedSize, heapCALLER() );
+}
+
+void *malloc(size_t nbytes) __attribute__((alias("pvPortMalloc")));
+
+/*-----------------------------------------------------------*/
+
+static void *prvMalloc( size_t xWantedSize, void *pvOwner )
+{
 void *pvReturn = NULL;
+portBASE_TYPE xLock;
 
 //    printf("%s %d %d\n", __func__, xWantedSize, xFreeBytesRemaining);
 
-//	vTaskSuspendAll();
-	ETS_INTR_LOCK();
+	#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+	{
+		/* Interrupt handlers try their pool first, it costs the same however
+		the heap looks. */
+		if( heapINTERRUPTS_MASKED() )
+		{
+			pvReturn = prvIsrPoolAllocate( xWantedSize );
+		}
+	}
+	#endif
+
+	if( ( pvReturn == NULL ) && ( ( xLock = prvHeapLock() ) != heapLOCK_FAILED ) )
 	{
 		/* If this is the first call to malloc then the heap will require
 		initialisation to setup the list of free blocks. */
@@ -196,61 +488,48 @@ void *pvReturn = NULL;
 				xWantedSize = xPortWantedSizeAlign(xWantedSize);
 			}
 
-			if( ( xWantedSize > 0 ) && ( xWantedSize <= xFreeBytesRemaining ) )
+			#if( configUSE_HEAP_SIZE_CLASSES == 1 )
 			{
-				/* Traverse the list from the start	(lowest address) block until 
-				one	of adequate size is found. */
-				pxPreviousBlock = &xStart;
-				pxBlock = xStart.pxNextFreeBlock;
-				while( ( pxBlock->xBlockSize < xWantedSize ) && ( pxBlock->pxNextFreeBlock != NULL ) )
+				/* Small requests are rounded up to their class and taken
+				from its free list when it has a block ready. */
+				if( xWantedSize > 0 )
 				{
-					pxPreviousBlock = pxBlock;
-					pxBlock = pxBlock->pxNextFreeBlock;
+					pvReturn = prvAllocateFromClass( &xWantedSize );
 				}
+			}
+			#endif
 
-				/* If the end marker was reached then a block of adequate size 
-				was	not found. */
-				if( pxBlock != pxEnd )
-				{
-					/* Return the memory space pointed to - jumping over the 
-					xBlockLink structure at its start. */
-					pvReturn = ( void * ) ( ( ( unsigned char * ) pxPreviousBlock->pxNextFreeBlock ) + heapSTRUCT_SIZE );
-
-					/* This block is being returned for use so must be taken out 
-					of the list of free blocks. */
-					pxPreviousBlock->pxNextFreeBlock = pxBlock->pxNextFreeBlock;
+			if( ( pvReturn == NULL ) && ( xWantedSize > 0 ) && ( xWantedSize <= xFreeBytesRemaining ) )
+			{
+				pvReturn = prvAllocateFromFreeList( xWantedSize );
 
-					/* If the block is larger than required it can be split into 
-					two. */
-					if( ( pxBlock->xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+				#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+				{
+					/* The free bytes may be sitting in the class lists, where
+					they cannot be merged into a block large enough. */
+					if( ( pvReturn == NULL ) && ( xClassCachedBytes > 0 ) )
 					{
-						/* This block is to be split into two.  Create a new 
-						block following the number of bytes requested. The void 
-						cast is used to prevent byte alignment warnings from the 
-						compiler. */
-						pxNewBlockLink = ( void * ) ( ( ( unsigned char * ) pxBlock ) + xWantedSize );
-
-						/* Calculate the sizes of two blocks split from the 
-						single block. */
-						pxNewBlockLink->xBlockSize = pxBlock->xBlockSize - xWantedSize;
-						pxBlock->xBlockSize = xWantedSize;
-
-						/* Insert the new block into the list of free blocks. */
-						prvInsertBlockIntoFreeList( ( pxNewBlockLink ) );
+						prvFlushClassLists();
+						pvReturn = prvAllocateFromFreeList( xWantedSize );
 					}
+				}
+				#endif
+			}
 
-					xFreeBytesRemaining -= pxBlock->xBlockSize;
+			if( pvReturn != NULL )
+			{
+				( ( xBlockLink * ) ( ( ( unsigned char * ) pvReturn ) - heapSTRUCT_SIZE ) )->pxNextFreeBlock = pvOwner;
+				xNumberOfSuccessfulAllocations++;
 
-					/* The block is being returned - it is allocated and owned
-					by the application and has no "next" block. */
-					pxBlock->xBlockSize |= xBlockAllocatedBit;
-					pxBlock->pxNextFreeBlock = NULL;
+				if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+				{
+					xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
 				}
 			}
 		}
+
+		prvHeapUnlock( xLock );
 	}
-//	xTaskResumeAll();
-	ETS_INTR_UNLOCK();
 
 	#if( configUSE_MALLOC_FAILED_HOOK == 1 )
 	{
@@ -262,23 +541,56 @@ void *pvReturn = NULL;
 	}
 	#endif
 
-//    printf("%s %x %x\n", __func__, pvReturn, pxBlock);
+//    printf("%s %x\n", __func__, pvReturn);
 	return pvReturn;
 }
 
-void *malloc(size_t nbytes) __attribute__((alias("pvPortMalloc")));
-
 /*-----------------------------------------------------------*/
 
 void vPortFree( void *pv )
+{
+	#if( configUSE_HEAP_TRACE == 1 )
+	{
+	pdHEAP_TRACE_HOOK pxHook = pxHeapTraceHook;
+	portBASE_TYPE xSuspended;
+
+		if( ( pxHook != NULL ) && ( pv != NULL ) )
+		{
+			xSuspended = prvTraceBegin();
+			prvFree( pv );
+			pxHook( 'f', pv, NULL, 0, __builtin_return_address( 0 ) );
+			prvTraceEnd( xSuspended );
+			return;
+		}
+	}
+	#endif
+
+	prvFree( pv );
+}
+
+void free(void *ptr) __attribute__((alias("vPortFree")));
+
+/*-----------------------------------------------------------*/
+
+static void prvFree( void *pv )
 {
 unsigned char *puc = ( unsigned char * ) pv;
 xBlockLink *pxLink;
+portBASE_TYPE xLock;
 
 //    printf("%s\n", __func__);
     
 	if( pv != NULL )
 	{
+		#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+		{
+			if( prvIsrPoolFree( pv ) == pdTRUE )
+			{
+				return;
+			}
+		}
+		#endif
+
 		/* The memory being freed will have an xBlockLink structure immediately
 		before it. */
 		puc -= heapSTRUCT_SIZE;
@@ -288,25 +600,37 @@ xBlockLink *pxLink;
 
 		/* Check the block is actually allocated. */
 		configASSERT( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 );
-		configASSERT( pxLink->pxNextFreeBlock == NULL );
+		configASSERT( heapBLOCK_IS_UNLINKED( pxLink ) );
 		
 		if( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 )
 		{
-			if( pxLink->pxNextFreeBlock == NULL )
+			if( heapBLOCK_IS_UNLINKED( pxLink ) )
 			{
 				/* The block is being returned to the heap - it is no longer
 				allocated. */
 				pxLink->xBlockSize &= ~xBlockAllocatedBit;
 
-//				vTaskSuspendAll();
-				ETS_INTR_LOCK();
+				xLock = prvHeapLock();
+				if( xLock != heapLOCK_FAILED )
 				{
 					/* Add this block to the list of free blocks. */
 					xFreeBytesRemaining += pxLink->xBlockSize;
-					prvInsertBlockIntoFreeList( ( ( xBlockLink * ) pxLink ) );
+					xNumberOfSuccessfulFrees++;
+					prvReleaseBlock( pxLink );
+
+					prvHeapUnlock( xLock );
 				}
-//				xTaskResumeAll();
-				ETS_INTR_UNLOCK();
+				#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+				else
+				{
+					/* An interrupt preempted a task that is using the heap.
+					Leave the block for the task to release. */
+					ETS_INTR_LOCK();
+					pxLink->pxNextFreeBlock = pxDeferredFree;
+					pxDeferredFree = pxLink;
+					ETS_INTR_UNLOCK();
+				}
+				#endif
 			}
 		}
 	}
@@ -314,16 +638,14 @@ xBlockLink *pxLink;
 //	printf("%s %x %d\n", __func__, pv, xFreeBytesRemaining);
 }
 
-void free(void *ptr) __attribute__((alias("vPortFree")));
-
 /*-----------------------------------------------------------*/
 
-void *pvPortCalloc(size_t count, size_t size)
+static void *prvCalloc(size_t count, size_t size, void *pvOwner)
 {
   void *p;
 
   /* allocate 'count' objects of size 'size' */
-  p = pvPortMalloc(count * size);
+  p = prvMalloc(count * size, pvOwner);
   if (p) {
     /* zero the memory */
     memset(p, 0, count * size);
@@ -331,13 +653,34 @@ void *pvPortCalloc(size_t count, size_t size)
   return p;
 }
 
+void *pvPortCalloc(size_t count, size_t size)
+{
+#if( configUSE_HEAP_TRACE == 1 )
+  pdHEAP_TRACE_HOOK pxHook = pxHeapTraceHook;
+
+  if (pxHook != NULL) {
+    return prvTracedAllocate(pxHook, count, size, pdTRUE, heapCALLER(), __builtin_return_address(0));
+  }
+#endif
+
+  return prvCalloc(count, size, heapCALLER());
+}
+
 void *calloc(size_t count, size_t nbytes) __attribute__((alias("pvPortCalloc")));
 
 /*-----------------------------------------------------------*/
 
 void *pvPortZalloc(size_t size)
 {
-     return pvPortCalloc(1, size);	
+#if( configUSE_HEAP_TRACE == 1 )
+     pdHEAP_TRACE_HOOK pxHook = pxHeapTraceHook;
+
+     if (pxHook != NULL) {
+          return prvTracedAllocate(pxHook, 1, size, pdTRUE, heapCALLER(), __builtin_return_address(0));
+     }
+#endif
+
+     return prvCalloc(1, size, heapCALLER());
 }
 
 void *zalloc(size_t nbytes) __attribute__((alias("pvPortZalloc")));
@@ -346,27 +689,183 @@ void *zalloc(size_t nbytes) __attribute__((alias("pvPortZalloc")));
 
 void *pvPortRealloc(void *mem, size_t newsize)
 {
-    if (newsize == 0) {
-        vPortFree(mem);
-        return NULL;
-    }
-
-     void *p;  	
-     p = pvPortMalloc(newsize);
-     if (p) {
-       /* zero the memory */
-       if (mem != NULL) {
-		   memcpy(p, mem, newsize);
-		   vPortFree(mem);
-       }
-     }
-     return p;     
+	#if( configUSE_HEAP_TRACE == 1 )
+	{
+	pdHEAP_TRACE_HOOK pxHook = pxHeapTraceHook;
+	portBASE_TYPE xSuspended;
+	void *pvReturn;
+
+		if( pxHook != NULL )
+		{
+			xSuspended = prvTraceBegin();
+			pvReturn = prvRealloc( mem, newsize, heapCALLER() );
+
+			/* Recorded as what it turned out to be. */
+			if( mem == NULL )
+			{
+				if( newsize != 0 )
+				{
+					pxHook( 'm', pvReturn, NULL, newsize, __builtin_return_address( 0 ) );
+				}
+			}
+			else if( newsize == 0 )
+			{
+				pxHook( 'f', mem, NULL, 0, __builtin_return_address( 0 ) );
+			}
+			else
+			{
+				pxHook( 'r', mem, pvReturn, newsize, __builtin_return_address( 0 ) );
+			}
+
+			prvTraceEnd( xSuspended );
+			return pvReturn;
+		}
+	}
+	#endif
+
+	return prvRealloc( mem, newsize, heapCALLER() );
 }
 
 void *realloc(void *ptr, size_t nbytes) __attribute__((alias("pvPortRealloc")));
 
 /*-----------------------------------------------------------*/
 
+static void *prvRealloc( void *mem, size_t newsize, void *pvOwner )
+{
+xBlockLink *pxLink, *pxPreviousBlock, *pxNextBlock, *pxNewBlockLink;
+size_t xWantedSize, xBlockSize;
+void *pvReturn = NULL;
+portBASE_TYPE xLock;
+
+	if( newsize == 0 )
+	{
+		prvFree( mem );
+		return NULL;
+	}
+
+	if( ( mem == NULL ) || ( ( newsize & xBlockAllocatedBit ) != 0 ) )
+	{
+		return prvMalloc( newsize, pvOwner );
+	}
+
+	#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+	{
+		/* Interrupt pool blocks all have the same size, so they either still
+		fit or have to move. */
+		if( heapIS_ISR_POOL_BLOCK( mem ) )
+		{
+			if( newsize <= heapISR_POOL_BLOCK_SIZE )
+			{
+				return mem;
+			}
+
+			pvReturn = prvMalloc( newsize, pvOwner );
+			if( pvReturn != NULL )
+			{
+				memcpy( pvReturn, mem, heapISR_POOL_BLOCK_SIZE );
+				prvFree( mem );
+			}
+
+			return pvReturn;
+		}
+	}
+	#endif
+
+	xWantedSize = xPortWantedSizeAlign( newsize );
+
+	/* The block being resized has an xBlockLink structure immediately before
+	it, exactly as in vPortFree(). */
+	pxLink = ( void * ) ( ( ( unsigned char * ) mem ) - heapSTRUCT_SIZE );
+	configASSERT( ( pxLink->xBlockSize & xBlockAllocatedBit ) != 0 );
+	configASSERT( heapBLOCK_IS_UNLINKED( pxLink ) );
+
+	/* Nobody else changes the header of an allocated block. */
+	xBlockSize = pxLink->xBlockSize & ~xBlockAllocatedBit;
+
+	/* An interrupt that cannot have the heap falls through to moving the
+	data, which it can do from its pool. */
+	xLock = prvHeapLock();
+	if( xLock != heapLOCK_FAILED )
+	{
+		if( xWantedSize <= xBlockSize )
+		{
+			/* Shrinking, or growing within the slack of the block.  Give the
+			tail back if it is worth having as a block of its own. */
+			if( ( xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+			{
+				pxNewBlockLink = ( void * ) ( ( ( unsigned char * ) pxLink ) + xWantedSize );
+				pxNewBlockLink->xBlockSize = xBlockSize - xWantedSize;
+				pxLink->xBlockSize = xWantedSize | xBlockAllocatedBit;
+
+				xFreeBytesRemaining += pxNewBlockLink->xBlockSize;
+				prvInsertBlockIntoFreeList( pxNewBlockLink );
+			}
+
+			pvReturn = mem;
+		}
+		else
+		{
+			/* Growing.  If the block physically after this one is free and
+			large enough the two can be joined without moving the data. */
+			pxNextBlock = ( void * ) ( ( ( unsigned char * ) pxLink ) + xBlockSize );
+
+			for( pxPreviousBlock = &xStart; pxPreviousBlock->pxNextFreeBlock < pxNextBlock; pxPreviousBlock = pxPreviousBlock->pxNextFreeBlock )
+			{
+				/* Nothing to do here, just iterate to the right position. */
+			}
+
+			if( ( pxPreviousBlock->pxNextFreeBlock == pxNextBlock ) && ( pxNextBlock != pxEnd ) && ( ( xBlockSize + pxNextBlock->xBlockSize ) >= xWantedSize ) )
+			{
+				pxPreviousBlock->pxNextFreeBlock = pxNextBlock->pxNextFreeBlock;
+				xFreeBytesRemaining -= pxNextBlock->xBlockSize;
+				xBlockSize += pxNextBlock->xBlockSize;
+
+				if( ( xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+				{
+					pxNewBlockLink = ( void * ) ( ( ( unsigned char * ) pxLink ) + xWantedSize );
+					pxNewBlockLink->xBlockSize = xBlockSize - xWantedSize;
+					xBlockSize = xWantedSize;
+
+					xFreeBytesRemaining += pxNewBlockLink->xBlockSize;
+					prvInsertBlockIntoFreeList( pxNewBlockLink );
+				}
+
+				pxLink->xBlockSize = xBlockSize | xBlockAllocatedBit;
+				pvReturn = mem;
+
+				if( xFreeBytesRemaining < xMinimumEverFreeBytesRemaining )
+				{
+					xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+				}
+			}
+		}
+
+		/* Whoever resized the block owns it now. */
+		if( pvReturn != NULL )
+		{
+			pxLink->pxNextFreeBlock = pvOwner;
+		}
+
+		prvHeapUnlock( xLock );
+	}
+
+	if( pvReturn == NULL )
+	{
+		/* No room in place, move the data.  Only the old block's contents
+		exist to be copied. */
+		pvReturn = prvMalloc( newsize, pvOwner );
+		if( pvReturn != NULL )
+		{
+			xBlockSize -= heapSTRUCT_SIZE;
+			memcpy( pvReturn, mem, ( newsize < xBlockSize ) ? newsize : xBlockSize );
+			prvFree( mem );
+		}
+	}
+
+	return pvReturn;
+}
+/*-----------------------------------------------------------*/
+
 size_t ICACHE_FLASH_ATTR
 xPortGetFreeHeapSize( void )
 {
@@ -374,6 +873,262 @@ xPortGetFreeHeapSize( void )
 }
 /*-----------------------------------------------------------*/
 
+size_t ICACHE_FLASH_ATTR
+xPortGetMinimumEverFreeHeapSize( void )
+{
+	return xMinimumEverFreeBytesRemaining;
+}
+/*-----------------------------------------------------------*/
+
+void ICACHE_FLASH_ATTR
+vPortGetHeapStats( xHeapStats *pxHeapStats )
+{
+xBlockLink *pxBlock;
+size_t xBlocks = 0, xMaxSize = 0, xMinSize = ( size_t ) -1;
+portBASE_TYPE xLock;
+
+	memset( pxHeapStats, 0, sizeof( xHeapStats ) );
+
+	xLock = prvHeapLock();
+	if( xLock != heapLOCK_FAILED )
+	{
+		/* Only the free blocks are visited, the walk is as long as one
+		allocation that fails. */
+		if( pxEnd != NULL )
+		{
+			for( pxBlock = xStart.pxNextFreeBlock; pxBlock != pxEnd; pxBlock = pxBlock->pxNextFreeBlock )
+			{
+				xBlocks++;
+
+				if( pxBlock->xBlockSize > xMaxSize )
+				{
+					xMaxSize = pxBlock->xBlockSize;
+				}
+
+				if( pxBlock->xBlockSize < xMinSize )
+				{
+					xMinSize = pxBlock->xBlockSize;
+				}
+			}
+		}
+
+		#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+		{
+		size_t x;
+
+			/* Cached blocks are free as well, only smaller than anything a
+			fragmentation figure cares about. */
+			for( x = 0; x < heapNUM_SIZE_CLASSES; x++ )
+			{
+				for( pxBlock = pxClassFreeList[ x ]; pxBlock != NULL; pxBlock = pxBlock->pxNextFreeBlock )
+				{
+					xBlocks++;
+
+					if( pxBlock->xBlockSize > xMaxSize )
+					{
+						xMaxSize = pxBlock->xBlockSize;
+					}
+
+					if( pxBlock->xBlockSize < xMinSize )
+					{
+						xMinSize = pxBlock->xBlockSize;
+					}
+				}
+			}
+		}
+		#endif
+
+		pxHeapStats->xAvailableHeapSpaceInBytes = xFreeBytesRemaining;
+		pxHeapStats->xMinimumEverFreeBytesRemaining = xMinimumEverFreeBytesRemaining;
+		pxHeapStats->xNumberOfSuccessfulAllocations = xNumberOfSuccessfulAllocations;
+		pxHeapStats->xNumberOfSuccessfulFrees = xNumberOfSuccessfulFrees;
+
+		prvHeapUnlock( xLock );
+	}
+
+	pxHeapStats->xNumberOfFreeBlocks = xBlocks;
+	pxHeapStats->xSizeOfLargestFreeBlockInBytes = ( xMaxSize > heapSTRUCT_SIZE ) ? xMaxSize - heapSTRUCT_SIZE : 0;
+	pxHeapStats->xSizeOfSmallestFreeBlockInBytes = ( xBlocks > 0 ) ? xMinSize - heapSTRUCT_SIZE : 0;
+}
+/*-----------------------------------------------------------*/
+
+unsigned portBASE_TYPE ICACHE_FLASH_ATTR
+uxPortGetHeapBlocks( xHeapBlockStatus *pxBlockArray, unsigned portBASE_TYPE uxArraySize )
+{
+xBlockLink *pxBlock;
+unsigned portBASE_TYPE uxBlocks = 0;
+size_t xBlockSize;
+portBASE_TYPE xLock;
+
+	xLock = prvHeapLock();
+	if( xLock != heapLOCK_FAILED )
+	{
+		/* The blocks tile the heap from its start up to pxEnd, so stepping
+		by each block's size visits all of them in address order. */
+		for( pxBlock = ( void * ) pucHeapStart; ( pxEnd != NULL ) && ( pxBlock < pxEnd ); pxBlock = ( void * ) ( ( ( unsigned char * ) pxBlock ) + xBlockSize ) )
+		{
+			xBlockSize = pxBlock->xBlockSize & ~xBlockAllocatedBit;
+
+			if( uxBlocks < uxArraySize )
+			{
+				pxBlockArray[ uxBlocks ].pvAddress = ( ( unsigned char * ) pxBlock ) + heapSTRUCT_SIZE;
+				pxBlockArray[ uxBlocks ].xSize = xBlockSize - heapSTRUCT_SIZE;
+				pxBlockArray[ uxBlocks ].ucAllocated = ( ( pxBlock->xBlockSize & xBlockAllocatedBit ) != 0 );
+				pxBlockArray[ uxBlocks ].pvOwner = NULL;
+
+				#if( configUSE_HEAP_TRACKING == 1 )
+				{
+					if( pxBlockArray[ uxBlocks ].ucAllocated )
+					{
+						pxBlockArray[ uxBlocks ].pvOwner = pxBlock->pxNextFreeBlock;
+					}
+				}
+				#endif
+			}
+
+			uxBlocks++;
+		}
+
+		prvHeapUnlock( xLock );
+	}
+
+	return uxBlocks;
+}
+/*-----------------------------------------------------------*/
+
+void ICACHE_FLASH_ATTR
+vPortDumpHeap( void )
+{
+struct
+{
+	void *pvOwner;
+	size_t xBytes;
+	unsigned short usBlocks;
+} xOwners[ heapDUMP_OWNERS + 1 ];
+xHeapStats xStats;
+xBlockLink *pxBlock;
+void *pvOwner;
+size_t xBlockSize, x;
+portBASE_TYPE xLock;
+
+	vPortGetHeapStats( &xStats );
+
+	printf( "heap: %u free, %u min ever, %u largest in %u free blocks, %u allocs %u frees\n",
+		( unsigned int ) xStats.xAvailableHeapSpaceInBytes, ( unsigned int ) xStats.xMinimumEverFreeBytesRemaining,
+		( unsigned int ) xStats.xSizeOfLargestFreeBlockInBytes, ( unsigned int ) xStats.xNumberOfFreeBlocks,
+		( unsigned int ) xStats.xNumberOfSuccessfulAllocations, ( unsigned int ) xStats.xNumberOfSuccessfulFrees );
+
+	memset( xOwners, 0, sizeof( xOwners ) );
+
+	/* The heap stays locked for one pass over every block.  The totals are
+	gathered first and printed after, as printing is far slower. */
+	xLock = prvHeapLock();
+	if( xLock != heapLOCK_FAILED )
+	{
+		for( pxBlock = ( void * ) pucHeapStart; ( pxEnd != NULL ) && ( pxBlock < pxEnd ); pxBlock = ( void * ) ( ( ( unsigned char * ) pxBlock ) + xBlockSize ) )
+		{
+			xBlockSize = pxBlock->xBlockSize & ~xBlockAllocatedBit;
+
+			if( ( pxBlock->xBlockSize & xBlockAllocatedBit ) == 0 )
+			{
+				continue;
+			}
+
+			pvOwner = NULL;
+			#if( configUSE_HEAP_TRACKING == 1 )
+			{
+				pvOwner = pxBlock->pxNextFreeBlock;
+			}
+			#endif
+
+			/* The last slot collects whatever does not fit. */
+			for( x = 0; x < heapDUMP_OWNERS; x++ )
+			{
+				if( ( xOwners[ x ].pvOwner == pvOwner ) || ( xOwners[ x ].usBlocks == 0 ) )
+				{
+					break;
+				}
+			}
+
+			xOwners[ x ].pvOwner = pvOwner;
+			xOwners[ x ].xBytes += xBlockSize;
+			xOwners[ x ].usBlocks++;
+		}
+
+		prvHeapUnlock( xLock );
+	}
+
+	for( x = 0; ( x <= heapDUMP_OWNERS ) && ( xOwners[ x ].usBlocks != 0 ); x++ )
+	{
+		if( x == heapDUMP_OWNERS )
+		{
+			printf( "heap: other      %u bytes in %u blocks\n", ( unsigned int ) xOwners[ x ].xBytes, ( unsigned int ) xOwners[ x ].usBlocks );
+		}
+		else
+		{
+			printf( "heap: %p %u bytes in %u blocks\n", xOwners[ x ].pvOwner, ( unsigned int ) xOwners[ x ].xBytes, ( unsigned int ) xOwners[ x ].usBlocks );
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+#if( configUSE_HEAP_TRACE == 1 )
+
+	void ICACHE_FLASH_ATTR
+	vPortSetHeapTraceHook( pdHEAP_TRACE_HOOK pxHook )
+	{
+		pxHeapTraceHook = pxHook;
+	}
+	/*-----------------------------------------------------------*/
+
+	static portBASE_TYPE prvTraceBegin( void )
+	{
+		/* Nothing preempts an interrupt, and before the scheduler runs
+		there is nothing to keep out. */
+		if( heapINTERRUPTS_MASKED() || ( xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED ) )
+		{
+			return pdFALSE;
+		}
+
+		vTaskSuspendAll();
+		return pdTRUE;
+	}
+	/*-----------------------------------------------------------*/
+
+	static void prvTraceEnd( portBASE_TYPE xSuspended )
+	{
+		if( xSuspended == pdTRUE )
+		{
+			( void ) xTaskResumeAll();
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+	static void *prvTracedAllocate( pdHEAP_TRACE_HOOK pxHook, size_t xCount, size_t xSize, portBASE_TYPE xZero, void *pvOwner, void *pvCaller )
+	{
+	portBASE_TYPE xSuspended;
+	void *pvReturn;
+
+		xSuspended = prvTraceBegin();
+
+		if( xZero == pdTRUE )
+		{
+			pvReturn = prvCalloc( xCount, xSize, pvOwner );
+		}
+		else
+		{
+			pvReturn = prvMalloc( xCount * xSize, pvOwner );
+		}
+
+		pxHook( 'm', pvReturn, NULL, xCount * xSize, pvCaller );
+		prvTraceEnd( xSuspended );
+
+		return pvReturn;
+	}
+	/*-----------------------------------------------------------*/
+
+#endif
+
 void ICACHE_FLASH_ATTR
 vPortInitialiseBlocks( void )
 {
@@ -415,12 +1170,194 @@ unsigned char *pucHeapEnd, *pucAlignedHeap;
 
 	/* The heap now contains pxEnd. */
 	xFreeBytesRemaining -= heapSTRUCT_SIZE;
+	xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+	pucHeapStart = pucAlignedHeap;
 
 	/* Work out the position of the top bit in a size_t variable. */
 	xBlockAllocatedBit = ( ( size_t ) 1 ) << ( ( sizeof( size_t ) * heapBITS_PER_BYTE ) - 1 );
+
+	#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+	{
+	size_t x, xClass = 0;
+
+		for( x = 0; x < heapNUM_SIZE_CLASSES; x++ )
+		{
+			xClassBlockSize[ x ] = xPortWantedSizeAlign( usClassPayloadSize[ x ] );
+			pxClassFreeList[ x ] = NULL;
+		}
+
+		for( x = 0; x < sizeof( ucClassIndex ); x++ )
+		{
+			while( ( size_t ) usClassPayloadSize[ xClass ] < x * portBYTE_ALIGNMENT )
+			{
+				xClass++;
+			}
+			ucClassIndex[ x ] = ( unsigned char ) xClass;
+		}
+	}
+	#endif
+
+	#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+	{
+	size_t x;
+
+		if( configHEAP_ISR_POOL_BLOCKS > 0 )
+		{
+			pucIsrPoolStart = prvAllocateFromFreeList( xPortWantedSizeAlign( configHEAP_ISR_POOL_BLOCKS * heapISR_POOL_BLOCK_SIZE ) );
+			if( pucIsrPoolStart != NULL )
+			{
+				pucIsrPoolEnd = pucIsrPoolStart + configHEAP_ISR_POOL_BLOCKS * heapISR_POOL_BLOCK_SIZE;
+
+				for( x = configHEAP_ISR_POOL_BLOCKS; x > 0; x-- )
+				{
+					prvIsrPoolFree( pucIsrPoolStart + ( x - 1 ) * heapISR_POOL_BLOCK_SIZE );
+				}
+			}
+
+			xMinimumEverFreeBytesRemaining = xFreeBytesRemaining;
+		}
+	}
+	#endif
+}
+/*-----------------------------------------------------------*/
+
+static portBASE_TYPE prvHeapLock( void )
+{
+portBASE_TYPE xLock;
+
+	#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+	{
+		if( heapINTERRUPTS_MASKED() )
+		{
+			/* Nothing can preempt the caller, but the caller may have
+			preempted a task halfway through a search. */
+			if( ucHeapBusy != 0 )
+			{
+				return heapLOCK_FAILED;
+			}
+
+			xLock = heapLOCK_HELD;
+		}
+		else if( xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED )
+		{
+			/* Before the scheduler runs there are no other tasks to keep
+			out, and interrupts are kept out by the busy flag. */
+			xLock = heapLOCK_HELD;
+		}
+		else
+		{
+			vTaskSuspendAll();
+			xLock = heapLOCK_SCHEDULER;
+		}
+
+		ucHeapBusy = 1;
+		heapBARRIER();
+
+		if( pxDeferredFree != NULL )
+		{
+			prvReleaseDeferredBlocks();
+		}
+	}
+	#else
+	{
+		ETS_INTR_LOCK();
+		xLock = heapLOCK_INTERRUPTS;
+	}
+	#endif
+
+	return xLock;
+}
+/*-----------------------------------------------------------*/
+
+static void prvHeapUnlock( portBASE_TYPE xLock )
+{
+	#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+	{
+		heapBARRIER();
+		ucHeapBusy = 0;
+
+		if( xLock == heapLOCK_SCHEDULER )
+		{
+			( void ) xTaskResumeAll();
+		}
+	}
+	#else
+	{
+		( void ) xLock;
+		ETS_INTR_UNLOCK();
+	}
+	#endif
 }
 /*-----------------------------------------------------------*/
 
+#if( configUSE_HEAP_SCHEDULER_LOCK == 1 )
+
+	static void *prvIsrPoolAllocate( size_t xWantedSize )
+	{
+	xBlockLink *pxBlock = NULL;
+
+		if( ( xWantedSize > 0 ) && ( xWantedSize <= heapISR_POOL_BLOCK_SIZE ) )
+		{
+			ETS_INTR_LOCK();
+			{
+				pxBlock = pxIsrPoolFreeList;
+				if( pxBlock != NULL )
+				{
+					pxIsrPoolFreeList = pxBlock->pxNextFreeBlock;
+				}
+			}
+			ETS_INTR_UNLOCK();
+		}
+
+		return pxBlock;
+	}
+	/*-----------------------------------------------------------*/
+
+	static portBASE_TYPE prvIsrPoolFree( void *pv )
+	{
+	xBlockLink *pxBlock = pv;
+
+		if( !heapIS_ISR_POOL_BLOCK( pv ) )
+		{
+			return pdFALSE;
+		}
+
+		ETS_INTR_LOCK();
+		{
+			pxBlock->pxNextFreeBlock = pxIsrPoolFreeList;
+			pxIsrPoolFreeList = pxBlock;
+		}
+		ETS_INTR_UNLOCK();
+
+		return pdTRUE;
+	}
+	/*-----------------------------------------------------------*/
+
+	static void prvReleaseDeferredBlocks( void )
+	{
+	xBlockLink *pxBlock, *pxNext;
+
+		/* Take the whole list at once, interrupts may add to it again as
+		soon as they are back on. */
+		ETS_INTR_LOCK();
+		{
+			pxBlock = pxDeferredFree;
+			pxDeferredFree = NULL;
+		}
+		ETS_INTR_UNLOCK();
+
+		for( ; pxBlock != NULL; pxBlock = pxNext )
+		{
+			pxNext = pxBlock->pxNextFreeBlock;
+			xFreeBytesRemaining += pxBlock->xBlockSize;
+			xNumberOfSuccessfulFrees++;
+			prvReleaseBlock( pxBlock );
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+#endif
+
 static void prvInsertBlockIntoFreeList( xBlockLink *pxBlockToInsert )
 {
 xBlockLink *pxIterator;
@@ -471,4 +1408,141 @@ unsigned char *puc;
 		pxIterator->pxNextFreeBlock = pxBlockToInsert;
 	}
 }
+/*-----------------------------------------------------------*/
+
+static void *prvAllocateFromFreeList( size_t xWantedSize )
+{
+xBlockLink *pxBlock, *pxPreviousBlock, *pxNewBlockLink;
+
+	/* Traverse the list from the start	(lowest address) block until 
+	one	of adequate size is found. */
+	pxPreviousBlock = &xStart;
+	pxBlock = xStart.pxNextFreeBlock;
+	while( ( pxBlock->xBlockSize < xWantedSize ) && ( pxBlock->pxNextFreeBlock != NULL ) )
+	{
+		pxPreviousBlock = pxBlock;
+		pxBlock = pxBlock->pxNextFreeBlock;
+	}
+
+	/* If the end marker was reached then a block of adequate size 
+	was	not found. */
+	if( pxBlock == pxEnd )
+	{
+		return NULL;
+	}
+
+	/* This block is being returned for use so must be taken out 
+	of the list of free blocks. */
+	pxPreviousBlock->pxNextFreeBlock = pxBlock->pxNextFreeBlock;
+
+	/* If the block is larger than required it can be split into 
+	two. */
+	if( ( pxBlock->xBlockSize - xWantedSize ) > heapMINIMUM_BLOCK_SIZE )
+	{
+		/* This block is to be split into two.  Create a new 
+		block following the number of bytes requested. The void 
+		cast is used to prevent byte alignment warnings from the 
+		compiler. */
+		pxNewBlockLink = ( void * ) ( ( ( unsigned char * ) pxBlock ) + xWantedSize );
+
+		/* Calculate the sizes of two blocks split from the 
+		single block. */
+		pxNewBlockLink->xBlockSize = pxBlock->xBlockSize - xWantedSize;
+		pxBlock->xBlockSize = xWantedSize;
+
+		/* Insert the new block into the list of free blocks. */
+		prvInsertBlockIntoFreeList( ( pxNewBlockLink ) );
+	}
+
+	xFreeBytesRemaining -= pxBlock->xBlockSize;
+
+	/* The block is being returned - it is allocated and owned
+	by the application and has no "next" block. */
+	pxBlock->xBlockSize |= xBlockAllocatedBit;
+	pxBlock->pxNextFreeBlock = NULL;
+
+	/* Return the memory space pointed to - jumping over the 
+	xBlockLink structure at its start. */
+	return ( void * ) ( ( ( unsigned char * ) pxBlock ) + heapSTRUCT_SIZE );
+}
+/*-----------------------------------------------------------*/
+
+static void prvReleaseBlock( xBlockLink *pxBlock )
+{
+	#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+	{
+	size_t xPayload = pxBlock->xBlockSize - heapSTRUCT_SIZE;
+	unsigned char ucClass;
+
+		/* Only blocks of exactly a class size are cached, anything else would
+		be handed out again with the wrong size. */
+		if( ( xPayload <= heapMAX_CLASS_PAYLOAD ) && ( xClassCachedBytes + pxBlock->xBlockSize <= configHEAP_CLASS_CACHE_SIZE ) )
+		{
+			ucClass = ucClassIndex[ xPayload / portBYTE_ALIGNMENT ];
+			if( xClassBlockSize[ ucClass ] == pxBlock->xBlockSize )
+			{
+				pxBlock->pxNextFreeBlock = pxClassFreeList[ ucClass ];
+				pxClassFreeList[ ucClass ] = pxBlock;
+				xClassCachedBytes += pxBlock->xBlockSize;
+				return;
+			}
+		}
+	}
+	#endif
+
+	prvInsertBlockIntoFreeList( pxBlock );
+}
+/*-----------------------------------------------------------*/
+
+#if( configUSE_HEAP_SIZE_CLASSES == 1 )
+
+	static void *prvAllocateFromClass( size_t *pxWantedSize )
+	{
+	size_t xPayload = *pxWantedSize - heapSTRUCT_SIZE;
+	unsigned char ucClass;
+	xBlockLink *pxBlock;
+
+		if( xPayload > heapMAX_CLASS_PAYLOAD )
+		{
+			return NULL;
+		}
+
+		ucClass = ucClassIndex[ xPayload / portBYTE_ALIGNMENT ];
+		*pxWantedSize = xClassBlockSize[ ucClass ];
+
+		pxBlock = pxClassFreeList[ ucClass ];
+		if( pxBlock == NULL )
+		{
+			return NULL;
+		}
+
+		pxClassFreeList[ ucClass ] = pxBlock->pxNextFreeBlock;
+		xClassCachedBytes -= pxBlock->xBlockSize;
+		xFreeBytesRemaining -= pxBlock->xBlockSize;
+
+		pxBlock->xBlockSize |= xBlockAllocatedBit;
+		pxBlock->pxNextFreeBlock = NULL;
+
+		return ( void * ) ( ( ( unsigned char * ) pxBlock ) + heapSTRUCT_SIZE );
+	}
+	/*-----------------------------------------------------------*/
+
+	static void prvFlushClassLists( void )
+	{
+	size_t x;
+	xBlockLink *pxBlock;
+
+		for( x = 0; x < heapNUM_SIZE_CLASSES; x++ )
+		{
+			while( pxClassFreeList[ x ] != NULL )
+			{
+				pxBlock = pxClassFreeList[ x ];
+				pxClassFreeList[ x ] = pxBlock->pxNextFreeBlock;
+				prvInsertBlockIntoFreeList( pxBlock );
+			}
+		}
+
+		xClassCachedBytes = 0;
+	}
 
+#endif
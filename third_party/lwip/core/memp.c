@@ -483,3 +483,181 @@ memp_free(memp_t type, void *mem)
 }
 
 #endif /* MEMP_MEM_MALLOC */
+
+#if MEMP_MEM_MALLOC && MEMP_HYBRID_POOLS
+
+struct memp {
+  struct memp *next;
+};
+
+/** A static pool in front of mem_malloc for one type. start and end bound
+ *  the pool's storage, so memp_free() can tell its elements from heap ones
+ *  without a header, whoever allocated them. */
+struct memp_hybrid_pool {
+  struct memp *free;
+  u8_t *start;
+  u8_t *end;
+};
+
+static struct memp_hybrid_pool memp_pools[MEMP_MAX];
+static struct memp_hybrid_stats memp_stats[MEMP_MAX];
+
+/** The element size of every type as a constant, for sizing the storage */
+enum {
+#define LWIP_MEMPOOL(name,num,size,desc)  MEMP_HYBRID_SIZE_ ## name = LWIP_MEM_ALIGN_SIZE(size),
+#include "lwip/memp_std.h"
+  MEMP_HYBRID_SIZE_MAX
+};
+
+#define MEMP_HYBRID_STORAGE(name, num) \
+  static u8_t memp_hybrid_ ## name ## _base[MEM_ALIGNMENT - 1 + (num) * MEMP_HYBRID_SIZE_ ## name]
+
+#if LWIP_TCP
+MEMP_HYBRID_STORAGE(TCP_SEG, MEMP_HYBRID_NUM_TCP_SEG);
+#endif /* LWIP_TCP */
+MEMP_HYBRID_STORAGE(PBUF, MEMP_HYBRID_NUM_PBUF);
+#if LWIP_NETCONN
+MEMP_HYBRID_STORAGE(NETBUF, MEMP_HYBRID_NUM_NETBUF);
+#endif /* LWIP_NETCONN */
+#if NO_SYS==0
+MEMP_HYBRID_STORAGE(TCPIP_MSG_API, MEMP_HYBRID_NUM_TCPIP_MSG);
+#if !LWIP_TCPIP_CORE_LOCKING_INPUT
+MEMP_HYBRID_STORAGE(TCPIP_MSG_INPKT, MEMP_HYBRID_NUM_TCPIP_MSG);
+#endif /* !LWIP_TCPIP_CORE_LOCKING_INPUT */
+#endif /* NO_SYS==0 */
+
+/**
+ * Link the elements of one static pool into its free list.
+ *
+ * @param type the pool type the storage belongs to
+ * @param base storage for num elements, plus room to align it
+ * @param num number of elements
+ */
+static void
+memp_hybrid_carve(memp_t type, u8_t *base, u16_t num)
+{
+  struct memp_hybrid_pool *pool = &memp_pools[type];
+  struct memp *memp;
+  u16_t i;
+
+  pool->free = NULL;
+  pool->start = (u8_t *)LWIP_MEM_ALIGN(base);
+  pool->end = pool->start + num * memp_sizes[type];
+  for (i = 0; i < num; ++i) {
+    memp = (struct memp *)(void *)(pool->start + i * memp_sizes[type]);
+    memp->next = pool->free;
+    pool->free = memp;
+  }
+  memp_stats[type].avail = num;
+}
+
+/**
+ * Initialize this module.
+ *
+ * Carves the static storage of the hybrid pool types into free lists.
+ * Every other type is served by mem_malloc alone.
+ */
+void
+memp_init(void)
+{
+#if LWIP_TCP
+  memp_hybrid_carve(MEMP_TCP_SEG, memp_hybrid_TCP_SEG_base, MEMP_HYBRID_NUM_TCP_SEG);
+#endif /* LWIP_TCP */
+  memp_hybrid_carve(MEMP_PBUF, memp_hybrid_PBUF_base, MEMP_HYBRID_NUM_PBUF);
+#if LWIP_NETCONN
+  memp_hybrid_carve(MEMP_NETBUF, memp_hybrid_NETBUF_base, MEMP_HYBRID_NUM_NETBUF);
+#endif /* LWIP_NETCONN */
+#if NO_SYS==0
+  memp_hybrid_carve(MEMP_TCPIP_MSG_API, memp_hybrid_TCPIP_MSG_API_base, MEMP_HYBRID_NUM_TCPIP_MSG);
+#if !LWIP_TCPIP_CORE_LOCKING_INPUT
+  memp_hybrid_carve(MEMP_TCPIP_MSG_INPKT, memp_hybrid_TCPIP_MSG_INPKT_base, MEMP_HYBRID_NUM_TCPIP_MSG);
+#endif /* !LWIP_TCPIP_CORE_LOCKING_INPUT */
+#endif /* NO_SYS==0 */
+}
+
+/**
+ * Get an element of a specific type, from its static pool if it has one
+ * left and from the heap otherwise.
+ *
+ * @param type the pool to get an element from
+ *
+ * @return a pointer to the allocated memory or a NULL pointer on error
+ */
+void *
+memp_malloc(memp_t type)
+{
+  struct memp *memp;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  LWIP_ERROR("memp_malloc: type < MEMP_MAX", (type < MEMP_MAX), return NULL;);
+
+  SYS_ARCH_PROTECT(old_level);
+  memp = memp_pools[type].free;
+  if (memp != NULL) {
+    memp_pools[type].free = memp->next;
+    memp_stats[type].hits++;
+    if (++memp_stats[type].used > memp_stats[type].max) {
+      memp_stats[type].max = memp_stats[type].used;
+    }
+  } else {
+    memp_stats[type].misses++;
+  }
+  SYS_ARCH_UNPROTECT(old_level);
+
+  if (memp == NULL) {
+    memp = (struct memp *)mem_malloc(memp_sizes[type]);
+  }
+  return memp;
+}
+
+/**
+ * Put an element back into its pool, or give it back to the heap if it
+ * did not come from one.
+ *
+ * @param type the pool where to put mem
+ * @param mem the memp element to free
+ */
+void
+memp_free(memp_t type, void *mem)
+{
+  struct memp *memp;
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  if (mem == NULL) {
+    return;
+  }
+  LWIP_ERROR("memp_free: type < MEMP_MAX", (type < MEMP_MAX), return;);
+
+  if ((u8_t *)mem < memp_pools[type].start || (u8_t *)mem >= memp_pools[type].end) {
+    mem_free(mem);
+    return;
+  }
+
+  memp = (struct memp *)mem;
+
+  SYS_ARCH_PROTECT(old_level);
+  memp->next = memp_pools[type].free;
+  memp_pools[type].free = memp;
+  memp_stats[type].used--;
+  SYS_ARCH_UNPROTECT(old_level);
+}
+
+/**
+ * Read the allocation counts of one pool type.
+ *
+ * @param type the pool to report on
+ * @param stats filled with a consistent copy of the counts
+ */
+void
+memp_hybrid_get_stats(memp_t type, struct memp_hybrid_stats *stats)
+{
+  SYS_ARCH_DECL_PROTECT(old_level);
+
+  LWIP_ERROR("memp_hybrid_get_stats: type < MEMP_MAX", (type < MEMP_MAX), return;);
+
+  SYS_ARCH_PROTECT(old_level);
+  *stats = memp_stats[type];
+  SYS_ARCH_UNPROTECT(old_level);
+}
+
+#endif /* MEMP_MEM_MALLOC && MEMP_HYBRID_POOLS */
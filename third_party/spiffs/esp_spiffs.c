@@ -3,6 +3,10 @@
 #include <fcntl.h>
 #include <stdio.h>
 
+#if SPIFFS_GC_TASK
+#include "freertos/semphr.h"
+#endif
+
 #define NUM_SYS_FD 3
 
 static spiffs fs;
@@ -11,59 +15,168 @@ static u8_t *spiffs_work_buf;
 static u8_t *spiffs_fd_buf;
 static u8_t *spiffs_cache_buf;
 
+#if SPIFFS_GC_TASK
+#define GC_TASK_STACK_SIZE 512
+#define GC_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+static xSemaphoreHandle spiffs_mutex;
+static xTaskHandle spiffs_gc_task_handle;
+static u32_t spiffs_gc_reserve;
+static portTickType spiffs_gc_period;
+#endif
+
 #define FLASH_UNIT_SIZE 4
 
-static s32_t esp_spiffs_readwrite(u32_t addr, u32_t size, u8_t *p, int write)
+/*
+ * Accesses shorter than this, or to a buffer not aligned like the flash
+ * address, go through a buffer on the stack
+ */
+#define FLASH_BOUNCE_SIZE 64
+
+#define FLASH_UNIT_OFFSET(x) ((uintptr_t)(x) & (FLASH_UNIT_SIZE - 1))
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+static s32_t esp_spiffs_flash_read(u32_t addr, u32_t *dst, u32_t size)
 {
-    /*
-     * With proper configurarion spiffs never reads or writes more than
-     * LOG_PAGE_SIZE
-     */
+    int res = spi_flash_read(addr, dst, size);
 
-    if (size > fs.cfg.log_page_size) {
-        printf("Invalid size provided to read/write (%d)\n\r", (int) size);
-        return SPIFFS_ERR_NOT_CONFIGURED;
+    if (res != 0) {
+        printf("spi_flash_read failed: %d (%d, %d)\n\r", res, (int) addr,
+               (int) size);
     }
 
-    char tmp_buf[fs.cfg.log_page_size + FLASH_UNIT_SIZE * 2];
-    u32_t aligned_addr = addr & (-FLASH_UNIT_SIZE);
-    u32_t aligned_size =
-        ((size + (FLASH_UNIT_SIZE - 1)) & -FLASH_UNIT_SIZE) + FLASH_UNIT_SIZE;
+    return res;
+}
 
-    int res = spi_flash_read(aligned_addr, (u32_t *) tmp_buf, aligned_size);
+static s32_t esp_spiffs_flash_write(u32_t addr, u32_t *src, u32_t size)
+{
+    int res = spi_flash_write(addr, src, size);
 
     if (res != 0) {
-        printf("spi_flash_read failed: %d (%d, %d)\n\r", res, (int) aligned_addr,
-               (int) aligned_size);
-        return res;
+//	    printf("spi_flash_write failed: %d (%d, %d)\n\r", res,
+//	              (int) addr, (int) size);
     }
 
-    if (!write) {
-        memcpy(p, tmp_buf + (addr - aligned_addr), size);
-        return SPIFFS_OK;
+    return res;
+}
+
+/*
+ * spi_flash_read and spi_flash_write move whole words to and from word
+ * aligned buffers. The bounce functions take any address, size and buffer
+ * and go through whole words on the stack, one flash access for up to
+ * FLASH_BOUNCE_SIZE bytes.
+ */
+static s32_t esp_spiffs_bounce_read(u32_t addr, u32_t size, u8_t *dst)
+{
+    u32_t bounce[(FLASH_BOUNCE_SIZE + 2 * FLASH_UNIT_SIZE) / FLASH_UNIT_SIZE];
+    u32_t end = (addr + size + FLASH_UNIT_SIZE - 1) & -FLASH_UNIT_SIZE;
+    u32_t a, n;
+    s32_t res;
+
+    for (a = addr & -FLASH_UNIT_SIZE; a < end; a += n) {
+        n = MIN(end - a, sizeof(bounce));
+
+        if ((res = esp_spiffs_flash_read(a, bounce, n)) != 0) {
+            return res;
+        }
+
+        u32_t lo = MAX(a, addr);
+        u32_t hi = MIN(a + n, addr + size);
+        memcpy(dst + (lo - addr), (u8_t *) bounce + (lo - a), hi - lo);
     }
 
-    memcpy(tmp_buf + (addr - aligned_addr), p, size);
+    return SPIFFS_OK;
+}
 
-    res = spi_flash_write(aligned_addr, (u32_t *) tmp_buf, aligned_size);
+/*
+ * Programming only clears bits, so the bytes around the data are sent as
+ * 0xff and left as they are in flash, no read back is needed.
+ */
+static s32_t esp_spiffs_bounce_write(u32_t addr, u32_t size, u8_t *src)
+{
+    u32_t bounce[(FLASH_BOUNCE_SIZE + 2 * FLASH_UNIT_SIZE) / FLASH_UNIT_SIZE];
+    u32_t end = (addr + size + FLASH_UNIT_SIZE - 1) & -FLASH_UNIT_SIZE;
+    u32_t a, n;
+    s32_t res;
 
-    if (res != 0) {
-//	    printf("spi_flash_write failed: %d (%d, %d)\n\r", res,
-//	              (int) aligned_addr, (int) aligned_size);
-        return res;
+    for (a = addr & -FLASH_UNIT_SIZE; a < end; a += n) {
+        n = MIN(end - a, sizeof(bounce));
+
+        u32_t lo = MAX(a, addr);
+        u32_t hi = MIN(a + n, addr + size);
+        memset(bounce, 0xff, n);
+        memcpy((u8_t *) bounce + (lo - a), src + (lo - addr), hi - lo);
+
+        if ((res = esp_spiffs_flash_write(a, bounce, n)) != 0) {
+            return res;
+        }
     }
 
     return SPIFFS_OK;
 }
 
+/*
+ * Longer accesses whose buffer is aligned like the flash address move the
+ * whole words straight between flash and the caller's buffer, only the
+ * head and tail bytes are bounced.
+ */
 static s32_t esp_spiffs_read(u32_t addr, u32_t size, u8_t *dst)
 {
-    return esp_spiffs_readwrite(addr, size, dst, 0);
+    if (size < FLASH_BOUNCE_SIZE || FLASH_UNIT_OFFSET(addr) != FLASH_UNIT_OFFSET(dst)) {
+        return esp_spiffs_bounce_read(addr, size, dst);
+    }
+
+    u32_t head = (FLASH_UNIT_SIZE - FLASH_UNIT_OFFSET(addr)) & (FLASH_UNIT_SIZE - 1);
+    u32_t body = (size - head) & -FLASH_UNIT_SIZE;
+    s32_t res;
+
+    if (head != 0 && (res = esp_spiffs_bounce_read(addr, head, dst)) != 0) {
+        return res;
+    }
+
+    if ((res = esp_spiffs_flash_read(addr + head, (u32_t *) (dst + head), body)) != 0) {
+        return res;
+    }
+
+    if (head + body < size) {
+        return esp_spiffs_bounce_read(addr + head + body, size - head - body,
+                                      dst + head + body);
+    }
+
+    return SPIFFS_OK;
 }
 
 static s32_t esp_spiffs_write(u32_t addr, u32_t size, u8_t *src)
 {
-    return esp_spiffs_readwrite(addr, size, src, 1);
+    if (size < FLASH_BOUNCE_SIZE || FLASH_UNIT_OFFSET(addr) != FLASH_UNIT_OFFSET(src)) {
+        return esp_spiffs_bounce_write(addr, size, src);
+    }
+
+    u32_t head = (FLASH_UNIT_SIZE - FLASH_UNIT_OFFSET(addr)) & (FLASH_UNIT_SIZE - 1);
+    u32_t body = (size - head) & -FLASH_UNIT_SIZE;
+    s32_t res;
+
+    if (head != 0 && (res = esp_spiffs_bounce_write(addr, head, src)) != 0) {
+        return res;
+    }
+
+    if ((res = esp_spiffs_flash_write(addr + head, (u32_t *) (src + head), body)) != 0) {
+        return res;
+    }
+
+    if (head + body < size) {
+        return esp_spiffs_bounce_write(addr + head + body, size - head - body,
+                                       src + head + body);
+    }
+
+    return SPIFFS_OK;
 }
 
 static s32_t esp_spiffs_erase(u32_t addr, u32_t size)
@@ -87,6 +200,12 @@ s32_t esp_spiffs_init(struct esp_spiffs_config *config)
         return -1;
     }
 
+#if SPIFFS_GC_TASK
+    if (spiffs_mutex == NULL && (spiffs_mutex = xSemaphoreCreateRecursiveMutex()) == NULL) {
+        return -1;
+    }
+#endif
+
     spiffs_config cfg;
     s32_t ret;
 
@@ -118,6 +237,7 @@ s32_t esp_spiffs_init(struct esp_spiffs_config *config)
 
     if (spiffs_fd_buf == NULL) {
         free(spiffs_work_buf);
+        spiffs_work_buf = NULL;
         return -1;
     }
 
@@ -130,6 +250,8 @@ s32_t esp_spiffs_init(struct esp_spiffs_config *config)
     if (spiffs_cache_buf == NULL) {
         free(spiffs_work_buf);
         free(spiffs_fd_buf);
+        spiffs_work_buf = NULL;
+        spiffs_fd_buf = NULL;
         return -1;
     }
 
@@ -142,6 +264,9 @@ s32_t esp_spiffs_init(struct esp_spiffs_config *config)
         free(spiffs_work_buf);
         free(spiffs_fd_buf);
         free(spiffs_cache_buf);
+        spiffs_work_buf = NULL;
+        spiffs_fd_buf = NULL;
+        spiffs_cache_buf = NULL;
     }
 
     return ret;        
@@ -149,17 +274,102 @@ s32_t esp_spiffs_init(struct esp_spiffs_config *config)
 
 void esp_spiffs_deinit(u8_t format)
 {
+    /* keep the gc task out until the buffers are gone */
+    SPIFFS_LOCK(&fs);
+
     if (SPIFFS_mounted(&fs)) {
         SPIFFS_unmount(&fs);
-        free(spiffs_work_buf);
-        free(spiffs_fd_buf);
-        free(spiffs_cache_buf);
 
+        /* formatting still goes through the work and cache buffers */
         if (format) {
             SPIFFS_format(&fs);
         }
+
+        free(spiffs_work_buf);
+        free(spiffs_fd_buf);
+        free(spiffs_cache_buf);
+        spiffs_work_buf = NULL;
+        spiffs_fd_buf = NULL;
+        spiffs_cache_buf = NULL;
+    }
+
+    SPIFFS_UNLOCK(&fs);
+}
+
+#if SPIFFS_GC_TASK
+void esp_spiffs_lock(void)
+{
+    if (spiffs_mutex != NULL) {
+        xSemaphoreTakeRecursive(spiffs_mutex, portMAX_DELAY);
+    }
+}
+
+void esp_spiffs_unlock(void)
+{
+    if (spiffs_mutex != NULL) {
+        xSemaphoreGiveRecursive(spiffs_mutex);
+    }
+}
+
+/*
+ * Runs just above the idle task, so it only gets the cpu while the
+ * application tasks are blocked. The lock is given back after every block
+ * reclaimed, a task wanting the file system waits for one block at most.
+ */
+static void esp_spiffs_gc_task(void *arg)
+{
+    s32_t res;
+
+    for (;;) {
+        do {
+            esp_spiffs_lock();
+            res = SPIFFS_mounted(&fs) ? SPIFFS_gc_step(&fs, spiffs_gc_reserve) : 0;
+            esp_spiffs_unlock();
+        } while (res > 0);
+
+        vTaskDelay(spiffs_gc_period);
+    }
+}
+
+s32_t esp_spiffs_gc_start(u32_t reserve_blocks, u32_t period_ms)
+{
+    if (spiffs_gc_task_handle != NULL) {
+        return -1;
+    }
+
+    if (spiffs_mutex == NULL && (spiffs_mutex = xSemaphoreCreateRecursiveMutex()) == NULL) {
+        return -1;
+    }
+
+    spiffs_gc_reserve = reserve_blocks;
+    spiffs_gc_period = period_ms / portTICK_RATE_MS;
+
+    if (spiffs_gc_period == 0) {
+        spiffs_gc_period = 1;
+    }
+
+    if (xTaskCreate(esp_spiffs_gc_task, (const signed char *) "spiffs_gc", GC_TASK_STACK_SIZE,
+                    NULL, GC_TASK_PRIORITY, &spiffs_gc_task_handle) != pdPASS) {
+        spiffs_gc_task_handle = NULL;
+        return -1;
     }
+
+    return 0;
+}
+
+void esp_spiffs_gc_stop(void)
+{
+    if (spiffs_gc_task_handle == NULL) {
+        return;
+    }
+
+    /* holding the lock, the task is not in the middle of a block */
+    esp_spiffs_lock();
+    vTaskDelete(spiffs_gc_task_handle);
+    spiffs_gc_task_handle = NULL;
+    esp_spiffs_unlock();
 }
+#endif
 
 int _open_r(struct _reent *r, const char *filename, int flags, int mode)
 {
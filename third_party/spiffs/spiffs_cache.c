@@ -10,20 +10,89 @@
 
 #if SPIFFS_CACHE
 
+// fibonacci hashing, lookup pages sit at block strides and would all share
+// a bucket if the low bits of the page index were used as is
+#define spiffs_cache_hash_bucket(c, pix) \
+  (&(c)->hash[(u16_t)((u32_t)(pix) * 40503u) >> (c)->hash_shift])
+
+// unlinks a cache page from the lru or write list
+static void spiffs_cache_list_unlink(spiffs *fs, spiffs_cache *cache,
+    u16_t *head, u16_t *tail, spiffs_cache_page *cp) {
+  if (cp->lru_prev == SPIFFS_CACHE_NIL) {
+    *head = cp->lru_next;
+  } else {
+    spiffs_get_cache_page_hdr(fs, cache, cp->lru_prev)->lru_next = cp->lru_next;
+  }
+  if (cp->lru_next == SPIFFS_CACHE_NIL) {
+    *tail = cp->lru_prev;
+  } else {
+    spiffs_get_cache_page_hdr(fs, cache, cp->lru_next)->lru_prev = cp->lru_prev;
+  }
+}
+
+// puts a cache page first in the lru or write list
+static void spiffs_cache_list_push(spiffs *fs, spiffs_cache *cache,
+    u16_t *head, u16_t *tail, spiffs_cache_page *cp) {
+  cp->lru_prev = SPIFFS_CACHE_NIL;
+  cp->lru_next = *head;
+  if (*head == SPIFFS_CACHE_NIL) {
+    *tail = cp->ix;
+  } else {
+    spiffs_get_cache_page_hdr(fs, cache, *head)->lru_prev = cp->ix;
+  }
+  *head = cp->ix;
+}
+
+// marks a read cache page as most recently used
+static void spiffs_cache_lru_touch(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  if (cache->lru_head == cp->ix) return;
+  spiffs_cache_list_unlink(fs, cache, &cache->lru_head, &cache->lru_tail, cp);
+  spiffs_cache_list_push(fs, cache, &cache->lru_head, &cache->lru_tail, cp);
+}
+
+// adds a read cache page to the page index hash
+static void spiffs_cache_hash_insert(spiffs_cache *cache, spiffs_cache_page *cp) {
+  u16_t *bucket = spiffs_cache_hash_bucket(cache, cp->pix);
+  cp->hash_next = *bucket;
+  *bucket = cp->ix;
+}
+
+// removes a read cache page from the page index hash
+static void spiffs_cache_hash_remove(spiffs *fs, spiffs_cache *cache, spiffs_cache_page *cp) {
+  u16_t *link = spiffs_cache_hash_bucket(cache, cp->pix);
+  while (*link != SPIFFS_CACHE_NIL) {
+    if (*link == cp->ix) {
+      *link = cp->hash_next;
+      return;
+    }
+    link = &spiffs_get_cache_page_hdr(fs, cache, *link)->hash_next;
+  }
+}
+
+#if SPIFFS_READ_AHEAD_PAGES
+// empties the read ahead window if it overlaps given flash range
+static void spiffs_cache_read_ahead_drop(spiffs *fs, u32_t addr, u32_t len) {
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  if (cache == 0) return;
+  if (addr < cache->ra_addr + cache->ra_len && addr + len > cache->ra_addr) {
+    cache->ra_len = 0;
+  }
+}
+#endif
+
 // returns cached page for give page index, or null if no such cached page
 static spiffs_cache_page *spiffs_cache_page_get(spiffs *fs, spiffs_page_ix pix) {
   spiffs_cache *cache = spiffs_get_cache(fs);
-  if ((cache->cpage_use_map & cache->cpage_use_mask) == 0) return 0;
-  int i;
-  for (i = 0; i < cache->cpage_count; i++) {
-    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->cpage_use_map & (1<<i)) &&
-        (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
-        cp->pix == pix ) {
-      SPIFFS_CACHE_DBG("CACHE_GET: have cache page %i for %04x\n", i, pix);
-      cp->last_access = cache->last_access;
+  if (cache == 0) return 0;
+  u16_t ix = *spiffs_cache_hash_bucket(cache, pix);
+  while (ix != SPIFFS_CACHE_NIL) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, ix);
+    if (cp->pix == pix) {
+      SPIFFS_CACHE_DBG("CACHE_GET: have cache page %i for %04x\n", ix, pix);
+      spiffs_cache_lru_touch(fs, cache, cp);
       return cp;
     }
+    ix = cp->hash_next;
   }
   //SPIFFS_CACHE_DBG("CACHE_GET: no cache for %04x\n", pix);
   return 0;
@@ -34,7 +103,7 @@ static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
   s32_t res = SPIFFS_OK;
   spiffs_cache *cache = spiffs_get_cache(fs);
   spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, ix);
-  if (cache->cpage_use_map & (1<<ix)) {
+  if (cp->flags) {
     if (write_back &&
         (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) == 0 &&
         (cp->flags & SPIFFS_CACHE_FLAG_DIRTY)) {
@@ -42,14 +111,18 @@ static s32_t spiffs_cache_page_free(spiffs *fs, int ix, u8_t write_back) {
       res = fs->cfg.hal_write_f(SPIFFS_PAGE_TO_PADDR(fs, cp->pix), SPIFFS_CFG_LOG_PAGE_SZ(fs), mem);
     }
 
-    cp->flags = 0;
-    cache->cpage_use_map &= ~(1 << ix);
-
     if (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
       SPIFFS_CACHE_DBG("CACHE_FREE: free cache page %i objid %04x\n", ix, cp->obj_id);
+      spiffs_cache_list_unlink(fs, cache, &cache->wr_head, &cache->wr_tail, cp);
     } else {
       SPIFFS_CACHE_DBG("CACHE_FREE: free cache page %i pix %04x\n", ix, cp->pix);
+      spiffs_cache_hash_remove(fs, cache, cp);
+      spiffs_cache_list_unlink(fs, cache, &cache->lru_head, &cache->lru_tail, cp);
     }
+
+    cp->flags = 0;
+    cp->lru_next = cache->free_head;
+    cache->free_head = cp->ix;
   }
 
   return res;
@@ -60,50 +133,44 @@ static s32_t spiffs_cache_page_remove_oldest(spiffs *fs, u8_t flag_mask, u8_t fl
   s32_t res = SPIFFS_OK;
   spiffs_cache *cache = spiffs_get_cache(fs);
 
-  if ((cache->cpage_use_map & cache->cpage_use_mask) != cache->cpage_use_mask) {
+  if (cache->free_head != SPIFFS_CACHE_NIL) {
     // at least one free cpage
     return SPIFFS_OK;
   }
 
-  // all busy, scan thru all to find the cpage which has oldest access
-  int i;
-  int cand_ix = -1;
-  u32_t oldest_val = 0;
-  for (i = 0; i < cache->cpage_count; i++) {
-    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->last_access - cp->last_access) > oldest_val &&
-        (cp->flags & flag_mask) == flags) {
-      oldest_val = cache->last_access - cp->last_access;
-      cand_ix = i;
+  // all busy, walk from the least recently used end to the first
+  // cpage that may be evicted
+  u16_t ix = cache->lru_tail;
+  while (ix != SPIFFS_CACHE_NIL) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, ix);
+    if ((cp->flags & flag_mask) == flags) {
+      res = spiffs_cache_page_free(fs, ix, 1);
+      break;
     }
-  }
-
-  if (cand_ix >= 0) {
-    res = spiffs_cache_page_free(fs, cand_ix, 1);
+    ix = cp->lru_prev;
   }
 
   return res;
 }
 
-// allocates a new cached page and returns it, or null if all cache pages are busy
-static spiffs_cache_page *spiffs_cache_page_allocate(spiffs *fs) {
+// allocates a new cached page with given flags and returns it, or null if
+// all cache pages are busy
+static spiffs_cache_page *spiffs_cache_page_allocate(spiffs *fs, u8_t flags) {
   spiffs_cache *cache = spiffs_get_cache(fs);
-  if (cache->cpage_use_map == 0xffffffff) {
-    // out of cache memory
+  if (cache->free_head == SPIFFS_CACHE_NIL) {
+    // out of cache entries
     return 0;
   }
-  int i;
-  for (i = 0; i < cache->cpage_count; i++) {
-    if ((cache->cpage_use_map & (1<<i)) == 0) {
-      spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-      cache->cpage_use_map |= (1<<i);
-      cp->last_access = cache->last_access;
-      SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page %i\n", i);
-      return cp;
-    }
+  spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, cache->free_head);
+  cache->free_head = cp->lru_next;
+  cp->flags = flags;
+  if (flags & SPIFFS_CACHE_FLAG_TYPE_WR) {
+    spiffs_cache_list_push(fs, cache, &cache->wr_head, &cache->wr_tail, cp);
+  } else {
+    spiffs_cache_list_push(fs, cache, &cache->lru_head, &cache->lru_tail, cp);
   }
-  // out of cache entries
-  return 0;
+  SPIFFS_CACHE_DBG("CACHE_ALLO: allocated cache page %i\n", cp->ix);
+  return cp;
 }
 
 // drops the cache page for give page index
@@ -112,8 +179,34 @@ void spiffs_cache_drop_page(spiffs *fs, spiffs_page_ix pix) {
   if (cp) {
     spiffs_cache_page_free(fs, cp->ix, 0);
   }
+#if SPIFFS_READ_AHEAD_PAGES
+  spiffs_cache_read_ahead_drop(fs, SPIFFS_PAGE_TO_PADDR(fs, pix), SPIFFS_CFG_LOG_PAGE_SZ(fs));
+#endif
 }
 
+#if SPIFFS_READ_AHEAD_PAGES
+// reads given number of consecutive pages, starting at pix, into the read
+// ahead window in one flash access, unless pix already is in the window.
+// A failed read leaves the window empty, the read that follows will go to
+// flash and report the error.
+void spiffs_cache_read_ahead(spiffs *fs, spiffs_file fh, spiffs_page_ix pix, u32_t pages) {
+  (void)fh;
+  spiffs_cache *cache = spiffs_get_cache(fs);
+  if (cache == 0 || cache->ra_buf == 0) return;
+  u32_t addr = SPIFFS_PAGE_TO_PADDR(fs, pix);
+  if (addr >= cache->ra_addr && addr < cache->ra_addr + cache->ra_len) {
+    return;
+  }
+  pages = MIN(pages, SPIFFS_READ_AHEAD_PAGES);
+  cache->ra_len = 0;
+  if (fs->cfg.hal_read_f(addr, pages * SPIFFS_CFG_LOG_PAGE_SZ(fs), cache->ra_buf) == SPIFFS_OK) {
+    SPIFFS_CACHE_DBG("CACHE_RA: read ahead %i pages from %04x\n", pages, pix);
+    cache->ra_addr = addr;
+    cache->ra_len = pages * SPIFFS_CFG_LOG_PAGE_SZ(fs);
+  }
+}
+#endif
+
 // ------------------------------
 
 // reads from spi flash or the cache
@@ -127,13 +220,23 @@ s32_t spiffs_phys_rd(
   (void)fh;
   s32_t res = SPIFFS_OK;
   spiffs_cache *cache = spiffs_get_cache(fs);
+  if (cache == 0) {
+    return fs->cfg.hal_read_f(addr, len, dst);
+  }
+#if SPIFFS_READ_AHEAD_PAGES
+  if (addr >= cache->ra_addr && addr + len <= cache->ra_addr + cache->ra_len) {
+#if SPIFFS_CACHE_STATS
+    fs->cache_hits++;
+#endif
+    memcpy(dst, &cache->ra_buf[addr - cache->ra_addr], len);
+    return SPIFFS_OK;
+  }
+#endif
   spiffs_cache_page *cp =  spiffs_cache_page_get(fs, SPIFFS_PADDR_TO_PAGE(fs, addr));
-  cache->last_access++;
   if (cp) {
 #if SPIFFS_CACHE_STATS
     fs->cache_hits++;
 #endif
-    cp->last_access = cache->last_access;
   } else {
     if ((op & SPIFFS_OP_TYPE_MASK) == SPIFFS_OP_T_OBJ_LU2) {
       // for second layer lookup functions, we do not cache in order to prevent shredding
@@ -146,11 +249,14 @@ s32_t spiffs_phys_rd(
     fs->cache_misses++;
 #endif
     res = spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
-    cp = spiffs_cache_page_allocate(fs);
-    if (cp) {
-      cp->flags = SPIFFS_CACHE_FLAG_WRTHRU;
-      cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+    cp = spiffs_cache_page_allocate(fs, SPIFFS_CACHE_FLAG_WRTHRU);
+    if (cp == 0) {
+      // every cache page is held by a file descriptor, read thru
+      s32_t res2 = fs->cfg.hal_read_f(addr, len, dst);
+      return res2 != SPIFFS_OK ? res2 : res;
     }
+    cp->pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
+    spiffs_cache_hash_insert(cache, cp);
 
     s32_t res2 = fs->cfg.hal_read_f(
         addr - SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr),
@@ -176,6 +282,12 @@ s32_t spiffs_phys_wr(
   (void)fh;
   spiffs_page_ix pix = SPIFFS_PADDR_TO_PAGE(fs, addr);
   spiffs_cache *cache = spiffs_get_cache(fs);
+  if (cache == 0) {
+    return fs->cfg.hal_write_f(addr, len, src);
+  }
+#if SPIFFS_READ_AHEAD_PAGES
+  spiffs_cache_read_ahead_drop(fs, addr, len);
+#endif
   spiffs_cache_page *cp =  spiffs_cache_page_get(fs, pix);
 
   if (cp && (op & SPIFFS_OP_COM_MASK) != SPIFFS_OP_C_WRTHRU) {
@@ -192,9 +304,6 @@ s32_t spiffs_phys_wr(
     u8_t *mem =  spiffs_get_cache_page(fs, cache, cp->ix);
     memcpy(&mem[SPIFFS_PADDR_TO_PAGE_OFFSET(fs, addr)], src, len);
 
-    cache->last_access++;
-    cp->last_access = cache->last_access;
-
     if (cp->flags & SPIFFS_CACHE_FLAG_WRTHRU) {
       // page is being updated, no write-cache, just pass thru
       return fs->cfg.hal_write_f(addr, len, src);
@@ -211,20 +320,16 @@ s32_t spiffs_phys_wr(
 // returns the cache page that this fd refers, or null if no cache page
 spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
   spiffs_cache *cache = spiffs_get_cache(fs);
+  if (cache == 0) return 0;
 
-  if ((cache->cpage_use_map & cache->cpage_use_mask) == 0) {
-    // all cpages free, no cpage cannot be assigned to obj_id
-    return 0;
-  }
-
-  int i;
-  for (i = 0; i < cache->cpage_count; i++) {
-    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, i);
-    if ((cache->cpage_use_map & (1<<i)) &&
-        (cp->flags & SPIFFS_CACHE_FLAG_TYPE_WR) &&
-        cp->obj_id == fd->obj_id) {
+  // at most one write cache page per open file, walk the write list
+  u16_t ix = cache->wr_head;
+  while (ix != SPIFFS_CACHE_NIL) {
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, cache, ix);
+    if (cp->obj_id == fd->obj_id) {
       return cp;
     }
+    ix = cp->lru_next;
   }
 
   return 0;
@@ -235,14 +340,14 @@ spiffs_cache_page *spiffs_cache_page_get_by_fd(spiffs *fs, spiffs_fd *fd) {
 spiffs_cache_page *spiffs_cache_page_allocate_by_fd(spiffs *fs, spiffs_fd *fd) {
   // before this function is called, it is ensured that there is no already existing
   // cache page with same object id
+  if (spiffs_get_cache(fs) == 0) return 0;
   spiffs_cache_page_remove_oldest(fs, SPIFFS_CACHE_FLAG_TYPE_WR, 0);
-  spiffs_cache_page *cp = spiffs_cache_page_allocate(fs);
+  spiffs_cache_page *cp = spiffs_cache_page_allocate(fs, SPIFFS_CACHE_FLAG_TYPE_WR);
   if (cp == 0) {
     // could not get cache page
     return 0;
   }
 
-  cp->flags = SPIFFS_CACHE_FLAG_TYPE_WR;
   cp->obj_id = fd->obj_id;
   fd->cache_page = cp;
   return cp;
@@ -270,33 +375,56 @@ void spiffs_cache_fd_release(spiffs *fs, spiffs_cache_page *cp) {
 void spiffs_cache_init(spiffs *fs) {
   if (fs->cache == 0) return;
   u32_t sz = fs->cache_size;
-  u32_t cache_mask = 0;
+  u32_t buckets = 1;
+  u8_t shift = 16;
+  u32_t ra_size = 0;
   int i;
-  int cache_entries =
-      (sz - sizeof(spiffs_cache)) / (SPIFFS_CACHE_PAGE_SIZE(fs));
-  if (cache_entries <= 0) return;
+#if SPIFFS_READ_AHEAD_PAGES
+  // the window only gets room if a cache page still fits beside it
+  if (sz >= sizeof(spiffs_cache) + SPIFFS_CACHE_READ_AHEAD_SIZE(fs) + SPIFFS_CACHE_ENTRY_SIZE(fs)) {
+    ra_size = SPIFFS_CACHE_READ_AHEAD_SIZE(fs);
+  }
+#endif
+  int cache_entries = sz < sizeof(spiffs_cache) ? 0 :
+      (sz - sizeof(spiffs_cache) - ra_size) / (SPIFFS_CACHE_ENTRY_SIZE(fs));
+  if (cache_entries <= 0) {
+    // no room for a single page, run uncached
+    fs->cache = 0;
+    return;
+  }
+  if (cache_entries > SPIFFS_CACHE_NIL - 1) cache_entries = SPIFFS_CACHE_NIL - 1;
 
-  for (i = 0; i < cache_entries; i++) {
-    cache_mask <<= 1;
-    cache_mask |= 1;
+  while (buckets < (u32_t)cache_entries) {
+    buckets <<= 1;
+    shift--;
   }
 
   spiffs_cache cache;
   memset(&cache, 0, sizeof(spiffs_cache));
   cache.cpage_count = cache_entries;
-  cache.cpages = (u8_t *)((u8_t *)fs->cache + sizeof(spiffs_cache));
-
-  cache.cpage_use_map = 0xffffffff;
-  cache.cpage_use_mask = cache_mask;
+  cache.lru_head = SPIFFS_CACHE_NIL;
+  cache.lru_tail = SPIFFS_CACHE_NIL;
+  cache.wr_head = SPIFFS_CACHE_NIL;
+  cache.wr_tail = SPIFFS_CACHE_NIL;
+  cache.free_head = 0;
+  cache.hash_shift = shift;
+  // the read ahead window goes first to keep it word aligned for the hal
+  cache.cpages = (u8_t *)((u8_t *)fs->cache + sizeof(spiffs_cache) + ra_size);
+#if SPIFFS_READ_AHEAD_PAGES
+  cache.ra_buf = ra_size ? (u8_t *)fs->cache + sizeof(spiffs_cache) : 0;
+#endif
+  cache.hash = (u16_t *)(cache.cpages + cache_entries * SPIFFS_CACHE_PAGE_SIZE(fs));
   memcpy(fs->cache, &cache, sizeof(spiffs_cache));
 
   spiffs_cache *c = spiffs_get_cache(fs);
 
   memset(c->cpages, 0, c->cpage_count * SPIFFS_CACHE_PAGE_SIZE(fs));
+  memset(c->hash, 0xff, buckets * sizeof(u16_t));
 
-  c->cpage_use_map &= ~(c->cpage_use_mask);
   for (i = 0; i < cache.cpage_count; i++) {
-    spiffs_get_cache_page_hdr(fs, c, i)->ix = i;
+    spiffs_cache_page *cp = spiffs_get_cache_page_hdr(fs, c, i);
+    cp->ix = i;
+    cp->lru_next = i + 1 < cache.cpage_count ? i + 1 : SPIFFS_CACHE_NIL;
   }
 }
 
@@ -12,6 +12,9 @@ static s32_t spiffs_gc_erase_block(
   SPIFFS_GC_DBG("gc: erase block %i\n", bix);
   res = spiffs_erase_block(fs, bix);
   SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+  fs->stats_gc_erases++;
+#endif
 
 #if SPIFFS_CACHE
   {
@@ -102,6 +105,23 @@ s32_t spiffs_gc_quick(
   return res;
 }
 
+// Moves all live pages out of given block and erases it
+static s32_t spiffs_gc_reclaim(
+    spiffs *fs,
+    spiffs_block_ix bix) {
+  s32_t res;
+  fs->cleaning = 1;
+  res = spiffs_gc_clean(fs, bix);
+  fs->cleaning = 0;
+  SPIFFS_GC_DBG("gc: cleaning block %i, result %i\n", bix, res);
+  SPIFFS_CHECK_RES(res);
+
+  res = spiffs_gc_erase_page_stats(fs, bix);
+  SPIFFS_CHECK_RES(res);
+
+  return spiffs_gc_erase_block(fs, bix);
+}
+
 // Checks if garbage collecting is necessary. If so a candidate block is found,
 // cleansed and erased
 s32_t spiffs_gc_check(
@@ -149,21 +169,7 @@ s32_t spiffs_gc_check(
     fs->stats_gc_runs++;
 #endif
     cand = cands[0];
-    fs->cleaning = 1;
-    //printf("gcing: cleaning block %i\n", cand);
-    res = spiffs_gc_clean(fs, cand);
-    fs->cleaning = 0;
-    if (res < 0) {
-      SPIFFS_GC_DBG("gc_check: cleaning block %i, result %i\n", cand, res);
-    } else {
-      SPIFFS_GC_DBG("gc_check: cleaning block %i, result %i\n", cand, res);
-    }
-    SPIFFS_CHECK_RES(res);
-
-    res = spiffs_gc_erase_page_stats(fs, cand);
-    SPIFFS_CHECK_RES(res);
-
-    res = spiffs_gc_erase_block(fs, cand);
+    res = spiffs_gc_reclaim(fs, cand);
     SPIFFS_CHECK_RES(res);
 
     free_pages =
@@ -193,6 +199,55 @@ s32_t spiffs_gc_check(
   return res;
 }
 
+// Does a bounded piece of garbage collection, meant to be called repeatedly
+// while the system is idle so that spiffs_gc_check seldom has to do it in
+// the middle of a write. If there are reserve_blocks free blocks or less, one
+// block is reclaimed: a fully deleted one if there is any, as that needs no
+// page moves, otherwise the best candidate is cleaned and erased.
+// Cleaning only starts when there are at least a block worth of deleted
+// pages, so a file system full of live data is not worn by moving them back
+// and forth.
+// Returns 1 if a block was reclaimed, SPIFFS_OK if there was nothing to do.
+s32_t spiffs_gc_step(
+    spiffs *fs,
+    u32_t reserve_blocks) {
+  s32_t res;
+  spiffs_block_ix *cands;
+  int count;
+
+  if (fs->free_blocks > reserve_blocks) {
+    return SPIFFS_OK;
+  }
+
+  res = spiffs_gc_quick(fs, 0);
+  if (res == SPIFFS_OK) {
+    return 1;
+  }
+  if (res != SPIFFS_ERR_NO_DELETED_BLOCKS) {
+    return res;
+  }
+
+  if (fs->stats_p_deleted < SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+    return SPIFFS_OK;
+  }
+
+  res = spiffs_gc_find_candidate(fs, &cands, &count, 0);
+  SPIFFS_CHECK_RES(res);
+  if (count == 0) {
+    return SPIFFS_OK;
+  }
+
+  SPIFFS_GC_DBG("gc_step: free_blocks:%i pdele:%i, cleaning block %i\n",
+      fs->free_blocks, fs->stats_p_deleted, cands[0]);
+#if SPIFFS_GC_STATS
+  fs->stats_gc_runs++;
+#endif
+  res = spiffs_gc_reclaim(fs, cands[0]);
+  SPIFFS_CHECK_RES(res);
+
+  return 1;
+}
+
 // Updates page statistics for a block that is about to be erased
 s32_t spiffs_gc_erase_page_stats(
     spiffs *fs,
@@ -230,6 +285,128 @@ s32_t spiffs_gc_erase_page_stats(
   return res;
 }
 
+// Counts the used and deleted pages of a block from its object lookup pages
+static s32_t spiffs_gc_count_pages(
+    spiffs *fs,
+    spiffs_block_ix bix,
+    spiffs_block_stats *b) {
+  s32_t res = SPIFFS_OK;
+  u32_t block_addr = bix * SPIFFS_CFG_LOG_BLOCK_SZ(fs);
+  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
+  int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
+  int obj_lookup_page = 0;
+  int cur_entry = 0;
+
+  memset(b, 0, sizeof(spiffs_block_stats));
+  b->bix = bix;
+  b->pages = SPIFFS_PAGES_PER_BLOCK(fs) - SPIFFS_OBJ_LOOKUP_PAGES(fs);
+
+  // check each object lookup page
+  while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
+    int entry_offset = obj_lookup_page * entries_per_page;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
+        0, block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
+    // check each entry
+    while (res == SPIFFS_OK &&
+        cur_entry - entry_offset < entries_per_page &&
+        cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
+      spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
+      if (obj_id == SPIFFS_OBJ_ID_FREE) {
+        // when a free entry is encountered, scan logic ensures that all following entries are free also
+        res = 1; // kill object lu loop
+        break;
+      } else  if (obj_id == SPIFFS_OBJ_ID_DELETED) {
+        b->deleted_pages++;
+      } else {
+        b->used_pages++;
+      }
+      cur_entry++;
+    } // per entry
+    obj_lookup_page++;
+  } // per object lookup page
+  if (res == 1) res = SPIFFS_OK;
+
+  return res;
+}
+
+// Fewest erases of any block since mount, 0 if not counted
+static u16_t spiffs_gc_erases_min(
+    spiffs *fs) {
+  u16_t min = 0;
+#if SPIFFS_WEAR_STATS_BLOCKS
+  if (fs->block_count <= SPIFFS_WEAR_STATS_BLOCKS) {
+    u32_t i;
+    min = fs->block_erases[0];
+    for (i = 1; i < fs->block_count; i++) {
+      min = MIN(min, fs->block_erases[i]);
+    }
+  }
+#endif
+  return min;
+}
+
+// Reads the erase count of a block, and fills in its erase age and its
+// erases since mount
+static s32_t spiffs_gc_wear(
+    spiffs *fs,
+    spiffs_block_ix bix,
+    spiffs_block_stats *b) {
+  s32_t res;
+  spiffs_obj_id erase_count;
+  res = _spiffs_rd(fs, SPIFFS_OP_C_READ | SPIFFS_OP_T_OBJ_LU2, 0,
+      SPIFFS_ERASE_COUNT_PADDR(fs, bix),
+      sizeof(spiffs_obj_id), (u8_t *)&erase_count);
+  SPIFFS_CHECK_RES(res);
+
+  // the erase count is the value of max_erase_count when the block was
+  // erased, which wraps to 0 at SPIFFS_OBJ_ID_IX_FLAG
+  b->erase_age = (fs->max_erase_count - erase_count) & (SPIFFS_OBJ_ID_IX_FLAG - 1);
+#if SPIFFS_WEAR_STATS_BLOCKS
+  if (fs->block_count <= SPIFFS_WEAR_STATS_BLOCKS) {
+    b->erases = fs->block_erases[bix];
+  }
+#endif
+  return res;
+}
+
+// Fills in the page counts and wear of a block
+s32_t spiffs_gc_block_stats(
+    spiffs *fs,
+    spiffs_block_ix bix,
+    spiffs_block_stats *b) {
+  s32_t res = spiffs_gc_count_pages(fs, bix, b);
+  SPIFFS_CHECK_RES(res);
+  res = spiffs_gc_wear(fs, bix, b);
+  SPIFFS_CHECK_RES(res);
+  b->erases_min = spiffs_gc_erases_min(fs);
+  return res;
+}
+
+s32_t spiffs_gc_score_default(
+    const spiffs_block_stats *b,
+    u8_t fs_crammed) {
+  return
+      b->deleted_pages * SPIFFS_GC_HEUR_W_DELET +
+      b->used_pages * SPIFFS_GC_HEUR_W_USED +
+      b->erase_age * (fs_crammed ? 0 : SPIFFS_GC_HEUR_W_ERASE_AGE);
+}
+
+s32_t spiffs_gc_score_greedy(
+    const spiffs_block_stats *b,
+    u8_t fs_crammed) {
+  (void)fs_crammed;
+  return
+      b->deleted_pages * SPIFFS_GC_HEUR_W_DELET +
+      b->used_pages * SPIFFS_GC_HEUR_W_USED;
+}
+
+s32_t spiffs_gc_score_wear(
+    const spiffs_block_stats *b,
+    u8_t fs_crammed) {
+  return spiffs_gc_score_greedy(b, fs_crammed) +
+      (b->erases - b->erases_min) * (fs_crammed ? 0 : SPIFFS_GC_HEUR_W_WEAR);
+}
+
 // Finds block candidates to erase
 s32_t spiffs_gc_find_candidate(
     spiffs *fs,
@@ -239,9 +416,6 @@ s32_t spiffs_gc_find_candidate(
   s32_t res = SPIFFS_OK;
   u32_t blocks = fs->block_count;
   spiffs_block_ix cur_block = 0;
-  u32_t cur_block_addr = 0;
-  spiffs_obj_id *obj_lu_buf = (spiffs_obj_id *)fs->lu_work;
-  int cur_entry = 0;
 
   // using fs->work area as sorted candidate memory, (spiffs_block_ix)cand_bix/(s32_t)score
   int max_candidates = MIN(fs->block_count, (SPIFFS_CFG_LOG_PAGE_SZ(fs)-8)/(sizeof(spiffs_block_ix) + sizeof(s32_t)));
@@ -255,62 +429,24 @@ s32_t spiffs_gc_find_candidate(
 
   *block_candidates = cand_blocks;
 
-  int entries_per_page = (SPIFFS_CFG_LOG_PAGE_SZ(fs) / sizeof(spiffs_obj_id));
+  spiffs_gc_score_f score_f = fs->gc_score_f ? fs->gc_score_f : spiffs_gc_score_default;
+  u16_t erases_min = spiffs_gc_erases_min(fs);
 
   // check each block
   while (res == SPIFFS_OK && blocks--) {
-    u16_t deleted_pages_in_block = 0;
-    u16_t used_pages_in_block = 0;
-
-    int obj_lookup_page = 0;
-    // check each object lookup page
-    while (res == SPIFFS_OK && obj_lookup_page < (int)SPIFFS_OBJ_LOOKUP_PAGES(fs)) {
-      int entry_offset = obj_lookup_page * entries_per_page;
-      res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
-          0, cur_block_addr + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page), SPIFFS_CFG_LOG_PAGE_SZ(fs), fs->lu_work);
-      // check each entry
-      while (res == SPIFFS_OK &&
-          cur_entry - entry_offset < entries_per_page &&
-          cur_entry < (int)(SPIFFS_PAGES_PER_BLOCK(fs)-SPIFFS_OBJ_LOOKUP_PAGES(fs))) {
-        spiffs_obj_id obj_id = obj_lu_buf[cur_entry-entry_offset];
-        if (obj_id == SPIFFS_OBJ_ID_FREE) {
-          // when a free entry is encountered, scan logic ensures that all following entries are free also
-          res = 1; // kill object lu loop
-          break;
-        } else  if (obj_id == SPIFFS_OBJ_ID_DELETED) {
-          deleted_pages_in_block++;
-        } else {
-          used_pages_in_block++;
-        }
-        cur_entry++;
-      } // per entry
-      obj_lookup_page++;
-    } // per object lookup page
-    if (res == 1) res = SPIFFS_OK;
+    spiffs_block_stats b;
+    res = spiffs_gc_count_pages(fs, cur_block, &b);
 
     // calculate score and insert into candidate table
     // stoneage sort, but probably not so many blocks
-    if (res == SPIFFS_OK && deleted_pages_in_block > 0) {
-      // read erase count
-      spiffs_obj_id erase_count;
-      res = _spiffs_rd(fs, SPIFFS_OP_C_READ | SPIFFS_OP_T_OBJ_LU2, 0,
-          SPIFFS_ERASE_COUNT_PADDR(fs, cur_block),
-          sizeof(spiffs_obj_id), (u8_t *)&erase_count);
+    if (res == SPIFFS_OK && b.deleted_pages > 0) {
+      res = spiffs_gc_wear(fs, cur_block, &b);
       SPIFFS_CHECK_RES(res);
+      b.erases_min = erases_min;
 
-      spiffs_obj_id erase_age;
-      if (fs->max_erase_count > erase_count) {
-        erase_age = fs->max_erase_count - erase_count;
-      } else {
-        erase_age = SPIFFS_OBJ_ID_FREE - (erase_count - fs->max_erase_count);
-      }
-
-      s32_t score =
-          deleted_pages_in_block * SPIFFS_GC_HEUR_W_DELET +
-          used_pages_in_block * SPIFFS_GC_HEUR_W_USED +
-          erase_age * (fs_crammed ? 0 : SPIFFS_GC_HEUR_W_ERASE_AGE);
+      s32_t score = score_f(&b, fs_crammed);
       int cand_ix = 0;
-      SPIFFS_GC_DBG("gc_check: bix:%i del:%i use:%i score:%i\n", cur_block, deleted_pages_in_block, used_pages_in_block, score);
+      SPIFFS_GC_DBG("gc_check: bix:%i del:%i use:%i age:%i score:%i\n", cur_block, b.deleted_pages, b.used_pages, b.erase_age, score);
       while (cand_ix < max_candidates) {
         if (cand_blocks[cand_ix] == (spiffs_block_ix)-1) {
           cand_blocks[cand_ix] = cur_block;
@@ -332,9 +468,7 @@ s32_t spiffs_gc_find_candidate(
       (*candidate_count)++;
     }
 
-    cur_entry = 0;
     cur_block++;
-    cur_block_addr += SPIFFS_CFG_LOG_BLOCK_SZ(fs);
   } // per block
 
   return res;
@@ -437,6 +571,9 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
                 res = spiffs_page_move(fs, 0, 0, obj_id, &p_hdr, cur_pix, &new_data_pix);
                 SPIFFS_GC_DBG("gc_clean: MOVE_DATA move objix %04x:%04x page %04x to %04x\n", gc.cur_obj_id, p_hdr.span_ix, cur_pix, new_data_pix);
                 SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+                fs->stats_gc_moved_pages++;
+#endif
                 // move wipes obj_lu, reload it
                 res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
                     0, bix * SPIFFS_CFG_LOG_BLOCK_SZ(fs) + SPIFFS_PAGE_TO_PADDR(fs, obj_lookup_page),
@@ -477,6 +614,9 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
               res = spiffs_page_move(fs, 0, 0, obj_id, &p_hdr, cur_pix, &new_pix);
               SPIFFS_GC_DBG("gc_clean: MOVE_OBJIX move objix %04x:%04x page %04x to %04x\n", obj_id, p_hdr.span_ix, cur_pix, new_pix);
               SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+              fs->stats_gc_moved_pages++;
+#endif
               spiffs_cb_object_event(fs, 0, SPIFFS_EV_IX_UPD, obj_id, p_hdr.span_ix, new_pix, 0);
               // move wipes obj_lu, reload it
               res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU | SPIFFS_OP_C_READ,
@@ -543,11 +683,17 @@ s32_t spiffs_gc_clean(spiffs *fs, spiffs_block_ix bix) {
         res = spiffs_object_update_index_hdr(fs, 0, gc.cur_obj_id | SPIFFS_OBJ_ID_IX_FLAG, gc.cur_objix_pix, fs->work, 0, 0, &new_objix_pix);
         SPIFFS_GC_DBG("gc_clean: MOVE_DATA store modified objix_hdr page, %04x:%04x\n", new_objix_pix, 0);
         SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+        fs->stats_gc_moved_pages++;
+#endif
       } else {
         // store object index page
         res = spiffs_page_move(fs, 0, fs->work, gc.cur_obj_id | SPIFFS_OBJ_ID_IX_FLAG, 0, gc.cur_objix_pix, &new_objix_pix);
         SPIFFS_GC_DBG("gc_clean: MOVE_DATA store modified objix page, %04x:%04x\n", new_objix_pix, objix->p_hdr.span_ix);
         SPIFFS_CHECK_RES(res);
+#if SPIFFS_GC_STATS
+        fs->stats_gc_moved_pages++;
+#endif
         spiffs_cb_object_event(fs, 0, SPIFFS_EV_IX_UPD, gc.cur_obj_id, objix->p_hdr.span_ix, new_objix_pix, 0);
       }
     }
@@ -16,7 +16,8 @@ u32_t SPIFFS_buffer_bytes_for_filedescs(spiffs *fs, u32_t num_descs) {
 }
 #if SPIFFS_CACHE
 u32_t SPIFFS_buffer_bytes_for_cache(spiffs *fs, u32_t num_pages) {
-  return sizeof(spiffs_cache) + num_pages * (sizeof(spiffs_cache_page) + SPIFFS_CFG_LOG_PAGE_SZ(fs));
+  return sizeof(spiffs_cache) + num_pages * SPIFFS_CACHE_ENTRY_SIZE(fs) +
+      SPIFFS_CACHE_READ_AHEAD_SIZE(fs);
 }
 #endif
 #endif
@@ -91,7 +92,7 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
   }
 #if SPIFFS_CACHE
   fs->cache = cache;
-  fs->cache_size = (cache_size > (config->log_page_size*32)) ? config->log_page_size*32 : cache_size;
+  fs->cache_size = cache_size;
   spiffs_cache_init(fs);
 #endif
 
@@ -107,6 +108,11 @@ s32_t SPIFFS_mount(spiffs *fs, spiffs_config *config, u8_t *work,
   res = spiffs_obj_lu_scan(fs);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
+#if SPIFFS_NAME_INDEX
+  res = spiffs_name_ix_build(fs);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+#endif
+
   SPIFFS_DBG("page index byte len:         %i\n", SPIFFS_CFG_LOG_PAGE_SZ(fs));
   SPIFFS_DBG("object lookup pages:         %i\n", SPIFFS_OBJ_LOOKUP_PAGES(fs));
   SPIFFS_DBG("page pages per block:        %i\n", SPIFFS_PAGES_PER_BLOCK(fs));
@@ -133,7 +139,7 @@ void SPIFFS_unmount(spiffs *fs) {
   for (i = 0; i < fs->fd_count; i++) {
     spiffs_fd *cur_fd = &fds[i];
     if (cur_fd->file_nbr != 0) {
-#if SPIFFS_CACHE
+#if SPIFFS_CACHE || SPIFFS_APPEND_BUFFERS
       (void)spiffs_fflush_cache(fs, cur_fd->file_nbr);
 #endif
       spiffs_fd_return(fs, cur_fd->file_nbr);
@@ -274,7 +280,7 @@ s32_t SPIFFS_read(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
     SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   }
 
-#if SPIFFS_CACHE_WR
+#if SPIFFS_CACHE_WR || SPIFFS_APPEND_BUFFERS
   spiffs_fflush_cache(fs, fh);
 #endif
 
@@ -327,6 +333,26 @@ static s32_t spiffs_hydro_write(spiffs *fs, spiffs_fd *fd, void *buf, u32_t offs
 
 }
 
+#if SPIFFS_APPEND_BUFFERS
+// Appends what is in given append buffer to the end of the file, through
+// the file descriptor owning the buffer. The buffer is emptied also on
+// failure, like a write cache page is.
+static s32_t spiffs_append_buf_flush(spiffs *fs, spiffs_append_buf *ab) {
+  s32_t res = SPIFFS_OK;
+  if (ab->len) {
+    spiffs_fd *fd;
+    res = spiffs_fd_get(fs, ab->file_nbr, &fd);
+    SPIFFS_CHECK_RES(res);
+    SPIFFS_DBG("append_buf: flushing %i bytes for fd %i:%04x\n", ab->len, fd->file_nbr, fd->obj_id);
+    res = spiffs_hydro_write(fs, fd, ab->buf,
+        fd->size == SPIFFS_UNDEFINED_LEN ? 0 : fd->size, ab->len);
+    ab->len = 0;
+    ab->aged = 0;
+  }
+  return res < SPIFFS_OK ? res : SPIFFS_OK;
+}
+#endif
+
 s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
   SPIFFS_API_CHECK_CFG(fs);
   SPIFFS_API_CHECK_MOUNT(fs);
@@ -344,6 +370,16 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
     SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
   }
 
+#if SPIFFS_APPEND_BUFFERS
+  spiffs_append_buf *ab = spiffs_append_buf_get_by_obj_id(fs, fd->obj_id);
+  if (ab && ab->file_nbr != fh) {
+    // another descriptor of the file buffers appends, they go first
+    res = spiffs_append_buf_flush(fs, ab);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    ab = 0;
+  }
+#endif
+
   offset = fd->fdoffset;
 
 #if SPIFFS_CACHE_WR
@@ -365,6 +401,43 @@ s32_t SPIFFS_write(spiffs *fs, spiffs_file fh, void *buf, s32_t len) {
 #endif
   }
 
+#if SPIFFS_APPEND_BUFFERS
+  if (ab) {
+    // files with an append buffer bypass the write cache, but another
+    // descriptor of the file may have cached writes since, they go first
+#if SPIFFS_CACHE_WR
+    if (fd->cache_page) {
+      res = spiffs_fflush_cache(fs, fh);
+      SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    }
+#endif
+    u32_t end = (fd->size == SPIFFS_UNDEFINED_LEN ? 0 : fd->size) + ab->len;
+    if (fd->flags & SPIFFS_APPEND) {
+      offset = end;
+    }
+    if (offset == end && (u32_t)len < ab->size) {
+      // small write to the end of the file, buffer it
+      if (ab->len + len > ab->size) {
+        res = spiffs_append_buf_flush(fs, ab);
+        SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+      }
+      memcpy(&ab->buf[ab->len], buf, len);
+      ab->len += len;
+      fd->fdoffset += len;
+      SPIFFS_UNLOCK(fs);
+      return len;
+    }
+    // anything else is written after what is buffered
+    res = spiffs_append_buf_flush(fs, ab);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    res = spiffs_hydro_write(fs, fd, buf, offset, len);
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    fd->fdoffset += len;
+    SPIFFS_UNLOCK(fs);
+    return res;
+  }
+#endif
+
 #if SPIFFS_CACHE_WR
   if ((fd->flags & SPIFFS_DIRECT) == 0) {
     if (len < (s32_t)SPIFFS_CFG_LOG_PAGE_SZ(fs)) {
@@ -456,7 +529,7 @@ s32_t SPIFFS_lseek(spiffs *fs, spiffs_file fh, s32_t offs, int whence) {
   res = spiffs_fd_get(fs, fh, &fd);
   SPIFFS_API_CHECK_RES(fs, res);
 
-#if SPIFFS_CACHE_WR
+#if SPIFFS_CACHE_WR || SPIFFS_APPEND_BUFFERS
   spiffs_fflush_cache(fs, fh);
 #endif
 
@@ -603,7 +676,7 @@ s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s) {
   res = spiffs_fd_get(fs, fh, &fd);
   SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
 
-#if SPIFFS_CACHE_WR
+#if SPIFFS_CACHE_WR || SPIFFS_APPEND_BUFFERS
   spiffs_fflush_cache(fs, fh);
 #endif
 
@@ -614,16 +687,17 @@ s32_t SPIFFS_fstat(spiffs *fs, spiffs_file fh, spiffs_stat *s) {
   return res;
 }
 
-// Checks if there are any cached writes for the object id associated with
-// given filehandle. If so, these writes are flushed.
+// Checks if there are any cached or buffered writes for the object id
+// associated with given filehandle. If so, these writes are flushed.
 static s32_t spiffs_fflush_cache(spiffs *fs, spiffs_file fh) {
   s32_t res = SPIFFS_OK;
-#if SPIFFS_CACHE_WR
+#if SPIFFS_CACHE_WR || SPIFFS_APPEND_BUFFERS
 
   spiffs_fd *fd;
   res = spiffs_fd_get(fs, fh, &fd);
   SPIFFS_API_CHECK_RES(fs, res);
 
+#if SPIFFS_CACHE_WR
   if ((fd->flags & SPIFFS_DIRECT) == 0) {
     if (fd->cache_page == 0) {
       // see if object id is associated with cache already
@@ -641,6 +715,18 @@ static s32_t spiffs_fflush_cache(spiffs *fs, spiffs_file fh) {
       spiffs_cache_fd_release(fs, fd->cache_page);
     }
   }
+#endif
+#if SPIFFS_APPEND_BUFFERS
+  // like the write cache, by object id: the buffer may belong to another
+  // descriptor of the file
+  spiffs_append_buf *ab = spiffs_append_buf_get_by_obj_id(fs, fd->obj_id);
+  if (ab && ab->len) {
+    res = spiffs_append_buf_flush(fs, ab);
+    if (res < SPIFFS_OK) {
+      fs->err_code = res;
+    }
+  }
+#endif
 #endif
 
   return res;
@@ -650,7 +736,7 @@ s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh) {
   SPIFFS_API_CHECK_CFG(fs);
   SPIFFS_API_CHECK_MOUNT(fs);
   s32_t res = SPIFFS_OK;
-#if SPIFFS_CACHE_WR
+#if SPIFFS_CACHE_WR || SPIFFS_APPEND_BUFFERS
   SPIFFS_LOCK(fs);
   res = spiffs_fflush_cache(fs, fh);
   SPIFFS_API_CHECK_RES_UNLOCK(fs,res);
@@ -660,6 +746,82 @@ s32_t SPIFFS_fflush(spiffs *fs, spiffs_file fh) {
   return res;
 }
 
+#if SPIFFS_APPEND_BUFFERS
+s32_t SPIFFS_fbuffer(spiffs *fs, spiffs_file fh, u8_t *buf, u32_t size) {
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  spiffs_fd *fd;
+  s32_t res;
+  res = spiffs_fd_get(fs, fh, &fd);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  if ((fd->flags & SPIFFS_WRONLY) == 0) {
+    res = SPIFFS_ERR_NOT_WRITABLE;
+    SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  }
+
+  // what is cached or buffered so far goes first
+  res = spiffs_fflush_cache(fs, fh);
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+
+  if (buf == 0 || size == 0) {
+    spiffs_append_buf_release(fs, fh);
+    SPIFFS_UNLOCK(fs);
+    return SPIFFS_OK;
+  }
+
+  // the file's buffer, if another descriptor of it has one, moves here
+  spiffs_append_buf *ab = spiffs_append_buf_get_by_obj_id(fs, fd->obj_id);
+  if (ab == 0) {
+    ab = spiffs_append_buf_get(fs, 0);
+    if (ab == 0) {
+      res = SPIFFS_ERR_OUT_OF_APPEND_BUFS;
+      SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+    }
+  }
+  ab->file_nbr = fh;
+  ab->obj_id = fd->obj_id;
+  ab->buf = buf;
+  ab->size = size;
+  ab->len = 0;
+  ab->aged = 0;
+
+  SPIFFS_UNLOCK(fs);
+
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_fflush_aged(spiffs *fs, u32_t now, u32_t max_age) {
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  s32_t res;
+  s32_t flushed = 0;
+  u32_t i;
+  for (i = 0; i < SPIFFS_APPEND_BUFFERS; i++) {
+    spiffs_append_buf *ab = &fs->append_bufs[i];
+    if (ab->file_nbr == 0 || ab->len == 0) continue;
+    if (!ab->aged) {
+      // first seen now, time it from here
+      ab->aged = 1;
+      ab->since = now;
+    }
+    if (now - ab->since >= max_age) {
+      res = spiffs_append_buf_flush(fs, ab);
+      SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+      flushed++;
+    }
+  }
+
+  SPIFFS_UNLOCK(fs);
+
+  return flushed;
+}
+#endif
+
 void SPIFFS_close(spiffs *fs, spiffs_file fh) {
   if (!SPIFFS_CHECK_CFG((fs))) {
     (fs)->err_code = SPIFFS_ERR_NOT_CONFIGURED;
@@ -672,7 +834,7 @@ void SPIFFS_close(spiffs *fs, spiffs_file fh) {
   }
   SPIFFS_LOCK(fs);
 
-#if SPIFFS_CACHE
+#if SPIFFS_CACHE || SPIFFS_APPEND_BUFFERS
   spiffs_fflush_cache(fs, fh);
 #endif
   spiffs_fd_return(fs, fh);
@@ -827,6 +989,13 @@ s32_t SPIFFS_check(spiffs *fs) {
 
   res = spiffs_obj_lu_scan(fs);
 
+#if SPIFFS_NAME_INDEX
+  // pages may have been moved or deleted behind the index
+  if (res == SPIFFS_OK) {
+    res = spiffs_name_ix_build(fs);
+  }
+#endif
+
   SPIFFS_UNLOCK(fs);
   return res;
 }
@@ -882,6 +1051,78 @@ s32_t SPIFFS_gc(spiffs *fs, u32_t size) {
   return 0;
 }
 
+s32_t SPIFFS_gc_step(spiffs *fs, u32_t reserve_blocks) {
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  res = spiffs_gc_step(fs, reserve_blocks);
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return res;
+}
+
+s32_t SPIFFS_fs_stats(spiffs *fs, spiffs_fs_stats *s) {
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  memset(s, 0, sizeof(spiffs_fs_stats));
+#if SPIFFS_GC_STATS
+  s->gc_runs = fs->stats_gc_runs;
+  s->gc_erases = fs->stats_gc_erases;
+  s->gc_moved_pages = fs->stats_gc_moved_pages;
+  s->erases = fs->stats_erases;
+#endif
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  s->cache_hits = fs->cache_hits;
+  s->cache_misses = fs->cache_misses;
+#endif
+#if SPIFFS_WEAR_STATS_BLOCKS
+  if (fs->block_count <= SPIFFS_WEAR_STATS_BLOCKS) {
+    u32_t bix;
+    s->block_erases_min = fs->block_erases[0];
+    for (bix = 0; bix < fs->block_count; bix++) {
+      s->block_erases_max = MAX(s->block_erases_max, fs->block_erases[bix]);
+      s->block_erases_min = MIN(s->block_erases_min, fs->block_erases[bix]);
+    }
+  }
+#endif
+
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+}
+
+s32_t SPIFFS_block_stats(spiffs *fs, u32_t bix, spiffs_block_stats *s) {
+  s32_t res;
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  if (bix >= fs->block_count) {
+    res = SPIFFS_ERR_NOT_FOUND;
+  } else {
+    res = spiffs_gc_block_stats(fs, bix, s);
+  }
+
+  SPIFFS_API_CHECK_RES_UNLOCK(fs, res);
+  SPIFFS_UNLOCK(fs);
+  return res;
+}
+
+s32_t SPIFFS_gc_policy(spiffs *fs, spiffs_gc_score_f score_f) {
+  SPIFFS_API_CHECK_CFG(fs);
+  SPIFFS_API_CHECK_MOUNT(fs);
+  SPIFFS_LOCK(fs);
+
+  fs->gc_score_f = score_f;
+
+  SPIFFS_UNLOCK(fs);
+  return SPIFFS_OK;
+}
+
 
 #if SPIFFS_TEST_VISUALISATION
 s32_t SPIFFS_vis(spiffs *fs) {
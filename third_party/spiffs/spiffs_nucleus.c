@@ -232,6 +232,26 @@ s32_t spiffs_erase_block(
     size -= SPIFFS_CFG_PHYS_ERASE_SZ(fs);
   }
   fs->free_blocks++;
+#if SPIFFS_GC_STATS
+  fs->stats_erases++;
+#endif
+#if SPIFFS_WEAR_STATS_BLOCKS
+  if (fs->block_count <= SPIFFS_WEAR_STATS_BLOCKS && fs->block_erases[bix] != (u16_t)-1) {
+    fs->block_erases[bix]++;
+  }
+#endif
+
+#if SPIFFS_ALLOC_MAP_PAGES
+  {
+    u32_t i = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+    u32_t end = i + SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+    if (end <= fs->free_map_pages) {
+      for (; i < end; i++) {
+        fs->free_map[i >> 3] |= 1 << (i & 7);
+      }
+    }
+  }
+#endif
 
   // register erase count for this block
   res = _spiffs_wr(fs, SPIFFS_OP_C_WRTHRU | SPIFFS_OP_T_OBJ_LU2, 0,
@@ -272,10 +292,22 @@ static s32_t spiffs_obj_lu_scan_v(
       fs->free_blocks++;
       // todo optimize further, return SPIFFS_NEXT_BLOCK
     }
+#if SPIFFS_ALLOC_MAP_PAGES
+    u32_t i = bix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + ix_entry;
+    if (i < fs->free_map_pages) {
+      fs->free_map[i >> 3] |= 1 << (i & 7);
+    }
+#endif
   } else if (obj_id == SPIFFS_OBJ_ID_DELETED) {
     fs->stats_p_deleted++;
   } else {
     fs->stats_p_allocated++;
+#if SPIFFS_ALLOC_MAP_IDS
+    spiffs_obj_id id = (obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) - 1;
+    if (id < SPIFFS_ALLOC_MAP_IDS) {
+      fs->id_map[id >> 3] |= 1 << (id & 7);
+    }
+#endif
   }
 
   return SPIFFS_VIS_COUNTINUE;
@@ -285,6 +317,7 @@ static s32_t spiffs_obj_lu_scan_v(
 // Scans thru all obj lu and counts free, deleted and used pages
 // Find the maximum block erase count
 // Checks magic if enabled
+// Builds the free page and object id bitmaps if enabled
 s32_t spiffs_obj_lu_scan(
     spiffs *fs) {
   s32_t res;
@@ -359,6 +392,17 @@ s32_t spiffs_obj_lu_scan(
   fs->stats_p_allocated = 0;
   fs->stats_p_deleted = 0;
 
+#if SPIFFS_ALLOC_MAP_PAGES
+  memset(fs->free_map, 0, sizeof(fs->free_map));
+  fs->free_map_pages = fs->block_count * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+  if (fs->free_map_pages > SPIFFS_ALLOC_MAP_PAGES) {
+    fs->free_map_pages = 0;
+  }
+#endif
+#if SPIFFS_ALLOC_MAP_IDS
+  memset(fs->id_map, 0, sizeof(fs->id_map));
+#endif
+
   res = spiffs_obj_lu_find_entry_visitor(fs,
       0,
       0,
@@ -379,6 +423,40 @@ s32_t spiffs_obj_lu_scan(
   return res;
 }
 
+#if SPIFFS_ALLOC_MAP_PAGES
+// Finds the first free page in the free page bitmap from given entry on,
+// wrapping at the end
+static s32_t spiffs_free_map_find(
+    spiffs *fs,
+    spiffs_block_ix starting_block,
+    int starting_lu_entry,
+    spiffs_block_ix *block_ix,
+    int *lu_entry) {
+  u32_t i = starting_block * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + starting_lu_entry;
+  u32_t n = 0;
+  // bits past free_map_pages are never set, so a whole byte can be skipped
+  while (n < fs->free_map_pages + 8) {
+    if (i >= fs->free_map_pages) {
+      i = 0;
+    }
+    u8_t bits = fs->free_map[i >> 3] >> (i & 7);
+    if (bits == 0) {
+      n += 8 - (i & 7);
+      i += 8 - (i & 7);
+      continue;
+    }
+    while ((bits & 1) == 0) {
+      bits >>= 1;
+      i++;
+    }
+    *block_ix = i / SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+    *lu_entry = i % SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs);
+    return SPIFFS_OK;
+  }
+  return SPIFFS_VIS_END;
+}
+#endif
+
 // Find free object lookup entry
 // Iterate over object lookup pages in each block until a free object id entry is found
 s32_t spiffs_obj_lu_find_free(
@@ -398,6 +476,11 @@ s32_t spiffs_obj_lu_find_free(
       return SPIFFS_ERR_FULL;
     }
   }
+#if SPIFFS_ALLOC_MAP_PAGES
+  if (fs->free_map_pages) {
+    res = spiffs_free_map_find(fs, starting_block, starting_lu_entry, block_ix, lu_entry);
+  } else
+#endif
   res = spiffs_obj_lu_find_id(fs, starting_block, starting_lu_entry,
       SPIFFS_OBJ_ID_FREE, block_ix, lu_entry);
   if (res == SPIFFS_OK) {
@@ -406,6 +489,13 @@ s32_t spiffs_obj_lu_find_free(
     if (*lu_entry == 0) {
       fs->free_blocks--;
     }
+#if SPIFFS_ALLOC_MAP_PAGES
+    // the caller occupies the entry right away
+    u32_t i = *block_ix * SPIFFS_OBJ_LOOKUP_MAX_ENTRIES(fs) + *lu_entry;
+    if (i < fs->free_map_pages) {
+      fs->free_map[i >> 3] &= ~(1 << (i & 7));
+    }
+#endif
   }
   if (res == SPIFFS_VIS_END) {
     SPIFFS_DBG("fs full\n");
@@ -684,6 +774,126 @@ s32_t spiffs_page_delete(
   return res;
 }
 
+#if SPIFFS_NAME_INDEX
+// checks that an object index header page is in use and not deleted
+#define SPIFFS_NAME_IX_HDR_VALID(hdr) \
+  ((hdr).p_hdr.span_ix == 0 && \
+   ((hdr).p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) == \
+       (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE))
+
+static u16_t spiffs_name_ix_hash(const u8_t *name) {
+  // FNV-1a, folded to 16 bits
+  u32_t h = 2166136261u;
+  int i;
+  for (i = 0; i < SPIFFS_OBJ_NAME_LEN && name[i]; i++) {
+    h = (h ^ name[i]) * 16777619u;
+  }
+  return (u16_t)(h ^ (h >> 16));
+}
+
+static spiffs_name_ix_entry *spiffs_name_ix_by_id(spiffs *fs, spiffs_obj_id obj_id) {
+  u32_t i;
+  obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
+  for (i = 0; i < fs->name_ix_count; i++) {
+    if (fs->name_ix[i].obj_id == obj_id) {
+      return &fs->name_ix[i];
+    }
+  }
+  return 0;
+}
+
+// Adds an object to the name index, or notes that it did not fit
+static void spiffs_name_ix_add(
+    spiffs *fs,
+    spiffs_obj_id obj_id,
+    const u8_t *name,
+    spiffs_page_ix pix) {
+  if (fs->name_ix_count >= SPIFFS_NAME_INDEX) {
+    fs->name_ix_overflow = 1;
+    return;
+  }
+  spiffs_name_ix_entry *e = &fs->name_ix[fs->name_ix_count++];
+  e->hash = spiffs_name_ix_hash(name);
+  e->obj_id = obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
+  e->pix = pix;
+}
+
+static s32_t spiffs_name_ix_build_v(
+    spiffs *fs,
+    spiffs_obj_id obj_id,
+    spiffs_block_ix bix,
+    int ix_entry,
+    u32_t user_data,
+    void *user_p) {
+  (void)user_data;
+  (void)user_p;
+  s32_t res;
+  spiffs_page_object_ix_header objix_hdr;
+  spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
+  if (obj_id == SPIFFS_OBJ_ID_FREE || obj_id == SPIFFS_OBJ_ID_DELETED ||
+      (obj_id & SPIFFS_OBJ_ID_IX_FLAG) == 0) {
+    return SPIFFS_VIS_COUNTINUE;
+  }
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+  SPIFFS_CHECK_RES(res);
+  if (SPIFFS_NAME_IX_HDR_VALID(objix_hdr)) {
+    spiffs_name_ix_add(fs, obj_id, objix_hdr.name, pix);
+  }
+  return SPIFFS_VIS_COUNTINUE;
+}
+
+// Builds the name index from the object index headers on flash
+s32_t spiffs_name_ix_build(
+    spiffs *fs) {
+  s32_t res;
+  fs->name_ix_count = 0;
+  fs->name_ix_overflow = 0;
+  res = spiffs_obj_lu_find_entry_visitor(fs, 0, 0, SPIFFS_VIS_NO_WRAP, 0,
+      spiffs_name_ix_build_v, 0, 0, 0, 0);
+  if (res == SPIFFS_VIS_END) {
+    res = SPIFFS_OK;
+  }
+  if (res != SPIFFS_OK) {
+    // scan for everything rather than trust a partial index
+    fs->name_ix_count = 0;
+    fs->name_ix_overflow = 1;
+  }
+  return res;
+}
+
+// Looks name up in the name index, one flash read per entry with the same
+// hash. Returns SPIFFS_VIS_COUNTINUE when the name must be scanned for.
+static s32_t spiffs_name_ix_find(
+    spiffs *fs,
+    u8_t name[SPIFFS_OBJ_NAME_LEN],
+    spiffs_page_ix *pix) {
+  s32_t res;
+  spiffs_page_object_ix_header objix_hdr;
+  u16_t hash = spiffs_name_ix_hash(name);
+  u8_t stale = 0;
+  u32_t i;
+  for (i = 0; i < fs->name_ix_count; i++) {
+    spiffs_name_ix_entry *e = &fs->name_ix[i];
+    if (e->hash != hash) continue;
+    res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+        0, SPIFFS_PAGE_TO_PADDR(fs, e->pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+    SPIFFS_CHECK_RES(res);
+    if (!SPIFFS_NAME_IX_HDR_VALID(objix_hdr) ||
+        (objix_hdr.p_hdr.obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) != e->obj_id) {
+      SPIFFS_DBG("name_ix: stale entry %04x for %04x\n", e->pix, e->obj_id);
+      stale = 1;
+      continue;
+    }
+    if (strcmp((char *)name, (char *)objix_hdr.name) == 0) {
+      *pix = e->pix;
+      return SPIFFS_OK;
+    }
+  }
+  return stale || fs->name_ix_overflow ? SPIFFS_VIS_COUNTINUE : SPIFFS_ERR_NOT_FOUND;
+}
+#endif
+
 // Create an object index header page with empty index and undefined length
 s32_t spiffs_object_create(
     spiffs *fs,
@@ -728,6 +938,17 @@ s32_t spiffs_object_create(
 
   SPIFFS_CHECK_RES(res);
   spiffs_cb_object_event(fs, 0, SPIFFS_EV_IX_NEW, obj_id, 0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry), SPIFFS_UNDEFINED_LEN);
+#if SPIFFS_NAME_INDEX
+  spiffs_name_ix_add(fs, obj_id, name, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry));
+#endif
+#if SPIFFS_ALLOC_MAP_IDS
+  {
+    spiffs_obj_id id = (obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) - 1;
+    if (id < SPIFFS_ALLOC_MAP_IDS) {
+      fs->id_map[id >> 3] |= 1 << (id & 7);
+    }
+  }
+#endif
 
   if (objix_hdr_pix) {
     *objix_hdr_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
@@ -786,6 +1007,12 @@ s32_t spiffs_object_update_index_hdr(
     // callback on object index update
     spiffs_cb_object_event(fs, fd, SPIFFS_EV_IX_UPD, obj_id, objix_hdr->p_hdr.span_ix, new_objix_hdr_pix, objix_hdr->size);
     if (fd) fd->objix_hdr_pix = new_objix_hdr_pix; // if this is not in the registered cluster
+#if SPIFFS_NAME_INDEX
+    if (name) {
+      spiffs_name_ix_entry *e = spiffs_name_ix_by_id(fs, obj_id);
+      if (e) e->hash = spiffs_name_ix_hash(name);
+    }
+#endif
   }
 
   return res;
@@ -802,6 +1029,17 @@ void spiffs_cb_object_event(
   (void)fd;
   // update index caches in all file descriptors
   obj_id &= ~SPIFFS_OBJ_ID_IX_FLAG;
+#if SPIFFS_NAME_INDEX
+  if (spix == 0) {
+    // follow object index header moves and deletions in the name index
+    spiffs_name_ix_entry *e = spiffs_name_ix_by_id(fs, obj_id);
+    if (e && (ev == SPIFFS_EV_IX_NEW || ev == SPIFFS_EV_IX_UPD)) {
+      e->pix = new_pix;
+    } else if (e && ev == SPIFFS_EV_IX_DEL && e->pix == new_pix) {
+      *e = fs->name_ix[--fs->name_ix_count];
+    }
+  }
+#endif
   u32_t i;
   spiffs_fd *fds = (spiffs_fd *)fs->fd_space;
   for (i = 0; i < fs->fd_count; i++) {
@@ -815,6 +1053,9 @@ void spiffs_cb_object_event(
           cur_fd->size = new_size;
         }
       } else if (ev == SPIFFS_EV_IX_DEL) {
+#if SPIFFS_APPEND_BUFFERS
+        spiffs_append_buf_release(fs, cur_fd->file_nbr);
+#endif
         cur_fd->file_nbr = 0;
         cur_fd->obj_id = SPIFFS_OBJ_ID_DELETED;
       }
@@ -1366,6 +1607,18 @@ s32_t spiffs_object_find_object_index_header_by_name(
   spiffs_block_ix bix;
   int entry;
 
+#if SPIFFS_NAME_INDEX
+  spiffs_page_ix ix_pix;
+  res = spiffs_name_ix_find(fs, name, &ix_pix);
+  if (res != SPIFFS_VIS_COUNTINUE) {
+    SPIFFS_CHECK_RES(res);
+    if (pix) {
+      *pix = ix_pix;
+    }
+    return res;
+  }
+#endif
+
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
       fs->cursor_obj_lu_entry,
@@ -1571,6 +1824,16 @@ s32_t spiffs_object_truncate(
 
         res = spiffs_page_delete(fs, objix_pix);
         SPIFFS_CHECK_RES(res);
+#if SPIFFS_ALLOC_MAP_IDS
+        {
+          // all pages of the object are gone, its id may be reused. Done
+          // before the event, which clears fd->obj_id
+          spiffs_obj_id id = (fd->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) - 1;
+          if (id < SPIFFS_ALLOC_MAP_IDS) {
+            fs->id_map[id >> 3] &= ~(1 << (id & 7));
+          }
+        }
+#endif
         spiffs_cb_object_event(fs, fd, SPIFFS_EV_IX_DEL, fd->obj_id, 0, objix_pix, 0);
       } else {
         // make uninitialized object
@@ -1613,6 +1876,41 @@ s32_t spiffs_object_truncate(
   return res;
 }
 
+#if SPIFFS_CACHE && SPIFFS_READ_AHEAD_PAGES
+// Reads the data page at data_spix into the read ahead window, along with
+// the flash after it for as long as the following data pages of the file
+// fall within SPIFFS_READ_AHEAD_PAGES. Pages in between, like replaced
+// index pages, are read too as the window is one flash access.
+// The object index page for data_spix must be loaded in fs->work.
+static void spiffs_object_read_ahead(
+    spiffs *fs,
+    spiffs_fd *fd,
+    spiffs_span_ix objix_spix,
+    spiffs_span_ix data_spix,
+    spiffs_page_ix data_pix) {
+  spiffs_page_ix *entries;
+  u32_t entry = SPIFFS_OBJ_IX_ENTRY(fs, data_spix);
+  u32_t entry_count;
+  if (objix_spix == 0) {
+    entries = (spiffs_page_ix *)((u8_t *)fs->work + sizeof(spiffs_page_object_ix_header));
+    entry_count = SPIFFS_OBJ_HDR_IX_LEN(fs);
+  } else {
+    entries = (spiffs_page_ix *)((u8_t *)fs->work + sizeof(spiffs_page_object_ix));
+    entry_count = SPIFFS_OBJ_IX_LEN(fs);
+  }
+  // last data page of the file, pages after it are not in the index
+  u32_t last_spix = fd->size == 0 ? 0 : (fd->size - 1) / SPIFFS_DATA_PAGE_SIZE(fs);
+  u32_t pages = 1;
+  u32_t i;
+  for (i = 1; entry + i < entry_count && data_spix + i <= last_spix; i++) {
+    spiffs_page_ix pix = entries[entry + i];
+    if (pix <= data_pix || pix >= data_pix + SPIFFS_READ_AHEAD_PAGES) break;
+    pages = MAX(pages, (u32_t)(pix - data_pix + 1));
+  }
+  spiffs_cache_read_ahead(fs, fd->file_nbr, data_pix, pages);
+}
+#endif
+
 s32_t spiffs_object_read(
     spiffs_fd *fd,
     u32_t offset,
@@ -1628,6 +1926,10 @@ s32_t spiffs_object_read(
   spiffs_span_ix prev_objix_spix = (spiffs_span_ix)-1;
   spiffs_page_object_ix_header *objix_hdr = (spiffs_page_object_ix_header *)fs->work;
   spiffs_page_object_ix *objix = (spiffs_page_object_ix *)fs->work;
+#if SPIFFS_CACHE && SPIFFS_READ_AHEAD_PAGES
+  // fd->offset is where the last access of this fd ended
+  u8_t sequential = offset == fd->offset;
+#endif
 
   while (cur_offset < offset + len) {
     cur_objix_spix = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(fs, data_spix);
@@ -1635,6 +1937,8 @@ s32_t spiffs_object_read(
       // load current object index (header) page
       if (cur_objix_spix == 0) {
         objix_pix = fd->objix_hdr_pix;
+      } else if (fd->cursor_objix_spix == cur_objix_spix) {
+        objix_pix = fd->cursor_objix_pix;
       } else {
         SPIFFS_DBG("read: find objix %04x:%04x\n", fd->obj_id, cur_objix_spix);
         res = spiffs_obj_lu_find_id_and_span(fs, fd->obj_id | SPIFFS_OBJ_ID_IX_FLAG, cur_objix_spix, 0, &objix_pix);
@@ -1673,6 +1977,11 @@ s32_t spiffs_object_read(
       res = SPIFFS_ERR_END_OF_OBJECT;
       break;
     }
+#if SPIFFS_CACHE && SPIFFS_READ_AHEAD_PAGES
+    if (sequential) {
+      spiffs_object_read_ahead(fs, fd, cur_objix_spix, data_spix, data_pix);
+    }
+#endif
     res = spiffs_page_data_check(fs, fd, data_pix, data_spix);
     SPIFFS_CHECK_RES(res);
     res = _spiffs_rd(
@@ -1777,6 +2086,31 @@ s32_t spiffs_obj_lu_find_free_obj_id(spiffs *fs, spiffs_obj_id *obj_id, u8_t *co
   }
   state.compaction = 0;
   state.conflicting_name = conflicting_name;
+
+#if SPIFFS_ALLOC_MAP_IDS
+  {
+    u32_t id;
+    for (id = 0; id < SPIFFS_ALLOC_MAP_IDS && id < max_objects; id++) {
+      if ((fs->id_map[id >> 3] & (1 << (id & 7))) == 0) {
+        break;
+      }
+    }
+    if (id < SPIFFS_ALLOC_MAP_IDS && id < max_objects) {
+      if (conflicting_name) {
+        res = spiffs_object_find_object_index_header_by_name(fs, conflicting_name, 0);
+        if (res == SPIFFS_OK) {
+          return SPIFFS_ERR_CONFLICTING_NAME;
+        }
+        if (res != SPIFFS_ERR_NOT_FOUND) {
+          return res;
+        }
+      }
+      *obj_id = id + 1;
+      return SPIFFS_OK;
+    }
+  }
+#endif
+
   while (res == SPIFFS_OK && free_obj_id == SPIFFS_OBJ_ID_FREE) {
     if (state.max_obj_id - state.min_obj_id <= (spiffs_obj_id)SPIFFS_CFG_LOG_PAGE_SZ(fs)*8) {
       // possible to represent in bitmap
@@ -1882,6 +2216,9 @@ s32_t spiffs_fd_return(spiffs *fs, spiffs_file f) {
   if (fd->file_nbr == 0) {
     return SPIFFS_ERR_FILE_CLOSED;
   }
+#if SPIFFS_APPEND_BUFFERS
+  spiffs_append_buf_release(fs, f);
+#endif
   fd->file_nbr = 0;
   return SPIFFS_OK;
 }
@@ -1897,3 +2234,39 @@ s32_t spiffs_fd_get(spiffs *fs, spiffs_file f, spiffs_fd **fd) {
   }
   return SPIFFS_OK;
 }
+
+#if SPIFFS_APPEND_BUFFERS
+// Returns the append buffer of given file descriptor, or null if it has none.
+// Given 0, returns an unused append buffer if there is one
+spiffs_append_buf *spiffs_append_buf_get(spiffs *fs, spiffs_file f) {
+  u32_t i;
+  for (i = 0; i < SPIFFS_APPEND_BUFFERS; i++) {
+    if (fs->append_bufs[i].file_nbr == f) {
+      return &fs->append_bufs[i];
+    }
+  }
+  return 0;
+}
+
+// Returns the append buffer of the file with given object id, whichever of
+// its file descriptors owns it, or null if the file has none
+spiffs_append_buf *spiffs_append_buf_get_by_obj_id(spiffs *fs, spiffs_obj_id obj_id) {
+  u32_t i;
+  for (i = 0; i < SPIFFS_APPEND_BUFFERS; i++) {
+    if (fs->append_bufs[i].file_nbr != 0 && fs->append_bufs[i].obj_id == obj_id) {
+      return &fs->append_bufs[i];
+    }
+  }
+  return 0;
+}
+
+// Releases the append buffer of given file descriptor, anything still in it
+// is dropped
+void spiffs_append_buf_release(spiffs *fs, spiffs_file f) {
+  spiffs_append_buf *ab = spiffs_append_buf_get(fs, f);
+  if (ab) {
+    ab->file_nbr = 0;
+    ab->len = 0;
+  }
+}
+#endif